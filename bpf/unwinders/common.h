@@ -21,7 +21,31 @@
 #define __AGENT_STACK_TRACE_DEFINITION__
 
 #include "basic_types.h"
+// Maximum number of frames. Can be overridden at build time to build variants
+// of the unwinders for deeper or shallower stacks.
+#ifndef MAX_STACK_DEPTH
 #define MAX_STACK_DEPTH 127
+#endif
+
+#if __TARGET_ARCH_x86
+// Number of frames to walk per tail call iteration.
+#define MAX_STACK_DEPTH_PER_PROGRAM 7
+#endif
+
+#if __TARGET_ARCH_arm64
+// Number of frames to walk per tail call iteration.
+#define MAX_STACK_DEPTH_PER_PROGRAM 5
+#endif
+
+// Number of BPF tail calls that will be attempted.
+#define MAX_TAIL_CALLS ((MAX_STACK_DEPTH + MAX_STACK_DEPTH_PER_PROGRAM - 1) / MAX_STACK_DEPTH_PER_PROGRAM)
+// The kernel allows up to 33 tail calls per chain.
+#define MAX_TAIL_CALL_CHAIN 33
+// Tail calls left to an interpreter unwinder to walk its stack once the native
+// stack was walked. The entrypoint's tail call to the native unwinder and the
+// native unwinder's tail call to the interpreter unwinder are part of the
+// chain too.
+#define INTERPRETER_MAX_TAIL_CALLS (MAX_TAIL_CALL_CHAIN - 2 - MAX_TAIL_CALLS)
 
 typedef struct {
   u64 len;
@@ -39,8 +63,56 @@ typedef struct {
   char path[PATH_MAXLEN];
 } symbol_t;
 
-// TODO(kakkoyun): Merge
-// - SampleState, RubyStack, ProcessData, ruby_stack_status,
-// with
-// - State, Sample, InterpreterInfo, python_stack_status.
+enum interpreter_stack_status {
+  STACK_COMPLETE = 0,
+  STACK_TRUNCATED = 1,
+  STACK_ERROR = 2,
+};
+
+enum interpreter_frame_link {
+  // Every frame points to its caller's, the last one to NULL.
+  FRAME_LINK_POINTER = 0,
+  // Frames are contiguous, their callers at higher addresses, up to the
+  // end of the stack.
+  FRAME_LINK_ARRAY = 1,
+};
+
+// Describes how the interpreter unwinders walk the frames of a runtime
+// version, see interpreter.h.
+typedef struct {
+  // enum interpreter_frame_link.
+  u32 frame_link;
+  // FRAME_LINK_ARRAY: size of a frame.
+  u32 frame_size;
+  // FRAME_LINK_POINTER: offset of the pointer to the caller's frame.
+  s64 caller_offset;
+  // Offset of the pointer to the code object in a frame.
+  s64 code_offset;
+  // Offset of the pointer to follow from it to the code object, for
+  // runtimes where frames point to a wrapper of it, -1 otherwise.
+  s64 code_body_offset;
+  // Offset of the characters of a string, when embedded in it.
+  s64 string_data_offset;
+  // Offset of the pointer to the characters of a string, when they are on
+  // the heap.
+  s64 string_heap_ptr_offset;
+  // Bit set in the first word of strings whose characters are on the heap,
+  // 0 if they are always embedded.
+  u64 string_heap_flag;
+} interpreter_frame_descriptor_t;
+
+// Where an interpreter unwinder is in the stack it walks, kept across tail
+// calls.
+typedef struct {
+  u64 frame;
+  // FRAME_LINK_ARRAY: address of the outermost frame.
+  u64 end;
+} interpreter_cursor_t;
+
+enum interpreter_walk_result {
+  INTERPRETER_WALK_DONE = 0,
+  // There are frames left, to be walked by another tail call.
+  INTERPRETER_WALK_MORE = 1,
+  INTERPRETER_WALK_ERROR = 2,
+};
 #endif
@@ -0,0 +1,82 @@
+#include "shared.h"
+
+// This file contains the frame walker shared by the interpreter unwinders.
+// The parts of the walk that only differ in offsets and layouts between
+// runtimes and their versions, that is following the link to the caller's
+// frame, finding the code object of a frame and reading strings, are driven by
+// a frame descriptor, see interpreter_frame_descriptor_t. Each unwinder keeps
+// its descriptors in a map, set in the user-space for every supported version,
+// and only implements reading the symbol of a frame.
+
+// Implemented by each interpreter unwinder. Reads the symbol of a frame, whose
+// code object might be NULL, into sym and returns its line number, or a
+// negative value if the walk can't continue. The offsets are the unwinder's
+// own version specific ones.
+static __always_inline int read_interpreter_symbol(interpreter_frame_descriptor_t *desc, void *offsets, void *frame, void *code, symbol_t *sym);
+
+static __always_inline bool interpreter_walk_done(interpreter_frame_descriptor_t *desc, interpreter_cursor_t *cursor) {
+    if (desc->frame_link == FRAME_LINK_ARRAY) {
+        return cursor->frame > cursor->end;
+    }
+    return cursor->frame == 0;
+}
+
+static __always_inline u64 next_interpreter_frame(interpreter_frame_descriptor_t *desc, void *frame) {
+    if (desc->frame_link == FRAME_LINK_ARRAY) {
+        return (u64)frame + desc->frame_size;
+    }
+
+    u64 caller = 0;
+    bpf_probe_read_user(&caller, sizeof(caller), frame + desc->caller_offset);
+    return caller;
+}
+
+static __always_inline void *read_interpreter_code(interpreter_frame_descriptor_t *desc, void *frame) {
+    void *code = NULL;
+    bpf_probe_read_user(&code, sizeof(code), frame + desc->code_offset);
+    if (code != NULL && desc->code_body_offset > -1) {
+        bpf_probe_read_user(&code, sizeof(code), code + desc->code_body_offset);
+    }
+    return code;
+}
+
+// Reads the characters of the string object at the given address.
+static __always_inline int read_interpreter_string(interpreter_frame_descriptor_t *desc, void *str, char *buf, u32 buf_len) {
+    void *chars = str + desc->string_data_offset;
+    if (desc->string_heap_flag != 0) {
+        u64 flags = 0;
+        bpf_probe_read_user(&flags, sizeof(flags), str);
+        if (flags & desc->string_heap_flag) {
+            bpf_probe_read_user(&chars, sizeof(chars), str + desc->string_heap_ptr_offset);
+        }
+    }
+    return bpf_probe_read_user_str(buf, buf_len, chars);
+}
+
+// Walks up to max_frames frames from the cursor into the stack, leaving the
+// cursor at the next frame to walk.
+static __always_inline enum interpreter_walk_result walk_interpreter_frames(interpreter_frame_descriptor_t *desc, void *offsets, interpreter_cursor_t *cursor,
+                                                                            stack_trace_t *stack, int max_frames) {
+    symbol_t sym;
+
+#pragma unroll
+    for (int i = 0; i < max_frames; i++) {
+        if (interpreter_walk_done(desc, cursor)) {
+            return INTERPRETER_WALK_DONE;
+        }
+
+        void *frame = (void *)cursor->frame;
+        void *code = read_interpreter_code(desc, frame);
+
+        __builtin_memset((void *)&sym, 0, sizeof(sym));
+        int lineno = read_interpreter_symbol(desc, offsets, frame, code, &sym);
+        if (lineno < 0) {
+            return INTERPRETER_WALK_ERROR;
+        }
+        append_interpreter_frame(stack, lineno, &sym);
+
+        cursor->frame = next_interpreter_frame(desc, frame);
+    }
+
+    return interpreter_walk_done(desc, cursor) ? INTERPRETER_WALK_DONE : INTERPRETER_WALK_MORE;
+}
@@ -21,26 +21,15 @@
 #define RUBY_UNWINDER_PROGRAM_ID 1
 #define PYTHON_UNWINDER_PROGRAM_ID 2
 
-#if __TARGET_ARCH_x86
-// Number of frames to walk per tail call iteration.
-#define MAX_STACK_DEPTH_PER_PROGRAM 7
-// Number of BPF tail calls that will be attempted.
-#define MAX_TAIL_CALLS 19
-#endif
-
-#if __TARGET_ARCH_arm64
-// Number of frames to walk per tail call iteration.
-#define MAX_STACK_DEPTH_PER_PROGRAM 5
-// Number of BPF tail calls that will be attempted.
-#define MAX_TAIL_CALLS 26
-#endif
-
 // Ensure that bpf_perf_prog_read_value() used to clear the addresses will fail as
 // the size won't be the expected one. On failure, this helper will zero the buffer.
 _Static_assert(sizeof(stack_trace_t) != sizeof(struct bpf_perf_event_value), "stack size must be different to the valid argument");
 
 // Maximum number of frames.
 _Static_assert(MAX_TAIL_CALLS *MAX_STACK_DEPTH_PER_PROGRAM >= MAX_STACK_DEPTH, "enough iterations to traverse the whole stack");
+// The interpreter unwinders walk their stacks after the native one, within the
+// same chain of tail calls. They assert that their walk fits too.
+_Static_assert(INTERPRETER_MAX_TAIL_CALLS >= 1, "the whole stack and an interpreter stack can be traversed within the tail call limit");
 // Number of unique stacks.
 #define MAX_STACK_TRACES_ENTRIES 64000
 // Maximum number of processes we are willing to track.
@@ -56,6 +45,17 @@ _Static_assert(1 << MAX_UNWIND_INFO_BINARY_SEARCH_DEPTH >= MAX_UNWIND_TABLE_SIZE
 // Unwind tables bigger than can't fit in the remaining space
 // of the current shard are broken up into chunks up to `MAX_UNWIND_TABLE_SIZE`.
 #define MAX_UNWIND_TABLE_CHUNKS 30
+// Executables with more chunks than `MAX_UNWIND_TABLE_CHUNKS` use a chunk
+// directory. Each top level entry then points to up to `MAX_UNWIND_TABLE_CHUNKS`
+// entries stored in `unwind_info_chunks_directory`, which can point to a
+// directory themselves, up to `MAX_UNWIND_TABLE_CHUNK_DIRECTORY_DEPTH` levels
+// below the top one. This bounds the search to
+// (1 + MAX_UNWIND_TABLE_CHUNK_DIRECTORY_DEPTH) * MAX_UNWIND_TABLE_CHUNKS
+// iterations, while normal executables only search the top level.
+#define MAX_UNWIND_TABLE_CHUNK_DIRECTORIES 1000
+#define MAX_UNWIND_TABLE_CHUNK_DIRECTORY_DEPTH 2
+// Set as the `shard_index` of a top level entry that points to a directory.
+#define CHUNK_DIRECTORY_MARKER 0xFFFFFFFFFFFFFFFFULL
 // Maximum memory mappings per process.
 #define MAX_MAPPINGS_PER_PROCESS 400
 #define MAX_MAPPINGS_BINARY_SEARCH_DEPTH 10
@@ -119,8 +119,8 @@ struct unwinder_config_t {
   bool mixed_stack_enabled;
   bool python_enabled;
   bool ruby_enabled;
-  /* 3 byte of padding */
-  bool _padding1;
+  bool degraded_unwinding_enabled;
+  /* 2 byte of padding */
   bool _padding2;
   bool _padding3;
   u32 rate_limit_unwind_info;
@@ -191,6 +191,13 @@ typedef struct {
   chunk_info_t chunks[MAX_UNWIND_TABLE_CHUNKS];
 } unwind_info_chunks_t;
 
+// Key of the second level of the chunk directory. The index is stored in
+// the `low_index` of the top level entry.
+typedef struct {
+  u64 executable_id;
+  u64 index;
+} chunk_directory_key_t;
+
 // Represents an executable mapping.
 typedef struct {
   u64 load_address;
@@ -241,6 +248,8 @@ BPF_HASH(unwind_info_chunks, u64, unwind_info_chunks_t,
          5 * 1000); // Mapping of executable ID to unwind info chunks.
 BPF_HASH(unwind_tables, u64, stack_unwind_table_t,
          5); // Table size will be updated in userspace.
+BPF_HASH(unwind_info_chunks_directory, chunk_directory_key_t, unwind_info_chunks_t,
+         MAX_UNWIND_TABLE_CHUNK_DIRECTORIES); // Chunks of executables that don't fit in `unwind_info_chunks`.
 
 BPF_HASH(events_count, u64, u32, MAX_PROCESSES);
 
@@ -262,7 +271,7 @@ struct {
   __uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
   __uint(key_size, sizeof(u32));
   __uint(value_size, sizeof(u32));
-  __uint(max_entries, 8192);
+  __uint(max_entries, 1); // Set in the user-space to the number of possible CPUs.
 } events SEC(".maps");
 
 /*=========================== HELPER FUNCTIONS ==============================*/
@@ -476,6 +485,20 @@ static __always_inline bool is_debug_enabled_for_thread(int per_thread_id) {
   return false;
 }
 
+// Returns the chunk whose PC range contains `adjusted_pc`, or NULL.
+static __always_inline chunk_info_t *find_chunk(unwind_info_chunks_t *chunks, u64 adjusted_pc) {
+  for (int i = 0; i < MAX_UNWIND_TABLE_CHUNKS; i++) {
+    // Reached last chunk.
+    if (chunks->chunks[i].low_pc == 0) {
+      break;
+    }
+    if (chunks->chunks[i].low_pc <= adjusted_pc && adjusted_pc <= chunks->chunks[i].high_pc) {
+      return &chunks->chunks[i];
+    }
+  }
+  return NULL;
+}
+
 // Finds the shard information for a given pid and program counter. Optionally,
 // and offset can be passed that will be filled in with the mapping's load
 // address.
@@ -552,20 +575,40 @@ static __always_inline enum find_unwind_table_return find_unwind_table(chunk_inf
   }
 
   u64 adjusted_pc = pc - load_address;
-  for (int i = 0; i < MAX_UNWIND_TABLE_CHUNKS; i++) {
-    // Reached last chunk.
-    if (chunks->chunks[i].low_pc == 0) {
+  chunk_info_t *found_chunk = find_chunk(chunks, adjusted_pc);
+  if (found_chunk == NULL) {
+    LOG("[error] could not find chunk");
+    return FIND_UNWIND_CHUNK_NOT_FOUND;
+  }
+
+  // Very large executables have more levels in the chunk directory.
+  for (int depth = 0; depth < MAX_UNWIND_TABLE_CHUNK_DIRECTORY_DEPTH; depth++) {
+    if (found_chunk->shard_index != CHUNK_DIRECTORY_MARKER) {
       break;
     }
-    if (chunks->chunks[i].low_pc <= adjusted_pc && adjusted_pc <= chunks->chunks[i].high_pc) {
-      LOG("[info] found chunk");
-      *chunk_info = &chunks->chunks[i];
-      return FIND_UNWIND_SUCCESS;
+    chunk_directory_key_t key = {
+        .executable_id = executable_id,
+        .index = found_chunk->low_index,
+    };
+    chunks = bpf_map_lookup_elem(&unwind_info_chunks_directory, &key);
+    if (chunks == NULL) {
+      LOG("[info] chunk directory %llu is null for executable %llu", key.index, executable_id);
+      return FIND_UNWIND_CHUNK_NOT_FOUND;
+    }
+    found_chunk = find_chunk(chunks, adjusted_pc);
+    if (found_chunk == NULL) {
+      LOG("[error] could not find chunk in directory");
+      return FIND_UNWIND_CHUNK_NOT_FOUND;
     }
   }
+  if (found_chunk->shard_index == CHUNK_DIRECTORY_MARKER) {
+    LOG("[error] chunk directory is deeper than expected");
+    return FIND_UNWIND_CHUNK_NOT_FOUND;
+  }
 
-  LOG("[error] could not find chunk");
-  return FIND_UNWIND_CHUNK_NOT_FOUND;
+  LOG("[info] found chunk");
+  *chunk_info = found_chunk;
+  return FIND_UNWIND_SUCCESS;
 }
 
 // Kernel addresses have the top bits set.
@@ -687,6 +730,8 @@ static __always_inline void add_stack(struct bpf_perf_event_data *ctx, u64 pid_t
     }
     LOG("[debug] tail-call to Ruby unwinder (rbperf)");
     bpf_tail_call(ctx, &programs, RUBY_UNWINDER_PROGRAM_ID);
+    // The Ruby unwinder isn't loaded yet, keep the native stack.
+    aggregate_stacks();
     break;
   case INTERPRETER_TYPE_PYTHON:
     if (!unwinder_config.python_enabled) {
@@ -696,6 +741,8 @@ static __always_inline void add_stack(struct bpf_perf_event_data *ctx, u64 pid_t
     }
     LOG("[debug] tail-call to Python unwinder (pyperf)");
     bpf_tail_call(ctx, &programs, PYTHON_UNWINDER_PROGRAM_ID);
+    // The Python unwinder isn't loaded yet, keep the native stack.
+    aggregate_stacks();
     break;
   default:
     LOG("[error] bad interpreter value: %d", unwind_state->interpreter_type);
@@ -1095,6 +1142,7 @@ static __always_inline bool set_initial_state(struct bpf_perf_event_data *ctx) {
   unwind_state->stack_key.user_stack_id = 0;
   unwind_state->stack_key.kernel_stack_id = 0;
   unwind_state->stack_key.interpreter_stack_id = 0;
+  unwind_state->stack_key.flags = 0;
 
   u64 ip = 0;
   u64 sp = 0;
@@ -1208,6 +1256,16 @@ int entrypoint(struct bpf_perf_event_data *ctx) {
   }
 
   request_unwind_information(ctx, per_process_id);
+
+  if (unwinder_config.degraded_unwinding_enabled) {
+    // Until the unwind information of the process is loaded, which can take
+    // longer than short-lived processes live, record the stack as walked by
+    // the kernel with frame pointers, tagged as such.
+    LOG("[debug] degraded unwinding for per_process_id %d", per_process_id);
+    unwind_state->stack_key.flags |= STACK_FLAG_DEGRADED;
+    unwind_using_kernel_provided_unwinder(ctx, unwind_state, BPF_F_USER_STACK);
+    add_stack(ctx, pid_tgid, unwind_state);
+  }
   return 0;
 }
 
@@ -12,7 +12,7 @@
 #include <bpf/bpf_tracing.h>
 
 #include "hash.h"
-#include "shared.h"
+#include "interpreter.h"
 
 //
 //   ╔═════════════════════════════════════════════════════════════════════════╗
@@ -21,6 +21,12 @@
 //
 const volatile bool verbose = false;
 
+// The native unwinder tail calls this unwinder once it's done, with the
+// entrypoint's tail call, its own tail calls and the one to this unwinder's
+// entrypoint taken, and walking the stack takes PYTHON_STACK_PROG_CNT more.
+_Static_assert(2 + MAX_TAIL_CALLS + PYTHON_STACK_PROG_CNT <= MAX_TAIL_CALL_CHAIN, "the native and Python stacks can be traversed within the tail call limit");
+_Static_assert(PYTHON_STACK_PROG_CNT >= 1, "the Python stack can be traversed");
+
 //
 //   ╔═════════════════════════════════════════════════════════════════════════╗
 //   ║  BPF Maps                                                               ║
@@ -48,6 +54,22 @@ struct {
   __type(value, PythonVersionOffsets);
 } version_specific_offsets SEC(".maps");
 
+// Same keys as version_specific_offsets.
+struct {
+  __uint(type, BPF_MAP_TYPE_HASH);
+  __uint(max_entries, 10);
+  __type(key, u32);
+  __type(value, interpreter_frame_descriptor_t);
+} frame_descriptors SEC(".maps");
+
+// Thread ID to the address of its PyThreadState.
+struct {
+  __uint(type, BPF_MAP_TYPE_LRU_HASH);
+  __uint(max_entries, PYTHON_MAX_THREADS);
+  __type(key, pid_t);
+  __type(value, u64);
+} thread_states SEC(".maps");
+
 struct {
   __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
   __uint(max_entries, 1);
@@ -73,6 +95,12 @@ struct {
     return 0;                                                                                                                                                  \
   }
 
+#define GET_FRAME_DESCRIPTOR()                                                                                                                                 \
+  interpreter_frame_descriptor_t *desc = bpf_map_lookup_elem(&frame_descriptors, &state->interpreter_info.py_version_offset_index);                          \
+  if (desc == NULL) {                                                                                                                                          \
+    return 0;                                                                                                                                                  \
+  }
+
 #define LOG(fmt, ...)                                                                                                                                          \
   ({                                                                                                                                                           \
     if (verbose) {                                                                                                                                             \
@@ -94,6 +122,89 @@ static __always_inline long unsigned int read_tls_base(struct task_struct *task)
   return tls_base;
 }
 
+// Returns the pthread_t of the current thread, or 0 if it can't be found.
+static __always_inline pthread_t current_pthread_self() {
+#if __TARGET_ARCH_x86
+  // The thread pointer points to the thread's own pthread structure, both
+  // with glibc and musl.
+  struct task_struct *task = (struct task_struct *)bpf_get_current_task();
+  return read_tls_base(task);
+#else
+  // The thread pointer points past the pthread structure, whose size isn't known.
+  return 0;
+#endif
+}
+
+// Whether the given thread state is the one of the given thread. Python
+// >= 3.8 records the thread ID, older versions only the pthread_t.
+static __always_inline bool is_thread_state_of(PythonVersionOffsets *offsets, void *thread_state, pid_t tid, pthread_t pthread_self) {
+  if (offsets->py_thread_state.native_thread_id > -1) {
+    u64 native_thread_id = 0;
+    bpf_probe_read_user(&native_thread_id, sizeof(native_thread_id), thread_state + offsets->py_thread_state.native_thread_id);
+    return native_thread_id == (u64)tid;
+  }
+
+  pthread_t thread_id = 0;
+  bpf_probe_read_user(&thread_id, sizeof(thread_id), thread_state + offsets->py_thread_state.thread_id);
+  return pthread_self != 0 && thread_id == pthread_self;
+}
+
+// Returns the PyThreadState of the given thread.
+//
+// The current thread state of the interpreter is the one of the thread holding
+// the GIL, which in multi-threaded programs often isn't the sampled one. The
+// first time a thread is sampled the thread states of the interpreter are
+// scanned for its own, which is cached.
+static __always_inline void *get_thread_state(InterpreterInfo *interpreter_info, PythonVersionOffsets *offsets, pid_t tid) {
+  pthread_t pthread_self = current_pthread_self();
+  bool identifiable = offsets->py_thread_state.native_thread_id > -1 || pthread_self != 0;
+
+  void **cached = bpf_map_lookup_elem(&thread_states, &tid);
+  if (cached != NULL) {
+    void *thread_state = *cached;
+    // Thread IDs are reused, make sure it's still the same thread.
+    if (is_thread_state_of(offsets, thread_state, tid, pthread_self)) {
+      return thread_state;
+    }
+    bpf_map_delete_elem(&thread_states, &tid);
+  }
+
+  if (identifiable && interpreter_info->interpreter_addr != 0) {
+    void *interpreter = NULL;
+    void *thread_state = NULL;
+    bpf_probe_read_user(&interpreter, sizeof(interpreter), (void *)(long)interpreter_info->interpreter_addr);
+    if (interpreter != NULL) {
+      bpf_probe_read_user(&thread_state, sizeof(thread_state), interpreter + offsets->py_interpreter_state.tstate_head);
+    }
+
+    for (int i = 0; i < PYTHON_THREAD_STATES_SCAN_MAX; i++) {
+      if (thread_state == NULL) {
+        // The thread doesn't run Python code.
+        LOG("[error] no thread state for tid=%d", tid);
+        return NULL;
+      }
+      if (is_thread_state_of(offsets, thread_state, tid, pthread_self)) {
+        bpf_map_update_elem(&thread_states, &tid, &thread_state, BPF_ANY);
+        return thread_state;
+      }
+      if (bpf_probe_read_user(&thread_state, sizeof(thread_state), thread_state + offsets->py_thread_state.next) != 0) {
+        break;
+      }
+    }
+  }
+
+  // Fall back to the thread state of the thread holding the GIL.
+  // GDB: ((PyThreadState *)_PyRuntime.gilstate.tstate_current)
+  LOG("interpreter_info->thread_state_addr 0x%llx", interpreter_info->thread_state_addr);
+  void *thread_state = NULL;
+  int err = bpf_probe_read_user(&thread_state, sizeof(thread_state), (void *)(long)interpreter_info->thread_state_addr);
+  if (err != 0) {
+    LOG("[error] bpf_probe_read_user failed with %d", err);
+    return NULL;
+  }
+  return thread_state;
+}
+
 //
 //   ╔═════════════════════════════════════════════════════════════════════════╗
 //   ║ BPF Programs                                                            ║
@@ -139,8 +250,7 @@ int unwind_python_stack(struct bpf_perf_event_data *ctx) {
   state->thread_state = 0;
   state->current_pthread = 0;
 
-  // state->base_stack = base_stack;
-  state->frame_ptr = 0;
+  state->cursor = (interpreter_cursor_t){0};
   state->stack_walker_prog_call_count = 0;
 
   // state->sample = (Sample){0};
@@ -148,55 +258,34 @@ int unwind_python_stack(struct bpf_perf_event_data *ctx) {
   state->sample.pid = pid;
   state->sample.stack_status = STACK_COMPLETE;
 
-  state->sample.stack = (stack_trace_t){0};
-  state->sample.stack.len = 0;
-
   // TODO(kakkoyun): Implement stack bound checks.
   // state->stack.expected_size = (base_stack - cfp) / control_frame_t_sizeof;
-  __builtin_memset((void *)state->sample.stack.addresses, 0, sizeof(state->sample.stack.addresses));
+  if (reset_interpreter_stack() == NULL) {
+    return 0;
+  }
 
-  // Fetch thread state.
+  GET_OFFSETS();
 
-  // GDB: ((PyThreadState *)_PyRuntime.gilstate.tstate_current)
-  LOG("interpreter_info->thread_state_addr 0x%llx", interpreter_info->thread_state_addr);
-  int err = bpf_probe_read_user(&state->thread_state, sizeof(state->thread_state), (void *)(long)interpreter_info->thread_state_addr);
-  if (err != 0) {
-    LOG("[error] bpf_probe_read_user failed with %d", err);
-    goto submit_without_unwinding;
-  }
+  // Fetch thread state.
+  state->thread_state = get_thread_state(interpreter_info, offsets, tid);
   if (state->thread_state == 0) {
     LOG("[error] thread_state was NULL");
     goto submit_without_unwinding;
   }
   LOG("thread_state 0x%llx", state->thread_state);
 
-  struct task_struct *task = (struct task_struct *)bpf_get_current_task();
-  long unsigned int tls_base = read_tls_base(task);
-  LOG("tls_base 0x%llx", (void *)tls_base);
-
-  GET_OFFSETS();
-
   // Fetch the thread id.
   LOG("offsets->py_thread_state.thread_id %d", offsets->py_thread_state.thread_id);
   pthread_t pthread_id;
   bpf_probe_read_user(&pthread_id, sizeof(pthread_id), state->thread_state + offsets->py_thread_state.thread_id);
   LOG("pthread_id %lu", pthread_id);
-  // 0x10 = offsetof(tcbhead_t, self) for glibc x86.
-  // pthread_t current_pthread_id;
-  // bpf_probe_read_user(&current_pthread_id, sizeof(current_pthread_id), (void *)(tls_base + 0x10));
-  // LOG("current_pthread_id %lu", current_pthread_id);
-  // if (pthread_id != current_pthread_id) {
-  //   LOG("[error] pthread_id %lu != current_pthread_id %lu", pthread_id, current_pthread_id);
-  //   goto submit_without_unwinding;
-  // }
-  // state->current_pthread = current_pthread_id;
   state->current_pthread = pthread_id;
 
   // Get pointer to top frame from PyThreadState.
 
   if (offsets->py_thread_state.frame > -1) {
     LOG("offsets->py_thread_state.frame %d", offsets->py_thread_state.frame);
-    bpf_probe_read_user(&state->frame_ptr, sizeof(void *), state->thread_state + offsets->py_thread_state.frame);
+    bpf_probe_read_user(&state->cursor.frame, sizeof(state->cursor.frame), state->thread_state + offsets->py_thread_state.frame);
   } else {
     LOG("offsets->py_thread_state.cframe %d", offsets->py_thread_state.cframe);
     void *cframe;
@@ -208,14 +297,14 @@ int unwind_python_stack(struct bpf_perf_event_data *ctx) {
     LOG("cframe 0x%llx", cframe);
 
     LOG("offsets->py_cframe.current_frame %d", offsets->py_cframe.current_frame);
-    bpf_probe_read_user(&state->frame_ptr, sizeof(state->frame_ptr), (void *)(cframe + offsets->py_cframe.current_frame));
+    bpf_probe_read_user(&state->cursor.frame, sizeof(state->cursor.frame), (void *)(cframe + offsets->py_cframe.current_frame));
   }
-  if (state->frame_ptr == 0) {
+  if (state->cursor.frame == 0) {
     LOG("[error] frame_ptr was NULL");
     goto submit_without_unwinding;
   }
 
-  LOG("frame_ptr 0x%llx", state->frame_ptr);
+  LOG("frame_ptr 0x%llx", state->cursor.frame);
   bpf_tail_call(ctx, &programs, PYPERF_STACK_WALKING_PROGRAM_IDX);
 
 submit_without_unwinding:
@@ -223,7 +312,13 @@ submit_without_unwinding:
   return 0;
 }
 
-static inline __attribute__((__always_inline__)) u32 read_symbol(PythonVersionOffsets *offsets, void *cur_frame, void *code_ptr, symbol_t *symbol) {
+static __always_inline int read_interpreter_symbol(interpreter_frame_descriptor_t *desc, void *version_offsets, void *cur_frame, void *code_ptr, symbol_t *symbol) {
+  PythonVersionOffsets *offsets = version_offsets;
+  if (code_ptr == NULL) {
+    LOG("[error] code object was NULL");
+    return -1;
+  }
+
   // Figure out if we want to parse class name, basically checking the name of
   // the first argument.
   // If it's 'self', we get the type and it's name, if it's cls, we just get
@@ -236,7 +331,7 @@ static inline __attribute__((__always_inline__)) u32 read_symbol(PythonVersionOf
   void *args_ptr;
   bpf_probe_read_user(&args_ptr, sizeof(void *), code_ptr + offsets->py_code_object.co_varnames);
   bpf_probe_read_user(&args_ptr, sizeof(void *), args_ptr + offsets->py_tuple_object.ob_item);
-  bpf_probe_read_user_str(&symbol->method_name, sizeof(symbol->method_name), args_ptr + offsets->py_string.data);
+  read_interpreter_string(desc, args_ptr, symbol->method_name, sizeof(symbol->method_name));
 
   // Compare strings as ints to save instructions.
   char self_str[4] = {'s', 'e', 'l', 'f'};
@@ -260,24 +355,21 @@ static inline __attribute__((__always_inline__)) u32 read_symbol(PythonVersionOf
 
   // GDB: $frame->f_code->co_filename
   bpf_probe_read_user(&pystr_ptr, sizeof(void *), code_ptr + offsets->py_code_object.co_filename);
-  bpf_probe_read_user_str(&symbol->path, sizeof(symbol->path), pystr_ptr + offsets->py_string.data);
+  read_interpreter_string(desc, pystr_ptr, symbol->path, sizeof(symbol->path));
 
   // GDB: $frame->f_code->co_name
   bpf_probe_read_user(&pystr_ptr, sizeof(void *), code_ptr + offsets->py_code_object.co_name);
-  bpf_probe_read_user_str(&symbol->method_name, sizeof(symbol->method_name), pystr_ptr + offsets->py_string.data);
+  read_interpreter_string(desc, pystr_ptr, symbol->method_name, sizeof(symbol->method_name));
 
   u32 lineno;
   // GDB: $frame->f_code->co_firstlineno
   bpf_probe_read_user(&lineno, sizeof(u32), code_ptr + offsets->py_code_object.co_firstlineno);
-  return lineno;
-}
-
-static inline __attribute__((__always_inline__)) void reset_symbol(symbol_t *sym) {
-  __builtin_memset((void *)sym, 0, sizeof(symbol_t));
 
-  sym->class_name[0] = '\0';
-  sym->method_name[0] = '\0';
-  sym->path[0] = '\0';
+  LOG("\tsym.path %s", symbol->path);
+  LOG("\tsym.class_name %s", symbol->class_name);
+  LOG("\tsym.method_name %s", symbol->method_name);
+  LOG("\tsym.lineno %d", lineno);
+  return lineno;
 }
 
 SEC("perf_event")
@@ -289,55 +381,22 @@ int walk_python_stack(struct bpf_perf_event_data *ctx) {
   LOG("=====================================================\n");
   LOG("[start] walk_python_stack");
   state->stack_walker_prog_call_count++;
-  Sample *sample = &state->sample;
-
-  int frame_count = 0;
-#pragma unroll
-  for (int i = 0; i < PYTHON_STACK_FRAMES_PER_PROG; i++) {
-    void *cur_frame = state->frame_ptr;
-    if (!cur_frame) {
-      break;
-    }
-
-    // Read the code pointer. PyFrameObject.f_code
-    void *cur_code_ptr;
-    bpf_probe_read_user(&cur_code_ptr, sizeof(cur_code_ptr), state->frame_ptr + offsets->py_frame_object.f_code);
-    if (!cur_code_ptr) {
-      LOG("[error] bpf_probe_read_user failed");
-      break;
-    }
-
-    LOG("## frame %d", frame_count);
-    LOG("\tcur_frame_ptr 0x%llx", cur_frame);
-    LOG("\tcur_code_ptr 0x%llx", cur_code_ptr);
-
-    symbol_t sym = (symbol_t){0};
-    reset_symbol(&sym);
-
-    // Read symbol information from the code object if possible.
-    u64 lineno = read_symbol(offsets, cur_frame, cur_code_ptr, &sym);
+  stack_trace_t *stack = interpreter_stack();
+  if (stack == NULL) {
+    return 0;
+  }
 
-    LOG("\tsym.path %s", sym.path);
-    LOG("\tsym.class_name %s", sym.class_name);
-    LOG("\tsym.method_name %s", sym.method_name);
-    LOG("\tsym.lineno %d", lineno);
+  GET_FRAME_DESCRIPTOR();
 
-    u64 symbol_id = get_symbol_id(&sym);
-    u64 cur_len = sample->stack.len;
-    if (cur_len >= 0 && cur_len < MAX_STACK_DEPTH) {
-      LOG("\tstack->frames[%llu] = %llu", cur_len, symbol_id);
-      sample->stack.addresses[cur_len] = (lineno << 32) | symbol_id;
-      sample->stack.len++;
-    }
-    frame_count++;
-
-    bpf_probe_read_user(&state->frame_ptr, sizeof(state->frame_ptr), cur_frame + offsets->py_frame_object.f_back);
-    if (!state->frame_ptr) {
-      // There aren't any frames to read. We are done.
-      goto complete;
-    }
+  enum interpreter_walk_result result = walk_interpreter_frames(desc, offsets, &state->cursor, stack, PYTHON_STACK_FRAMES_PER_PROG);
+  if (result == INTERPRETER_WALK_DONE) {
+    goto complete;
+  }
+  if (result == INTERPRETER_WALK_ERROR) {
+    LOG("[error] walk_python_stack failed, stack_len=%d", stack->len);
+    state->sample.stack_status = STACK_ERROR;
+    goto submit;
   }
-  LOG("[iteration] frame_count %d", frame_count);
 
   LOG("state->stack_walker_prog_call_count %d", state->stack_walker_prog_call_count);
   if (state->stack_walker_prog_call_count < PYTHON_STACK_PROG_CNT) {
@@ -353,33 +412,21 @@ int walk_python_stack(struct bpf_perf_event_data *ctx) {
   // }
 
   LOG("[error] walk_python_stack TRUNCATED");
-  LOG("[truncated] walk_python_stack, stack_len=%d", sample->stack.len);
+  LOG("[truncated] walk_python_stack, stack_len=%d", stack->len);
   state->sample.stack_status = STACK_TRUNCATED;
   goto submit;
 
 complete:
-  LOG("[complete] walk_python_stack, stack_len=%d", sample->stack.len);
+  LOG("[complete] walk_python_stack, stack_len=%d", stack->len);
   state->sample.stack_status = STACK_COMPLETE;
 submit:
   LOG("[stop] walk_python_stack");
 
-  // Hash stack.
-  u64 stack_hash = hash_stack(&state->sample.stack, 0);
-  LOG("[debug] stack hash: %d", stack_hash);
-
-  // Insert stack.
-  int err = bpf_map_update_elem(&stack_traces, &stack_hash, &state->sample.stack, BPF_ANY);
+  // We are done.
+  int err = submit_interpreter_stack();
   if (err != 0) {
     LOG("[error] bpf_map_update_elem with ret: %d", err);
   }
-
-  unwind_state_t *unwind_state = bpf_map_lookup_elem(&heap, &zero);
-  if (unwind_state != NULL) {
-    unwind_state->stack_key.interpreter_stack_id = stack_hash;
-  }
-
-  // We are done.
-  aggregate_stacks();
   return 0;
 }
 
@@ -7,30 +7,30 @@
 #include "common.h"
 
 #define PYTHON_STACK_FRAMES_PER_PROG 16
-#define PYTHON_STACK_PROG_CNT 5
-#define MAX_STACK (PYTHON_STACK_FRAMES_PER_PROG * PYTHON_STACK_PROG_CNT)
+// Enough programs to walk MAX_STACK_DEPTH frames, as long as the native
+// unwinder leaves enough tail calls. Otherwise the stacks are truncated to
+// PYTHON_STACK_FRAMES_PER_PROG * INTERPRETER_MAX_TAIL_CALLS frames.
+#define PYTHON_STACK_PROG_CNT_FOR_DEPTH ((MAX_STACK_DEPTH + PYTHON_STACK_FRAMES_PER_PROG - 1) / PYTHON_STACK_FRAMES_PER_PROG)
+#define PYTHON_STACK_PROG_CNT (PYTHON_STACK_PROG_CNT_FOR_DEPTH < INTERPRETER_MAX_TAIL_CALLS ? PYTHON_STACK_PROG_CNT_FOR_DEPTH : INTERPRETER_MAX_TAIL_CALLS)
 
 #define PYPERF_STACK_WALKING_PROGRAM_IDX 0
 
+// Number of threads cached in the thread states map.
+#define PYTHON_MAX_THREADS 16384
+// Maximum number of thread states walked to find the one of a thread.
+#define PYTHON_THREAD_STATES_SCAN_MAX 64
+
 typedef struct {
   // u64 start_time;
-  // u64 interpreter_addr;
   u64 thread_state_addr;
+  u64 interpreter_addr;
   u32 py_version_offset_index;
 } InterpreterInfo;
 
-enum python_stack_status {
-  STACK_COMPLETE = 0,
-  STACK_TRUNCATED = 1,
-  STACK_ERROR = 2,
-};
-
 typedef struct {
   u32 pid;
   u32 tid;
-  enum python_stack_status stack_status;
-
-  stack_trace_t stack;
+  enum interpreter_stack_status stack_status;
 } Sample;
 
 typedef unsigned long int pthread_t;
@@ -41,9 +41,7 @@ typedef struct {
   void *thread_state;
   pthread_t current_pthread;
 
-  // TODO: Unify naming with Ruby and CPU unwinders.
-  // u64 base_stack;
-  void *frame_ptr;
+  interpreter_cursor_t cursor;
   int stack_walker_prog_call_count;
 
   Sample sample;
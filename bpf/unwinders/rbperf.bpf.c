@@ -14,7 +14,13 @@
 #include <bpf/bpf_tracing.h>
 
 #include "hash.h"
-#include "shared.h"
+#include "interpreter.h"
+
+// The native unwinder tail calls this unwinder once it's done, with the
+// entrypoint's tail call, its own tail calls and the one to this unwinder's
+// entrypoint taken, and walking the stack takes BPF_PROGRAMS_COUNT more.
+_Static_assert(2 + MAX_TAIL_CALLS + BPF_PROGRAMS_COUNT <= MAX_TAIL_CALL_CHAIN, "the native and Ruby stacks can be traversed within the tail call limit");
+_Static_assert(BPF_PROGRAMS_COUNT >= 1, "the Ruby stack can be traversed");
 
 /* struct {
     // This map's type is a placeholder, it's dynamically set
@@ -44,6 +50,14 @@ struct {
     __type(value, RubyVersionOffsets);
 } version_specific_offsets SEC(".maps");
 
+// Same keys as version_specific_offsets.
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 12);
+    __type(key, u32);
+    __type(value, interpreter_frame_descriptor_t);
+} frame_descriptors SEC(".maps");
+
 struct {
     __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
     __uint(max_entries, 1);
@@ -67,31 +81,6 @@ static inline_method int read_syscall_id(void *ctx, int *syscall_id) {
     return bpf_probe_read_kernel(syscall_id, SYSCALL_NR_SIZE, ctx + SYSCALL_NR_OFFSET);
 }
 
-static inline_method void read_ruby_string(RubyVersionOffsets *version_offsets, u64 label, char *buffer, int buffer_len) {
-    u64 flags;
-    u64 char_ptr;
-
-    rbperf_read(&flags, 8, (void *)(label + 0 /* .basic */ + 0 /* .flags */));
-
-    if (STRING_ON_HEAP(flags)) {
-        rbperf_read(&char_ptr, 8, (void *)(label + as_offset + 8 /* .long len */));
-        int err = rbperf_read_str(buffer, buffer_len, (void *)(char_ptr));
-        if (err < 0) {
-            LOG("[warn] string @ 0x%llx [heap] failed with err=%d", char_ptr, err);
-        }
-    } else {
-        u64 c_string_address = label + as_offset;
-        if (version_offsets->major_version == 3 && version_offsets->minor_version >= 2) {
-            // Account for Variable Width Allocation https://bugs.ruby-lang.org/issues/18239.
-            c_string_address += sizeof(long);
-        }
-        int err = rbperf_read_str(buffer, buffer_len, (void *)(c_string_address));
-        if (err < 0) {
-            LOG("[warn] string @ 0x%llx [stack] failed with err=%d", c_string_address, err);
-        }
-    }
-}
-
 static inline_method int read_ruby_lineno(u64 pc, u64 body, RubyVersionOffsets *version_offsets) {
     // This will only give accurate line number for Ruby 2.4
 
@@ -129,15 +118,28 @@ static inline_method int read_ruby_lineno(u64 pc, u64 body, RubyVersionOffsets *
     }
 }
 
-static inline_method u32 read_frame(u64 pc, u64 body, symbol_t *current_frame, RubyVersionOffsets *version_offsets) {
+static __always_inline int read_interpreter_symbol(interpreter_frame_descriptor_t *desc, void *offsets, void *cfp, void *body, symbol_t *current_frame) {
+    RubyVersionOffsets *version_offsets = offsets;
     u64 path_addr;
     u64 path;
     u64 label;
     u64 flags;
+    u64 pc_addr;
+    u64 pc;
     int label_offset = version_offsets->label_offset;
 
+    if (body == NULL) {
+        // this could be a native frame, it's missing the check though
+        // https://github.com/ruby/ruby/blob/4ff3f20/.gdbinit#L1155
+        // TODO(javierhonduco): Fetch path for native stacks
+        bpf_probe_read_kernel_str(current_frame->method_name, sizeof(NATIVE_METHOD_NAME), NATIVE_METHOD_NAME);
+        bpf_probe_read_kernel_str(current_frame->path, sizeof(NATIVE_METHOD_PATH), NATIVE_METHOD_PATH);
+        return 0;
+    }
+
     LOG("[debug] reading stack");
-    __builtin_memset((void *)current_frame, 0, sizeof(symbol_t));
+    rbperf_read(&pc_addr, 8, cfp + 0);
+    rbperf_read(&pc, 8, (void *)pc_addr);
 
     rbperf_read(&path_addr, 8, (void *)(body + ruby_location_offset + path_offset));
     rbperf_read(&flags, 8, (void *)path_addr);
@@ -160,9 +162,15 @@ static inline_method u32 read_frame(u64 pc, u64 body, symbol_t *current_frame, R
 
     rbperf_read(&label, 8, (void *)(body + ruby_location_offset + label_offset));
 
-    read_ruby_string(version_offsets, path, current_frame->path, sizeof(current_frame->path));
-    u32 lineno = read_ruby_lineno(pc, body, version_offsets);
-    read_ruby_string(version_offsets, label, current_frame->method_name, sizeof(current_frame->method_name));
+    int err = read_interpreter_string(desc, (void *)path, current_frame->path, sizeof(current_frame->path));
+    if (err < 0) {
+        LOG("[warn] path string @ 0x%llx failed with err=%d", path, err);
+    }
+    u32 lineno = read_ruby_lineno(pc, (u64)body, version_offsets);
+    err = read_interpreter_string(desc, (void *)label, current_frame->method_name, sizeof(current_frame->method_name));
+    if (err < 0) {
+        LOG("[warn] label string @ 0x%llx failed with err=%d", label, err);
+    }
 
     LOG("[debug] method name=%s", current_frame->method_name);
     return lineno;
@@ -170,11 +178,6 @@ static inline_method u32 read_frame(u64 pc, u64 body, symbol_t *current_frame, R
 
 SEC("perf_event")
 int walk_ruby_stack(struct bpf_perf_event_data *ctx) {
-    u64 iseq_addr;
-    u64 pc;
-    u64 pc_addr;
-    u64 body;
-
     int zero = 0;
     SampleState *state = bpf_map_lookup_elem(&global_state, &zero);
     if (state == NULL) {
@@ -186,76 +189,45 @@ int walk_ruby_stack(struct bpf_perf_event_data *ctx) {
         return 0; // this should not happen
     }
 
-    symbol_t current_frame = {};
-    u64 base_stack = state->base_stack;
-    u64 cfp = state->cfp;
-    state->ruby_stack_program_count += 1;
-    u64 control_frame_t_sizeof = version_offsets->control_frame_t_sizeof;
-
-#pragma unroll
-    for (int i = 0; i < MAX_STACKS_PER_PROGRAM; i++) {
-        rbperf_read(&iseq_addr, 8, (void *)(cfp + iseq_offset));
-        rbperf_read(&pc_addr, 8, (void *)(cfp + 0));
-        rbperf_read(&pc, 8, (void *)pc_addr);
-
-        if (cfp > state->base_stack) {
-            LOG("[debug] done reading stack");
-            break;
-        }
-
-        u64 lineno = 0;
-
-        if ((void *)iseq_addr == NULL) {
-            // this could be a native frame, it's missing the check though
-            // https://github.com/ruby/ruby/blob/4ff3f20/.gdbinit#L1155
-            // TODO(javierhonduco): Fetch path for native stacks
-            bpf_probe_read_kernel_str(current_frame.method_name, sizeof(NATIVE_METHOD_NAME), NATIVE_METHOD_NAME);
-            bpf_probe_read_kernel_str(current_frame.path, sizeof(NATIVE_METHOD_PATH), NATIVE_METHOD_PATH);
-        } else {
-            rbperf_read(&body, 8, (void *)(iseq_addr + body_offset));
-            lineno = read_frame(pc, body, &current_frame, version_offsets);
-        }
-
-        long long int actual_index = state->stack.frames.len;
-        if (actual_index >= 0 && actual_index < MAX_STACK_DEPTH) {
-            state->stack.frames.addresses[actual_index] = (lineno << 32) | get_symbol_id(&current_frame);
-            state->stack.frames.len += 1;
-        }
+    interpreter_frame_descriptor_t *desc = bpf_map_lookup_elem(&frame_descriptors, &state->rb_version);
+    if (desc == NULL) {
+        return 0; // this should not happen
+    }
 
-        cfp += control_frame_t_sizeof;
+    stack_trace_t *stack = interpreter_stack();
+    if (stack == NULL) {
+        return 0;
     }
 
-    state->cfp = cfp;
-    state->base_stack = base_stack;
+    state->ruby_stack_program_count += 1;
 
-    if (cfp <= base_stack && state->ruby_stack_program_count < BPF_PROGRAMS_COUNT) {
+    enum interpreter_walk_result result = walk_interpreter_frames(desc, version_offsets, &state->cursor, stack, MAX_STACKS_PER_PROGRAM);
+    if (result == INTERPRETER_WALK_MORE && state->ruby_stack_program_count < BPF_PROGRAMS_COUNT) {
         LOG("[debug] traversing next chunk of the stack in a tail call");
         bpf_tail_call(ctx, &programs, RBPERF_STACK_READING_PROGRAM_IDX);
     }
 
-    state->stack.stack_status = cfp > state->base_stack ? STACK_COMPLETE : STACK_INCOMPLETE;
-
-    if (state->stack.frames.len != state->stack.expected_size) {
-        LOG("[error] stack size %d, expected %d", state->stack.frames.len, state->stack.expected_size);
+    switch (result) {
+    case INTERPRETER_WALK_DONE:
+        LOG("[debug] done reading stack");
+        state->stack.stack_status = STACK_COMPLETE;
+        break;
+    case INTERPRETER_WALK_MORE:
+        state->stack.stack_status = STACK_TRUNCATED;
+        break;
+    default:
+        state->stack.stack_status = STACK_ERROR;
     }
 
-    // Hash stack.
-    u64 ruby_stack_hash = hash_stack(&state->stack.frames, 0);
-    LOG("[debug] ruby stack hash: %d", ruby_stack_hash);
-
-    unwind_state_t *unwind_state = bpf_map_lookup_elem(&heap, &zero);
-    if (unwind_state != NULL) {
-        unwind_state->stack_key.interpreter_stack_id = ruby_stack_hash;
+    if (stack->len != state->stack.expected_size) {
+        LOG("[error] stack size %d, expected %d", stack->len, state->stack.expected_size);
     }
 
-    // Insert stack.
-    int err = bpf_map_update_elem(&stack_traces, &ruby_stack_hash, &state->stack.frames, BPF_ANY);
+    // We are done.
+    int err = submit_interpreter_stack();
     if (err != 0) {
         LOG("[error] bpf_map_update_elem with ret: %d", err);
     }
-
-    // We are done.
-    aggregate_stacks();
     return 0;
 }
 
@@ -354,13 +326,15 @@ int unwind_ruby_stack(struct bpf_perf_event_data *ctx) {
         } else {
             state->stack.syscall_id = 0;
         }
-        state->stack.frames.len = 0;
+        if (reset_interpreter_stack() == NULL) {
+            return 0;
+        }
         state->stack.expected_size = (base_stack - cfp) / control_frame_t_sizeof;
         bpf_get_current_comm(state->stack.comm, sizeof(state->stack.comm));
         state->stack.stack_status = STACK_COMPLETE;
 
-        state->base_stack = base_stack;
-        state->cfp = cfp + version_offsets->control_frame_t_sizeof;
+        state->cursor.frame = cfp + version_offsets->control_frame_t_sizeof;
+        state->cursor.end = base_stack;
         state->ruby_stack_program_count = 0;
         state->rb_version = process_data->rb_version;
 
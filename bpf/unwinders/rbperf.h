@@ -11,8 +11,11 @@
 #define COMM_MAXLEN 25
 
 #define MAX_STACKS_PER_PROGRAM 30
-#define BPF_PROGRAMS_COUNT 25
-#define MAX_STACK (MAX_STACKS_PER_PROGRAM * BPF_PROGRAMS_COUNT)
+// Enough programs to walk MAX_STACK_DEPTH frames, as long as the native
+// unwinder leaves enough tail calls. Otherwise the stacks are truncated to
+// MAX_STACKS_PER_PROGRAM * INTERPRETER_MAX_TAIL_CALLS frames.
+#define BPF_PROGRAMS_COUNT_FOR_DEPTH ((MAX_STACK_DEPTH + MAX_STACKS_PER_PROGRAM - 1) / MAX_STACKS_PER_PROGRAM)
+#define BPF_PROGRAMS_COUNT (BPF_PROGRAMS_COUNT_FOR_DEPTH < INTERPRETER_MAX_TAIL_CALLS ? BPF_PROGRAMS_COUNT_FOR_DEPTH : INTERPRETER_MAX_TAIL_CALLS)
 
 #define RBPERF_STACK_READING_PROGRAM_IDX 0
 
@@ -28,15 +31,13 @@
 
 #define rb_value_sizeof 0x8 // sizeof(VALUE)
 
-#define iseq_offset 0x10          // offsetof(rb_control_frame_t, iseq)
-#define body_offset 0x10          // offsetof(struct rb_iseq_struct, body)
+// The offsets of the iseq of a control frame, of the body of an iseq and of the
+// characters of strings are in the frame descriptors, set up by
+// pkg/profiler/cpu/bpf/maps/descriptors.go.
 #define ruby_location_offset 0x40 // offsetof(struct rb_iseq_constant_body, location)
 #define path_offset 0x0           // offsetof(struct rb_iseq_location_struct, path)
 #define iseq_encoded_offset 0x8   // offsetof(struct rb_iseq_constant_body, iseq_encoded)
 
-#define as_offset 0x10
-
-#define STRING_ON_HEAP(flags) flags &(1 << 13)
 #define inline_method inline __attribute__((__always_inline__))
 
 // CRuby constants, from
@@ -56,11 +57,6 @@
 static char NATIVE_METHOD_NAME[] = "<native code>";
 static char NATIVE_METHOD_PATH[] = "<unknown>";
 
-enum ruby_stack_status {
-    STACK_COMPLETE = 0,
-    STACK_INCOMPLETE = 1,
-};
-
 enum rbperf_event_type {
     RBPERF_EVENT_UNKNOWN = 0,
     RBPERF_EVENT_ON_CPU_SAMPLING = 1,
@@ -69,7 +65,6 @@ enum rbperf_event_type {
 
 typedef struct {
     u64 timestamp;
-    stack_trace_t frames;
 
     u32 pid;
     u32 cpu;
@@ -78,13 +73,12 @@ typedef struct {
     // long long int size;
     long long int expected_size;
     char comm[COMM_MAXLEN];
-    enum ruby_stack_status stack_status;
+    enum interpreter_stack_status stack_status;
 } RubyStack;
 
 typedef struct {
     RubyStack stack;
-    u64 base_stack;
-    u64 cfp;
+    interpreter_cursor_t cursor;
     int ruby_stack_program_count;
     int rb_version;
 } SampleState;
@@ -9,12 +9,18 @@
 // A different stack produced the same hash.
 #define STACK_COLLISION(err) (err == -EEXIST)
 
+// The user stack was walked with frame pointers by the kernel, as the unwind
+// information of the process wasn't loaded yet.
+#define STACK_FLAG_DEGRADED (1ULL << 0)
+
 typedef struct {
     int pid;
     int tgid;
     u64 user_stack_id;
     u64 kernel_stack_id;
     u64 interpreter_stack_id;
+    // STACK_FLAG_* bits.
+    u64 flags;
 } stack_count_key_t;
 
 typedef struct {
@@ -65,7 +71,9 @@ struct {
     __type(value, u32);
 } symbol_index_storage SEC(".maps");
 
-const volatile int num_cpus = 200; // Hard-limit of 200 CPUs.
+// Number of possible CPUs. Set in the user-space before loading, so that the
+// per-CPU sharded symbol IDs never collide, regardless of the core count.
+const volatile int num_cpus = 200;
 
 static inline __attribute__((__always_inline__)) u32 get_symbol_id(symbol_t *sym) {
 	int *found_id = bpf_map_lookup_elem(&symbol_table, sym);
@@ -86,7 +94,12 @@ static inline __attribute__((__always_inline__)) u32 get_symbol_id(symbol_t *sym
 	//
 	// Checking for the version does not work as these branches are not pruned
 	// in older kernels, so we shard the id generation per CPU.
-	u32 idx = *sym_idx * num_cpus + bpf_get_smp_processor_id();
+	u32 cpu = bpf_get_smp_processor_id();
+	if (cpu >= num_cpus) {
+		// Would collide with another CPU's shard.
+		return 0;
+	}
+	u32 idx = *sym_idx * num_cpus + cpu;
 	*sym_idx += 1;
 
 	int err;
@@ -128,3 +141,56 @@ static __always_inline void *bpf_map_lookup_or_try_init(void *map, const void *k
             }                                                                                                                                                  \
         }                                                                                                                                                      \
     })
+
+// Interpreter unwinders walk their stacks into the stack of the unwind state,
+// which is free by then, as the native unwinder stores the user and kernel
+// stacks before tail-calling them. This way all the interpreter unwinders
+// share the same per-CPU buffer.
+static __always_inline stack_trace_t *interpreter_stack() {
+    u32 zero = 0;
+    unwind_state_t *unwind_state = bpf_map_lookup_elem(&heap, &zero);
+    if (unwind_state == NULL) {
+        return NULL;
+    }
+    return &unwind_state->stack;
+}
+
+// To be called by the interpreter unwinders before walking their stacks.
+static __always_inline stack_trace_t *reset_interpreter_stack() {
+    stack_trace_t *stack = interpreter_stack();
+    if (stack == NULL) {
+        return NULL;
+    }
+    // The whole stack is hashed, not only its frames.
+    stack->len = 0;
+    __builtin_memset((void *)stack->addresses, 0, sizeof(stack->addresses));
+    return stack;
+}
+
+// Adds a frame to an interpreter stack, with its line number in the upper 32
+// bits and the ID of its symbol in the lower ones.
+static __always_inline void append_interpreter_frame(stack_trace_t *stack, u64 lineno, symbol_t *sym) {
+    u64 len = stack->len;
+    if (len < MAX_STACK_DEPTH) {
+        stack->addresses[len] = (lineno << 32) | get_symbol_id(sym);
+        stack->len++;
+    }
+}
+
+// To be called by the interpreter unwinders once they are done walking their
+// stacks. Stores the interpreter stack and aggregates it with the native and
+// kernel ones.
+static __always_inline int submit_interpreter_stack() {
+    u32 zero = 0;
+    unwind_state_t *unwind_state = bpf_map_lookup_elem(&heap, &zero);
+    if (unwind_state == NULL) {
+        return 0;
+    }
+
+    u64 stack_hash = hash_stack(&unwind_state->stack, 0);
+    int err = bpf_map_update_elem(&stack_traces, &stack_hash, &unwind_state->stack, BPF_ANY);
+    unwind_state->stack_key.interpreter_stack_id = stack_hash;
+
+    aggregate_stacks();
+    return err;
+}
@@ -34,6 +34,7 @@ import (
 	"time"
 
 	"github.com/alecthomas/kong"
+	"github.com/apache/arrow/go/v14/arrow/memory"
 	libbpf "github.com/aquasecurity/libbpfgo"
 	"github.com/common-nighthawk/go-figure"
 	"github.com/go-kit/log"
@@ -85,8 +86,11 @@ import (
 	"github.com/parca-dev/parca-agent/pkg/process"
 	"github.com/parca-dev/parca-agent/pkg/profiler"
 	"github.com/parca-dev/parca-agent/pkg/profiler/cpu"
+	bpfprograms "github.com/parca-dev/parca-agent/pkg/profiler/cpu/bpf/programs"
 	"github.com/parca-dev/parca-agent/pkg/rlimit"
 	"github.com/parca-dev/parca-agent/pkg/runtime"
+	"github.com/parca-dev/parca-agent/pkg/runtime/interpreter"
+	"github.com/parca-dev/parca-agent/pkg/spool"
 	"github.com/parca-dev/parca-agent/pkg/template"
 	"github.com/parca-dev/parca-agent/pkg/tracer"
 	"github.com/parca-dev/parca-agent/pkg/vdso"
@@ -146,6 +150,8 @@ type flags struct {
 	PythonUnwindingDisable bool                `default:"false" help:"Disable Python unwinder."`
 	RubyUnwindingDisable   bool                `default:"false" help:"Disable Ruby unwinder."`
 
+	InterpreterCachePath string `help:"File to persist the analyzed Python and Ruby interpreter binaries to, so they aren't analyzed again after a restart. Defaults to a file in the debuginfo temp directory."`
+
 	AnalyticsOptOut bool `default:"false" help:"Opt out of sending anonymous usage statistics."`
 
 	Telemetry FlagsTelemetry `embed:"" prefix:"telemetry-"`
@@ -176,6 +182,10 @@ type FlagsProfiling struct {
 	PerfEventBufferPollInterval       time.Duration `default:"250ms" help:"The interval at which the perf event buffer is polled for new events."`
 	PerfEventBufferProcessingInterval time.Duration `default:"100ms" help:"The interval at which the perf event buffer is processed."`
 	PerfEventBufferWorkerCount        int           `default:"4"     help:"The number of workers that process the perf event buffer."`
+
+	PipelineConvertWorkerCount int `default:"4"   help:"The number of workers that convert the profiles of the processes to pprof."`
+	PipelineStoreWorkerCount   int `default:"2"   help:"The number of workers that write the converted profiles to the profile store."`
+	PipelineQueueSize          int `default:"256" help:"The number of profiles that can wait for each stage of the profile pipeline."`
 }
 
 // FlagsMetadata provides metadadata configuration flags.
@@ -188,7 +198,9 @@ type FlagsMetadata struct {
 
 // FlagsLocalStore provides local store configuration flags.
 type FlagsLocalStore struct {
-	Directory string `help:"The local directory to store the profiling data."`
+	Directory     string        `help:"The local directory to store the profiling data."`
+	Format        string        `default:"pprof" enum:"pprof,arrow" help:"The format to store the profiles in. pprof writes a gzipped pprof per profile, arrow batches the profiles of all processes into dictionary-encoded Arrow records."`
+	FlushInterval time.Duration `default:"10s"   help:"Interval between writes of the batched profiles when the format is arrow."`
 }
 
 // FlagsRemoteStore provides remote store configuration flags.
@@ -202,6 +214,10 @@ type FlagsRemoteStore struct {
 	BatchWriteInterval time.Duration `default:"10s"   help:"Interval between batch remote client writes. Leave this empty to use the default value of 10s."`
 	RPCLoggingEnable   bool          `default:"false" help:"Enable gRPC logging."`
 	RPCUnaryTimeout    time.Duration `default:"5m"    help:"Maximum timeout window for unary gRPC requests including retries."`
+
+	SpoolDirectory string        `help:"The local directory to spool the profiles to before they are sent, so they aren't lost while the remote store is slow or unreachable. Disabled if empty."`
+	SpoolMaxSizeMb int64         `default:"1024" help:"The maximum size of the spool, the oldest profiles are dropped first."`
+	SpoolMaxAge    time.Duration `default:"24h"  help:"The maximum age of the profiles in the spool."`
 }
 
 // FlagsDebuginfo contains flags to configure debuginfo.
@@ -224,8 +240,11 @@ type FlagsSymbolizer struct {
 
 // FlagsDWARFUnwinding contains flags to configure DWARF unwinding.
 type FlagsDWARFUnwinding struct {
-	Disable bool `help:"Do not unwind using .eh_frame information."`
-	Mixed   bool `default:"true"                                    help:"Unwind using .eh_frame information and frame pointers."`
+	Disable            bool `help:"Do not unwind using .eh_frame information."`
+	Mixed              bool `default:"true"                                    help:"Unwind using .eh_frame information and frame pointers."`
+	Degraded           bool `default:"true"                                    help:"Unwind the processes whose unwind information isn't loaded yet with frame pointers, tagging their samples with unwinding=degraded."`
+	Prewarm            bool `help:"Add the unwind information of the running processes on startup, starting with the ones using the most CPU."`
+	PrewarmConcurrency int  `default:"4"                                       help:"Number of processes to generate the unwind information for in parallel when prewarming."`
 }
 
 type FlagsTelemetry struct {
@@ -234,8 +253,9 @@ type FlagsTelemetry struct {
 }
 
 type FlagsObjectFilePool struct {
-	EvictionPolicy string `default:"lru" enum:"lru,lfu"                                                                                                                                                                                          help:"The eviction policy to use for the object file pool."`
-	Size           int    `default:"100" help:"The maximum number of object files to keep in the pool. This is used to avoid re-reading object files from disk. It keeps FDs open, so it should be kept in sync with ulimits. 0 means no limit."`
+	EvictionPolicy   string `default:"lru" enum:"lru,lfu"                                                                                                                                                                                          help:"The eviction policy to use for the object file pool."`
+	Size             int    `default:"100" help:"The maximum number of object files to keep in the pool. This is used to avoid re-reading object files from disk. It keeps FDs open, so it should be kept in sync with ulimits. 0 means no limit."`
+	BuildIDCachePath string `help:"File to persist the build IDs of the opened object files to, so they aren't computed again after a restart. Disabled if empty."`
 }
 
 // FlagsHidden contains hidden flags used for debugging or running with untested configurations.
@@ -259,7 +279,10 @@ type FlagsHidden struct {
 
 type FlagsBPF struct {
 	VerboseLogging   bool   `help:"Enable verbose BPF logging."`
-	EventsBufferSize uint32 `default:"8192"                     help:"Size in pages of the events buffer."`
+	EventsBufferSize uint32 `default:"8192"                     help:"Size in pages of the events buffer, split across all CPUs."`
+	MemoryBudget     uint64 `default:"0"                        help:"The number of bytes to divide across the BPF maps, based on the CPU count and the observed number of processes and executables. 0 means the default map sizes are used."`
+	MapStatsPath     string `help:"File to persist the BPF maps usage to, used to size them on restarts. Defaults to a file in the debuginfo temp directory."`
+	StackDepth       int    `default:"127"                      help:"Maximum number of frames of the walked stacks, deeper stacks are truncated. One of 64, 127 or 160, 160 is not available on arm64."`
 }
 
 var _ Profiler = (*profiler.NoopProfiler)(nil)
@@ -596,6 +619,22 @@ func run(logger log.Logger, reg *prometheus.Registry, flags flags) error {
 		return errors.New("the BPF events buffer is too small, should be at least 32 pages")
 	}
 
+	if flags.DWARFUnwinding.PrewarmConcurrency < 1 {
+		return errors.New("the DWARF unwinding prewarm concurrency should be at least 1")
+	}
+
+	if err := bpfprograms.ValidateStackDepth(flags.BPF.StackDepth); err != nil {
+		return err
+	}
+
+	if flags.BPF.MapStatsPath == "" {
+		flags.BPF.MapStatsPath = filepath.Join(flags.Debuginfo.TempDir, "bpf_map_stats.json")
+	}
+
+	if flags.InterpreterCachePath == "" {
+		flags.InterpreterCachePath = filepath.Join(flags.Debuginfo.TempDir, "interpreters.json")
+	}
+
 	release, err := kernel.GetRelease()
 	if err == nil && kernel.HasKnownBugs(release) && !flags.Hidden.IgnoreUnsafeKernelVersion {
 		return errors.New("this kernel version might cause issues such as freezing your system (https://github.com/parca-dev/parca-agent/discussions/2071). This can be bypassed with --ignore-unsafe-kernel-version but bad things can happen")
@@ -655,13 +694,33 @@ func run(logger log.Logger, reg *prometheus.Registry, flags flags) error {
 		}
 	}
 
+	var (
+		profileWriter profilestorepb.ProfileStoreServiceClient
+		profileSpool  *spool.Spool
+	)
+	if flags.RemoteStore.SpoolDirectory != "" {
+		profileSpool, err = spool.Open(log.With(logger, "component", "spool"), reg, flags.RemoteStore.SpoolDirectory, spool.Options{
+			MaxSize: flags.RemoteStore.SpoolMaxSizeMb << 20,
+			MaxAge:  flags.RemoteStore.SpoolMaxAge,
+		})
+		if err != nil {
+			return fmt.Errorf("failed to open profile spool: %w", err)
+		}
+		defer profileSpool.Close()
+		profileWriter = profileSpool
+		level.Info(logger).Log("msg", "profile spool is enabled", "dir", flags.RemoteStore.SpoolDirectory)
+	}
+
 	var (
 		g                   okrun.Group
 		batchWriteClient    = agent.NewBatchWriteClient(logger, reg, profileStoreClient, flags.RemoteStore.BatchWriteInterval)
 		localStorageEnabled = flags.LocalStore.Directory != ""
-		profileListener     = agent.NewMatchingProfileListener(logger, batchWriteClient)
 		profileStore        profiler.ProfileStore
 	)
+	if profileWriter == nil {
+		profileWriter = batchWriteClient
+	}
+	profileListener := agent.NewMatchingProfileListener(logger, profileWriter)
 
 	// Run group of OTL exporter.
 	if exporter != nil {
@@ -725,10 +784,31 @@ func run(logger log.Logger, reg *prometheus.Registry, flags flags) error {
 		})
 	}
 
-	if localStorageEnabled {
+	switch {
+	case localStorageEnabled && flags.LocalStore.Format == "arrow":
+		columnarStore := profiler.NewColumnarStore(memory.NewGoAllocator())
+		profileStore = columnarStore
+		level.Info(logger).Log("msg", "local profile storage is enabled", "dir", flags.LocalStore.Directory, "format", flags.LocalStore.Format)
+
+		// Run group of the columnar profile writer.
+		{
+			logger := log.With(logger, "group", "columnar_profile_writer")
+			ctx, cancel := context.WithCancel(ctx)
+			g.Add(func() error {
+				level.Debug(logger).Log("msg", "starting")
+				defer level.Debug(logger).Log("msg", "stopped")
+
+				return columnarStore.Run(ctx, logger, flags.LocalStore.Directory, flags.LocalStore.FlushInterval)
+			}, func(error) {
+				level.Debug(logger).Log("msg", "cleaning up")
+				defer level.Debug(logger).Log("msg", "cleanup finished")
+				cancel()
+			})
+		}
+	case localStorageEnabled:
 		profileStore = profiler.NewFileStore(flags.LocalStore.Directory)
 		level.Info(logger).Log("msg", "local profile storage is enabled", "dir", flags.LocalStore.Directory)
-	} else {
+	default:
 		profileStore = profiler.NewRemoteStore(logger, profileListener)
 
 		// Run group of profile writer.
@@ -741,6 +821,10 @@ func run(logger log.Logger, reg *prometheus.Registry, flags flags) error {
 
 				var err error
 				runtimepprof.Do(ctx, runtimepprof.Labels("component", "remote_profile_writer"), func(ctx context.Context) {
+					if profileSpool != nil {
+						err = profileSpool.Run(ctx, profileStoreClient, flags.RemoteStore.BatchWriteInterval)
+						return
+					}
 					err = batchWriteClient.Run(ctx)
 				})
 
@@ -851,7 +935,9 @@ func run(logger log.Logger, reg *prometheus.Registry, flags flags) error {
 		})
 	}
 
-	ofp := objectfile.NewPool(logger, reg, flags.ObjectFilePool.EvictionPolicy, flags.ObjectFilePool.Size, flags.Profiling.Duration)
+	ofp := objectfile.NewPool(logger, reg, flags.ObjectFilePool.EvictionPolicy, flags.ObjectFilePool.Size, flags.Profiling.Duration,
+		objectfile.WithBuildIDCachePath(flags.ObjectFilePool.BuildIDCachePath),
+	)
 	defer ofp.Close() // Will make sure all the files are closed.
 
 	nsCache := namespace.NewCache(logger, reg, flags.Profiling.Duration)
@@ -862,7 +948,7 @@ func run(logger log.Logger, reg *prometheus.Registry, flags flags) error {
 		discoveryMetadata,
 		metadata.Target(flags.Node, flags.Metadata.ExternalLabels),
 		metadata.Compiler(logger, reg, pfs, compilerInfoManager),
-		metadata.Runtime(reg, pfs),
+		metadata.Runtime(reg, pfs, ofp),
 		metadata.Java(logger, nsCache),
 		metadata.Process(pfs),
 		metadata.System(),
@@ -910,6 +996,14 @@ func run(logger log.Logger, reg *prometheus.Registry, flags flags) error {
 		dbginfo = debuginfo.NoopDebuginfoManager{}
 	}
 
+	interpreterFetcher := interpreter.NewFetcher(
+		log.With(logger, "component", "interpreter_fetcher"),
+		reg,
+		ofp,
+		flags.InterpreterCachePath,
+	)
+	defer interpreterFetcher.Close()
+
 	processInfoManager := process.NewInfoManager(
 		log.With(logger, "component", "process_info"),
 		tp.Tracer("process_info"),
@@ -921,6 +1015,7 @@ func run(logger log.Logger, reg *prometheus.Registry, flags flags) error {
 			pfs,
 			ofp,
 		),
+		interpreterFetcher,
 		dbginfo,
 		labelsManager,
 		flags.Profiling.Duration,
@@ -954,6 +1049,7 @@ func run(logger log.Logger, reg *prometheus.Registry, flags flags) error {
 			reg,
 			processInfoManager,
 			compilerInfoManager,
+			ofp,
 			converter.NewManager(
 				log.With(logger, "component", "converter_manager"),
 				reg,
@@ -962,6 +1058,7 @@ func run(logger log.Logger, reg *prometheus.Registry, flags flags) error {
 				perf.NewJITDumpCache(logger, reg, optimizedSymtabs, flags.Profiling.Duration),
 				vdsoResolver,
 				flags.Symbolizer.JITDisable,
+				flags.Profiling.Duration,
 			),
 			profileStore,
 			&cpu.Config{
@@ -970,12 +1067,21 @@ func run(logger log.Logger, reg *prometheus.Registry, flags flags) error {
 				PerfEventBufferPollInterval:       flags.Profiling.PerfEventBufferPollInterval,
 				PerfEventBufferProcessingInterval: flags.Profiling.PerfEventBufferProcessingInterval,
 				PerfEventBufferWorkerCount:        flags.Profiling.PerfEventBufferWorkerCount,
+				ProfilePipelineConvertWorkerCount: flags.Profiling.PipelineConvertWorkerCount,
+				ProfilePipelineStoreWorkerCount:   flags.Profiling.PipelineStoreWorkerCount,
+				ProfilePipelineQueueSize:          flags.Profiling.PipelineQueueSize,
 				MemlockRlimit:                     flags.MemlockRlimit,
 				DebugProcessNames:                 flags.Hidden.DebugProcessNames,
 				DWARFUnwindingDisabled:            flags.DWARFUnwinding.Disable,
 				DWARFUnwindingMixedModeEnabled:    flags.DWARFUnwinding.Mixed,
+				DWARFUnwindingDegradedModeEnabled: flags.DWARFUnwinding.Degraded,
+				DWARFUnwindingPrewarmEnabled:      flags.DWARFUnwinding.Prewarm,
+				DWARFUnwindingPrewarmConcurrency:  flags.DWARFUnwinding.PrewarmConcurrency,
 				BPFVerboseLoggingEnabled:          flags.BPF.VerboseLogging,
 				BPFEventsBufferSize:               flags.BPF.EventsBufferSize,
+				BPFMemoryBudget:                   flags.BPF.MemoryBudget,
+				BPFStackDepth:                     flags.BPF.StackDepth,
+				BPFMapStatsPath:                   flags.BPF.MapStatsPath,
 				PythonUnwindingEnabled:            !flags.PythonUnwindingDisable,
 				RubyUnwindingEnabled:              !flags.RubyUnwindingDisable,
 				RateLimitUnwindInfo:               flags.Hidden.RateLimitUnwindInfo,
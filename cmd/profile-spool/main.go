@@ -0,0 +1,85 @@
+// Copyright 2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package main
+
+import (
+	"fmt"
+	"os"
+	"path/filepath"
+	"sort"
+	"strings"
+	"time"
+
+	"github.com/alecthomas/kong"
+
+	"github.com/parca-dev/parca-agent/pkg/spool"
+)
+
+type flags struct {
+	Directory string            `kong:"required,help='The spool directory of the agent.'"`
+	From      time.Time         `kong:"help='Only the profiles written from this time, in RFC 3339 format.'"`
+	To        time.Time         `kong:"help='Only the profiles written until this time, in RFC 3339 format.'"`
+	Labels    map[string]string `kong:"help='Only the profiles with these labels, as name=value pairs separated by semicolons.'"`
+	Output    string            `kong:"help='The directory to write the profiles to, as gzipped pprof files. They are listed if empty.'"`
+}
+
+// This tool reads back the profiles spooled by Parca Agent, to look at them
+// when the remote store is unreachable, or without one.
+func main() {
+	flags := flags{}
+	kong.Parse(&flags)
+
+	if flags.Output != "" {
+		if err := os.MkdirAll(flags.Output, 0o755); err != nil {
+			// nolint:forbidigo
+			fmt.Fprintln(os.Stderr, "failed to create the output directory:", err)
+			os.Exit(1)
+		}
+	}
+
+	var profiles int
+	err := spool.Query(flags.Directory, flags.From, flags.To, flags.Labels, func(r spool.Record) error {
+		for _, series := range r.Request.GetSeries() {
+			labels := make([]string, 0, len(series.GetLabels().GetLabels()))
+			for _, l := range series.GetLabels().GetLabels() {
+				labels = append(labels, l.GetName()+"="+l.GetValue())
+			}
+			sort.Strings(labels)
+
+			for _, sample := range series.GetSamples() {
+				profiles++
+				if flags.Output == "" {
+					// nolint:forbidigo
+					fmt.Printf("%s\t%d bytes\t{%s}\n", r.Time.Format(time.RFC3339Nano), len(sample.GetRawProfile()), strings.Join(labels, ", "))
+					continue
+				}
+
+				path := filepath.Join(flags.Output, fmt.Sprintf("%d_%04d.pb.gz", r.Time.UnixNano(), profiles))
+				if err := os.WriteFile(path, sample.GetRawProfile(), 0o644); err != nil { //nolint:gosec
+					return err
+				}
+			}
+		}
+		return nil
+	})
+	if err != nil {
+		// nolint:forbidigo
+		fmt.Fprintln(os.Stderr, "failed with:", err)
+		os.Exit(1)
+	}
+	if flags.Output != "" {
+		// nolint:forbidigo
+		fmt.Printf("wrote %d profiles to %s\n", profiles, flags.Output)
+	}
+}
@@ -7,6 +7,7 @@ require (
 	github.com/Masterminds/semver/v3 v3.2.1
 	github.com/RoaringBitmap/roaring v1.9.0
 	github.com/alecthomas/kong v0.8.1
+	github.com/apache/arrow/go/v14 v14.0.1
 	github.com/aquasecurity/libbpfgo v0.6.0-libbpf-1.3
 	github.com/aquasecurity/libbpfgo/helpers v0.4.5
 	github.com/armon/circbuf v0.0.0-20190214190532-5111143e8da2
@@ -81,7 +82,6 @@ require (
 	github.com/Microsoft/go-winio v0.6.1 // indirect
 	github.com/aliyun/aliyun-oss-go-sdk v3.0.1+incompatible // indirect
 	github.com/andybalholm/brotli v1.0.6 // indirect
-	github.com/apache/arrow/go/v14 v14.0.1 // indirect
 	github.com/aws/aws-sdk-go-v2 v1.22.2 // indirect
 	github.com/aws/aws-sdk-go-v2/config v1.25.0 // indirect
 	github.com/aws/aws-sdk-go-v2/credentials v1.16.0 // indirect
@@ -16,10 +16,13 @@ package agent
 
 import (
 	"context"
+	"sort"
 	"sync"
+	"sync/atomic"
 	"time"
 
 	"github.com/cenkalti/backoff/v4"
+	"github.com/cespare/xxhash/v2"
 	"github.com/go-kit/log"
 	"github.com/go-kit/log/level"
 	profilestorepb "github.com/parca-dev/parca/gen/proto/go/parca/profilestore/v1alpha1"
@@ -56,6 +59,11 @@ func newMetrics(reg prometheus.Registerer) *metrics {
 	return &m
 }
 
+// seriesShards is the number of shards the batched series are split into, by
+// the hash of their label set, so concurrent writes of different series
+// rarely contend for the same lock.
+const seriesShards = 16
+
 // BatchWriteClient is a batch writer for profiles.
 type BatchWriteClient struct {
 	logger        log.Logger
@@ -63,13 +71,29 @@ type BatchWriteClient struct {
 	writeClient   profilestorepb.ProfileStoreServiceClient
 	writeInterval time.Duration
 
-	mtx    *sync.RWMutex
-	series []*profilestorepb.RawProfileSeries
+	shards [seriesShards]seriesShard
+	// Orders the series across the shards by the time they were added.
+	nextSeriesSeq atomic.Uint64
 
+	mtx                *sync.RWMutex
 	lastBatchSentAt    time.Time
 	lastBatchSendError error
 }
 
+// seriesShard holds the batched series whose label sets hash to it, indexed
+// by the hash.
+type seriesShard struct {
+	mtx    sync.Mutex
+	series []*batchedSeries
+	// Series whose label sets have the same hash are chained.
+	index map[uint64][]*batchedSeries
+}
+
+type batchedSeries struct {
+	seq    uint64
+	series *profilestorepb.RawProfileSeries
+}
+
 func NewBatchWriteClient(logger log.Logger, reg prometheus.Registerer, wc profilestorepb.ProfileStoreServiceClient, writeInterval time.Duration) *BatchWriteClient {
 	return &BatchWriteClient{
 		logger:        logger,
@@ -77,8 +101,7 @@ func NewBatchWriteClient(logger log.Logger, reg prometheus.Registerer, wc profil
 		writeClient:   wc,
 		writeInterval: writeInterval,
 
-		series: []*profilestorepb.RawProfileSeries{},
-		mtx:    &sync.RWMutex{},
+		mtx: &sync.RWMutex{},
 	}
 }
 
@@ -111,10 +134,7 @@ func (b *BatchWriteClient) batch(ctx context.Context) error {
 		b.metrics.writeRawWithRetriesLatency.Observe(time.Since(start).Seconds())
 	}()
 
-	b.mtx.Lock()
-	batch := b.series
-	b.series = []*profilestorepb.RawProfileSeries{}
-	b.mtx.Unlock()
+	batch := b.collect(true)
 
 	expbackOff := backoff.NewExponentialBackOff()
 	expbackOff.MaxElapsedTime = b.writeInterval         // TODO: Subtract ~10% of interval to account for overhead in loop
@@ -155,44 +175,109 @@ func (b *BatchWriteClient) batch(ctx context.Context) error {
 	return nil
 }
 
+// collect returns the batched series in the order they were added, and
+// starts a new batch if reset is set.
+func (b *BatchWriteClient) collect(reset bool) []*profilestorepb.RawProfileSeries {
+	var batched []*batchedSeries
+	for i := range b.shards {
+		shard := &b.shards[i]
+		shard.mtx.Lock()
+		batched = append(batched, shard.series...)
+		if reset {
+			clear(shard.series)
+			shard.series = shard.series[:0]
+			clear(shard.index)
+		}
+		shard.mtx.Unlock()
+	}
+
+	sort.Slice(batched, func(i, j int) bool {
+		return batched[i].seq < batched[j].seq
+	})
+	series := make([]*profilestorepb.RawProfileSeries, 0, len(batched))
+	for _, s := range batched {
+		series = append(series, s.series)
+	}
+	return series
+}
+
 func isEqualLabel(a, b *profilestorepb.LabelSet) bool {
 	if len(a.GetLabels()) != len(b.GetLabels()) {
 		return false
 	}
 
-	ret := true
 	for i := range a.GetLabels() {
 		if (a.GetLabels()[i].GetName() != b.GetLabels()[i].GetName()) || (a.GetLabels()[i].GetValue() != b.GetLabels()[i].GetValue()) {
-			ret = false
+			return false
 		}
 	}
-	return ret
+	return true
 }
 
-func findIndex(arr []*profilestorepb.RawProfileSeries, p *profilestorepb.RawProfileSeries) (int, bool) {
-	for i, val := range arr {
-		if isEqualLabel(val.GetLabels(), p.GetLabels()) {
-			return i, true
-		}
+// sortedLabelSet returns the label set with its labels sorted by name, so the
+// same labels match however they were ordered. The label set is returned as
+// is if it's sorted already.
+func sortedLabelSet(ls *profilestorepb.LabelSet) *profilestorepb.LabelSet {
+	labels := ls.GetLabels()
+	less := func(i, j int) bool {
+		return labels[i].GetName() < labels[j].GetName()
 	}
-	return -1, false
+	if sort.SliceIsSorted(labels, less) {
+		return ls
+	}
+
+	labels = append([]*profilestorepb.Label(nil), labels...)
+	sort.Slice(labels, less)
+	return &profilestorepb.LabelSet{Labels: labels}
 }
 
-func (b *BatchWriteClient) WriteRaw(ctx context.Context, r *profilestorepb.WriteRawRequest, opts ...grpc.CallOption) (*profilestorepb.WriteRawResponse, error) {
-	b.mtx.Lock()
-	defer b.mtx.Unlock()
+// hashLabelSet returns the hash of a sorted label set.
+func hashLabelSet(ls *profilestorepb.LabelSet) uint64 {
+	sep := []byte{0xff}
+	h := xxhash.New()
+	for _, l := range ls.GetLabels() {
+		_, _ = h.WriteString(l.GetName())
+		_, _ = h.Write(sep)
+		_, _ = h.WriteString(l.GetValue())
+		_, _ = h.Write(sep)
+	}
+	return h.Sum64()
+}
 
+func (b *BatchWriteClient) WriteRaw(ctx context.Context, r *profilestorepb.WriteRawRequest, opts ...grpc.CallOption) (*profilestorepb.WriteRawResponse, error) {
 	for _, profileSeries := range r.GetSeries() {
-		if j, ok := findIndex(b.series, profileSeries); ok {
-			b.series[j].Samples = append(b.series[j].GetSamples(), profileSeries.GetSamples()...)
-			continue
-		}
+		labels := sortedLabelSet(profileSeries.GetLabels())
+		h := hashLabelSet(labels)
 
-		b.series = append(b.series, &profilestorepb.RawProfileSeries{
-			Labels:  profileSeries.GetLabels(),
-			Samples: profileSeries.GetSamples(),
-		})
+		shard := &b.shards[h%seriesShards]
+		shard.mtx.Lock()
+		shard.add(h, labels, profileSeries.GetSamples(), &b.nextSeriesSeq)
+		shard.mtx.Unlock()
 	}
 
 	return &profilestorepb.WriteRawResponse{}, nil
 }
+
+// add appends the samples to the series with the given label set, or adds a
+// new series if there's none.
+func (s *seriesShard) add(h uint64, labels *profilestorepb.LabelSet, samples []*profilestorepb.RawSample, seq *atomic.Uint64) {
+	for _, bs := range s.index[h] {
+		if isEqualLabel(bs.series.GetLabels(), labels) {
+			bs.series.Samples = append(bs.series.GetSamples(), samples...)
+			return
+		}
+	}
+
+	bs := &batchedSeries{
+		seq: seq.Add(1),
+		series: &profilestorepb.RawProfileSeries{
+			Labels:  labels,
+			Samples: samples,
+		},
+	}
+	if s.index == nil {
+		s.index = map[uint64][]*batchedSeries{}
+	}
+	s.index[h] = append(s.index[h], bs)
+	s.series = append(s.series, bs)
+}
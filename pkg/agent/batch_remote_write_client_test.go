@@ -16,6 +16,7 @@ package agent
 import (
 	"bytes"
 	"context"
+	"strconv"
 	"testing"
 	"time"
 
@@ -89,7 +90,7 @@ func TestWriteClient(t *testing.T) {
 		}}
 
 		require.NoError(t, err)
-		require.True(t, compareProfileSeries(batcher.series, series))
+		require.True(t, compareProfileSeries(batcher.collect(false), series))
 	})
 
 	t.Run("insertSecondProfile", func(t *testing.T) {
@@ -112,7 +113,7 @@ func TestWriteClient(t *testing.T) {
 		}
 
 		require.NoError(t, err)
-		require.True(t, compareProfileSeries(batcher.series, series))
+		require.True(t, compareProfileSeries(batcher.collect(false), series))
 	})
 
 	t.Run("appendProfile", func(t *testing.T) {
@@ -135,6 +136,91 @@ func TestWriteClient(t *testing.T) {
 		}
 
 		require.NoError(t, err)
-		require.True(t, compareProfileSeries(batcher.series, series))
+		require.True(t, compareProfileSeries(batcher.collect(false), series))
+	})
+}
+
+func TestWriteClientLabelOrder(t *testing.T) {
+	batcher := NewBatchWriteClient(log.NewNopLogger(), prometheus.NewRegistry(), NewNoopProfileStoreClient(), time.Second)
+
+	samples1 := []*profilestorepb.RawSample{{RawProfile: []byte{11, 4, 96}}}
+	samples2 := []*profilestorepb.RawSample{{RawProfile: []byte{15, 11, 95}}}
+	n1 := &profilestorepb.Label{Name: "n1", Value: "v1"}
+	n2 := &profilestorepb.Label{Name: "n2", Value: "v2"}
+
+	ctx := context.Background()
+	_, err := batcher.WriteRaw(ctx, &profilestorepb.WriteRawRequest{
+		Series: []*profilestorepb.RawProfileSeries{{
+			Labels:  &profilestorepb.LabelSet{Labels: []*profilestorepb.Label{n2, n1}},
+			Samples: samples1,
+		}},
+	})
+	require.NoError(t, err)
+	_, err = batcher.WriteRaw(ctx, &profilestorepb.WriteRawRequest{
+		Series: []*profilestorepb.RawProfileSeries{{
+			Labels:  &profilestorepb.LabelSet{Labels: []*profilestorepb.Label{n1, n2}},
+			Samples: samples2,
+		}},
+	})
+	require.NoError(t, err)
+
+	series := []*profilestorepb.RawProfileSeries{{
+		Labels:  &profilestorepb.LabelSet{Labels: []*profilestorepb.Label{n1, n2}},
+		Samples: append(samples1, samples2...),
+	}}
+	require.True(t, compareProfileSeries(batcher.collect(true), series))
+	require.Empty(t, batcher.collect(false))
+}
+
+// BenchmarkWriteRaw measures batching a profile for each of 10k series, as the
+// profile store does, and starting a new batch.
+func BenchmarkWriteRaw(b *testing.B) {
+	const numSeries = 10000
+
+	requests := make([]*profilestorepb.WriteRawRequest, numSeries)
+	for i := range requests {
+		requests[i] = &profilestorepb.WriteRawRequest{
+			Series: []*profilestorepb.RawProfileSeries{{
+				Labels: &profilestorepb.LabelSet{Labels: []*profilestorepb.Label{
+					{Name: "__name__", Value: "parca_agent_cpu"},
+					{Name: "comm", Value: "comm-" + strconv.Itoa(i%100)},
+					{Name: "node", Value: "node-1"},
+					{Name: "pid", Value: strconv.Itoa(i)},
+				}},
+				Samples: []*profilestorepb.RawSample{{RawProfile: []byte{1}}},
+			}},
+		}
+	}
+	ctx := context.Background()
+
+	b.Run("serial", func(b *testing.B) {
+		batcher := NewBatchWriteClient(log.NewNopLogger(), prometheus.NewRegistry(), NewNoopProfileStoreClient(), time.Second)
+
+		b.ReportAllocs()
+		b.ResetTimer()
+		for i := 0; i < b.N; i++ {
+			for _, r := range requests {
+				if _, err := batcher.WriteRaw(ctx, r); err != nil {
+					b.Fatal(err)
+				}
+			}
+			batcher.collect(true)
+		}
+	})
+
+	b.Run("parallel", func(b *testing.B) {
+		batcher := NewBatchWriteClient(log.NewNopLogger(), prometheus.NewRegistry(), NewNoopProfileStoreClient(), time.Second)
+
+		b.ReportAllocs()
+		b.ResetTimer()
+		b.RunParallel(func(pb *testing.PB) {
+			i := 0
+			for pb.Next() {
+				if _, err := batcher.WriteRaw(ctx, requests[i%numSeries]); err != nil {
+					b.Fatal(err)
+				}
+				i++
+			}
+		})
 	})
 }
@@ -14,27 +14,31 @@
 package cache
 
 import (
-	"sync"
-
 	"github.com/prometheus/client_golang/prometheus"
 
-	"github.com/parca-dev/parca-agent/pkg/cache/lfu"
-	"github.com/parca-dev/parca-agent/pkg/cache/lru"
+	"github.com/parca-dev/parca-agent/pkg/cache/clock"
 )
 
-// NewLRUCache returns a new concurrency-safe fixed size cache with LRU exiction policy.
+// lfuMaxFrequency is the number of hits counted by the caches approximating
+// LFU.
+const lfuMaxFrequency = 4
+
+// NewLRUCache returns a new concurrency-safe fixed size cache with an exiction policy approximating LRU.
+// It's sharded, and hits don't contend with each other.
 func NewLRUCache[K comparable, V any](reg prometheus.Registerer, maxEntries int) *Cache[K, V] {
 	return &Cache[K, V]{
-		c:   lru.New[K, V](reg, lru.WithMaxSize[K, V](maxEntries)),
-		mtx: &sync.RWMutex{},
+		c: clock.New[K, V](reg, clock.WithMaxSize[K, V](maxEntries)),
 	}
 }
 
-// NewLFUCache returns a new concurrency-safe fixed size cache with LFU exiction policy.
+// NewLFUCache returns a new concurrency-safe fixed size cache with an exiction policy approximating LFU.
+// It's sharded, and hits don't contend with each other.
 func NewLFUCache[K comparable, V any](reg prometheus.Registerer, maxEntries int) *Cache[K, V] {
 	return &Cache[K, V]{
-		c:   lfu.New[K, V](reg, lfu.WithMaxSize[K, V](maxEntries)),
-		mtx: &sync.RWMutex{},
+		c: clock.New[K, V](reg,
+			clock.WithMaxSize[K, V](maxEntries),
+			clock.WithMaxFrequency[K, V](lfuMaxFrequency),
+		),
 	}
 }
 
@@ -47,46 +51,33 @@ type cacher[K comparable, V any] interface {
 	Close() error
 }
 
+// Cache is a cache safe for concurrent use, the underlying cache is
+// synchronized.
 type Cache[K comparable, V any] struct {
-	c   cacher[K, V]
-	mtx *sync.RWMutex
+	c cacher[K, V]
 }
 
 func (c *Cache[K, V]) Add(key K, value V) {
-	c.mtx.Lock()
-	defer c.mtx.Unlock()
 	c.c.Add(key, value)
 }
 
 func (c *Cache[K, V]) Get(key K) (V, bool) {
-	c.mtx.Lock()
-	defer c.mtx.Unlock()
 	return c.c.Get(key)
 }
 
 // Peek returns the value associated with key without updating the "recently used"-ness of that key.
 func (c *Cache[K, V]) Peek(key K) (V, bool) {
-	c.mtx.RLock()
-	defer c.mtx.RUnlock()
 	return c.c.Peek(key)
 }
 
 func (c *Cache[K, V]) Remove(key K) {
-	c.mtx.Lock()
-	defer c.mtx.Unlock()
 	c.c.Remove(key)
 }
 
 func (c *Cache[K, V]) Purge() {
-	c.mtx.Lock()
-	defer c.mtx.Unlock()
 	c.c.Purge()
 }
 
 func (c *Cache[K, V]) Close() error {
-	c.mtx.Lock()
-	defer c.mtx.Unlock()
-
-	c.c.Purge()
 	return c.c.Close()
 }
@@ -14,11 +14,15 @@
 package cache
 
 import (
+	"math/rand"
+	"sync"
 	"testing"
 	"time"
 
 	"github.com/prometheus/client_golang/prometheus"
 	"github.com/stretchr/testify/require"
+
+	"github.com/parca-dev/parca-agent/pkg/cache/lru"
 )
 
 func TestLRUCache(t *testing.T) {
@@ -158,3 +162,103 @@ func TestLRUCacheWithEvictionTTL(t *testing.T) {
 		t.Errorf("expected key3 to be evicted, but was still present")
 	}
 }
+
+func TestLRUCacheWithTTLRemoveExpiredOnAdd(t *testing.T) {
+	ttl := 10 * time.Millisecond
+	c := NewLRUCacheWithTTL[string, int](prometheus.NewRegistry(), 10, ttl, CacheWithTTLOptions{
+		UpdateDeadlineOnGet: true,
+		RemoveExpiredOnAdd:  true,
+	})
+
+	c.Add("key1", 1)
+	c.Add("key2", 2)
+	time.Sleep(ttl / 2)
+	// Extends the deadline of key2.
+	_, ok := c.Get("key2")
+	require.True(t, ok)
+
+	time.Sleep(ttl/2 + 2*ttl/expiryWheelTicks)
+	c.Add("key3", 3)
+	_, ok = c.Peek("key1")
+	require.False(t, ok, "expected key1 to be removed")
+	_, ok = c.Peek("key2")
+	require.True(t, ok, "expected key2 to be kept")
+
+	time.Sleep(ttl)
+	// Adding again after a whole TTL expires everything.
+	c.Add("key1", 1)
+	_, ok = c.Peek("key2")
+	require.False(t, ok, "expected key2 to be removed")
+	_, ok = c.Peek("key3")
+	require.False(t, ok, "expected key3 to be removed")
+	v, ok := c.Get("key1")
+	require.True(t, ok)
+	require.Equal(t, 1, v)
+}
+
+// newLRUCacheWithScanTTL returns a cache removing the expired entries by
+// walking all of them, as it was done before the expiry wheel, to compare
+// against.
+func newLRUCacheWithScanTTL[K comparable, V any](reg prometheus.Registerer, maxEntries int, ttl time.Duration) *CacheWithTTL[K, V] {
+	c := &CacheWithTTL[K, V]{
+		mtx: &sync.RWMutex{},
+		ttl: ttl,
+	}
+	nextRemoveExpired := time.Now().Add(ttl)
+	c.c = lru.New[K, valueWithDeadline[V]](reg,
+		lru.WithMaxSize[K, valueWithDeadline[V]](maxEntries),
+		lru.WithOnAdded[K, valueWithDeadline[V]](func(key K, value valueWithDeadline[V]) {
+			now := time.Now()
+			if nextRemoveExpired.Before(now) {
+				c.c.RemoveMatching(func(k K, v valueWithDeadline[V]) bool {
+					return v.deadline.Before(now)
+				})
+				nextRemoveExpired = now.Add(ttl)
+			}
+		}),
+	)
+	return c
+}
+
+func BenchmarkCacheWithTTLRemoveExpiredOnAdd(b *testing.B) {
+	const (
+		maxEntries = 100000
+		ttl        = 10 * time.Millisecond
+	)
+
+	for _, bc := range []struct {
+		name  string
+		cache func() *CacheWithTTL[int, int]
+	}{{
+		name: "scan",
+		cache: func() *CacheWithTTL[int, int] {
+			return newLRUCacheWithScanTTL[int, int](prometheus.NewRegistry(), maxEntries, ttl)
+		},
+	}, {
+		name: "wheel",
+		cache: func() *CacheWithTTL[int, int] {
+			return NewLRUCacheWithTTL[int, int](prometheus.NewRegistry(), maxEntries, ttl, CacheWithTTLOptions{
+				RemoveExpiredOnAdd: true,
+			})
+		},
+	}} {
+		b.Run(bc.name, func(b *testing.B) {
+			c := bc.cache()
+			for i := 0; i < maxEntries; i++ {
+				c.Add(i, i)
+			}
+
+			b.ReportAllocs()
+			b.ResetTimer()
+			b.RunParallel(func(pb *testing.PB) {
+				r := rand.New(rand.NewSource(rand.Int63())) //nolint:gosec
+				for pb.Next() {
+					k := r.Intn(2 * maxEntries)
+					if _, ok := c.Get(k); !ok {
+						c.Add(k, k)
+					}
+				}
+			})
+		})
+	}
+}
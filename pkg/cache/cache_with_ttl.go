@@ -35,19 +35,8 @@ func NewLRUCacheWithTTL[K comparable, V any](reg prometheus.Registerer, maxEntri
 	}
 	if len(opts) > 0 {
 		c.updateDeadlineOnGet = opts[0].UpdateDeadlineOnGet
-		c.removeExpiredOnAdd = opts[0].RemoveExpiredOnAdd
-		if c.removeExpiredOnAdd {
-			c.nextRemoveExpired = time.Now().Add(ttl)
-			lruOpts = append(lruOpts, lru.WithOnAdded[K, valueWithDeadline[V]](func(key K, value valueWithDeadline[V]) {
-				now := time.Now()
-				if c.nextRemoveExpired.Before(now) {
-					// Happens in "Add" inside a lock, so we don't need to lock here.
-					c.c.RemoveMatching(func(k K, v valueWithDeadline[V]) bool {
-						return v.deadline.Before(now)
-					})
-					c.nextRemoveExpired = now.Add(ttl)
-				}
-			}))
+		if opts[0].RemoveExpiredOnAdd {
+			c.expiry = newExpiryWheel[K](ttl, time.Now())
 		}
 	}
 	c.c = lru.New[K, valueWithDeadline[V]](reg, lruOpts...)
@@ -65,19 +54,8 @@ func NewLFUCacheWithTTL[K comparable, V any](reg prometheus.Registerer, maxEntri
 	}
 	if len(opts) > 0 {
 		c.updateDeadlineOnGet = opts[0].UpdateDeadlineOnGet
-		c.removeExpiredOnAdd = opts[0].RemoveExpiredOnAdd
-		if c.removeExpiredOnAdd {
-			c.nextRemoveExpired = time.Now().Add(ttl)
-			lfuOpts = append(lfuOpts, lfu.WithOnAdded[K, valueWithDeadline[V]](func(key K, value valueWithDeadline[V]) {
-				now := time.Now()
-				if c.nextRemoveExpired.Before(now) {
-					// Happens in "Add" inside a lock, so we don't need to lock here.
-					c.c.RemoveMatching(func(k K, v valueWithDeadline[V]) bool {
-						return v.deadline.Before(now)
-					})
-					c.nextRemoveExpired = now.Add(ttl)
-				}
-			}))
+		if opts[0].RemoveExpiredOnAdd {
+			c.expiry = newExpiryWheel[K](ttl, time.Now())
 		}
 	}
 	c.c = lfu.New[K, valueWithDeadline[V]](reg, lfuOpts...)
@@ -91,7 +69,10 @@ type cacherWithRemoveMatching[K comparable, V any] interface {
 
 type CacheWithTTLOptions struct {
 	UpdateDeadlineOnGet bool
-	RemoveExpiredOnAdd  bool
+	// RemoveExpiredOnAdd removes the expired entries when adding new ones,
+	// instead of only when they are looked up. The deadlines are tracked by
+	// a timing wheel, so it only visits the entries that expired.
+	RemoveExpiredOnAdd bool
 }
 
 type valueWithDeadline[V any] struct {
@@ -106,19 +87,39 @@ type CacheWithTTL[K comparable, V any] struct {
 	ttl time.Duration
 
 	updateDeadlineOnGet bool
-	removeExpiredOnAdd  bool
-	nextRemoveExpired   time.Time
+	// Set if the expired entries are removed when adding new ones.
+	expiry *expiryWheel[K]
 }
 
 func (c *CacheWithTTL[K, V]) Add(key K, value V) {
 	c.mtx.Lock()
 	defer c.mtx.Unlock()
+	c.add(key, value)
+}
+
+// add adds the value with a new deadline. It must be called with the lock
+// held.
+func (c *CacheWithTTL[K, V]) add(key K, value V) {
+	now := time.Now()
+	deadline := now.Add(c.ttl)
+	if c.expiry != nil {
+		if v, ok := c.c.Peek(key); ok {
+			c.expiry.remove(key, v.deadline)
+		}
+		c.expiry.advance(now, c.deadline, c.c.Remove)
+		c.expiry.add(key, deadline)
+	}
 	c.c.Add(key, valueWithDeadline[V]{
 		value:    value,
-		deadline: time.Now().Add(c.ttl),
+		deadline: deadline,
 	})
 }
 
+func (c *CacheWithTTL[K, V]) deadline(key K) (time.Time, bool) {
+	v, ok := c.c.Peek(key)
+	return v.deadline, ok
+}
+
 func (c *CacheWithTTL[K, V]) Get(key K) (V, bool) {
 	c.mtx.Lock()
 	v, ok := c.c.Get(key)
@@ -134,10 +135,7 @@ func (c *CacheWithTTL[K, V]) Get(key K) (V, bool) {
 	}
 	if c.updateDeadlineOnGet {
 		c.mtx.Lock()
-		c.c.Add(key, valueWithDeadline[V]{
-			value:    v.value,
-			deadline: time.Now().Add(c.ttl),
-		})
+		c.add(key, v.value)
 		c.mtx.Unlock()
 	}
 	return v.value, true
@@ -160,11 +158,17 @@ func (c *CacheWithTTL[K, V]) Purge() {
 	c.mtx.Lock()
 	defer c.mtx.Unlock()
 	c.c.Purge()
+	if c.expiry != nil {
+		c.expiry.reset()
+	}
 }
 
 func (c *CacheWithTTL[K, V]) Close() error {
 	c.mtx.Lock()
 	defer c.mtx.Unlock()
+	if c.expiry != nil {
+		c.expiry.reset()
+	}
 	return c.c.Close()
 }
 
@@ -0,0 +1,269 @@
+// Copyright 2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package clock
+
+import (
+	"math/bits"
+	"runtime"
+	"sync"
+	"sync/atomic"
+	"unsafe"
+
+	"github.com/prometheus/client_golang/prometheus"
+)
+
+// minShardEntries is the minimum number of entries of a shard, so the small
+// caches aren't sharded and their eviction stays close to exact.
+const minShardEntries = 64
+
+// Clock is a concurrency-safe cache, split into shards by the hash of the
+// keys, each evicting its entries with the CLOCK algorithm: the entries are
+// kept in a ring, a hit only bumps the frequency of the entry, and the hand
+// of the clock sweeps the ring to find an entry that wasn't hit since it last
+// passed, decrementing the frequencies on its way.
+//
+// Hits only take the read lock of their shard and don't allocate.
+type Clock[K comparable, V any] struct {
+	metrics *metrics
+	closer  func() error
+
+	maxEntries   int // Zero means no limit.
+	maxFrequency uint32
+	shards       int
+
+	keyHashing keyHashing
+	keySize    uintptr
+	mask       uint64
+	ring       []shard[K, V]
+}
+
+type entry[K comparable, V any] struct {
+	key       K
+	value     V
+	frequency atomic.Uint32
+}
+
+type shard[K comparable, V any] struct {
+	mtx sync.RWMutex
+
+	maxEntries int
+	// Index of the entries by key.
+	items   map[K]int
+	entries []entry[K, V]
+	// Slots of removed entries.
+	free []int
+	hand int
+
+	hits, misses atomic.Uint64
+
+	// Keeps the shards on separate cache lines.
+	_ [64]byte
+}
+
+// New returns a new cache with the provided maximum items count.
+func New[K comparable, V any](reg prometheus.Registerer, opts ...Option[K, V]) *Clock[K, V] {
+	c := &Clock[K, V]{
+		maxFrequency: 1,
+		shards:       4 * runtime.GOMAXPROCS(0),
+		keyHashing:   keyHashingOf[K](),
+	}
+	for _, opt := range opts {
+		opt(c)
+	}
+
+	n := max(c.shards, 1)
+	if c.maxEntries > 0 {
+		n = min(n, c.maxEntries/minShardEntries)
+	}
+	if n <= 1 || c.keyHashing == keyHashingNone {
+		n = 1
+	}
+	// Round up to a power of two, so the shard is picked by masking the hash.
+	n = 1 << bits.Len(uint(n-1))
+
+	var zero K
+	c.keySize = unsafe.Sizeof(zero)
+	c.mask = uint64(n - 1)
+	c.ring = make([]shard[K, V], n)
+	for i := range c.ring {
+		s := &c.ring[i]
+		s.items = map[K]int{}
+		if c.maxEntries > 0 {
+			s.maxEntries = c.maxEntries / n
+			if i < c.maxEntries%n {
+				s.maxEntries++
+			}
+		}
+	}
+
+	c.metrics = newMetrics(reg, c.sum(func(s *shard[K, V]) uint64 {
+		return s.hits.Load()
+	}), c.sum(func(s *shard[K, V]) uint64 {
+		return s.misses.Load()
+	}))
+	c.closer = c.metrics.unregister
+	return c
+}
+
+func (c *Clock[K, V]) sum(f func(s *shard[K, V]) uint64) func() float64 {
+	return func() float64 {
+		var sum uint64
+		for i := range c.ring {
+			sum += f(&c.ring[i])
+		}
+		return float64(sum)
+	}
+}
+
+func (c *Clock[K, V]) shard(key *K) *shard[K, V] {
+	var h uint64
+	switch c.keyHashing {
+	case keyHashingString:
+		h = hashString(*(*string)(unsafe.Pointer(key)))
+	case keyHashingMemory:
+		h = hashBytes(unsafe.Slice((*byte)(unsafe.Pointer(key)), c.keySize))
+	case keyHashingNone:
+	}
+	return &c.ring[h&c.mask]
+}
+
+// Add adds a value to the cache.
+func (c *Clock[K, V]) Add(key K, value V) {
+	s := c.shard(&key)
+	s.mtx.Lock()
+	defer s.mtx.Unlock()
+
+	if i, ok := s.items[key]; ok {
+		s.entries[i].value = value
+		return
+	}
+
+	var i int
+	switch {
+	case s.maxEntries > 0 && len(s.items) >= s.maxEntries:
+		i = s.evict()
+		c.metrics.evictions.Inc()
+	case len(s.free) > 0:
+		i = s.free[len(s.free)-1]
+		s.free = s.free[:len(s.free)-1]
+	default:
+		s.entries = append(s.entries, entry[K, V]{})
+		i = len(s.entries) - 1
+	}
+	e := &s.entries[i]
+	e.key = key
+	e.value = value
+	e.frequency.Store(0)
+	s.items[key] = i
+}
+
+// Get looks up a key's value from the cache.
+func (c *Clock[K, V]) Get(key K) (V, bool) {
+	s := c.shard(&key)
+	s.mtx.RLock()
+	i, ok := s.items[key]
+	if !ok {
+		s.mtx.RUnlock()
+		s.misses.Add(1)
+		var zero V
+		return zero, false
+	}
+	e := &s.entries[i]
+	value := e.value
+	if e.frequency.Load() < c.maxFrequency {
+		e.frequency.Add(1)
+	}
+	s.mtx.RUnlock()
+	s.hits.Add(1)
+	return value, true
+}
+
+// Peek returns the key value (or undefined if not found) without updating the frequency of the key.
+func (c *Clock[K, V]) Peek(key K) (V, bool) {
+	s := c.shard(&key)
+	s.mtx.RLock()
+	defer s.mtx.RUnlock()
+
+	if i, ok := s.items[key]; ok {
+		return s.entries[i].value, true
+	}
+	var zero V
+	return zero, false
+}
+
+// Remove removes the provided key from the cache.
+func (c *Clock[K, V]) Remove(key K) {
+	s := c.shard(&key)
+	s.mtx.Lock()
+	defer s.mtx.Unlock()
+
+	i, ok := s.items[key]
+	if !ok {
+		return
+	}
+	s.remove(i)
+	s.free = append(s.free, i)
+	c.metrics.evictions.Inc()
+}
+
+// Purge is used to completely clear the cache.
+func (c *Clock[K, V]) Purge() {
+	for i := range c.ring {
+		s := &c.ring[i]
+		s.mtx.Lock()
+		clear(s.items)
+		s.entries = nil
+		s.free = nil
+		s.hand = 0
+		s.mtx.Unlock()
+	}
+}
+
+// Close closes the cache using registered closer.
+func (c *Clock[K, V]) Close() error {
+	c.Purge()
+	if c.closer != nil {
+		return c.closer()
+	}
+	return nil
+}
+
+// evict removes the entry under the hand of the clock, once it finds one
+// whose frequency is down to zero, and returns its slot. It must be called
+// with the lock held, on a full shard.
+func (s *shard[K, V]) evict() int {
+	for {
+		i := s.hand
+		s.hand = (s.hand + 1) % len(s.entries)
+		e := &s.entries[i]
+		// Hits only ever increment the frequency, and sweeps are serialized
+		// by the lock, so it doesn't go below zero.
+		if e.frequency.Load() > 0 {
+			e.frequency.Add(^uint32(0))
+			continue
+		}
+		s.remove(i)
+		return i
+	}
+}
+
+// remove removes the entry in the given slot, which is left for reuse.
+func (s *shard[K, V]) remove(i int) {
+	e := &s.entries[i]
+	delete(s.items, e.key)
+	// Don't keep the key and value alive.
+	var zero entry[K, V]
+	e.key = zero.key
+	e.value = zero.value
+}
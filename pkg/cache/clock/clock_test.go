@@ -0,0 +1,237 @@
+// Copyright 2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package clock
+
+import (
+	"math/rand"
+	"strconv"
+	"sync"
+	"testing"
+
+	"github.com/prometheus/client_golang/prometheus"
+	"github.com/prometheus/client_golang/prometheus/testutil"
+	"github.com/stretchr/testify/require"
+
+	"github.com/parca-dev/parca-agent/pkg/cache/lru"
+)
+
+func TestClock(t *testing.T) {
+	c := New[int, int](prometheus.NewRegistry(), WithMaxSize[int, int](128), WithShards[int, int](1))
+	require.Len(t, c.ring, 1)
+
+	for i := 0; i < 256; i++ {
+		c.Add(i, i)
+	}
+	require.Len(t, c.ring[0].items, 128)
+	require.InEpsilon(t, 128.0, testutil.ToFloat64(c.metrics.evictions), 1e-12)
+
+	for i := 0; i < 128; i++ {
+		v, ok := c.Get(i)
+		require.Zero(t, v)
+		require.False(t, ok)
+	}
+	for i := 128; i < 256; i++ {
+		v, ok := c.Get(i)
+		require.Equal(t, i, v)
+		require.True(t, ok)
+	}
+
+	for i := 128; i < 192; i++ {
+		c.Remove(i)
+		_, ok := c.Get(i)
+		require.False(t, ok, "should be deleted")
+	}
+
+	// The removed slots are reused before anything is evicted.
+	for i := 0; i < 64; i++ {
+		c.Add(i, i)
+	}
+	for i := 192; i < 256; i++ {
+		v, ok := c.Get(i)
+		require.True(t, ok)
+		require.Equal(t, i, v)
+	}
+	require.Len(t, c.ring[0].items, 128)
+}
+
+func TestClockSecondChance(t *testing.T) {
+	c := New[string, int](prometheus.NewRegistry(), WithMaxSize[string, int](3))
+
+	c.Add("key1", 1)
+	c.Add("key2", 2)
+	c.Add("key3", 3)
+	_, ok := c.Get("key1")
+	require.True(t, ok)
+	_, ok = c.Peek("key2")
+	require.True(t, ok)
+
+	// key1 was hit, and key2 only peeked.
+	c.Add("key4", 4)
+	_, ok = c.Peek("key2")
+	require.False(t, ok)
+	_, ok = c.Peek("key1")
+	require.True(t, ok)
+}
+
+func TestClockFrequency(t *testing.T) {
+	c := New[int, int](prometheus.NewRegistry(), WithMaxSize[int, int](2), WithMaxFrequency[int, int](4))
+
+	c.Add(1, 1)
+	c.Add(2, 2)
+	for i := 0; i < 4; i++ {
+		c.Get(1)
+	}
+	c.Get(2)
+
+	// The most frequently hit key outlives the others.
+	for i := 3; i < 6; i++ {
+		c.Add(i, i)
+		_, ok := c.Peek(1)
+		require.True(t, ok)
+	}
+	_, ok := c.Peek(2)
+	require.False(t, ok)
+}
+
+func TestClockShards(t *testing.T) {
+	type fileID struct {
+		dev, inode uint64
+	}
+	c := New[fileID, int](prometheus.NewRegistry(), WithMaxSize[fileID, int](1024), WithShards[fileID, int](3))
+	require.Len(t, c.ring, 4)
+
+	for i := 0; i < 2048; i++ {
+		c.Add(fileID{1, uint64(i)}, i)
+	}
+	var entries int
+	for i := range c.ring {
+		require.LessOrEqual(t, len(c.ring[i].items), 256)
+		require.NotEmpty(t, c.ring[i].items)
+		entries += len(c.ring[i].items)
+	}
+	require.Equal(t, 1024, entries)
+
+	require.InEpsilon(t, 1024.0, testutil.ToFloat64(c.metrics.evictions), 1e-12)
+	c.Get(fileID{1, 2047})
+	c.Get(fileID{2, 0})
+	require.Equal(t, 1.0, c.sum(func(s *shard[fileID, int]) uint64 { return s.hits.Load() })())
+	require.Equal(t, 1.0, c.sum(func(s *shard[fileID, int]) uint64 { return s.misses.Load() })())
+}
+
+func TestKeyHashingOf(t *testing.T) {
+	type name string
+	type padded struct {
+		a uint8
+		b uint64
+	}
+	require.Equal(t, keyHashingMemory, keyHashingOf[int]())
+	require.Equal(t, keyHashingMemory, keyHashingOf[[2]uint32]())
+	require.Equal(t, keyHashingString, keyHashingOf[string]())
+	require.Equal(t, keyHashingString, keyHashingOf[name]())
+	require.Equal(t, keyHashingNone, keyHashingOf[padded]())
+	require.Equal(t, keyHashingNone, keyHashingOf[float64]())
+	require.Equal(t, keyHashingNone, keyHashingOf[*int]())
+	require.Equal(t, keyHashingNone, keyHashingOf[any]())
+}
+
+func TestClockGetDoesNotAllocate(t *testing.T) {
+	c := New[string, int](prometheus.NewRegistry(), WithMaxSize[string, int](1024))
+	c.Add("key", 1)
+	require.Zero(t, testing.AllocsPerRun(100, func() {
+		c.Get("key")
+	}))
+}
+
+type cacher interface {
+	Add(key string, value int)
+	Get(key string) (int, bool)
+}
+
+// lockedLRU is the LRU behind a single lock, as the caches were before.
+type lockedLRU struct {
+	mtx sync.Mutex
+	lru *lru.LRU[string, int]
+}
+
+func (c *lockedLRU) Add(key string, value int) {
+	c.mtx.Lock()
+	defer c.mtx.Unlock()
+	c.lru.Add(key, value)
+}
+
+func (c *lockedLRU) Get(key string) (int, bool) {
+	c.mtx.Lock()
+	defer c.mtx.Unlock()
+	return c.lru.Get(key)
+}
+
+// BenchmarkParallelGet measures a read mostly workload, with keys mostly in
+// the cache, from 8 to 64 goroutines.
+func BenchmarkParallelGet(b *testing.B) {
+	const (
+		maxEntries = 8192
+		keys       = 2 * maxEntries
+	)
+
+	ks := make([]string, keys)
+	for i := range ks {
+		ks[i] = "/usr/lib/x86_64-linux-gnu/libfoo.so." + strconv.Itoa(i)
+	}
+
+	for _, impl := range []struct {
+		name  string
+		cache func() cacher
+	}{{
+		name: "locked-lru",
+		cache: func() cacher {
+			return &lockedLRU{lru: lru.New[string, int](prometheus.NewRegistry(), lru.WithMaxSize[string, int](maxEntries))}
+		},
+	}, {
+		name: "clock",
+		cache: func() cacher {
+			return New[string, int](prometheus.NewRegistry(), WithMaxSize[string, int](maxEntries))
+		},
+	}} {
+		for _, goroutines := range []int{8, 16, 32, 64} {
+			b.Run(impl.name+"/goroutines="+strconv.Itoa(goroutines), func(b *testing.B) {
+				c := impl.cache()
+				for i := 0; i < maxEntries; i++ {
+					c.Add(ks[i], i)
+				}
+
+				b.ReportAllocs()
+				b.ResetTimer()
+				var wg sync.WaitGroup
+				for g := 0; g < goroutines; g++ {
+					wg.Add(1)
+					go func(seed int64) {
+						defer wg.Done()
+						r := rand.New(rand.NewSource(seed)) //nolint:gosec
+						for i := 0; i < b.N/goroutines; i++ {
+							// Skewed towards the keys in the cache.
+							k := r.Intn(maxEntries)
+							if r.Intn(10) == 0 {
+								k = r.Intn(keys)
+							}
+							if _, ok := c.Get(ks[k]); !ok {
+								c.Add(ks[k], k)
+							}
+						}
+					}(int64(g))
+				}
+				wg.Wait()
+			})
+		}
+	}
+}
@@ -0,0 +1,83 @@
+// Copyright 2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package clock
+
+import (
+	"hash/maphash"
+	"reflect"
+)
+
+// keyHashing is how the keys of a cache are hashed to pick their shard.
+type keyHashing int
+
+const (
+	// The keys can't be hashed, the cache isn't sharded.
+	keyHashingNone keyHashing = iota
+	keyHashingString
+	// The keys are hashed by their memory, which is only done when equal
+	// keys have the same bytes.
+	keyHashingMemory
+)
+
+// keyHashingOf returns how the keys of type K are hashed.
+func keyHashingOf[K comparable]() keyHashing {
+	var zero K
+	t := reflect.TypeOf(zero)
+	switch {
+	case t == nil:
+		// Interface types.
+		return keyHashingNone
+	case t.Kind() == reflect.String:
+		return keyHashingString
+	case isPlainMemory(t):
+		return keyHashingMemory
+	default:
+		return keyHashingNone
+	}
+}
+
+// isPlainMemory returns whether the values of the type are equal if, and only
+// if, their bytes are, so no pointers, strings, floats or padding.
+func isPlainMemory(t reflect.Type) bool {
+	switch t.Kind() { //nolint:exhaustive
+	case reflect.Bool,
+		reflect.Int, reflect.Int8, reflect.Int16, reflect.Int32, reflect.Int64,
+		reflect.Uint, reflect.Uint8, reflect.Uint16, reflect.Uint32, reflect.Uint64, reflect.Uintptr:
+		return true
+	case reflect.Array:
+		return isPlainMemory(t.Elem())
+	case reflect.Struct:
+		var size uintptr
+		for i := 0; i < t.NumField(); i++ {
+			f := t.Field(i)
+			if !isPlainMemory(f.Type) {
+				return false
+			}
+			size += f.Type.Size()
+		}
+		return size == t.Size()
+	default:
+		return false
+	}
+}
+
+var seed = maphash.MakeSeed()
+
+func hashString(s string) uint64 {
+	return maphash.String(seed, s)
+}
+
+func hashBytes(b []byte) uint64 {
+	return maphash.Bytes(seed, b)
+}
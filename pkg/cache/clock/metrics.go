@@ -0,0 +1,75 @@
+// Copyright 2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package clock
+
+import (
+	"errors"
+	"fmt"
+
+	"github.com/prometheus/client_golang/prometheus"
+	"github.com/prometheus/client_golang/prometheus/promauto"
+)
+
+type metrics struct {
+	evictions prometheus.Counter
+
+	unregisterer func() error
+}
+
+// newMetrics registers the metrics of the cache. The requests are counted by
+// the shards, so the hits don't contend on a shared counter, and are summed
+// up when collected.
+func newMetrics(reg prometheus.Registerer, hits, misses func() float64) *metrics {
+	reg = prometheus.WrapRegistererWith(prometheus.Labels{"cache_type": "clock"}, reg)
+	requestsHit := promauto.With(reg).NewCounterFunc(prometheus.CounterOpts{
+		Name:        "cache_requests_total",
+		Help:        "Total number of cache requests.",
+		ConstLabels: prometheus.Labels{"result": "hit"},
+	}, hits)
+	requestsMiss := promauto.With(reg).NewCounterFunc(prometheus.CounterOpts{
+		Name:        "cache_requests_total",
+		Help:        "Total number of cache requests.",
+		ConstLabels: prometheus.Labels{"result": "miss"},
+	}, misses)
+	evictions := promauto.With(reg).NewCounter(prometheus.CounterOpts{
+		Name: "cache_evictions_total",
+		Help: "Total number of cache evictions.",
+	})
+	return &metrics{
+		evictions: evictions,
+
+		unregisterer: func() error {
+			// This closer makes sure that the metrics are unregistered when the cache is closed.
+			// This is useful when the a new cache is created with the same name.
+			var err error
+			if ok := reg.Unregister(requestsHit); !ok {
+				err = errors.Join(err, errors.New("unregistering requests counter"))
+			}
+			if ok := reg.Unregister(requestsMiss); !ok {
+				err = errors.Join(err, errors.New("unregistering requests counter"))
+			}
+			if ok := reg.Unregister(evictions); !ok {
+				err = errors.Join(err, errors.New("unregistering eviction counter"))
+			}
+			if err != nil {
+				return fmt.Errorf("cleaning cache stats counter: %w", err)
+			}
+			return nil
+		},
+	}
+}
+
+func (m *metrics) unregister() error {
+	return m.unregisterer()
+}
@@ -0,0 +1,39 @@
+// Copyright 2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package clock
+
+type Option[K comparable, V any] func(c *Clock[K, V])
+
+func WithMaxSize[K comparable, V any](maxSize int) Option[K, V] {
+	return func(c *Clock[K, V]) {
+		// Zero means no limit.
+		c.maxEntries = maxSize
+	}
+}
+
+// WithMaxFrequency sets how many hits of an entry are counted. An entry
+// survives as many passes of the hand of the clock as it was hit, so one
+// approximates LRU, and more approximate LFU.
+func WithMaxFrequency[K comparable, V any](maxFrequency uint32) Option[K, V] {
+	return func(c *Clock[K, V]) {
+		c.maxFrequency = max(maxFrequency, 1)
+	}
+}
+
+// WithShards sets the number of shards, rounded up to a power of two.
+func WithShards[K comparable, V any](shards int) Option[K, V] {
+	return func(c *Clock[K, V]) {
+		c.shards = shards
+	}
+}
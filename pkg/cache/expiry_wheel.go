@@ -0,0 +1,99 @@
+// Copyright 2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package cache
+
+import (
+	"time"
+)
+
+// expiryWheelTicks is the number of ticks the TTL of a cache is divided into
+// by its expiry wheel.
+const expiryWheelTicks = 64
+
+// expiryWheel is a timing wheel tracking the deadlines of the entries of a
+// cache, so the expired ones can be removed without walking all of them.
+//
+// Each slot of the wheel holds the keys whose deadlines fall in a tick. All
+// the entries of a cache have the same TTL, so no deadline is further than
+// the TTL away, and a single ring of slots covering it is enough.
+type expiryWheel[K comparable] struct {
+	tick  int64
+	slots []map[K]struct{}
+	// The first tick whose keys weren't expired yet.
+	next int64
+}
+
+func newExpiryWheel[K comparable](ttl time.Duration, now time.Time) *expiryWheel[K] {
+	tick := max(int64(ttl)/expiryWheelTicks, 1)
+	return &expiryWheel[K]{
+		tick: tick,
+		// One more slot for the tick of the deadlines of the entries added
+		// now, one more because deadlines don't fall on tick boundaries.
+		slots: make([]map[K]struct{}, expiryWheelTicks+2),
+		next:  now.UnixNano() / tick,
+	}
+}
+
+func (w *expiryWheel[K]) slot(deadline time.Time) int {
+	return int((deadline.UnixNano() / w.tick) % int64(len(w.slots)))
+}
+
+// add tracks the deadline of a key.
+func (w *expiryWheel[K]) add(key K, deadline time.Time) {
+	i := w.slot(deadline)
+	if w.slots[i] == nil {
+		w.slots[i] = map[K]struct{}{}
+	}
+	w.slots[i][key] = struct{}{}
+}
+
+// remove stops tracking the deadline of a key.
+func (w *expiryWheel[K]) remove(key K, deadline time.Time) {
+	delete(w.slots[w.slot(deadline)], key)
+}
+
+// advance removes the keys whose deadlines passed since the last call. Keys
+// are only tracked by the wheel, so the actual deadline of each is looked up
+// with deadline, which returns false if the key is gone already, and the
+// expired ones are removed with expire. Each key is visited once, when its
+// tick passes, unless the wheel wasn't advanced for a whole TTL.
+func (w *expiryWheel[K]) advance(now time.Time, deadline func(K) (time.Time, bool), expire func(K)) {
+	current := now.UnixNano() / w.tick
+	from := max(w.next, current-int64(len(w.slots)))
+	for t := from; t < current; t++ {
+		i := int(t % int64(len(w.slots)))
+		for key := range w.slots[i] {
+			d, ok := deadline(key)
+			switch {
+			case !ok:
+				// Removed or evicted.
+				delete(w.slots[i], key)
+			case d.Before(now):
+				expire(key)
+				delete(w.slots[i], key)
+			case w.slot(d) != i:
+				// Re-added after being evicted, it's tracked in its new slot.
+				delete(w.slots[i], key)
+			}
+		}
+	}
+	w.next = max(w.next, current)
+}
+
+// reset stops tracking all the keys.
+func (w *expiryWheel[K]) reset() {
+	for i := range w.slots {
+		w.slots[i] = nil
+	}
+}
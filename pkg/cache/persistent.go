@@ -0,0 +1,172 @@
+// Copyright 2022-2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+package cache
+
+import (
+	"encoding/json"
+	"errors"
+	"fmt"
+	"os"
+	"path/filepath"
+	"sync"
+	"time"
+
+	"github.com/parca-dev/parca-agent/internal/fsutil"
+)
+
+// Persistent is a concurrency-safe fixed size cache that can be saved to and
+// loaded from disk, for values that are expensive to compute and never go
+// stale, because their key identifies the input they were computed from.
+type Persistent[K comparable, V any] struct {
+	// Where the cache is persisted to, empty if it isn't.
+	path         string
+	maxEntries   int
+	saveInterval time.Duration
+
+	mtx      sync.Mutex
+	entries  map[K]V
+	dirty    bool
+	lastSave time.Time
+
+	// Serializes the writes to disk, which happen without holding mtx.
+	saveMtx sync.Mutex
+}
+
+type persistentEntry[K comparable, V any] struct {
+	Key   K `json:"key"`
+	Value V `json:"value"`
+}
+
+// NewPersistentCache returns a new cache persisted to the given path, if not
+// empty. Add reports when new entries were added more than saveInterval after
+// the last save.
+func NewPersistentCache[K comparable, V any](path string, maxEntries int, saveInterval time.Duration) *Persistent[K, V] {
+	return &Persistent[K, V]{
+		path:         path,
+		maxEntries:   maxEntries,
+		saveInterval: saveInterval,
+		entries:      map[K]V{},
+		lastSave:     time.Now(),
+	}
+}
+
+func (c *Persistent[K, V]) Get(key K) (V, bool) {
+	c.mtx.Lock()
+	defer c.mtx.Unlock()
+
+	v, ok := c.entries[key]
+	return v, ok
+}
+
+// Add adds a value to the cache. It returns true if the cache should be
+// saved.
+func (c *Persistent[K, V]) Add(key K, value V) bool {
+	c.mtx.Lock()
+	defer c.mtx.Unlock()
+
+	if _, ok := c.entries[key]; !ok && len(c.entries) >= c.maxEntries {
+		// Make room by dropping an arbitrary entry, the cache is sized so
+		// this is very unlikely to happen.
+		for k := range c.entries {
+			delete(c.entries, k)
+			break
+		}
+	}
+	c.entries[key] = value
+	c.dirty = true
+
+	return c.path != "" && time.Since(c.lastSave) >= c.saveInterval
+}
+
+// Load reads the previously persisted entries. A missing file is not an
+// error.
+func (c *Persistent[K, V]) Load() error {
+	if c.path == "" {
+		return nil
+	}
+
+	b, err := os.ReadFile(c.path)
+	if err != nil {
+		if errors.Is(err, os.ErrNotExist) {
+			return nil
+		}
+		return fmt.Errorf("read cache: %w", err)
+	}
+
+	var entries []persistentEntry[K, V]
+	if err := json.Unmarshal(b, &entries); err != nil {
+		return fmt.Errorf("decode cache: %w", err)
+	}
+
+	c.mtx.Lock()
+	defer c.mtx.Unlock()
+
+	for _, e := range entries {
+		if len(c.entries) >= c.maxEntries {
+			break
+		}
+		c.entries[e.Key] = e.Value
+	}
+	return nil
+}
+
+// Save atomically writes the entries to disk, if any were added since the
+// last time.
+func (c *Persistent[K, V]) Save() error {
+	if c.path == "" {
+		return nil
+	}
+
+	c.saveMtx.Lock()
+	defer c.saveMtx.Unlock()
+
+	c.mtx.Lock()
+	if !c.dirty {
+		c.mtx.Unlock()
+		return nil
+	}
+	entries := make([]persistentEntry[K, V], 0, len(c.entries))
+	for k, v := range c.entries {
+		entries = append(entries, persistentEntry[K, V]{Key: k, Value: v})
+	}
+	c.dirty = false
+	c.lastSave = time.Now()
+	c.mtx.Unlock()
+
+	if err := writeJSONFile(c.path, entries); err != nil {
+		// Try again the next time.
+		c.mtx.Lock()
+		c.dirty = true
+		c.mtx.Unlock()
+		return err
+	}
+	return nil
+}
+
+func writeJSONFile(path string, v any) error {
+	b, err := json.Marshal(v)
+	if err != nil {
+		return fmt.Errorf("encode cache: %w", err)
+	}
+
+	if err := os.MkdirAll(filepath.Dir(path), 0o755); err != nil {
+		return fmt.Errorf("create cache directory: %w", err)
+	}
+
+	if err := fsutil.WriteFileAtomic(path, b, 0o644); err != nil {
+		return fmt.Errorf("write cache: %w", err)
+	}
+	return nil
+}
@@ -0,0 +1,81 @@
+// Copyright 2022-2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+package cache
+
+import (
+	"path/filepath"
+	"testing"
+	"time"
+
+	"github.com/stretchr/testify/require"
+)
+
+type testFileID struct {
+	Dev   uint64
+	Inode uint64
+}
+
+func TestPersistentCache(t *testing.T) {
+	path := filepath.Join(t.TempDir(), "cache.json")
+
+	c := NewPersistentCache[testFileID, string](path, 10, time.Minute)
+	require.NoError(t, c.Load())
+
+	// Not saved until the interval has passed since the cache was created.
+	require.False(t, c.Add(testFileID{Dev: 1, Inode: 2}, "abc"))
+	require.NoError(t, c.Save())
+
+	loaded := NewPersistentCache[testFileID, string](path, 10, time.Minute)
+	require.NoError(t, loaded.Load())
+	v, ok := loaded.Get(testFileID{Dev: 1, Inode: 2})
+	require.True(t, ok)
+	require.Equal(t, "abc", v)
+
+	_, ok = loaded.Get(testFileID{Dev: 1, Inode: 3})
+	require.False(t, ok)
+}
+
+func TestPersistentCacheSaveInterval(t *testing.T) {
+	c := NewPersistentCache[int, int](filepath.Join(t.TempDir(), "cache.json"), 10, 0)
+	require.True(t, c.Add(1, 1))
+	require.NoError(t, c.Save())
+}
+
+func TestPersistentCacheNotPersisted(t *testing.T) {
+	c := NewPersistentCache[int, int]("", 10, 0)
+	require.NoError(t, c.Load())
+	require.False(t, c.Add(1, 1))
+	require.NoError(t, c.Save())
+
+	v, ok := c.Get(1)
+	require.True(t, ok)
+	require.Equal(t, 1, v)
+}
+
+func TestPersistentCacheMaxEntries(t *testing.T) {
+	c := NewPersistentCache[int, int]("", 2, time.Minute)
+	c.Add(1, 1)
+	c.Add(2, 2)
+	// Replacing an existing entry doesn't evict anything.
+	c.Add(2, 3)
+	_, ok1 := c.Get(1)
+	_, ok2 := c.Get(2)
+	require.True(t, ok1 && ok2)
+
+	c.Add(3, 3)
+	_, ok3 := c.Get(3)
+	require.True(t, ok3)
+	require.Len(t, c.entries, 2)
+}
@@ -13,8 +13,57 @@
 
 package cpuinfo
 
-import "runtime"
+import (
+	"fmt"
+	"os"
+	"runtime"
+	"strconv"
+	"strings"
+	"sync"
+)
+
+const possibleCPUsPath = "/sys/devices/system/cpu/possible"
 
 func NumCPU() int {
 	return runtime.NumCPU()
 }
+
+var numPossibleCPU = sync.OnceValue(func() int {
+	b, err := os.ReadFile(possibleCPUsPath)
+	if err != nil {
+		return runtime.NumCPU()
+	}
+	n, err := parseCPUList(strings.TrimSpace(string(b)))
+	if err != nil || n == 0 {
+		return runtime.NumCPU()
+	}
+	return n
+})
+
+// NumPossibleCPU returns the number of CPUs the kernel could bring online.
+// This is what the kernel uses to size per-CPU BPF maps, and CPU IDs, as
+// returned by `bpf_get_smp_processor_id()`, are always smaller than it.
+func NumPossibleCPU() int {
+	return numPossibleCPU()
+}
+
+// parseCPUList parses a CPU list such as "0-3,8-11" and returns the highest
+// CPU ID plus one.
+func parseCPUList(list string) (int, error) {
+	highest := -1
+	for _, r := range strings.Split(list, ",") {
+		if r == "" {
+			continue
+		}
+		end := r
+		if _, after, ok := strings.Cut(r, "-"); ok {
+			end = after
+		}
+		n, err := strconv.Atoi(end)
+		if err != nil {
+			return 0, fmt.Errorf("parse cpu list %q: %w", list, err)
+		}
+		highest = max(highest, n)
+	}
+	return highest + 1, nil
+}
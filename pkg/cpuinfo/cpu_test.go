@@ -0,0 +1,39 @@
+// Copyright 2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package cpuinfo
+
+import (
+	"testing"
+
+	"github.com/stretchr/testify/require"
+)
+
+func TestParseCPUList(t *testing.T) {
+	for list, want := range map[string]int{
+		"0":          1,
+		"0-3":        4,
+		"0-255":      256,
+		"0-3,8-11":   12,
+		"0,2,4,383":  384,
+		"0-191,192-": 0,
+	} {
+		got, err := parseCPUList(list)
+		if want == 0 {
+			require.Error(t, err, list)
+			continue
+		}
+		require.NoError(t, err, list)
+		require.Equal(t, want, got, list)
+	}
+}
@@ -24,6 +24,7 @@ import (
 	"net/http"
 	"net/http/httptrace"
 	"os"
+	runtimemetrics "runtime/metrics"
 	"time"
 
 	"github.com/go-kit/log"
@@ -347,10 +348,22 @@ func (di *Manager) extract(ctx context.Context, buildID string, src *objectfile.
 	}
 	span.AddEvent("acquired reader for objectfile")
 
+	allocsBefore := heapAllocatedBytes()
 	if err := di.Extractor.OnlyKeepDebug(ctx, f, r); err != nil {
 		err = fmt.Errorf("failed to extract debug information: %w", err)
 		return nil, err
 	}
+	// Sections are streamed, so the memory used by the extraction stays
+	// bounded regardless of their size. Everything it allocates is an upper
+	// bound of its peak, other goroutines' allocations included.
+	di.metrics.extractAllocs.Observe(float64(heapAllocatedBytes() - allocsBefore))
+
+	size, err := f.Seek(0, io.SeekEnd)
+	if err != nil {
+		return nil, fmt.Errorf("failed to seek to the end of the file: %w", err)
+	}
+	di.metrics.extractedBytes.Add(float64(size))
+	di.metrics.extractedSize.Observe(float64(size))
 
 	if _, err := f.Seek(0, io.SeekStart); err != nil {
 		return nil, fmt.Errorf("failed to seek to the beginning of the file: %w", err)
@@ -364,6 +377,16 @@ func (di *Manager) extract(ctx context.Context, buildID string, src *objectfile.
 	return debuginfoFile, nil
 }
 
+// heapAllocatedBytes returns the cumulative bytes allocated on the heap.
+func heapAllocatedBytes() uint64 {
+	sample := []runtimemetrics.Sample{{Name: "/gc/heap/allocs:bytes"}}
+	runtimemetrics.Read(sample)
+	if sample[0].Value.Kind() != runtimemetrics.KindUint64 {
+		return 0
+	}
+	return sample[0].Value.Uint64()
+}
+
 func (di *Manager) Upload(ctx context.Context, dbg *objectfile.ObjectFile) (err error) { //nolint:nonamedreturns
 	di.metrics.uploadRequests.Inc()
 
@@ -34,6 +34,9 @@ type metrics struct {
 
 	extracted       *prometheus.CounterVec
 	extractDuration prometheus.Histogram
+	extractedBytes  prometheus.Counter
+	extractedSize   prometheus.Histogram
+	extractAllocs   prometheus.Histogram
 
 	found        *prometheus.CounterVec
 	findDuration prometheus.Histogram
@@ -66,6 +69,20 @@ func newMetrics(reg prometheus.Registerer) *metrics {
 			Help:                        "Total time spent extracting debuginfo.",
 			NativeHistogramBucketFactor: 1.1,
 		}),
+		extractedBytes: promauto.With(reg).NewCounter(prometheus.CounterOpts{
+			Name: "parca_agent_debuginfo_extracted_bytes_total",
+			Help: "Total number of bytes of debuginfo written while extracting.",
+		}),
+		extractedSize: promauto.With(reg).NewHistogram(prometheus.HistogramOpts{
+			Name:                        "parca_agent_debuginfo_extracted_size_bytes",
+			Help:                        "Size of the extracted debuginfo files.",
+			NativeHistogramBucketFactor: 1.1,
+		}),
+		extractAllocs: promauto.With(reg).NewHistogram(prometheus.HistogramOpts{
+			Name:                        "parca_agent_debuginfo_extract_allocated_bytes",
+			Help:                        "Bytes allocated on the heap while extracting debuginfo, an upper bound of the peak memory used by an extraction.",
+			NativeHistogramBucketFactor: 1.1,
+		}),
 		found: promauto.With(reg).NewCounterVec(prometheus.CounterOpts{
 			Name: "parca_agent_debuginfo_found_total",
 			Help: "Total number of debug information found.",
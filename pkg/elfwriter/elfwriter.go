@@ -25,7 +25,6 @@
 package elfwriter
 
 import (
-	"bytes"
 	"debug/elf"
 	"encoding/binary"
 	"errors"
@@ -614,20 +613,13 @@ func (w *Writer) writeSections() {
 			if sr != nil {
 				if w.compressDWARFSections && isDWARF(sec) && !isCompressed(sec) {
 					// Compress DWARF sections.
-					cw := &countingWriter{w: io.Discard}
-					tr := io.TeeReader(sr, cw)
-
-					buf := bytes.NewBuffer(nil)
-					bufWritten, err := copyCompressed(buf, tr)
-					if err != nil && w.err == nil {
-						w.err = err
-					}
-
+					// The data is compressed straight into the destination, so sections
+					// aren't held in memory, and the uncompressed size is patched in the
+					// compression header once it's known.
 					ch := compressionHeader{
 						byteOrder: w.fhdr.ByteOrder,
 						class:     w.fhdr.Class,
 						Type:      uint32(elf.COMPRESS_ZLIB),
-						Size:      uint64(cw.written), // read bytes from the section reader.
 						Addralign: sec.SectionHeader.Addralign,
 					}
 					hdrWritten, err := ch.WriteTo(w.dst)
@@ -635,20 +627,23 @@ func (w *Writer) writeSections() {
 						w.err = err
 					}
 
-					dataWritten, err := buf.WriteTo(w.dst)
+					read, dataWritten, err := copyCompressed(w.dst, sr)
 					if err != nil && w.err == nil {
 						w.err = err
 					}
 
-					if bufWritten != dataWritten {
-						w.err = fmt.Errorf("section %s: expected %d bytes, wrote %d bytes", sec.Name, bufWritten, dataWritten)
+					ch.Size = uint64(read) // read bytes from the section reader.
+					w.seek(entryOffset, io.SeekStart)
+					if _, err := ch.WriteTo(w.dst); err != nil && w.err == nil {
+						w.err = err
 					}
+					w.seek(0, io.SeekEnd)
 
 					written = hdrWritten + dataWritten
 					sec.Flags |= elf.SHF_COMPRESSED
 				} else {
 					// Write as is.
-					written, err = io.Copy(w.dst, sr)
+					written, err = copySectionData(w.dst, sr)
 					if err != nil && w.err == nil {
 						w.err = err
 					}
@@ -15,7 +15,9 @@
 package elfwriter
 
 import (
+	"bytes"
 	"debug/elf"
+	"io"
 	"os"
 	"path/filepath"
 	"testing"
@@ -407,3 +409,95 @@ func TestExtractingWithCompression(t *testing.T) {
 		})
 	}
 }
+
+func TestExtractingToFile(t *testing.T) {
+	for _, tc := range []struct {
+		name    string
+		extract func(dst io.WriteSeeker, src io.ReaderAt, opts ...Option) error
+		opts    []Option
+	}{
+		{name: "only keep debug", extract: onlyKeepDebug},
+		{name: "only keep debug compressed", extract: onlyKeepDebug, opts: []Option{WithCompressDWARFSections()}},
+		{name: "strip debug", extract: stripDebug},
+		{name: "strip debug compressed", extract: stripDebug, opts: []Option{WithCompressDWARFSections()}},
+	} {
+		t.Run(tc.name, func(t *testing.T) {
+			f, err := os.Open("./testdata/basic-cpp-dwarf")
+			require.NoError(t, err)
+			t.Cleanup(func() {
+				f.Close()
+			})
+
+			// Sections are copied by the kernel when both the source and the
+			// destination are files, the result should be the same as when
+			// writing to memory.
+			buf := flexbuf.New()
+			require.NoError(t, tc.extract(buf, f, tc.opts...))
+
+			output, err := os.CreateTemp("", "test-output.*")
+			require.NoError(t, err)
+			t.Cleanup(func() {
+				output.Close()
+				os.Remove(output.Name())
+			})
+			require.NoError(t, tc.extract(output, f, tc.opts...))
+
+			buf.SeekStart()
+			want, err := io.ReadAll(buf)
+			require.NoError(t, err)
+			data, err := os.ReadFile(output.Name())
+			require.NoError(t, err)
+			require.Equal(t, want, data)
+
+			ef, err := elf.NewFile(bytes.NewReader(data))
+			require.NoError(t, err)
+			_, err = ef.DWARF()
+			require.NoError(t, err)
+
+			// Every section has the same data as in the source.
+			og, err := elf.NewFile(f)
+			require.NoError(t, err)
+			for _, sec := range ef.Sections {
+				if sec.Type == elf.SHT_NOBITS || sec.Type == elf.SHT_NULL || sec.Flags&elf.SHF_COMPRESSED != 0 {
+					continue
+				}
+				ogSec := og.Section(sec.Name)
+				if ogSec == nil || ogSec.Type == elf.SHT_NOBITS {
+					continue
+				}
+				got, err := sec.Data()
+				require.NoError(t, err)
+				exp, err := ogSec.Data()
+				require.NoError(t, err)
+				require.Equal(t, exp, got, sec.Name)
+			}
+		})
+	}
+}
+
+func TestFileRange(t *testing.T) {
+	f, err := os.Open("./testdata/basic-cpp-dwarf")
+	require.NoError(t, err)
+	t.Cleanup(func() {
+		f.Close()
+	})
+
+	ef, err := elf.NewFile(f)
+	require.NoError(t, err)
+	sec := ef.Section(".debug_info")
+	require.NotNil(t, sec)
+
+	// elf.Section.Open() returns an unbounded reader on top of the one of
+	// the section, the range should still end with the section.
+	r := sec.Open()
+	_, err = r.Seek(16, io.SeekStart)
+	require.NoError(t, err)
+	src, off, n, ok := fileRange(r)
+	require.True(t, ok)
+	require.Equal(t, f, src)
+	require.Equal(t, int64(sec.Offset)+16, off)
+	require.Equal(t, int64(sec.FileSize)-16, n)
+
+	_, _, _, ok = fileRange(bytes.NewReader(nil))
+	require.False(t, ok)
+}
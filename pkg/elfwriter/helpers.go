@@ -20,9 +20,11 @@ import (
 	"errors"
 	"fmt"
 	"io"
+	"os"
 	"strings"
 
 	"github.com/klauspost/compress/zlib"
+	"golang.org/x/sys/unix"
 )
 
 type zeroReader struct{}
@@ -133,44 +135,94 @@ func (hdr compressionHeader) WriteTo(w io.Writer) (int64, error) {
 	return int64(written), nil
 }
 
-func copyCompressed(w io.Writer, r io.Reader) (int64, error) {
+// copyCompressed compresses the data of the reader into the writer, and
+// returns the number of bytes read and written.
+func copyCompressed(w io.Writer, r io.Reader) (int64, int64, error) {
 	if r == nil {
-		return 0, errors.New("reader is nil")
+		return 0, 0, errors.New("reader is nil")
 	}
 
-	pr, pw := io.Pipe()
-
-	// write in writer end of pipe.
-	var wErr error
-	go func() {
-		defer pw.Close()
-		defer func() {
-			if r := recover(); r != nil {
-				err, ok := r.(error)
-				if ok {
-					wErr = fmt.Errorf("panic occurred: %w", err)
-				}
-			}
-		}()
-		_, wErr = io.Copy(pw, r)
-	}()
-
-	// read from reader end of pipe.
-	defer pr.Close()
-
 	cw := &countingWriter{w: w}
 	zw := zlib.NewWriter(cw)
-	_, err := io.Copy(zw, pr)
+	read, err := io.Copy(zw, r)
 	if err != nil {
 		zw.Close()
-		return 0, err
+		return 0, 0, err
+	}
+	if err := zw.Close(); err != nil {
+		return 0, 0, err
+	}
+	return read, cw.written, nil
+}
+
+// copySectionData copies the data of a section to the writer. If both the section
+// and the writer are files, the data is copied by the kernel, with
+// copy_file_range(2), without going through user space.
+func copySectionData(w io.Writer, r io.Reader) (int64, error) {
+	if dst, ok := w.(*os.File); ok {
+		if src, off, n, ok := fileRange(r); ok {
+			written, err := copyFileRange(dst, src, off, n)
+			// Not every file system supports copy_file_range(2), e.g. across
+			// file systems on older kernels, nothing was copied in that case.
+			if err == nil || written > 0 {
+				return written, err
+			}
+		}
+	}
+	return io.Copy(w, r)
+}
+
+// fileRange returns the file, and the range of it, the remaining data of the
+// reader is read from, if any.
+func fileRange(r io.Reader) (*os.File, int64, int64, bool) {
+	sr, ok := r.(*io.SectionReader)
+	if !ok {
+		return nil, 0, 0, false
+	}
+	pos, err := sr.Seek(0, io.SeekCurrent)
+	if err != nil {
+		return nil, 0, 0, false
+	}
+	outer, off, n := sr.Outer()
+	off += pos
+	n -= pos
+	for {
+		switch o := outer.(type) {
+		case *os.File:
+			return o, off, n, true
+		case *io.SectionReader:
+			// The range is relative to, and bounded by, the range of the
+			// outer reader, e.g. elf.Section.Open() returns a reader of
+			// 1<<63-1 bytes on top of the section's own reader.
+			inner, base, size := o.Outer()
+			n = max(0, min(n, size-off))
+			outer, off = inner, base+off
+		default:
+			return nil, 0, 0, false
+		}
 	}
-	zw.Close()
+}
+
+// maxCopyFileRangeChunk bounds the bytes copied with one copy_file_range(2)
+// call, so the copy can be interrupted.
+const maxCopyFileRangeChunk = 1 << 30
 
-	if wErr != nil {
-		return 0, wErr
+// copyFileRange copies n bytes of src from off to the current offset of dst.
+func copyFileRange(dst, src *os.File, off, n int64) (int64, error) {
+	var written int64
+	for written < n {
+		roff := off + written
+		m, err := unix.CopyFileRange(int(src.Fd()), &roff, int(dst.Fd()), nil, int(min(n-written, maxCopyFileRangeChunk)), 0)
+		if err != nil {
+			return written, err
+		}
+		if m == 0 {
+			// Reached the end of src.
+			break
+		}
+		written += int64(m)
 	}
-	return cw.written, nil
+	return written, nil
 }
 
 func isDWARF(s *elf.Section) bool {
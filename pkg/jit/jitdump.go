@@ -493,3 +493,118 @@ func LoadJITDump(logger log.Logger, rd io.Reader, dump *JITDump) error {
 
 	return nil
 }
+
+// jrCodeLoadFixedSize is the size of the JRCodeLoad fixed-sized fields.
+const jrCodeLoadFixedSize int = jrPrefixSize + 40
+
+// CodeLoadReader reads the JITCodeLoad records of a jitdump file that is
+// being appended to, only reading the records written since the last read.
+type CodeLoadReader struct {
+	logger     log.Logger
+	endianness binary.ByteOrder
+
+	// Offset of the first record that wasn't read yet.
+	offset int64
+	closed bool
+}
+
+// NewCodeLoadReader returns a reader starting at the beginning of a jitdump
+// file.
+func NewCodeLoadReader(logger log.Logger) *CodeLoadReader {
+	return &CodeLoadReader{logger: logger}
+}
+
+// Offset returns how much of the file was read.
+func (r *CodeLoadReader) Offset() int64 {
+	return r.offset
+}
+
+// Read calls fn for each JITCodeLoad record that was completely written to
+// the first size bytes of f since the last read. A record that is still being
+// written is read the next time.
+func (r *CodeLoadReader) Read(f io.ReaderAt, size int64, fn func(name string, codeAddr, codeSize uint64) error) error {
+	if r.endianness == nil {
+		if err := r.readHeader(f, size); err != nil {
+			return err
+		}
+	}
+
+	prefix := make([]byte, jrPrefixSize)
+	var fixed []byte
+	for !r.closed && r.offset+int64(jrPrefixSize) <= size {
+		if _, err := f.ReadAt(prefix, r.offset); err != nil {
+			return fmt.Errorf("failed to read JIT Record Prefix: %w", isUnexpectedIOError(err))
+		}
+		id := JITRecordType(r.endianness.Uint32(prefix[0:4]))
+		totalSize := int64(r.endianness.Uint32(prefix[4:8]))
+		if totalSize < int64(jrPrefixSize) {
+			return fmt.Errorf("invalid JIT record size: %d", totalSize)
+		}
+		if r.offset+totalSize > size {
+			// Not completely written yet.
+			return nil
+		}
+
+		switch id {
+		case JITCodeLoad:
+			if totalSize < int64(jrCodeLoadFixedSize) {
+				return fmt.Errorf("invalid JIT Code Load size: %d", totalSize)
+			}
+			if fixed == nil {
+				fixed = make([]byte, jrCodeLoadFixedSize-jrPrefixSize)
+			}
+			if _, err := f.ReadAt(fixed, r.offset+int64(jrPrefixSize)); err != nil {
+				return fmt.Errorf("failed to read JIT Code Load: %w", isUnexpectedIOError(err))
+			}
+			codeAddr := r.endianness.Uint64(fixed[16:24])
+			codeSize := r.endianness.Uint64(fixed[24:32])
+
+			// The name is followed by its null termination and the code.
+			nameLen := totalSize - int64(jrCodeLoadFixedSize) - int64(codeSize) - 1
+			if codeSize > uint64(totalSize) || nameLen < 0 {
+				return fmt.Errorf("invalid JIT Code Load size: %d", totalSize)
+			}
+			name := make([]byte, nameLen)
+			if _, err := f.ReadAt(name, r.offset+int64(jrCodeLoadFixedSize)); err != nil {
+				return fmt.Errorf("failed to read JIT Code Load name: %w", isUnexpectedIOError(err))
+			}
+			if err := fn(string(name), codeAddr, codeSize); err != nil {
+				return err
+			}
+		case JITCodeClose:
+			level.Debug(r.logger).Log("msg", "reached JIT Code Close record")
+			r.closed = true
+		}
+		r.offset += totalSize
+	}
+	return nil
+}
+
+func (r *CodeLoadReader) readHeader(f io.ReaderAt, size int64) error {
+	// The magic, version and total size.
+	b := make([]byte, 12)
+	if size < int64(len(b)) {
+		return fmt.Errorf("failed to read JIT dump header: %w", io.ErrUnexpectedEOF)
+	}
+	if _, err := f.ReadAt(b, 0); err != nil {
+		return fmt.Errorf("failed to read JIT dump header: %w", isUnexpectedIOError(err))
+	}
+
+	switch {
+	case bytes.Equal(b[:4], []byte{'J', 'i', 'T', 'D'}):
+		r.endianness = binary.BigEndian
+	case bytes.Equal(b[:4], []byte{'D', 'T', 'i', 'J'}):
+		r.endianness = binary.LittleEndian
+	default:
+		return fmt.Errorf("%w: %#x", ErrWrongJITDumpMagic, b[:4])
+	}
+
+	if version := r.endianness.Uint32(b[4:8]); version > JITHeaderVersion {
+		r.endianness = nil
+		return fmt.Errorf("%w: %d (expected: %d)", ErrWrongJITDumpVersion, version, JITHeaderVersion)
+	}
+
+	// The header might be followed by optional fields.
+	r.offset = max(int64(r.endianness.Uint32(b[8:12])), 40)
+	return nil
+}
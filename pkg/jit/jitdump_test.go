@@ -15,6 +15,7 @@ package jit_test
 
 import (
 	"bytes"
+	"encoding/binary"
 	"encoding/json"
 	"fmt"
 	"io"
@@ -147,3 +148,79 @@ func BenchmarkLoadJITDump(b *testing.B) {
 		})
 	}
 }
+
+type codeLoad struct {
+	Name     string
+	CodeAddr uint64
+	CodeSize uint64
+}
+
+func readCodeLoads(t *testing.T, r *jit.CodeLoadReader, f io.ReaderAt, size int64) []codeLoad {
+	t.Helper()
+
+	var loads []codeLoad
+	err := r.Read(f, size, func(name string, codeAddr, codeSize uint64) error {
+		loads = append(loads, codeLoad{Name: name, CodeAddr: codeAddr, CodeSize: codeSize})
+		return nil
+	})
+	require.NoError(t, err)
+	return loads
+}
+
+func TestCodeLoadReader(t *testing.T) {
+	t.Parallel()
+
+	logger := log.NewNopLogger()
+
+	for _, tt := range getCases() {
+		tc := tt
+		t.Run(tc.runtime, func(t *testing.T) {
+			t.Parallel()
+
+			b, err := os.ReadFile(fmt.Sprintf("%s/%s.dump", testdataDir, tc.runtime))
+			require.NoError(t, err)
+
+			dump := &jit.JITDump{}
+			err = jit.LoadJITDump(logger, bytes.NewReader(b), dump)
+			require.ErrorIs(t, err, tc.err)
+
+			expected := make([]codeLoad, 0, len(dump.CodeLoads))
+			for _, cl := range dump.CodeLoads {
+				expected = append(expected, codeLoad{Name: cl.Name, CodeAddr: cl.CodeAddr, CodeSize: cl.CodeSize})
+			}
+
+			// Read in two steps, as if the second half wasn't written yet.
+			r := jit.NewCodeLoadReader(logger)
+			actual := readCodeLoads(t, r, bytes.NewReader(b), int64(len(b)/2))
+			actual = append(actual, readCodeLoads(t, r, bytes.NewReader(b), int64(len(b)))...)
+			require.Equal(t, expected, actual)
+		})
+	}
+}
+
+func TestCodeLoadReaderIncomplete(t *testing.T) {
+	t.Parallel()
+
+	var buf bytes.Buffer
+	le := binary.LittleEndian
+	// Header.
+	binary.Write(&buf, le, []uint32{0x4A695444, 1, 40, 62, 0, 1234})
+	binary.Write(&buf, le, []uint64{0, 0})
+	writeCodeLoad := func(name string, codeAddr uint64, code []byte) {
+		binary.Write(&buf, le, []uint32{uint32(jit.JITCodeLoad), uint32(56 + len(name) + 1 + len(code))})
+		binary.Write(&buf, le, []uint64{0})
+		binary.Write(&buf, le, []uint32{1234, 1234})
+		binary.Write(&buf, le, []uint64{codeAddr, codeAddr, uint64(len(code)), 0})
+		buf.WriteString(name)
+		buf.WriteByte(0)
+		buf.Write(code)
+	}
+	writeCodeLoad("foo", 0x1000, []byte{1, 2, 3, 4})
+	writeCodeLoad("bar", 0x2000, []byte{5, 6})
+
+	b := buf.Bytes()
+	r := jit.NewCodeLoadReader(log.NewNopLogger())
+	require.Equal(t, []codeLoad{{Name: "foo", CodeAddr: 0x1000, CodeSize: 4}}, readCodeLoads(t, r, bytes.NewReader(b), int64(len(b)-1)))
+	require.Equal(t, []codeLoad{{Name: "bar", CodeAddr: 0x2000, CodeSize: 2}}, readCodeLoads(t, r, bytes.NewReader(b), int64(len(b))))
+	require.Equal(t, int64(len(b)), r.Offset())
+}
@@ -19,6 +19,7 @@ import (
 	"io/fs"
 	"os"
 	"path"
+	"sort"
 	"strconv"
 	"sync"
 	"time"
@@ -28,6 +29,7 @@ import (
 	"github.com/go-kit/log/level"
 	"github.com/prometheus/client_golang/prometheus"
 
+	"github.com/parca-dev/parca-agent/pkg/cache"
 	"github.com/parca-dev/parca-agent/pkg/hash"
 	"github.com/parca-dev/parca-agent/pkg/symtab"
 )
@@ -40,9 +42,22 @@ type Ksym struct {
 	lastCacheInvalidation time.Time
 	updateDuration        time.Duration
 	mtx                   *sync.RWMutex
-	optimizedReader       *symtab.FileReader
+
+	// The symbols of the kernel image never change, only the ones of the
+	// modules and BPF programs are reloaded.
+	coreReader    *symtab.FileReader
+	modulesReader *symtab.FileReader
+	modulesPath   string
+	reloads       int
+
+	// Symbols of the addresses resolved in previous rounds, emptied when
+	// the symbols change.
+	symbols *cache.Cache[uint64, string]
 }
 
+// Kernel stacks mostly go through the same few thousand functions.
+const maxCachedSymbols = 100_000
+
 type realfs struct{}
 
 func (f *realfs) Open(name string) (fs.File, error) { return os.Open(name) }
@@ -58,6 +73,10 @@ func NewKsym(logger log.Logger, reg prometheus.Registerer, tempDir string, f ...
 		fs:             fs,
 		updateDuration: time.Minute * 5,
 		mtx:            &sync.RWMutex{},
+		symbols: cache.NewLRUCache[uint64, string](
+			prometheus.WrapRegistererWith(prometheus.Labels{"cache": "ksym"}, reg),
+			maxCachedSymbols,
+		),
 	}
 }
 
@@ -96,6 +115,12 @@ func (c *Ksym) Resolve(addrs map[uint64]struct{}) (map[uint64]string, error) {
 	toResolve := []uint64{}
 
 	for addr := range addrs {
+		if symbol, ok := c.symbols.Get(addr); ok {
+			if symbol != "" {
+				res[addr] = symbol
+			}
+			continue
+		}
 		toResolve = append(toResolve, addr)
 	}
 
@@ -103,9 +128,21 @@ func (c *Ksym) Resolve(addrs map[uint64]struct{}) (map[uint64]string, error) {
 		return res, nil
 	}
 
-	syms := c.resolveKsyms(toResolve)
+	sort.Slice(toResolve, func(i, j int) bool { return toResolve[i] < toResolve[j] })
+
+	// Held until the results are cached, so they can't outlive a reload.
+	c.mtx.RLock()
+	defer c.mtx.RUnlock()
+
+	syms, err := c.resolveKsyms(toResolve)
+	if err != nil {
+		return nil, err
+	}
 
 	for i := range toResolve {
+		// Addresses without a symbol are cached too, they are as likely to
+		// show up again.
+		c.symbols.Add(toResolve[i], syms[i])
 		if syms[i] != "" {
 			res[toResolve[i]] = syms[i]
 		}
@@ -121,41 +158,93 @@ func unsafeString(b []byte) string {
 	return *((*string)(unsafe.Pointer(&b)))
 }
 
+// reload loads the kernel symbols, only reading the ones of the modules if
+// the ones of the kernel image were already loaded.
 func (c *Ksym) reload() error {
-	path := path.Join(c.tempDir, "parca-agent-kernel-symbols")
+	c.reloads++
+	modulesPath := path.Join(c.tempDir, fmt.Sprintf("parca-agent-kernel-module-symbols-%d", c.reloads))
 
-	// Generate optimized file.
-	writer, err := symtab.NewWriter(path, 100)
+	// Generate optimized files.
+	modulesWriter, err := symtab.NewWriter(modulesPath, 100)
 	if err != nil {
 		return fmt.Errorf("newWriter: %w", err)
 	}
+	ok := false
+	defer func() {
+		if !ok {
+			os.Remove(modulesPath)
+		}
+	}()
+
+	var (
+		corePath   string
+		coreWriter *symtab.FileWriter
+	)
+	if c.coreReader == nil {
+		corePath = path.Join(c.tempDir, "parca-agent-kernel-symbols")
+		coreWriter, err = symtab.NewWriter(corePath, 100)
+		if err != nil {
+			modulesWriter.Close()
+			return fmt.Errorf("newWriter: %w", err)
+		}
+	}
 
 	err = c.loadKsyms(
-		func(addr uint64, symbol string) {
-			_ = writer.AddSymbol(symbol, addr)
+		coreWriter == nil,
+		func(addr uint64, symbol string, module bool) {
+			if module {
+				_ = modulesWriter.AddSymbol(symbol, addr)
+			} else {
+				_ = coreWriter.AddSymbol(symbol, addr)
+			}
 		},
 	)
 	if err != nil {
+		modulesWriter.Close()
+		if coreWriter != nil {
+			coreWriter.Close()
+		}
 		return fmt.Errorf("loadKsyms: %w", err)
 	}
 
-	err = writer.Write()
-	if err != nil {
-		return fmt.Errorf("writer.Write: %w", err)
+	if coreWriter != nil {
+		if err := coreWriter.Write(); err != nil {
+			modulesWriter.Close()
+			return fmt.Errorf("writer.Write: %w", err)
+		}
+		reader, err := symtab.NewReader(corePath)
+		if err != nil {
+			modulesWriter.Close()
+			return fmt.Errorf("newReader: %w", err)
+		}
+		c.coreReader = reader
 	}
 
-	// Set up reader.
-	reader, err := symtab.NewReader(path)
+	if err := modulesWriter.Write(); err != nil {
+		return fmt.Errorf("writer.Write: %w", err)
+	}
+	reader, err := symtab.NewReader(modulesPath)
 	if err != nil {
 		return fmt.Errorf("newReader: %w", err)
 	}
-	c.optimizedReader = reader
+
+	if c.modulesReader != nil {
+		if err := c.modulesReader.Close(); err != nil {
+			level.Warn(c.logger).Log("msg", "failed to close kernel module symbols", "err", err)
+		}
+		os.Remove(c.modulesPath)
+	}
+	c.modulesReader = reader
+	c.modulesPath = modulesPath
+	c.symbols.Purge()
+	ok = true
 	return nil
 }
 
 // loadKsyms reads /proc/kallsyms and passed the address and symbol name
-// to the given callback.
-func (c *Ksym) loadKsyms(callback func(uint64, string)) error {
+// to the given callback, along with whether it belongs to a module or BPF
+// program rather than the kernel image.
+func (c *Ksym) loadKsyms(modulesOnly bool, callback func(uint64, string, bool)) error {
 	fd, err := c.fs.Open("/proc/kallsyms")
 	if err != nil {
 		return err
@@ -167,6 +256,12 @@ func (c *Ksym) loadKsyms(callback func(uint64, string)) error {
 	for s.Scan() {
 		line := s.Bytes()
 
+		// Their symbols are followed by the module name in brackets.
+		module := len(line) > 0 && line[len(line)-1] == ']'
+		if modulesOnly && !module {
+			continue
+		}
+
 		address, err := strconv.ParseUint(unsafeString(line[:16]), 16, 64)
 		if err != nil {
 			level.Debug(c.logger).Log("msg", "failed to parse kallsym address")
@@ -200,7 +295,7 @@ func (c *Ksym) loadKsyms(callback func(uint64, string)) error {
 		}
 
 		symbol := string(line[19:endIndex])
-		callback(address, symbol)
+		callback(address, symbol, module)
 	}
 	if err := s.Err(); err != nil {
 		return s.Err()
@@ -209,20 +304,52 @@ func (c *Ksym) loadKsyms(callback func(uint64, string)) error {
 	return nil
 }
 
-// resolveKsyms returns the function names for the requested addresses.
-func (c *Ksym) resolveKsyms(addrs []uint64) []string {
-	result := make([]string, 0, len(addrs))
+// resolveKsyms returns the function names for the requested addresses, which
+// must be sorted, in a single pass over the symbols.
+func (c *Ksym) resolveKsyms(addrs []uint64) ([]string, error) {
+	result := make([]string, len(addrs))
+	if c.coreReader == nil {
+		return result, nil
+	}
 
-	for _, addr := range addrs {
-		symbol, err := c.optimizedReader.Symbolize(addr)
-		if err != nil {
-			result = append(result, "")
-		} else {
-			result = append(result, symbol)
+	coreEntries := make([]symtab.Entry, len(addrs))
+	if err := c.coreReader.SymbolizeSorted(addrs, coreEntries); err != nil {
+		return nil, fmt.Errorf("symbolize kernel symbols: %w", err)
+	}
+	moduleEntries := make([]symtab.Entry, len(addrs))
+	if c.modulesReader != nil {
+		if err := c.modulesReader.SymbolizeSorted(addrs, moduleEntries); err != nil {
+			return nil, fmt.Errorf("symbolize kernel module symbols: %w", err)
+		}
+	}
+
+	// Consecutive addresses often belong to the same function.
+	var (
+		lastReader *symtab.FileReader
+		lastEntry  symtab.Entry
+		lastName   string
+	)
+	for i := range addrs {
+		// The closest symbol of either, as if they were a single table.
+		reader, entry := c.coreReader, coreEntries[i]
+		if m := moduleEntries[i]; m.Len != 0 && (entry.Len == 0 || m.Address >= entry.Address) {
+			reader, entry = c.modulesReader, m
+		}
+		if entry.Len == 0 {
+			continue
+		}
+
+		if reader != lastReader || entry != lastEntry {
+			name, err := reader.Name(entry)
+			if err != nil {
+				continue
+			}
+			lastReader, lastEntry, lastName = reader, entry, name
 		}
+		result[i] = lastName
 	}
 
-	return result
+	return result, nil
 }
 
 func (c *Ksym) kallsymsHash() (uint64, error) {
@@ -16,7 +16,9 @@ package ksym
 import (
 	"bytes"
 	"errors"
+	"io/fs"
 	"testing"
+	"time"
 
 	"github.com/go-kit/log"
 	"github.com/prometheus/client_golang/prometheus"
@@ -239,6 +241,61 @@ ffffffff8f6d15c4 a not_in_order
 	}, syms)
 }
 
+func TestKsymModules(t *testing.T) {
+	kallsyms := func(modules string) fs.FS {
+		return testutil.NewFakeFS(map[string][]byte{
+			"/proc/kallsyms": []byte(`ffffffff81000000 T _stext
+ffffffff81000100 T do_syscall_64
+ffffffff82000000 T _etext
+` + modules),
+		})
+	}
+	c := NewKsym(log.NewNopLogger(), prometheus.NewRegistry(), t.TempDir(),
+		kallsyms("ffffffffc0a00000 t nf_hook\t[nf_tables]\n"))
+
+	syms, err := c.Resolve(map[uint64]struct{}{
+		0xffffffff81000104: {},
+		0xffffffffc0a00010: {},
+		0xffffffffc0b00010: {},
+	})
+	require.NoError(t, err)
+	require.Equal(t, map[uint64]string{
+		0xffffffff81000104: "do_syscall_64",
+		0xffffffffc0a00010: "nf_hook\t[nf_tables]",
+		0xffffffffc0b00010: "nf_hook\t[nf_tables]",
+	}, syms)
+
+	// A module was loaded, only the module symbols are read again.
+	coreReader := c.coreReader
+	c.fs = kallsyms("ffffffffc0a00000 t nf_hook\t[nf_tables]\nffffffffc0b00000 t bpf_prog_1\t[bpf]\n")
+	c.lastCacheInvalidation = time.Time{}
+
+	syms, err = c.Resolve(map[uint64]struct{}{
+		0xffffffff81000104: {},
+		0xffffffffc0a00010: {},
+		0xffffffffc0b00010: {},
+	})
+	require.NoError(t, err)
+	require.Equal(t, map[uint64]string{
+		0xffffffff81000104: "do_syscall_64",
+		0xffffffffc0a00010: "nf_hook\t[nf_tables]",
+		0xffffffffc0b00010: "bpf_prog_1\t[bpf]",
+	}, syms)
+	require.Same(t, coreReader, c.coreReader)
+
+	// All modules were unloaded.
+	c.fs = kallsyms("")
+	c.lastCacheInvalidation = time.Time{}
+
+	syms, err = c.Resolve(map[uint64]struct{}{
+		0xffffffffc0a00010: {},
+	})
+	require.NoError(t, err)
+	require.Equal(t, map[uint64]string{
+		0xffffffffc0a00010: "_etext",
+	}, syms)
+}
+
 var errLoadKsyms error
 
 func BenchmarkLoadKernelSymbols(b *testing.B) {
@@ -252,7 +309,8 @@ func BenchmarkLoadKernelSymbols(b *testing.B) {
 
 	for n := 0; n < b.N; n++ {
 		errLoadKsyms = c.loadKsyms(
-			func(addr uint64, symbol string) {
+			false,
+			func(addr uint64, symbol string, module bool) {
 			},
 		)
 	}
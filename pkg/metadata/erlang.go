@@ -25,10 +25,11 @@ import (
 	"github.com/prometheus/procfs"
 
 	"github.com/parca-dev/parca-agent/pkg/cache"
+	"github.com/parca-dev/parca-agent/pkg/objectfile"
 	"github.com/parca-dev/parca-agent/pkg/runtime/erlang"
 )
 
-func Erlang(reg prometheus.Registerer, procfs procfs.FS) Provider {
+func Erlang(reg prometheus.Registerer, procfs procfs.FS, objFilePool *objectfile.Pool) Provider {
 	cache := cache.NewLRUCache[int, model.LabelSet](
 		prometheus.WrapRegistererWith(prometheus.Labels{"cache": "metadata_erlang"}, reg),
 		128,
@@ -47,7 +48,7 @@ func Erlang(reg prometheus.Registerer, procfs procfs.FS) Provider {
 			return nil, fmt.Errorf("failed to instantiate procfs for PID %d: %w", pid, err)
 		}
 
-		ok, err := erlang.IsRuntime(p)
+		ok, err := erlang.IsRuntime(objFilePool, p)
 		if err != nil {
 			return nil, fmt.Errorf("failed to check if PID %d is a NodeJS runtime: %w", pid, err)
 		}
@@ -60,7 +61,7 @@ func Erlang(reg prometheus.Registerer, procfs procfs.FS) Provider {
 			"erlang": model.LabelValue(strconv.FormatBool(true)),
 		}
 
-		rt, err := erlang.RuntimeInfo(p)
+		rt, err := erlang.RuntimeInfo(objFilePool, p)
 		if err != nil {
 			return nil, fmt.Errorf("failed to fetch interpreter info for PID %d: %w", pid, err)
 		}
@@ -25,10 +25,11 @@ import (
 	"github.com/prometheus/procfs"
 
 	"github.com/parca-dev/parca-agent/pkg/cache"
+	"github.com/parca-dev/parca-agent/pkg/objectfile"
 	"github.com/parca-dev/parca-agent/pkg/runtime/nodejs"
 )
 
-func NodeJS(reg prometheus.Registerer, procfs procfs.FS) Provider {
+func NodeJS(reg prometheus.Registerer, procfs procfs.FS, objFilePool *objectfile.Pool) Provider {
 	cache := cache.NewLRUCache[int, model.LabelSet](
 		prometheus.WrapRegistererWith(prometheus.Labels{"cache": "metadata_nodejs"}, reg),
 		128,
@@ -47,7 +48,7 @@ func NodeJS(reg prometheus.Registerer, procfs procfs.FS) Provider {
 			return nil, fmt.Errorf("failed to instantiate procfs for PID %d: %w", pid, err)
 		}
 
-		ok, err := nodejs.IsRuntime(p)
+		ok, err := nodejs.IsRuntime(objFilePool, p)
 		if err != nil {
 			return nil, fmt.Errorf("failed to check if PID %d is a NodeJS runtime: %w", pid, err)
 		}
@@ -60,7 +61,7 @@ func NodeJS(reg prometheus.Registerer, procfs procfs.FS) Provider {
 			"nodejs": model.LabelValue(strconv.FormatBool(true)),
 		}
 
-		rt, err := nodejs.RuntimeInfo(p)
+		rt, err := nodejs.RuntimeInfo(objFilePool, p)
 		if err != nil {
 			return nil, fmt.Errorf("failed to fetch interpreter info for PID %d: %w", pid, err)
 		}
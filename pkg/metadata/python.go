@@ -25,10 +25,11 @@ import (
 	"github.com/prometheus/procfs"
 
 	"github.com/parca-dev/parca-agent/pkg/cache"
+	"github.com/parca-dev/parca-agent/pkg/objectfile"
 	"github.com/parca-dev/parca-agent/pkg/runtime/python"
 )
 
-func Python(reg prometheus.Registerer, procfs procfs.FS) Provider {
+func Python(reg prometheus.Registerer, procfs procfs.FS, objFilePool *objectfile.Pool) Provider {
 	cache := cache.NewLRUCache[int, model.LabelSet](
 		prometheus.WrapRegistererWith(prometheus.Labels{"cache": "metadata_python"}, reg),
 		128,
@@ -47,7 +48,7 @@ func Python(reg prometheus.Registerer, procfs procfs.FS) Provider {
 			return nil, fmt.Errorf("failed to instantiate procfs for PID %d: %w", pid, err)
 		}
 
-		ok, err := python.IsRuntime(p)
+		ok, err := python.IsRuntime(objFilePool, p)
 		if err != nil {
 			return nil, fmt.Errorf("failed to check if PID %d is a Python runtime: %w", pid, err)
 		}
@@ -59,7 +60,7 @@ func Python(reg prometheus.Registerer, procfs procfs.FS) Provider {
 			"python": model.LabelValue(strconv.FormatBool(true)),
 		}
 
-		rt, err := python.RuntimeInfo(p)
+		rt, err := python.RuntimeInfo(objFilePool, p)
 		if err != nil {
 			return nil, fmt.Errorf("failed to fetch interpreter info for PID %d: %w", pid, err)
 		}
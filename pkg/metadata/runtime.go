@@ -21,6 +21,8 @@ import (
 	"github.com/prometheus/client_golang/prometheus"
 	"github.com/prometheus/common/model"
 	"github.com/prometheus/procfs"
+
+	"github.com/parca-dev/parca-agent/pkg/objectfile"
 )
 
 type runtimeProvider struct {
@@ -51,12 +53,12 @@ func (p *runtimeProvider) ShouldCache() bool {
 	return true
 }
 
-func Runtime(reg prometheus.Registerer, procfs procfs.FS) Provider {
+func Runtime(reg prometheus.Registerer, procfs procfs.FS, objFilePool *objectfile.Pool) Provider {
 	return &runtimeProvider{[]Provider{
-		Python(reg, procfs),
-		Ruby(reg, procfs),
-		NodeJS(reg, procfs),
-		Erlang(reg, procfs),
+		Python(reg, procfs, objFilePool),
+		Ruby(reg, procfs, objFilePool),
+		NodeJS(reg, procfs, objFilePool),
+		Erlang(reg, procfs, objFilePool),
 		// TODO(kakkoyun): Convert Java.
 	}}
 }
@@ -0,0 +1,206 @@
+// Copyright 2022-2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+package objectfile
+
+import (
+	"bufio"
+	"bytes"
+	"debug/elf"
+	"errors"
+	"fmt"
+	"os"
+	"syscall"
+
+	"github.com/parca-dev/parca-agent/pkg/elfreader"
+)
+
+// FileID identifies the contents of a file regardless of the path, or the
+// mount namespace, it is accessed through. Inodes are only unique within a
+// device and can be recycled, the modification time and size make it very
+// unlikely that a file replaced in place gets the same ID.
+type FileID struct {
+	Dev     uint64
+	Inode   uint64
+	Modtime int64
+	Size    int64
+}
+
+// FileIDFromPath returns the ID of the file at the given path.
+func FileIDFromPath(path string) (FileID, error) {
+	fileinfo, err := os.Stat(path)
+	if err != nil {
+		return FileID{}, err
+	}
+	return fileIDFromFileInfo(fileinfo)
+}
+
+func fileIDFromFileInfo(fileinfo os.FileInfo) (FileID, error) {
+	stat, ok := fileinfo.Sys().(*syscall.Stat_t)
+	if !ok {
+		return FileID{}, errors.New("fileinfo didn't have stat_t")
+	}
+
+	return FileID{
+		Dev:     stat.Dev,
+		Inode:   stat.Ino,
+		Modtime: fileinfo.ModTime().UnixNano(),
+		Size:    fileinfo.Size(),
+	}, nil
+}
+
+// SectionLocation is where a section is found in the file and in memory.
+type SectionLocation struct {
+	Addr   uint64
+	Offset uint64
+	Size   uint64
+}
+
+// Analysis contains everything the agent needs to know about an object file
+// that can be extracted from its headers. Unlike an ObjectFile, it doesn't
+// keep the file open, so it can be cached for as long as the file exists.
+type Analysis struct {
+	BuildID string
+	Type    elf.Type
+	Machine elf.Machine
+	// Whether the executable could be loaded at a random address.
+	ASLREligible bool
+
+	// Loadable program segments.
+	LoadSegments []elf.ProgHeader
+	// The loadable segment containing the .text section, if any.
+	TextSegment *elf.ProgHeader
+
+	// Location of the .eh_frame section, nil if it doesn't have one.
+	EhFrame *SectionLocation
+
+	// The registered identifying symbols found in the symbol tables.
+	identifyingSymbols map[string]struct{}
+}
+
+// identifyingSymbols are looked for in the symbol tables of every analyzed
+// file, see RegisterIdentifyingSymbols.
+var identifyingSymbols [][]byte
+
+// RegisterIdentifyingSymbols registers symbols whose presence is recorded by
+// the analysis, such as the ones identifying an interpreter. A symbol is found
+// if any symbol name contains it. It must only be called during package
+// initialization.
+func RegisterIdentifyingSymbols(symbols ...string) {
+	for _, s := range symbols {
+		identifyingSymbols = append(identifyingSymbols, []byte(s))
+	}
+}
+
+// HasIdentifyingSymbol returns whether any of the given registered symbols is
+// in the symbol table or the dynamic symbol table.
+func (a *Analysis) HasIdentifyingSymbol(symbols ...string) bool {
+	for _, s := range symbols {
+		if _, ok := a.identifyingSymbols[s]; ok {
+			return true
+		}
+	}
+	return false
+}
+
+// AnalyzeELF extracts the analysis in a single pass over the ELF headers and
+// the string tables of the symbol tables.
+func AnalyzeELF(ef *elf.File, buildID string) (*Analysis, error) {
+	a := &Analysis{
+		BuildID:      buildID,
+		Type:         ef.Type,
+		Machine:      ef.Machine,
+		ASLREligible: elfreader.IsASLRElegibleElf(ef),
+	}
+
+	for _, p := range ef.Progs {
+		if p.Type == elf.PT_LOAD {
+			a.LoadSegments = append(a.LoadSegments, p.ProgHeader)
+		}
+	}
+	if text := elfreader.FindTextProgHeader(ef); text != nil {
+		textSegment := *text
+		a.TextSegment = &textSegment
+	}
+
+	for _, s := range ef.Sections {
+		switch {
+		case s.Name == ".eh_frame":
+			a.EhFrame = &SectionLocation{Addr: s.Addr, Offset: s.Offset, Size: s.Size}
+		case s.Type == elf.SHT_SYMTAB || s.Type == elf.SHT_DYNSYM:
+			if err := findIdentifyingSymbols(ef, s, a); err != nil {
+				return nil, fmt.Errorf("failed to read the symbol names of %s: %w", s.Name, err)
+			}
+		}
+	}
+	return a, nil
+}
+
+// findIdentifyingSymbols streams the string table of the given symbol table
+// recording the registered symbols it contains.
+func findIdentifyingSymbols(ef *elf.File, symtab *elf.Section, a *Analysis) error {
+	if len(identifyingSymbols) == 0 {
+		return nil
+	}
+	if symtab.Link == 0 || int(symtab.Link) >= len(ef.Sections) {
+		return errors.New("section has invalid string table link")
+	}
+
+	scanner := bufio.NewScanner(ef.Sections[symtab.Link].Open())
+	// Mangled C++ symbol names can be longer than the default limit.
+	scanner.Buffer(make([]byte, 0, 64*1024), 1024*1024)
+	scanner.Split(elfreader.ScanNullTerminated)
+	for scanner.Scan() {
+		for _, match := range identifyingSymbols {
+			if !bytes.Contains(scanner.Bytes(), match) {
+				continue
+			}
+			if a.identifyingSymbols == nil {
+				a.identifyingSymbols = make(map[string]struct{})
+			}
+			a.identifyingSymbols[string(match)] = struct{}{}
+		}
+	}
+	return scanner.Err()
+}
+
+// Analyze returns the analysis of the object file at the given path. Results
+// are cached by the file's ID, so a file mapped by many processes, such as
+// libc, is only parsed once, even after its ObjectFile has been closed. Failed
+// analyses aren't cached.
+func (p *Pool) Analyze(path string) (*Analysis, error) {
+	id, err := FileIDFromPath(path)
+	if err != nil {
+		return nil, fmt.Errorf("failed to get file ID of %s: %w", path, err)
+	}
+	if a, ok := p.analyses.Get(id); ok {
+		return a, nil
+	}
+
+	obj, err := p.Open(path)
+	if err != nil {
+		return nil, err
+	}
+	ef, err := obj.ELF()
+	if err != nil {
+		return nil, err
+	}
+
+	a, err := AnalyzeELF(ef, obj.BuildID)
+	if err != nil {
+		return nil, fmt.Errorf("failed to analyze %s: %w", path, err)
+	}
+	p.analyses.Add(id, a)
+	return a, nil
+}
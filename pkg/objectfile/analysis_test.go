@@ -0,0 +1,134 @@
+// Copyright 2022-2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+package objectfile
+
+import (
+	"bytes"
+	"debug/elf"
+	"encoding/binary"
+	"os"
+	"path/filepath"
+	"testing"
+
+	"github.com/go-kit/log"
+	"github.com/prometheus/client_golang/prometheus"
+	"github.com/stretchr/testify/require"
+)
+
+func init() {
+	RegisterIdentifyingSymbols("fibNaive", "erts_schedule")
+}
+
+func TestAnalyze(t *testing.T) {
+	objFilePool := NewPool(log.NewNopLogger(), prometheus.NewRegistry(), "", 10, 0)
+	t.Cleanup(func() {
+		objFilePool.Close()
+	})
+
+	tests := []struct {
+		path         string
+		buildID      string
+		typ          elf.Type
+		aslrEligible bool
+	}{
+		{
+			path:         filepath.Join("./testdata", "fib"),
+			buildID:      "a3e257e3ad8f99654b76013b41eeba07f6d34c2a",
+			typ:          elf.ET_DYN,
+			aslrEligible: true,
+		},
+		{
+			path:         filepath.Join("./testdata", "fib-nopie"),
+			buildID:      "500018e64aeed6f995bac46ae5d81a30159204a5",
+			typ:          elf.ET_EXEC,
+			aslrEligible: false,
+		},
+	}
+	for _, tt := range tests {
+		t.Run(tt.path, func(t *testing.T) {
+			a, err := objFilePool.Analyze(tt.path)
+			require.NoError(t, err)
+			require.Equal(t, tt.buildID, a.BuildID)
+			require.Equal(t, tt.typ, a.Type)
+			require.Equal(t, elf.EM_X86_64, a.Machine)
+			require.Equal(t, tt.aslrEligible, a.ASLREligible)
+			require.NotEmpty(t, a.LoadSegments)
+			require.NotNil(t, a.TextSegment)
+			require.NotNil(t, a.EhFrame)
+			require.True(t, a.HasIdentifyingSymbol("fibNaive"))
+			require.False(t, a.HasIdentifyingSymbol("erts_schedule"))
+
+			// The second call is served from the cache.
+			cached, err := objFilePool.Analyze(tt.path)
+			require.NoError(t, err)
+			require.Same(t, a, cached)
+		})
+	}
+}
+
+func TestAnalyzeSymbolNameTooLong(t *testing.T) {
+	// Point the .strtab of a copy of fib to a name longer than the scanner
+	// accepts, appended to the end of the file.
+	b, err := os.ReadFile(filepath.Join("testdata", "fib"))
+	require.NoError(t, err)
+	ef, err := elf.NewFile(bytes.NewReader(b))
+	require.NoError(t, err)
+	var hdr elf.Header64
+	require.NoError(t, binary.Read(bytes.NewReader(b), ef.ByteOrder, &hdr))
+	strtab := -1
+	for i, s := range ef.Sections {
+		if s.Name == ".strtab" {
+			strtab = i
+		}
+	}
+	require.NotEqual(t, -1, strtab)
+
+	shdr := b[hdr.Shoff+uint64(strtab)*uint64(hdr.Shentsize):]
+	ef.ByteOrder.PutUint64(shdr[24:], uint64(len(b))) // sh_offset
+	ef.ByteOrder.PutUint64(shdr[32:], 2*1024*1024)    // sh_size
+	b = append(b, bytes.Repeat([]byte("x"), 2*1024*1024)...)
+	path := filepath.Join(t.TempDir(), "fib")
+	require.NoError(t, os.WriteFile(path, b, 0o755))
+
+	objFilePool := NewPool(log.NewNopLogger(), prometheus.NewRegistry(), "", 10, 0)
+	t.Cleanup(func() {
+		objFilePool.Close()
+	})
+
+	_, err = objFilePool.Analyze(path)
+	require.Error(t, err)
+
+	// The incomplete analysis isn't cached.
+	id, err := FileIDFromPath(path)
+	require.NoError(t, err)
+	_, ok := objFilePool.analyses.Peek(id)
+	require.False(t, ok)
+}
+
+func TestFileIDChangesWithContents(t *testing.T) {
+	path := filepath.Join(t.TempDir(), "file")
+	require.NoError(t, os.WriteFile(path, []byte("a"), 0o644))
+	before, err := FileIDFromPath(path)
+	require.NoError(t, err)
+
+	again, err := FileIDFromPath(path)
+	require.NoError(t, err)
+	require.Equal(t, before, again)
+
+	require.NoError(t, os.WriteFile(path, []byte("ab"), 0o644))
+	after, err := FileIDFromPath(path)
+	require.NoError(t, err)
+	require.NotEqual(t, before, after)
+}
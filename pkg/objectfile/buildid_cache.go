@@ -0,0 +1,83 @@
+// Copyright 2022-2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+package objectfile
+
+import (
+	"debug/elf"
+	"os"
+	"time"
+
+	"github.com/go-kit/log/level"
+
+	"github.com/parca-dev/parca-agent/pkg/buildid"
+	"github.com/parca-dev/parca-agent/pkg/cache"
+)
+
+const (
+	// Entries are less than a hundred bytes each, with their key.
+	maxBuildIDs = 100_000
+	// How often, at most, new build IDs are written to disk.
+	buildIDCacheSaveInterval = time.Minute
+)
+
+// buildIDFromELF computes the build ID of a file, which hashes its contents
+// if it doesn't have a build ID note.
+var buildIDFromELF = buildid.FromELF
+
+// buildIDCache remembers the build ID of every file by its identity, so
+// files without a build ID note, whose build ID is a hash of their contents,
+// are only hashed once. Files in container image layers shared by many
+// containers have the same identity in all of them, as overlayfs reports the
+// device and inode of the underlying file. Entries of files that changed
+// are harmless, their identity changed with them, so they are never looked
+// up again.
+type buildIDCache = cache.Persistent[FileID, string]
+
+func newBuildIDCache(path string) *buildIDCache {
+	return cache.NewPersistentCache[FileID, string](path, maxBuildIDs, buildIDCacheSaveInterval)
+}
+
+// WithBuildIDCachePath persists the build IDs of the opened object files to
+// the given path, so they don't need to be computed again after a restart.
+func WithBuildIDCachePath(path string) Option {
+	return func(p *Pool) {
+		p.buildIDs = newBuildIDCache(path)
+	}
+}
+
+// buildID returns the build ID of the given file, from the cache if it was
+// already computed.
+func (p *Pool) buildID(ef *elf.File, stat os.FileInfo) (string, error) {
+	id, err := fileIDFromFileInfo(stat)
+	if err != nil {
+		return buildIDFromELF(ef)
+	}
+	if buildID, ok := p.buildIDs.Get(id); ok {
+		p.metrics.buildIDCache.WithLabelValues(lvHit).Inc()
+		return buildID, nil
+	}
+	p.metrics.buildIDCache.WithLabelValues(lvMiss).Inc()
+
+	buildID, err := buildIDFromELF(ef)
+	if err != nil {
+		return "", err
+	}
+	if p.buildIDs.Add(id, buildID) {
+		if err := p.buildIDs.Save(); err != nil {
+			level.Warn(p.logger).Log("msg", "failed to save the build ID cache", "err", err)
+		}
+	}
+	return buildID, nil
+}
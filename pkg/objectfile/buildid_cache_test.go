@@ -0,0 +1,54 @@
+// Copyright 2022-2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+package objectfile
+
+import (
+	"path/filepath"
+	"testing"
+
+	"github.com/stretchr/testify/require"
+)
+
+func TestBuildIDCachePersistence(t *testing.T) {
+	path := filepath.Join(t.TempDir(), "build_ids.json")
+
+	c := newBuildIDCache(path)
+	require.NoError(t, c.Load())
+
+	id := FileID{Dev: 1, Inode: 2, Modtime: 3, Size: 4}
+	c.Add(id, "abc")
+	require.NoError(t, c.Save())
+
+	loaded := newBuildIDCache(path)
+	require.NoError(t, loaded.Load())
+	buildID, ok := loaded.Get(id)
+	require.True(t, ok)
+	require.Equal(t, "abc", buildID)
+
+	// The identity of a file changes when it is modified.
+	_, ok = loaded.Get(FileID{Dev: 1, Inode: 2, Modtime: 5, Size: 4})
+	require.False(t, ok)
+}
+
+func TestBuildIDCacheNotPersisted(t *testing.T) {
+	c := newBuildIDCache("")
+	require.NoError(t, c.Load())
+	require.False(t, c.Add(FileID{Inode: 1}, "abc"))
+	require.NoError(t, c.Save())
+
+	buildID, ok := c.Get(FileID{Inode: 1})
+	require.True(t, ok)
+	require.Equal(t, "abc", buildID)
+}
@@ -31,7 +31,6 @@ import (
 	"github.com/prometheus/client_golang/prometheus/promauto"
 	"go.uber.org/atomic"
 
-	"github.com/parca-dev/parca-agent/pkg/buildid"
 	"github.com/parca-dev/parca-agent/pkg/cache"
 )
 
@@ -47,6 +46,8 @@ const (
 	lvSuccess = "success"
 	lvError   = "error"
 	lvShared  = "shared"
+	lvHit     = "hit"
+	lvMiss    = "miss"
 
 	lvNotFound    = "not_found"
 	lvNotELF      = "not_elf"
@@ -64,6 +65,7 @@ type metrics struct {
 	closeAttempts    prometheus.Counter
 	closed           *prometheus.CounterVec
 	keptOpenDuration prometheus.Histogram
+	buildIDCache     *prometheus.CounterVec
 }
 
 func newMetrics(reg prometheus.Registerer) *metrics {
@@ -93,6 +95,10 @@ func newMetrics(reg prometheus.Registerer) *metrics {
 			Help:                        "Duration of object files kept open.",
 			NativeHistogramBucketFactor: 1.1,
 		}),
+		buildIDCache: promauto.With(reg).NewCounterVec(prometheus.CounterOpts{
+			Name: "parca_agent_objectfile_build_id_cache_requests_total",
+			Help: "Total number of build ID lookups of opened object files, by whether the build ID was cached.",
+		}, []string{"result"}),
 	}
 	m.opened.WithLabelValues(lvSuccess)
 	m.opened.WithLabelValues(lvError)
@@ -105,6 +111,8 @@ func newMetrics(reg prometheus.Registerer) *metrics {
 	m.openErrors.WithLabelValues(lvStat)
 	m.closed.WithLabelValues(lvSuccess)
 	m.closed.WithLabelValues(lvError)
+	m.buildIDCache.WithLabelValues(lvHit)
+	m.buildIDCache.WithLabelValues(lvMiss)
 	return m
 }
 
@@ -127,11 +135,21 @@ type Pool struct {
 	// There could be multiple object files mapped to different processes.
 	keyCache Cache[string, cacheKey]
 	objCache Cache[cacheKey, *ObjectFile]
+	// Analyses outlive the object files, they don't keep them open.
+	analyses Cache[FileID, *Analysis]
+	// See buildIDCache.
+	buildIDs *buildIDCache
 }
 
-const keepAliveProfileCycle = 18
+type Option func(*Pool)
 
-func NewPool(logger log.Logger, reg prometheus.Registerer, evictionPolicy string, poolSize int, profilingDuration time.Duration) *Pool {
+const (
+	keepAliveProfileCycle = 18
+	// Analyses are a few hundred bytes each.
+	maxAnalyses = 10_000
+)
+
+func NewPool(logger log.Logger, reg prometheus.Registerer, evictionPolicy string, poolSize int, profilingDuration time.Duration, opts ...Option) *Pool {
 	p := &Pool{
 		logger:  logger,
 		metrics: newMetrics(reg),
@@ -143,6 +161,17 @@ func NewPool(logger log.Logger, reg prometheus.Registerer, evictionPolicy string
 			poolSize,
 			keepAliveProfileCycle*profilingDuration,
 		),
+		analyses: cache.NewLRUCache[FileID, *Analysis](
+			prometheus.WrapRegistererWith(prometheus.Labels{"cache": "objectfile_analysis"}, reg),
+			maxAnalyses,
+		),
+		buildIDs: newBuildIDCache(""),
+	}
+	for _, opt := range opts {
+		opt(p)
+	}
+	if err := p.buildIDs.Load(); err != nil {
+		level.Warn(logger).Log("msg", "failed to load the build ID cache", "err", err)
 	}
 
 	switch evictionPolicy {
@@ -266,7 +295,13 @@ func (p *Pool) NewFile(f *os.File) (_ *ObjectFile, err error) { //nolint:nonamed
 		return nil, closer(errors.New("ELF does not have any sections"))
 	}
 
-	buildID, err := buildid.FromELF(ef)
+	stat, err := f.Stat()
+	if err != nil {
+		p.metrics.openErrors.WithLabelValues(lvStat).Inc()
+		return nil, closer(fmt.Errorf("failed to get stats of the file: %w", err))
+	}
+
+	buildID, err := p.buildID(ef, stat)
 	if err != nil {
 		p.metrics.openErrors.WithLabelValues(lvBuildID).Inc()
 		return nil, closer(fmt.Errorf("failed to get build ID from ELF for %s: %w", path, err))
@@ -276,12 +311,6 @@ func (p *Pool) NewFile(f *os.File) (_ *ObjectFile, err error) { //nolint:nonamed
 		return nil, closer(rErr)
 	}
 
-	stat, err := f.Stat()
-	if err != nil {
-		p.metrics.openErrors.WithLabelValues(lvStat).Inc()
-		return nil, closer(fmt.Errorf("failed to get stats of the file: %w", err))
-	}
-
 	mountNamespaceID, err := mountNamespaceIDFromPid(pidFromPath(path))
 	if err != nil {
 		p.metrics.openErrors.WithLabelValues(lvMountNS).Inc()
@@ -332,7 +361,8 @@ func (p *Pool) Close() error {
 	// Remove all the cached files from the pool.
 	p.keyCache.Purge()
 	p.objCache.Purge()
-	return nil
+	p.analyses.Purge()
+	return p.buildIDs.Save()
 }
 
 var rgx = regexp.MustCompile(`^/proc/(\d+)/root`)
@@ -16,7 +16,16 @@
 package objectfile
 
 import (
+	"debug/elf"
+	"os"
+	"path/filepath"
 	"testing"
+
+	"github.com/go-kit/log"
+	"github.com/prometheus/client_golang/prometheus"
+	"github.com/stretchr/testify/require"
+
+	"github.com/parca-dev/parca-agent/pkg/buildid"
 )
 
 func TestRemoveProcPrefix(t *testing.T) {
@@ -132,3 +141,44 @@ func TestExtractPidFromPath(t *testing.T) {
 		})
 	}
 }
+
+func TestPoolBuildIDCache(t *testing.T) {
+	hashed := 0
+	buildIDFromELF = func(ef *elf.File) (string, error) {
+		hashed++
+		return buildid.FromELF(ef)
+	}
+	t.Cleanup(func() {
+		buildIDFromELF = buildid.FromELF
+	})
+
+	newFile := func(p *Pool) string {
+		t.Helper()
+
+		f, err := os.Open(filepath.Join("testdata", "fib"))
+		require.NoError(t, err)
+		obj, err := p.NewFile(f)
+		require.NoError(t, err)
+		return obj.BuildID
+	}
+
+	path := filepath.Join(t.TempDir(), "build_ids.json")
+	p := NewPool(log.NewNopLogger(), prometheus.NewRegistry(), "", 10, 0, WithBuildIDCachePath(path))
+	want := newFile(p)
+	require.Equal(t, "a3e257e3ad8f99654b76013b41eeba07f6d34c2a", want)
+	require.Equal(t, 1, hashed)
+
+	// The same file opened again, e.g. from another container, isn't hashed
+	// again.
+	require.Equal(t, want, newFile(p))
+	require.Equal(t, 1, hashed)
+	require.NoError(t, p.Close())
+
+	// Nor after a restart, the build ID is loaded from disk.
+	p = NewPool(log.NewNopLogger(), prometheus.NewRegistry(), "", 10, 0, WithBuildIDCachePath(path))
+	t.Cleanup(func() {
+		p.Close()
+	})
+	require.Equal(t, want, newFile(p))
+	require.Equal(t, 1, hashed)
+}
@@ -16,11 +16,10 @@ package perf
 import (
 	"errors"
 	"fmt"
-	"io"
 	"io/fs"
 	"os"
 	"path/filepath"
-	"sort"
+	"sync"
 	"time"
 
 	"github.com/go-kit/log"
@@ -35,68 +34,67 @@ import (
 type JITDumpCache struct {
 	logger log.Logger
 
-	cache *cache.CacheWithEvictionTTL[string, jitdumpCacheValue]
+	// Serializes the creation of the cached values, they are updated while
+	// holding their own lock.
+	mtx   sync.Mutex
+	cache *cache.CacheWithEvictionTTL[string, *jitdumpCacheValue]
 
 	tmpDir string
 }
 
 type jitdumpCacheValue struct {
-	f *symtab.FileReader
+	mtx sync.Mutex
+	idx *SymbolIndex
+	r   *jit.CodeLoadReader
 
 	// We assume the file is unchanged if the size and modtime are the same as
-	// last time we parsed it.
+	// last time we read it, and was replaced rather than appended to if its
+	// inode changed or it shrank.
 	fileModTime time.Time
 	fileSize    int64
+	fileInode   uint64
 }
 
 var ErrJITDumpNotFound = errors.New("jitdump not found")
 
+// ReadJITdump reads the code loads appended to a jitdump since the last read
+// by r, writing the symbol names to w.
 func ReadJITdump(
 	logger log.Logger,
 	fileName string,
+	r *jit.CodeLoadReader,
 	w *symtab.FileWriter,
-) (Map, error) {
+) ([]MapAddr, error) {
 	fd, err := os.Open(fileName)
 	if err != nil {
-		return Map{}, err
+		return nil, err
 	}
 	defer fd.Close()
 
-	dump := &jit.JITDump{}
-	err = jit.LoadJITDump(logger, fd, dump)
-	if errors.Is(err, io.ErrUnexpectedEOF) {
-		if dump == nil || dump.CodeLoads == nil {
-			return Map{}, err
-		}
-		// Some runtimes update their dump all the time (e.g. libperf_jvmti.so),
-		// making it nearly impossible to read a complete file
-		level.Warn(logger).Log("msg", "JIT dump file ended unexpectedly", "filename", fileName, "err", err)
-	} else if err != nil {
-		return Map{}, err
+	stat, err := fd.Stat()
+	if err != nil {
+		return nil, err
 	}
 
-	addrs := make([]MapAddr, 0, len(dump.CodeLoads))
-	for _, cl := range dump.CodeLoads {
-		offset, err := w.AddString(cl.Name)
+	var addrs []MapAddr
+	err = r.Read(fd, stat.Size(), func(name string, codeAddr, codeSize uint64) error {
+		offset, err := w.AddString(name)
 		if err != nil {
-			return Map{}, fmt.Errorf("writing string: %w", err)
+			return fmt.Errorf("writing string: %w", err)
 		}
 		addrs = append(addrs, MapAddr{
-			Start:        cl.CodeAddr,
-			End:          cl.CodeAddr + cl.CodeSize,
+			Start:        codeAddr,
+			End:          codeAddr + codeSize,
 			SymbolOffset: offset,
-			SymbolLen:    uint16(len(cl.Name)),
+			SymbolLen:    uint16(len(name)),
 		})
-	}
-
-	// Sorted by end address to allow binary search during look-up. End to find
-	// the (closest) address _before_ the end. This could be an inlined instruction
-	// within a larger blob.
-	sort.Slice(addrs, func(i, j int) bool {
-		return addrs[i].End < addrs[j].End
+		return nil
 	})
+	if err != nil {
+		return nil, err
+	}
 
-	return Map{Path: fileName, addrs: addrs}, nil
+	return addrs, nil
 }
 
 func NewJITDumpCache(
@@ -110,17 +108,13 @@ func NewJITDumpCache(
 		tmpDir: tmpDir,
 	}
 
-	f := func(key string, value jitdumpCacheValue) {
-		if err := value.f.Close(); err != nil {
-			level.Error(logger).Log("msg", "failed to close perf map file", "err", err)
-		}
-
-		if err := os.Remove(key); err != nil {
-			level.Error(logger).Log("msg", "failed to remove perf map file", "err", err)
+	f := func(key string, value *jitdumpCacheValue) {
+		if err := value.idx.Close(); err != nil {
+			level.Error(logger).Log("msg", "failed to remove jitdump symbols", "err", err)
 		}
 	}
 
-	c.cache = cache.NewLRUCacheWithEvictionTTL[string, jitdumpCacheValue](
+	c.cache = cache.NewLRUCacheWithEvictionTTL[string, *jitdumpCacheValue](
 		prometheus.WrapRegistererWith(prometheus.Labels{"cache": "jitdump_cache"}, reg),
 		512,
 		10*profilingDuration,
@@ -142,9 +136,9 @@ func key(pid int, fileName string) string {
 	return filepath.Join(fmt.Sprintf("/proc/%d/root", pid), fileName)
 }
 
-// DumpForPID reads the JIT dump for the given PID and filename and returns a
-// Map that can be queried.
-func (p *JITDumpCache) JITDumpForPID(pid int, path string) (*symtab.FileReader, error) {
+// JITDumpForPID returns the symbols of the JIT dump for the given PID and
+// filename, reading the records that were appended to it since the last call.
+func (p *JITDumpCache) JITDumpForPID(pid int, path string) (*SymbolIndex, error) {
 	jitdumpFile := key(pid, path)
 	info, err := os.Stat(jitdumpFile)
 	if os.IsNotExist(err) || errors.Is(err, fs.ErrNotExist) {
@@ -154,74 +148,46 @@ func (p *JITDumpCache) JITDumpForPID(pid int, path string) (*symtab.FileReader,
 		return nil, err
 	}
 
-	if v, ok := p.cache.Get(jitdumpFile); ok {
-		if v.fileModTime == info.ModTime() && v.fileSize == info.Size() {
-			return v.f, nil
-		}
-		level.Debug(p.logger).Log("msg", "cached value is outdated", "pid", pid)
-		if err := v.f.Close(); err != nil {
-			level.Error(p.logger).Log("msg", "failed to close optimized symtab", "err", err, "pid", pid, "path", path)
-		}
-	}
-
 	filePath := p.path(pid, path)
-	if err := os.MkdirAll(filepath.Dir(filePath), 0o644); err != nil {
-		return nil, err
-	}
-	f, err := optimizeAndOpenJitdump(p.logger, jitdumpFile, filePath)
-	if err != nil {
-		return nil, err
-	}
-
-	p.cache.Add(jitdumpFile, jitdumpCacheValue{
-		f:           f,
-		fileModTime: info.ModTime(),
-		fileSize:    info.Size(),
-	})
-
-	return f, nil
-}
-
-func optimizeAndOpenJitdump(
-	logger log.Logger,
-	perfMapFile string,
-	outFile string,
-) (*symtab.FileReader, error) {
-	w, err := symtab.NewWriter(outFile, 0)
-	if err != nil {
-		return nil, err
+	p.mtx.Lock()
+	v, ok := p.cache.Get(jitdumpFile)
+	if !ok {
+		v = &jitdumpCacheValue{
+			idx: newSymbolIndex(filePath),
+			r:   jit.NewCodeLoadReader(p.logger),
+		}
+		p.cache.Add(jitdumpFile, v)
 	}
+	p.mtx.Unlock()
 
-	m, err := ReadJITdump(logger, perfMapFile, w)
-	if err != nil {
-		return nil, err
-	}
+	v.mtx.Lock()
+	defer v.mtx.Unlock()
 
-	indices := m.DeduplicatedIndices()
-	i := indices.Iterator()
-	for i.HasNext() {
-		e := m.addrs[i.Next()]
-		if err := w.WriteEntry(symtab.Entry{
-			Address: e.Start,
-			Offset:  e.SymbolOffset,
-			Len:     e.SymbolLen,
-		}); err != nil {
-			return nil, err
-		}
+	if v.fileModTime == info.ModTime() && v.fileSize == info.Size() {
+		return v.idx, nil
 	}
 
-	if err := w.WriteHeader(); err != nil {
-		return nil, err
+	inode := fileInode(info)
+	if inode != v.fileInode || info.Size() < v.r.Offset() {
+		level.Debug(p.logger).Log("msg", "jitdump was replaced", "pid", pid, "path", path)
+		v.idx.reset()
+		v.r = jit.NewCodeLoadReader(p.logger)
 	}
 
-	if err := w.Close(); err != nil {
+	if err := os.MkdirAll(filepath.Dir(filePath), 0o644); err != nil {
 		return nil, err
 	}
-
-	f, err := symtab.NewReader(outFile)
-	if err != nil {
+	if err := v.idx.update(func(w *symtab.FileWriter) ([]MapAddr, error) {
+		return ReadJITdump(p.logger, jitdumpFile, v.r, w)
+	}); err != nil {
+		// The reader might have moved past records that weren't added.
+		v.idx.reset()
+		v.r = jit.NewCodeLoadReader(p.logger)
 		return nil, err
 	}
+	v.fileModTime = info.ModTime()
+	v.fileSize = info.Size()
+	v.fileInode = inode
 
-	return f, nil
+	return v.idx, nil
 }
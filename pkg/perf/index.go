@@ -0,0 +1,356 @@
+// Copyright 2022-2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+package perf
+
+import (
+	"errors"
+	"fmt"
+	"math"
+	"os"
+	"sort"
+	"sync"
+	"sync/atomic"
+
+	"github.com/parca-dev/parca-agent/pkg/symtab"
+)
+
+// Upper bound of the number of segments of an index, they are merged
+// regardless of their size past it.
+const maxSegments = 8
+
+// Source of the generations of all the indexes, so an index that was
+// recreated doesn't reuse the generation of the one it replaced.
+var generations atomic.Uint64
+
+// SymbolIndex is the symbol table of a JIT'd process. It is updated with the
+// symbols the runtime appended to its perf map or jitdump since the last
+// update, without rebuilding it from scratch.
+//
+// It is made of immutable symtab files, or segments, each holding the symbols
+// of one update. Newer symbols replace the older ones they overlap, so the
+// segments are looked up from the newest to the oldest. A segment is merged
+// into the previous one when it's at least half its size, so there are only
+// logarithmically many segments, and each symbol is rewritten a logarithmic
+// number of times.
+type SymbolIndex struct {
+	pathPrefix string
+
+	// Serializes the updates, the segments can be looked up meanwhile.
+	updateMtx sync.Mutex
+	nextID    int
+
+	mtx      sync.Mutex
+	segments []*segment
+	// Changes whenever symbols are added or removed.
+	generation uint64
+}
+
+type segment struct {
+	path string
+	r    *symtab.FileReader
+	// Number of symbols, not counting the entries marking their end.
+	symbols uint64
+}
+
+// newSymbolIndex returns an empty index whose segments are stored in files
+// starting with the given prefix.
+func newSymbolIndex(pathPrefix string) *SymbolIndex {
+	return &SymbolIndex{pathPrefix: pathPrefix, generation: generations.Add(1)}
+}
+
+// Symbolize returns the name of the symbol containing the given address.
+func (idx *SymbolIndex) Symbolize(addr uint64) (string, error) {
+	idx.mtx.Lock()
+	defer idx.mtx.Unlock()
+
+	for i := len(idx.segments) - 1; i >= 0; i-- {
+		symbol, err := idx.segments[i].r.Symbolize(addr)
+		if err == nil {
+			return symbol, nil
+		}
+		if !errors.Is(err, symtab.ErrSymbolNotFound) {
+			return "", err
+		}
+	}
+	return "", symtab.ErrSymbolNotFound
+}
+
+// Empty returns true if the index doesn't have any symbols.
+func (idx *SymbolIndex) Empty() bool {
+	idx.mtx.Lock()
+	defer idx.mtx.Unlock()
+
+	return len(idx.segments) == 0
+}
+
+// Generation returns a number that changes whenever the symbols of the index
+// change, so the results of previous lookups can be reused until then.
+func (idx *SymbolIndex) Generation() uint64 {
+	idx.mtx.Lock()
+	defer idx.mtx.Unlock()
+
+	return idx.generation
+}
+
+// update adds a segment with the symbols written by fn, which adds their
+// names to the given writer.
+func (idx *SymbolIndex) update(fn func(w *symtab.FileWriter) ([]MapAddr, error)) error {
+	idx.updateMtx.Lock()
+	defer idx.updateMtx.Unlock()
+
+	path := idx.nextPath()
+	w, err := symtab.NewWriter(path, 0)
+	if err != nil {
+		return err
+	}
+
+	addrs, err := fn(w)
+	if err != nil || len(addrs) == 0 {
+		w.Close()
+		os.Remove(path)
+		return err
+	}
+
+	seg, err := writeSegment(path, w, addrs)
+	if err != nil {
+		os.Remove(path)
+		return err
+	}
+
+	idx.mtx.Lock()
+	idx.segments = append(idx.segments, seg)
+	idx.generation = generations.Add(1)
+	idx.mtx.Unlock()
+
+	return idx.compact()
+}
+
+// compact merges the newest segments while they are of comparable size.
+// Segments are immutable, so they are merged while being looked up.
+func (idx *SymbolIndex) compact() error {
+	for {
+		idx.mtx.Lock()
+		n := len(idx.segments)
+		if n < 2 || (idx.segments[n-1].symbols*2 < idx.segments[n-2].symbols && n <= maxSegments) {
+			idx.mtx.Unlock()
+			return nil
+		}
+		older, newer := idx.segments[n-2], idx.segments[n-1]
+		idx.mtx.Unlock()
+
+		path := idx.nextPath()
+		merged, err := mergeSegments(path, older, newer)
+		if err != nil {
+			os.Remove(path)
+			return fmt.Errorf("merge segments: %w", err)
+		}
+
+		idx.mtx.Lock()
+		idx.segments = append(idx.segments[:n-2], merged)
+		idx.mtx.Unlock()
+
+		older.close()
+		newer.close()
+	}
+}
+
+// reset removes all the symbols.
+func (idx *SymbolIndex) reset() {
+	idx.mtx.Lock()
+	defer idx.mtx.Unlock()
+
+	for _, seg := range idx.segments {
+		seg.close()
+	}
+	idx.segments = nil
+	idx.generation = generations.Add(1)
+}
+
+// Close removes the index.
+func (idx *SymbolIndex) Close() error {
+	idx.updateMtx.Lock()
+	defer idx.updateMtx.Unlock()
+
+	idx.reset()
+	return nil
+}
+
+func (idx *SymbolIndex) nextPath() string {
+	path := fmt.Sprintf("%s.%d", idx.pathPrefix, idx.nextID)
+	idx.nextID++
+	return path
+}
+
+// close must only be called once the segment was removed from the index.
+func (s *segment) close() {
+	s.r.Close()
+	os.Remove(s.path)
+}
+
+// writeSegment writes the entries of the given symbols, whose names were
+// already added to the writer, and opens the resulting segment.
+func writeSegment(path string, w *symtab.FileWriter, addrs []MapAddr) (*segment, error) {
+	// Sorted by end address to allow binary search during look-up. End to find
+	// the (closest) address _before_ the end. This could be an inlined instruction
+	// within a larger blob.
+	sort.SliceStable(addrs, func(i, j int) bool {
+		return addrs[i].End < addrs[j].End
+	})
+
+	m := Map{addrs: addrs}
+	kept := m.DeduplicatedIndices().ToArray()
+	for i, k := range kept {
+		e := addrs[k]
+		if err := w.WriteEntry(symtab.Entry{
+			Address: e.Start,
+			Offset:  e.SymbolOffset,
+			Len:     e.SymbolLen,
+		}); err != nil {
+			return nil, err
+		}
+		// Mark the end of the symbol, unless the next one starts there, so
+		// older segments are looked up for addresses in between.
+		if i == len(kept)-1 || addrs[kept[i+1]].Start > e.End {
+			if err := w.WriteEnd(e.End); err != nil {
+				return nil, err
+			}
+		}
+	}
+
+	if err := w.WriteHeader(); err != nil {
+		return nil, err
+	}
+	if err := w.Close(); err != nil {
+		return nil, err
+	}
+
+	r, err := symtab.NewReader(path)
+	if err != nil {
+		return nil, err
+	}
+	return &segment{path: path, r: r, symbols: uint64(len(kept))}, nil
+}
+
+// interval is a symbol of a segment and the address it ends at.
+type interval struct {
+	entry symtab.Entry
+	end   uint64
+}
+
+// intervalIterator iterates over the symbols of a segment, in address order.
+type intervalIterator struct {
+	r *symtab.FileReader
+	i uint32
+}
+
+func (it *intervalIterator) next() (interval, bool, error) {
+	for it.i < it.r.Len() {
+		e, err := it.r.EntryAt(it.i)
+		if err != nil {
+			return interval{}, false, err
+		}
+		it.i++
+		if e.Len == 0 {
+			continue
+		}
+
+		end := uint64(math.MaxUint64)
+		if it.i < it.r.Len() {
+			next, err := it.r.EntryAt(it.i)
+			if err != nil {
+				return interval{}, false, err
+			}
+			end = next.Address
+		}
+		return interval{entry: e, end: end}, true, nil
+	}
+	return interval{}, false, nil
+}
+
+// mergeSegments writes a segment with the symbols of the newer segment, and
+// the ones of the older segment that don't overlap any of them.
+func mergeSegments(path string, older, newer *segment) (*segment, error) {
+	w, err := symtab.NewWriter(path, 0)
+	if err != nil {
+		return nil, err
+	}
+
+	addrs := make([]MapAddr, 0, older.symbols+newer.symbols)
+	emit := func(s *segment, iv interval) error {
+		name, err := s.r.Name(iv.entry)
+		if err != nil {
+			return err
+		}
+		offset, err := w.AddString(name)
+		if err != nil {
+			return fmt.Errorf("writing string: %w", err)
+		}
+		addrs = append(addrs, MapAddr{
+			Start:        iv.entry.Address,
+			End:          iv.end,
+			SymbolOffset: offset,
+			SymbolLen:    iv.entry.Len,
+		})
+		return nil
+	}
+
+	var (
+		olderIt = &intervalIterator{r: older.r}
+		newerIt = &intervalIterator{r: newer.r}
+		// The last symbol of the newer segment that was emitted.
+		lastNewer *interval
+	)
+	o, oOK, err := olderIt.next()
+	if err != nil {
+		w.Close()
+		return nil, err
+	}
+	n, nOK, err := newerIt.next()
+	if err != nil {
+		w.Close()
+		return nil, err
+	}
+	for oOK || nOK {
+		if nOK && (!oOK || n.entry.Address <= o.entry.Address) {
+			if err := emit(newer, n); err != nil {
+				w.Close()
+				return nil, err
+			}
+			emitted := n
+			lastNewer = &emitted
+			if n, nOK, err = newerIt.next(); err != nil {
+				w.Close()
+				return nil, err
+			}
+			continue
+		}
+
+		// The symbols of the newer segment are sorted and don't overlap, so
+		// only the ones right before and after can overlap this one.
+		overlaps := (lastNewer != nil && lastNewer.end > o.entry.Address) || (nOK && n.entry.Address < o.end)
+		if !overlaps {
+			if err := emit(older, o); err != nil {
+				w.Close()
+				return nil, err
+			}
+		}
+		if o, oOK, err = olderIt.next(); err != nil {
+			w.Close()
+			return nil, err
+		}
+	}
+
+	return writeSegment(path, w, addrs)
+}
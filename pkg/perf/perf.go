@@ -23,7 +23,8 @@ import (
 	"io/fs"
 	"os"
 	"path/filepath"
-	"sort"
+	"sync"
+	"syscall"
 	"time"
 	"unsafe"
 
@@ -39,19 +40,28 @@ import (
 type PerfMapCache struct {
 	logger log.Logger
 
-	cache   *cache.CacheWithEvictionTTL[int, perfMapCacheValue]
+	// Serializes the creation of the cached values, they are updated while
+	// holding their own lock.
+	mtx     sync.Mutex
+	cache   *cache.CacheWithEvictionTTL[int, *perfMapCacheValue]
 	nsCache *namespace.Cache
 
 	tmpDir string
 }
 
 type perfMapCacheValue struct {
-	f *symtab.FileReader
+	mtx sync.Mutex
+	idx *SymbolIndex
 
+	// How much of the perf map was read.
+	offset int64
+
+	// We assume the file is unchanged if the size and modtime are the same as
+	// last time we read it, and was replaced rather than appended to if its
+	// inode changed or it shrank.
 	fileModTime time.Time
 	fileSize    int64
-
-	prevAddrCount uint64
+	fileInode   uint64
 }
 
 var (
@@ -62,58 +72,70 @@ var (
 
 // TODO(kakkoyun): Add Parser type to wrap: fs and logger.
 
+// ReadPerfMap reads the complete lines of a perf map starting at the given
+// offset, writing the symbol names to w. It returns the offset of the first
+// line that wasn't read, a line that is still being written is read the next
+// time.
 func ReadPerfMap(
 	logger log.Logger,
 	fileName string,
+	offset int64,
 	w *symtab.FileWriter,
-	prevAddrCount uint64,
-) (*Map, error) {
+) ([]MapAddr, int64, error) {
 	fd, err := os.Open(fileName)
 	if err != nil {
-		return nil, err
+		return nil, offset, err
 	}
 	defer fd.Close()
 
 	stat, err := fd.Stat()
 	if err != nil {
-		return nil, err
+		return nil, offset, err
 	}
-
-	var addrs []MapAddr
-	if prevAddrCount > 0 {
-		// If we have the previous map we use some stats to preallocate so we
-		// have a good starting point.
-		addrs = make([]MapAddr, 0, prevAddrCount)
-	} else {
-		// Estimate the number of lines in the map file
-		// and allocate a string converter when the file is sufficiently large.
-		const (
-			avgLineLen = 60
-			avgFuncLen = 42
-		)
-		fileSize := stat.Size()
-		linesCount := int(fileSize / avgLineLen)
-		addrs = make([]MapAddr, 0, linesCount)
+	if _, err := fd.Seek(offset, io.SeekStart); err != nil {
+		return nil, offset, err
 	}
 
+	// Estimate the number of lines to read and allocate a string converter
+	// when the file is sufficiently large.
+	const (
+		avgLineLen = 60
+		avgFuncLen = 42
+	)
+	linesCount := int((stat.Size() - offset) / avgLineLen)
+	addrs := make([]MapAddr, 0, max(linesCount, 0))
+
 	r := bufio.NewReader(fd)
 	i := 0
 	var multiError error
 	for {
 		b, err := r.ReadSlice('\n')
+		if errors.Is(err, bufio.ErrBufferFull) {
+			// Skip lines longer than the buffer, no symbol is that long.
+			n, err := skipLine(r)
+			if err != nil {
+				break
+			}
+			offset += int64(len(b)) + n
+			multiError = errors.Join(multiError, fmt.Errorf("parse perf map line %d: line too long", i))
+			i++
+			continue
+		}
 		if err != nil {
 			if errors.Is(err, io.EOF) {
+				// Either the end of the file or of what was written so far.
 				break
 			}
-			return nil, fmt.Errorf("read perf map line: %w", err)
+			return nil, offset, fmt.Errorf("read perf map line: %w", err)
 		}
+		offset += int64(len(b))
 
 		line, err := parsePerfMapLine(b, w)
 		if err != nil {
 			multiError = errors.Join(multiError, fmt.Errorf("parse perf map line %d: %w", i, err))
+		} else {
+			addrs = append(addrs, line)
 		}
-
-		addrs = append(addrs, line)
 		i++
 	}
 
@@ -121,21 +143,19 @@ func ReadPerfMap(
 		level.Debug(logger).Log("msg", "some perf map lines failed to be parsed, this is somewhat expected, but this log line exists for potential troubleshooting", "err", multiError)
 	}
 
-	if len(addrs) == 0 {
-		return nil, ErrEmptyPerfMap
-	}
-
-	// Sorted by end address to allow binary search during look-up. End to find
-	// the (closest) address _before_ the end. This could be an inlined instruction
-	// within a larger blob.
-	sort.SliceStable(addrs, func(i, j int) bool {
-		return addrs[i].End < addrs[j].End
-	})
+	return addrs, offset, nil
+}
 
-	return &Map{
-		Path:  fileName,
-		addrs: addrs,
-	}, nil
+// skipLine discards the rest of a line, returning how many bytes it read.
+func skipLine(r *bufio.Reader) (int64, error) {
+	var n int64
+	for {
+		b, err := r.ReadSlice('\n')
+		n += int64(len(b))
+		if !errors.Is(err, bufio.ErrBufferFull) {
+			return n, err
+		}
+	}
 }
 
 func parsePerfMapLine(b []byte, w *symtab.FileWriter) (MapAddr, error) {
@@ -204,17 +224,13 @@ func NewPerfMapCache(logger log.Logger, reg prometheus.Registerer, nsCache *name
 		tmpDir:  tmpDir,
 	}
 
-	f := func(key int, value perfMapCacheValue) {
-		if err := value.f.Close(); err != nil {
-			level.Error(logger).Log("msg", "failed to close perf map file", "err", err)
-		}
-
-		if err := os.Remove(c.path(key)); err != nil {
-			level.Error(logger).Log("msg", "failed to remove perf map file", "err", err)
+	f := func(key int, value *perfMapCacheValue) {
+		if err := value.idx.Close(); err != nil {
+			level.Error(logger).Log("msg", "failed to remove perf map symbols", "err", err)
 		}
 	}
 
-	c.cache = cache.NewLRUCacheWithEvictionTTL[int, perfMapCacheValue](
+	c.cache = cache.NewLRUCacheWithEvictionTTL[int, *perfMapCacheValue](
 		prometheus.WrapRegistererWith(prometheus.Labels{"cache": "perf_map_cache"}, reg),
 		512,
 		10*profilingDuration,
@@ -228,8 +244,9 @@ func (p *PerfMapCache) path(pid int) string {
 	return filepath.Join(p.tmpDir, fmt.Sprintf("perf-%d.symtab", pid))
 }
 
-// MapForPID returns the Map for the given pid if it exists.
-func (p *PerfMapCache) PerfMapForPID(pid int) (*symtab.FileReader, error) {
+// PerfMapForPID returns the symbols of the perf map of the given pid if it
+// exists, reading the lines that were appended to it since the last call.
+func (p *PerfMapCache) PerfMapForPID(pid int) (*SymbolIndex, error) {
 	// NOTE(zecke): There are various limitations and things to note.
 	// 1st) The input file is "tainted" and under control by the user. By all
 	//      means it could be an infinitely large.
@@ -252,79 +269,54 @@ func (p *PerfMapCache) PerfMapForPID(pid int) (*symtab.FileReader, error) {
 		return nil, err
 	}
 
+	p.mtx.Lock()
 	v, ok := p.cache.Get(pid)
-	if ok {
-		if v.fileModTime == info.ModTime() && v.fileSize == info.Size() {
-			return v.f, nil
-		}
-		level.Debug(p.logger).Log("msg", "cached value is outdated", "pid", pid)
-		if err := v.f.Close(); err != nil {
-			level.Error(p.logger).Log("msg", "failed to close optimized symtab", "err", err, "pid", pid)
-		}
-	}
-
-	f, addrCount, err := optimizeAndOpenPerfMap(
-		p.logger,
-		perfFile,
-		p.path(pid),
-		v.prevAddrCount,
-	)
-	if err != nil {
-		return nil, err
-	}
-
-	p.cache.Add(pid, perfMapCacheValue{
-		f:           f,
-		fileModTime: info.ModTime(),
-		fileSize:    info.Size(),
-
-		prevAddrCount: addrCount,
-	})
-
-	return f, nil
-}
-
-func optimizeAndOpenPerfMap(
-	logger log.Logger,
-	perfMapFile string,
-	outFile string,
-	prevAddrCount uint64,
-) (*symtab.FileReader, uint64, error) {
-	w, err := symtab.NewWriter(outFile, 0)
-	if err != nil {
-		return nil, 0, err
+	if !ok {
+		v = &perfMapCacheValue{idx: newSymbolIndex(p.path(pid))}
+		p.cache.Add(pid, v)
 	}
+	p.mtx.Unlock()
 
-	m, err := ReadPerfMap(logger, perfMapFile, w, prevAddrCount)
-	if err != nil {
-		return nil, 0, err
-	}
+	v.mtx.Lock()
+	defer v.mtx.Unlock()
 
-	indices := m.DeduplicatedIndices()
-	i := indices.Iterator()
-	for i.HasNext() {
-		e := m.addrs[i.Next()]
-		if err := w.WriteEntry(symtab.Entry{
-			Address: e.Start,
-			Offset:  e.SymbolOffset,
-			Len:     e.SymbolLen,
-		}); err != nil {
-			return nil, 0, err
+	if v.fileModTime == info.ModTime() && v.fileSize == info.Size() {
+		if v.idx.Empty() {
+			return nil, ErrEmptyPerfMap
 		}
+		return v.idx, nil
 	}
 
-	if err := w.WriteHeader(); err != nil {
-		return nil, 0, err
+	inode := fileInode(info)
+	if inode != v.fileInode || info.Size() < v.offset {
+		level.Debug(p.logger).Log("msg", "perf map was replaced", "pid", pid)
+		v.idx.reset()
+		v.offset = 0
 	}
 
-	if err := w.Close(); err != nil {
-		return nil, 0, err
+	offset := v.offset
+	if err := v.idx.update(func(w *symtab.FileWriter) ([]MapAddr, error) {
+		var addrs []MapAddr
+		addrs, offset, err = ReadPerfMap(p.logger, perfFile, v.offset, w)
+		return addrs, err
+	}); err != nil {
+		return nil, err
 	}
+	v.offset = offset
+	v.fileModTime = info.ModTime()
+	v.fileSize = info.Size()
+	v.fileInode = inode
 
-	f, err := symtab.NewReader(outFile)
-	if err != nil {
-		return nil, 0, err
+	if v.idx.Empty() {
+		return nil, ErrEmptyPerfMap
 	}
+	return v.idx, nil
+}
 
-	return f, indices.GetCardinality(), nil
+// fileInode returns the inode of a file, or 0 if it's unknown.
+func fileInode(info os.FileInfo) uint64 {
+	if stat, ok := info.Sys().(*syscall.Stat_t); ok {
+		return stat.Ino
+	}
+	return 0
 }
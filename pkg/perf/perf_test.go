@@ -14,6 +14,7 @@
 package perf
 
 import (
+	"fmt"
 	"os"
 	"testing"
 
@@ -31,22 +32,38 @@ func createTestFile(tb testing.TB) string {
 	return f.Name()
 }
 
+// readPerfMap reads the perf map at the given offset into the index,
+// returning the new offset.
+func readPerfMap(tb testing.TB, idx *SymbolIndex, fileName string, offset int64) int64 {
+	tb.Helper()
+	require.NoError(tb, idx.update(func(w *symtab.FileWriter) ([]MapAddr, error) {
+		var (
+			addrs []MapAddr
+			err   error
+		)
+		addrs, offset, err = ReadPerfMap(log.NewNopLogger(), fileName, offset, w)
+		return addrs, err
+	}))
+	return offset
+}
+
+func symbolCount(idx *SymbolIndex) uint64 {
+	var n uint64
+	for _, seg := range idx.segments {
+		n += seg.symbols
+	}
+	return n
+}
+
 func TestPerfMapParse(t *testing.T) {
-	filename := createTestFile(t)
-	defer os.Remove(filename)
+	idx := newSymbolIndex(createTestFile(t))
+	defer idx.Close()
 
-	f, _, err := optimizeAndOpenPerfMap(
-		log.NewNopLogger(),
-		"testdata/nodejs-perf-map",
-		filename,
-		0,
-	)
-	require.NoError(t, err)
-	h := f.Header()
-	require.Equal(t, 28, int(h.AddressesCount))
+	readPerfMap(t, idx, "testdata/nodejs-perf-map", 0)
+	require.Equal(t, 28, int(symbolCount(idx)))
 
 	// Look-up a symbol.
-	sym, err := f.Symbolize(0x4edd4f12 + 4)
+	sym, err := idx.Symbolize(0x4edd4f12 + 4)
 	require.NoError(t, err)
 	require.Equal(t, "LazyCompile:~remove internal/linkedlist.js:15", sym)
 }
@@ -63,61 +80,100 @@ func TestPerfMapCorruptLine(t *testing.T) {
 }
 
 func TestPerfMapRegression(t *testing.T) {
-	filename := createTestFile(t)
-	defer os.Remove(filename)
+	idx := newSymbolIndex(createTestFile(t))
+	defer idx.Close()
 
-	_, _, err := optimizeAndOpenPerfMap(
-		log.NewNopLogger(),
-		"testdata/nodejs-perf-map-regression",
-		filename,
-		0,
-	)
-	require.NoError(t, err)
+	readPerfMap(t, idx, "testdata/nodejs-perf-map-regression", 0)
 }
 
 func TestPerfMapParseErlangPerfMap(t *testing.T) {
-	filename := createTestFile(t)
-	defer os.Remove(filename)
+	idx := newSymbolIndex(createTestFile(t))
+	defer idx.Close()
 
-	_, _, err := optimizeAndOpenPerfMap(
-		log.NewNopLogger(),
-		"testdata/erlang-perf-map",
-		filename,
-		0,
-	)
-	require.NoError(t, err)
+	readPerfMap(t, idx, "testdata/erlang-perf-map", 0)
+}
+
+func TestPerfMapIncremental(t *testing.T) {
+	perfMap := createTestFile(t)
+	idx := newSymbolIndex(createTestFile(t))
+	defer idx.Close()
+
+	appendLines := func(lines string) {
+		f, err := os.OpenFile(perfMap, os.O_APPEND|os.O_WRONLY, 0)
+		require.NoError(t, err)
+		_, err = f.WriteString(lines)
+		require.NoError(t, err)
+		require.NoError(t, f.Close())
+	}
+	requireSymbol := func(addr uint64, expected string) {
+		t.Helper()
+		sym, err := idx.Symbolize(addr)
+		if expected == "" {
+			require.ErrorIs(t, err, symtab.ErrSymbolNotFound)
+			return
+		}
+		require.NoError(t, err)
+		require.Equal(t, expected, sym)
+	}
+
+	// The last line is still being written.
+	appendLines("100 10 a\n200 10 b\n300 10 c\n500 10 h\n600 10 i\n700 10 j\n800 10 k\n400 1")
+	offset := readPerfMap(t, idx, perfMap, 0)
+	requireSymbol(0x105, "a")
+	requireSymbol(0x305, "c")
+	requireSymbol(0x315, "")
+	requireSymbol(0x405, "")
+
+	// Replaces b, and partially overlaps c.
+	// Completes the last line.
+	generation := idx.Generation()
+	appendLines("0 d\n200 10 e\n308 10 f\n")
+	offset = readPerfMap(t, idx, perfMap, offset)
+	require.Len(t, idx.segments, 2)
+	require.NotEqual(t, generation, idx.Generation())
+	requireSymbol(0x105, "a")
+	requireSymbol(0x205, "e")
+	requireSymbol(0x305, "c")
+	requireSymbol(0x309, "f")
+	requireSymbol(0x405, "d")
+
+	// Enough symbols to be merged with the previous ones.
+	lines := ""
+	for i := 0; i < 10; i++ {
+		lines += fmt.Sprintf("%x 10 g%d\n", 0x1000+i*0x10, i)
+	}
+	appendLines(lines)
+	offset = readPerfMap(t, idx, perfMap, offset)
+	require.Len(t, idx.segments, 1)
+	requireSymbol(0x105, "a")
+	requireSymbol(0x205, "e")
+	// The older symbol overlapping a newer one was dropped.
+	requireSymbol(0x305, "")
+	requireSymbol(0x309, "f")
+	requireSymbol(0x405, "d")
+	requireSymbol(0x1095, "g9")
+	requireSymbol(0x10a5, "")
+
+	// Nothing new, the symbols didn't change.
+	generation = idx.Generation()
+	readPerfMap(t, idx, perfMap, offset)
+	require.Equal(t, generation, idx.Generation())
 }
 
 func BenchmarkPerfMapParse(b *testing.B) {
-	logger := log.NewNopLogger()
 	b.ResetTimer()
 	for i := 0; i < b.N; i++ {
-		filename := createTestFile(b)
-
-		_, _, err := optimizeAndOpenPerfMap(
-			logger,
-			"testdata/nodejs-perf-map",
-			filename,
-			0,
-		)
-		require.NoError(b, err)
-		require.NoError(b, os.Remove(filename))
+		idx := newSymbolIndex(createTestFile(b))
+		readPerfMap(b, idx, "testdata/nodejs-perf-map", 0)
+		require.NoError(b, idx.Close())
 	}
 }
 
 func BenchmarkPerfMapParseBig(b *testing.B) {
-	logger := log.NewNopLogger()
 	b.ResetTimer()
 	for i := 0; i < b.N; i++ {
-		filename := createTestFile(b)
-
-		_, _, err := optimizeAndOpenPerfMap(
-			logger,
-			"testdata/erlang-perf-map",
-			filename,
-			0,
-		)
-		require.NoError(b, err)
-		require.NoError(b, os.Remove(filename))
+		idx := newSymbolIndex(createTestFile(b))
+		readPerfMap(b, idx, "testdata/erlang-perf-map", 0)
+		require.NoError(b, idx.Close())
 	}
 }
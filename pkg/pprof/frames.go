@@ -0,0 +1,84 @@
+// Copyright 2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package pprof
+
+import (
+	"slices"
+	"sync"
+
+	"github.com/parca-dev/parca-agent/pkg/process"
+)
+
+// The mapping index of JIT frames symbolized with the perf map.
+const perfMapFrame = -1
+
+// processFrames is what the frames of a process resolved to in the previous
+// profiling rounds. A long-running process mostly hits the same code paths
+// every round, so symbolizing them again is wasted work. The pprof locations
+// and functions themselves are rebuilt, as their IDs and mappings are local
+// to a profile, but from the interned results.
+type processFrames struct {
+	// Held for the whole conversion of a profile of the process.
+	mtx sync.Mutex
+
+	// The mappings the frames were resolved with. The frames are forgotten
+	// when they change, e.g. when a library is loaded or the PID is reused.
+	mappings []*process.Mapping
+	// The generations of the jitdump and perf map indexes the JIT frames
+	// were symbolized with.
+	jitGenerations []uint64
+
+	vdso        map[uint64]string
+	jit         map[uint64]jitFrame
+	interpreter map[uint32]interpreterFrame
+}
+
+type jitFrame struct {
+	symbol string
+	// The index of the jitdump mapping the symbol was found in, or
+	// perfMapFrame.
+	mappingIndex int
+	found        bool
+}
+
+type interpreterFrame struct {
+	name     string
+	filename string
+}
+
+func newProcessFrames(mappings []*process.Mapping) *processFrames {
+	return &processFrames{
+		mappings:    mappings,
+		vdso:        map[uint64]string{},
+		jit:         map[uint64]jitFrame{},
+		interpreter: map[uint32]interpreterFrame{},
+	}
+}
+
+// resolvedWith returns true if the frames were resolved with the given
+// mappings. The mappings of a process are only fetched again when they
+// changed, so it's enough to compare them by identity.
+func (f *processFrames) resolvedWith(mappings []*process.Mapping) bool {
+	return slices.Equal(f.mappings, mappings)
+}
+
+// checkJITGenerations forgets the JIT frames if the symbols of the jitdumps or
+// the perf map changed since they were symbolized.
+func (f *processFrames) checkJITGenerations(generations []uint64) {
+	if slices.Equal(f.jitGenerations, generations) {
+		return
+	}
+	f.jitGenerations = generations
+	clear(f.jit)
+}
@@ -0,0 +1,100 @@
+// Copyright 2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package pprof
+
+import (
+	"context"
+	"testing"
+	"time"
+
+	"github.com/go-kit/log"
+	"github.com/prometheus/client_golang/prometheus"
+	"github.com/prometheus/procfs"
+	"github.com/stretchr/testify/require"
+
+	"github.com/parca-dev/parca-agent/pkg/process"
+	"github.com/parca-dev/parca-agent/pkg/profile"
+)
+
+type countingVDSOSymbolizer struct {
+	calls int
+}
+
+func (s *countingVDSOSymbolizer) Resolve(_ *process.Mapping, _ uint64) (string, error) {
+	s.calls++
+	return "__vdso_clock_gettime", nil
+}
+
+func TestConverterProcessFrames(t *testing.T) {
+	vdso := &countingVDSOSymbolizer{}
+	m := NewManager(log.NewNopLogger(), prometheus.NewRegistry(), nil, nil, nil, vdso, false, time.Second)
+
+	mappings := process.Mappings{
+		{ProcMap: &procfs.ProcMap{StartAddr: 0x1000, EndAddr: 0x2000, Pathname: "[vdso]"}},
+	}
+	symbols := profile.InterpreterSymbolTable{
+		1: {ModuleName: "Foo", Name: "bar", Filename: "foo.rb"},
+	}
+	samples := []profile.RawSample{{
+		UserStack:        []uint64{0x1100},
+		InterpreterStack: []uint64{1, 2},
+		Value:            1,
+	}}
+
+	convert := func(mappings process.Mappings, symbols profile.InterpreterSymbolTable) []string {
+		t.Helper()
+		p, _, err := m.NewConverter(procfs.FS{}, 1, mappings, time.Now(), 1, symbols, KernelSymbols{}).Convert(context.Background(), samples)
+		require.NoError(t, err)
+		require.Len(t, p.Sample, 1)
+
+		var functions []string
+		for _, l := range p.Sample[0].Location {
+			functions = append(functions, l.Line[0].Function.Name)
+		}
+		return functions
+	}
+
+	require.Equal(t, []string{"Foo::bar", "<not found>", "__vdso_clock_gettime"}, convert(mappings, symbols))
+	require.Equal(t, 1, vdso.calls)
+
+	// The frames are remembered, but not the missing interpreter symbol.
+	symbols[2] = &profile.Function{Name: "baz"}
+	require.Equal(t, []string{"Foo::bar", "baz", "__vdso_clock_gettime"}, convert(mappings, symbols))
+	require.Equal(t, 1, vdso.calls)
+
+	// The frames are forgotten when the mappings change.
+	mappings = process.Mappings{
+		{ProcMap: &procfs.ProcMap{StartAddr: 0x1000, EndAddr: 0x2000, Pathname: "[vdso]"}},
+	}
+	require.Equal(t, []string{"Foo::bar", "baz", "__vdso_clock_gettime"}, convert(mappings, symbols))
+	require.Equal(t, 2, vdso.calls)
+}
+
+func TestConverterDegradedSamples(t *testing.T) {
+	m := NewManager(log.NewNopLogger(), prometheus.NewRegistry(), nil, nil, nil, &countingVDSOSymbolizer{}, false, time.Second)
+
+	mappings := process.Mappings{
+		{ProcMap: &procfs.ProcMap{StartAddr: 0x1000, EndAddr: 0x2000, Pathname: "[vdso]"}},
+	}
+	samples := []profile.RawSample{
+		{UserStack: []uint64{0x1100}, Value: 1},
+		{UserStack: []uint64{0x1100}, Value: 2, Degraded: true},
+	}
+
+	p, _, err := m.NewConverter(procfs.FS{}, 1, mappings, time.Now(), 1, nil, KernelSymbols{}).Convert(context.Background(), samples)
+	require.NoError(t, err)
+	require.Len(t, p.Sample, 2)
+	require.Empty(t, p.Sample[0].Label[unwindingLabel])
+	require.Equal(t, []string{unwindingDegraded}, p.Sample[1].Label[unwindingLabel])
+}
@@ -0,0 +1,104 @@
+// Copyright 2022-2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package pprof
+
+import (
+	"sort"
+
+	pprofprofile "github.com/google/pprof/profile"
+)
+
+// mappingIndex finds the mapping containing an address with a binary search
+// over the mappings sorted by start address, rather than scanning all of them
+// for every frame, as processes like JVMs have hundreds of mappings.
+type mappingIndex struct {
+	mappings []*pprofprofile.Mapping
+
+	// The non-empty mappings sorted by start address, and their index in
+	// mappings.
+	starts  []uint64
+	limits  []uint64
+	indices []int
+
+	// The mappings of a process don't overlap, if they do anyway the first
+	// one containing an address is found by scanning all of them, as before.
+	overlapping bool
+
+	// The mapping of the last address, consecutive frames are often in the
+	// same one.
+	last int
+}
+
+func newMappingIndex(mappings []*pprofprofile.Mapping) *mappingIndex {
+	indices := make([]int, 0, len(mappings))
+	for i, m := range mappings {
+		if m.Start < m.Limit {
+			indices = append(indices, i)
+		}
+	}
+	sort.Slice(indices, func(i, j int) bool {
+		return mappings[indices[i]].Start < mappings[indices[j]].Start
+	})
+
+	idx := &mappingIndex{
+		mappings: mappings,
+		starts:   make([]uint64, len(indices)),
+		limits:   make([]uint64, len(indices)),
+		indices:  indices,
+		last:     -1,
+	}
+	for i, j := range indices {
+		idx.starts[i] = mappings[j].Start
+		idx.limits[i] = mappings[j].Limit
+		if i > 0 && idx.starts[i] < idx.limits[i-1] {
+			idx.overlapping = true
+		}
+	}
+	return idx
+}
+
+// find returns the index of the mapping containing the address, or -1.
+func (idx *mappingIndex) find(addr uint64) int {
+	if idx.overlapping {
+		return mappingForAddr(idx.mappings, addr)
+	}
+	if idx.last != -1 && idx.starts[idx.last] <= addr && addr < idx.limits[idx.last] {
+		return idx.indices[idx.last]
+	}
+
+	// The first mapping starting after the address.
+	i, j := 0, len(idx.starts)
+	for i < j {
+		h := int(uint(i+j) >> 1)
+		if idx.starts[h] <= addr {
+			i = h + 1
+		} else {
+			j = h
+		}
+	}
+	if i == 0 || addr >= idx.limits[i-1] {
+		return -1
+	}
+	idx.last = i - 1
+	return idx.indices[i-1]
+}
+
+func mappingForAddr(mappings []*pprofprofile.Mapping, addr uint64) int {
+	for i, m := range mappings {
+		if m.Start <= addr && addr < m.Limit {
+			return i
+		}
+	}
+	return -1
+}
@@ -0,0 +1,138 @@
+// Copyright 2022-2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package pprof
+
+import (
+	"bufio"
+	"math/rand"
+	"os"
+	"strconv"
+	"strings"
+	"testing"
+
+	pprofprofile "github.com/google/pprof/profile"
+	"github.com/stretchr/testify/require"
+)
+
+// readMappings reads the mappings recorded from /proc/<pid>/maps, followed by
+// the empty kernel and interpreter mappings, like the Converter's.
+func readMappings(tb testing.TB, path string) []*pprofprofile.Mapping {
+	tb.Helper()
+
+	f, err := os.Open(path)
+	require.NoError(tb, err)
+	defer f.Close()
+
+	var mappings []*pprofprofile.Mapping
+	s := bufio.NewScanner(f)
+	for s.Scan() {
+		fields := strings.Fields(s.Text())
+		start, limit, ok := strings.Cut(fields[0], "-")
+		require.True(tb, ok)
+		m := &pprofprofile.Mapping{ID: uint64(len(mappings) + 1)}
+		m.Start, err = strconv.ParseUint(start, 16, 64)
+		require.NoError(tb, err)
+		m.Limit, err = strconv.ParseUint(limit, 16, 64)
+		require.NoError(tb, err)
+		if len(fields) > 5 {
+			m.File = fields[5]
+		}
+		mappings = append(mappings, m)
+	}
+	require.NoError(tb, s.Err())
+
+	return append(mappings,
+		&pprofprofile.Mapping{ID: uint64(len(mappings) + 1), File: "[kernel.kallsyms]"},
+		&pprofprofile.Mapping{ID: uint64(len(mappings) + 2), File: "interpreter"},
+	)
+}
+
+// stackAddresses returns the addresses of the user stacks of the given
+// number of samples, mostly within mappings, and mostly the same ones.
+func stackAddresses(mappings []*pprofprofile.Mapping, samples int) []uint64 {
+	r := rand.New(rand.NewSource(1))
+	hot := make([]*pprofprofile.Mapping, 0, 10)
+	for len(hot) < cap(hot) {
+		if m := mappings[r.Intn(len(mappings))]; m.Start < m.Limit {
+			hot = append(hot, m)
+		}
+	}
+
+	addrs := make([]uint64, 0, samples*30)
+	for i := 0; i < samples*30; i++ {
+		m := hot[r.Intn(len(hot))]
+		if r.Intn(4) == 0 {
+			m = mappings[r.Intn(len(mappings))]
+		}
+		addr := m.Start + uint64(r.Int63n(int64(m.Limit-m.Start+1)))
+		if r.Intn(100) == 0 {
+			// Outside of any mapping, or right at the end of one.
+			addr = uint64(r.Int63())
+		}
+		addrs = append(addrs, addr)
+	}
+	return addrs
+}
+
+func TestMappingIndex(t *testing.T) {
+	mappings := readMappings(t, "testdata/python-maps")
+	idx := newMappingIndex(mappings)
+	require.False(t, idx.overlapping)
+
+	for _, addr := range stackAddresses(mappings, 1000) {
+		require.Equal(t, mappingForAddr(mappings, addr), idx.find(addr))
+	}
+	for _, m := range mappings[:len(mappings)-2] {
+		require.Equal(t, mappingForAddr(mappings, m.Start), idx.find(m.Start))
+		require.Equal(t, mappingForAddr(mappings, m.Limit), idx.find(m.Limit))
+		require.Equal(t, mappingForAddr(mappings, m.Start-1), idx.find(m.Start-1))
+	}
+}
+
+func TestMappingIndexOverlapping(t *testing.T) {
+	mappings := []*pprofprofile.Mapping{
+		{Start: 0x2000, Limit: 0x3000},
+		{Start: 0x1000, Limit: 0x2800},
+		{},
+	}
+	idx := newMappingIndex(mappings)
+	require.True(t, idx.overlapping)
+	require.Equal(t, 1, idx.find(0x1000))
+	require.Equal(t, 0, idx.find(0x2400))
+	require.Equal(t, -1, idx.find(0x3000))
+}
+
+func BenchmarkMappingForAddr(b *testing.B) {
+	mappings := readMappings(b, "testdata/python-maps")
+	addrs := stackAddresses(mappings, 10_000)
+
+	b.Run("linear", func(b *testing.B) {
+		b.ReportAllocs()
+		for n := 0; n < b.N; n++ {
+			for _, addr := range addrs {
+				mappingForAddr(mappings, addr)
+			}
+		}
+	})
+
+	b.Run("index", func(b *testing.B) {
+		b.ReportAllocs()
+		for n := 0; n < b.N; n++ {
+			idx := newMappingIndex(mappings)
+			for _, addr := range addrs {
+				idx.find(addr)
+			}
+		}
+	})
+}
@@ -21,11 +21,16 @@ import (
 const (
 	labelFrameDropReasonMappingNil          = "mapping_nil"
 	labelStackDropReasonNormalizationFailed = "normalization_failed"
+
+	labelFrameCacheHit  = "hit"
+	labelFrameCacheMiss = "miss"
 )
 
 type converterMetrics struct {
 	frameDrop *prometheus.CounterVec
 	stackDrop *prometheus.CounterVec
+	// Lookups of the frames resolved in the previous rounds.
+	frameCache *prometheus.CounterVec
 }
 
 func newConverterMetrics(reg prometheus.Registerer) *converterMetrics {
@@ -46,9 +51,19 @@ func newConverterMetrics(reg prometheus.Registerer) *converterMetrics {
 			},
 			[]string{"reason"},
 		),
+		frameCache: promauto.With(reg).NewCounterVec(
+			prometheus.CounterOpts{
+				Name:        "parca_agent_profiler_converter_frame_cache_requests_total",
+				Help:        "Total number of symbolized frames looked up in the previous profiling rounds of their process, by whether they were found.",
+				ConstLabels: map[string]string{"type": "cpu"},
+			},
+			[]string{"result"},
+		),
 	}
 
 	m.frameDrop.WithLabelValues(labelFrameDropReasonMappingNil)
+	m.frameCache.WithLabelValues(labelFrameCacheHit)
+	m.frameCache.WithLabelValues(labelFrameCacheMiss)
 
 	return m
 }
@@ -28,12 +28,20 @@ import (
 	"github.com/prometheus/client_golang/prometheus"
 	"github.com/prometheus/procfs"
 
+	"github.com/parca-dev/parca-agent/pkg/cache"
 	"github.com/parca-dev/parca-agent/pkg/js"
 	"github.com/parca-dev/parca-agent/pkg/ksym"
 	"github.com/parca-dev/parca-agent/pkg/perf"
 	"github.com/parca-dev/parca-agent/pkg/process"
 	"github.com/parca-dev/parca-agent/pkg/profile"
-	"github.com/parca-dev/parca-agent/pkg/symtab"
+)
+
+const (
+	// Upper bound of the number of processes whose frames are remembered.
+	maxProcessFrames = 4096
+	// The frames of a process are forgotten when it wasn't profiled for this
+	// many rounds, usually because it exited.
+	processFramesRounds = 10
 )
 
 type VDSOSymbolizer interface {
@@ -49,6 +57,9 @@ type Manager struct {
 	perfMapCache            *perf.PerfMapCache
 	jitdumpCache            *perf.JITDumpCache
 	disableJITSymbolization bool
+
+	// What the frames of the recently profiled processes resolved to, by PID.
+	frames *cache.CacheWithTTL[int, *processFrames]
 }
 
 func NewManager(
@@ -59,6 +70,7 @@ func NewManager(
 	jitdumpCache *perf.JITDumpCache,
 	vdsoSymbolizer VDSOSymbolizer,
 	disableJITSymbolization bool,
+	profilingDuration time.Duration,
 ) *Manager {
 	return &Manager{
 		logger:                  logger,
@@ -68,7 +80,27 @@ func NewManager(
 		jitdumpCache:            jitdumpCache,
 		vdsoSymbolizer:          vdsoSymbolizer,
 		disableJITSymbolization: disableJITSymbolization,
+		frames: cache.NewLRUCacheWithTTL[int, *processFrames](
+			prometheus.WrapRegistererWith(prometheus.Labels{"cache": "process_frames"}, reg),
+			maxProcessFrames,
+			processFramesRounds*profilingDuration,
+			cache.CacheWithTTLOptions{
+				UpdateDeadlineOnGet: true,
+				RemoveExpiredOnAdd:  true,
+			},
+		),
+	}
+}
+
+// processFrames returns the frames of a process resolved in the previous
+// rounds, or new ones if its mappings changed since.
+func (m *Manager) processFrames(pid int, mappings []*process.Mapping) *processFrames {
+	if f, ok := m.frames.Get(pid); ok && f.resolvedWith(mappings) {
+		return f
 	}
+	f := newProcessFrames(mappings)
+	m.frames.Add(pid, f)
+	return f
 }
 
 type Converter struct {
@@ -77,16 +109,21 @@ type Converter struct {
 
 	// We already have the perf map cache but it Stats() the perf map on every
 	// cache retrieval, but we only want to do that once per conversion.
-	cachedPerfMap    *symtab.FileReader
+	cachedPerfMap    *perf.SymbolIndex
 	cachedPerfMapErr error
 
 	// If the key is unchanged, then it's impossible to have evicted the value,
 	// therefore it's safe to use the file reader from the previous read. In
 	// practice there is usually no more than 1 jitdump per process anyway.
 	cachedJITDumpKey string
-	cachedJITDump    *symtab.FileReader
+	cachedJITDump    *perf.SymbolIndex
 	cachedJITDumpErr error
 
+	// The frames resolved in the previous rounds, and the generations of the
+	// JIT symbols in this one, nil until a JIT frame is seen.
+	frames         *processFrames
+	jitGenerations []uint64
+
 	functionIndex            map[functionKey]*pprofprofile.Function
 	addrLocationIndex        map[uint64]*pprofprofile.Location
 	perfmapLocationIndex     map[string]*pprofprofile.Location
@@ -98,16 +135,20 @@ type Converter struct {
 	pfs                    procfs.FS
 	pid                    int
 	mappings               []*process.Mapping
+	mappingIndex           *mappingIndex
 	kernelMapping          *pprofprofile.Mapping
 	executableInfos        []*profilestorepb.ExecutableInfo
 	interpreterMapping     *pprofprofile.Mapping
 	interpreterSymbolTable profile.InterpreterSymbolTable
+	kernelSymbols          KernelSymbols
 
 	threadNameCache map[int]string
 
 	result *pprofprofile.Profile
 }
 
+// NewConverter returns a converter for the profile of a process. The kernel
+// symbols are resolved by the converter if kernelSymbols is nil.
 func (m *Manager) NewConverter(
 	pfs procfs.FS,
 	pid int,
@@ -115,6 +156,7 @@ func (m *Manager) NewConverter(
 	captureTime time.Time,
 	periodNS int64,
 	interpreterSymbolTable profile.InterpreterSymbolTable,
+	kernelSymbols KernelSymbols,
 ) *Converter {
 	pprofMappings := mappings.ConvertToPprof()
 	kernelMapping := &pprofprofile.Mapping{
@@ -133,6 +175,8 @@ func (m *Manager) NewConverter(
 		m:      m,
 		logger: log.With(m.logger, "pid", pid),
 
+		frames: m.processFrames(pid, mappings),
+
 		functionIndex:            map[functionKey]*pprofprofile.Function{},
 		addrLocationIndex:        map[uint64]*pprofprofile.Location{},
 		perfmapLocationIndex:     map[string]*pprofprofile.Location{},
@@ -144,10 +188,12 @@ func (m *Manager) NewConverter(
 		pfs:                    pfs,
 		pid:                    pid,
 		mappings:               mappings,
+		mappingIndex:           newMappingIndex(pprofMappings),
 		kernelMapping:          kernelMapping,
 		executableInfos:        make([]*profilestorepb.ExecutableInfo, len(pprofMappings)),
 		interpreterMapping:     interpreterMapping,
 		interpreterSymbolTable: interpreterSymbolTable,
+		kernelSymbols:          kernelSymbols,
 
 		threadNameCache: map[int]string{},
 
@@ -172,22 +218,57 @@ func (m *Manager) NewConverter(
 const (
 	threadIDLabel   = "thread_id"
 	threadNameLabel = "thread_name"
+	unwindingLabel  = "unwinding"
+
+	unwindingDegraded = "degraded"
 )
 
-// Convert converts a profile to a pprof profile. It is intended to only be
-// used once.
-func (c *Converter) Convert(ctx context.Context, rawData []profile.RawSample) (*pprofprofile.Profile, []*profilestorepb.ExecutableInfo, error) {
+// KernelSymbols is the read-only table of the kernel symbols of a profiling
+// round, shared by the converters of all the processes.
+type KernelSymbols map[uint64]string
+
+// ResolveKernelSymbols resolves the kernel addresses of all the processes at
+// once, as most of them, like the syscall entry points or the scheduler, are
+// in the stacks of many processes.
+func (m *Manager) ResolveKernelSymbols(rawData profile.RawData) KernelSymbols {
 	kernelAddresses := map[uint64]struct{}{}
-	for _, sample := range rawData {
-		for _, addr := range sample.KernelStack {
-			kernelAddresses[addr] = struct{}{}
+	for _, perProcessRawData := range rawData {
+		for _, sample := range perProcessRawData.RawSamples {
+			for _, addr := range sample.KernelStack {
+				kernelAddresses[addr] = struct{}{}
+			}
 		}
 	}
 
-	kernelSymbols, err := c.m.ksym.Resolve(kernelAddresses)
+	kernelSymbols, err := m.ksym.Resolve(kernelAddresses)
 	if err != nil {
-		level.Debug(c.logger).Log("msg", "failed to resolve kernel symbols skipping profile", "err", err)
-		kernelSymbols = map[uint64]string{}
+		level.Debug(m.logger).Log("msg", "failed to resolve kernel symbols", "err", err)
+		return KernelSymbols{}
+	}
+	return kernelSymbols
+}
+
+// Convert converts a profile to a pprof profile. It is intended to only be
+// used once.
+func (c *Converter) Convert(ctx context.Context, rawData []profile.RawSample) (*pprofprofile.Profile, []*profilestorepb.ExecutableInfo, error) {
+	c.frames.mtx.Lock()
+	defer c.frames.mtx.Unlock()
+
+	kernelSymbols := c.kernelSymbols
+	if kernelSymbols == nil {
+		kernelAddresses := map[uint64]struct{}{}
+		for _, sample := range rawData {
+			for _, addr := range sample.KernelStack {
+				kernelAddresses[addr] = struct{}{}
+			}
+		}
+
+		var err error
+		kernelSymbols, err = c.m.ksym.Resolve(kernelAddresses)
+		if err != nil {
+			level.Debug(c.logger).Log("msg", "failed to resolve kernel symbols skipping profile", "err", err)
+			kernelSymbols = KernelSymbols{}
+		}
 	}
 
 	proc, err := c.pfs.Proc(c.pid)
@@ -215,7 +296,7 @@ func (c *Converter) Convert(ctx context.Context, rawData []profile.RawSample) (*
 		failedToNormalize := false
 
 		for _, addr := range sample.UserStack {
-			mappingIndex := mappingForAddr(c.result.Mapping, addr)
+			mappingIndex := c.mappingIndex.find(addr)
 			if mappingIndex == -1 {
 				c.m.metrics.frameDrop.WithLabelValues(labelFrameDropReasonMappingNil).Inc()
 				// Normalization will fail anyway, so we can skip this frame.
@@ -230,7 +311,7 @@ func (c *Converter) Convert(ctx context.Context, rawData []profile.RawSample) (*
 			case processMapping.NoFileMapping:
 				pprofSample.Location = append(pprofSample.Location, c.addJITLocation(c.mappings, pprofMapping, addr))
 			case processMapping.IsJITDump:
-				pprofSample.Location = append(pprofSample.Location, c.addJITDumpLocation(pprofMapping, addr, pprofMapping.File))
+				pprofSample.Location = append(pprofSample.Location, c.addJITDumpLocation(mappingIndex, pprofMapping, addr, pprofMapping.File))
 			default:
 				ei := c.addExecutableInfo(processMapping, addr)
 				c.executableInfos[mappingIndex] = ei
@@ -254,6 +335,9 @@ func (c *Converter) Convert(ctx context.Context, rawData []profile.RawSample) (*
 		if threadName != "" {
 			pprofSample.Label[threadNameLabel] = append(pprofSample.Label[threadNameLabel], threadName)
 		}
+		if sample.Degraded {
+			pprofSample.Label[unwindingLabel] = append(pprofSample.Label[unwindingLabel], unwindingDegraded)
+		}
 
 		c.result.Sample = append(c.result.Sample, pprofSample)
 	}
@@ -261,18 +345,9 @@ func (c *Converter) Convert(ctx context.Context, rawData []profile.RawSample) (*
 	return c.result, c.executableInfos, nil
 }
 
-func mappingForAddr(mappings []*pprofprofile.Mapping, addr uint64) int {
-	for i, m := range mappings {
-		if m.Start <= addr && addr < m.Limit {
-			return i
-		}
-	}
-	return -1
-}
-
 func (c *Converter) addKernelLocation(
 	m *pprofprofile.Mapping,
-	kernelSymbols map[uint64]string,
+	kernelSymbols KernelSymbols,
 	addr uint64,
 ) *pprofprofile.Location {
 	kernelSymbol, ok := kernelSymbols[addr]
@@ -298,29 +373,40 @@ func (c *Converter) addKernelLocation(
 	return l
 }
 
-func (c *Converter) interpreterSymbol(frameID uint32) *profile.Function {
-	interpreterSymbol, ok := c.interpreterSymbolTable[frameID]
+// interpreterFrame returns the function of an interpreter symbol. The IDs of
+// the symbols are never reused, so they can be remembered across rounds.
+func (c *Converter) interpreterFrame(symbolID uint32) interpreterFrame {
+	if f, ok := c.frames.interpreter[symbolID]; ok {
+		c.m.metrics.frameCache.WithLabelValues(labelFrameCacheHit).Inc()
+		return f
+	}
+	c.m.metrics.frameCache.WithLabelValues(labelFrameCacheMiss).Inc()
+
+	interpreterSymbol, ok := c.interpreterSymbolTable[symbolID]
 	if !ok {
-		return &profile.Function{Name: "<not found>"}
+		// The symbol table might be updated by the next round.
+		return interpreterFrame{name: "<not found>"}
 	}
-	return interpreterSymbol
+	f := interpreterFrame{name: interpreterSymbol.FullName(), filename: interpreterSymbol.Filename}
+	c.frames.interpreter[symbolID] = f
+	return f
 }
 
 func (c *Converter) addInterpreterLocation(frameID uint64) *pprofprofile.Location {
 	lineno := uint32(frameID >> 32)
 	symbolID := uint32(frameID)
 
-	interpreterSymbol := c.interpreterSymbol(symbolID)
-
 	if l, ok := c.interpreterLocationIndex[symbolID]; ok {
 		return l
 	}
 
+	interpreterSymbol := c.interpreterFrame(symbolID)
+
 	l := &pprofprofile.Location{
 		ID:      uint64(len(c.result.Location)) + 1,
 		Mapping: c.interpreterMapping,
 		Line: []pprofprofile.Line{{
-			Function: c.addFunction(interpreterSymbol.FullName(), interpreterSymbol.Filename),
+			Function: c.addFunction(interpreterSymbol.name, interpreterSymbol.filename),
 			Line:     int64(lineno),
 		}},
 	}
@@ -335,11 +421,7 @@ func (c *Converter) addVDSOLocation(
 	m *pprofprofile.Mapping,
 	addr uint64,
 ) *pprofprofile.Location {
-	functionName, err := c.m.vdsoSymbolizer.Resolve(processMapping, addr)
-	if err != nil {
-		level.Debug(c.logger).Log("msg", "failed to symbolize VDSO address", "address", strconv.FormatUint(addr, 16), "err", err)
-		functionName = "unknown"
-	}
+	functionName := c.vdsoFunctionName(processMapping, addr)
 
 	if l, ok := c.vdsoLocationIndex[functionName]; ok {
 		return l
@@ -359,6 +441,22 @@ func (c *Converter) addVDSOLocation(
 	return l
 }
 
+func (c *Converter) vdsoFunctionName(processMapping *process.Mapping, addr uint64) string {
+	if functionName, ok := c.frames.vdso[addr]; ok {
+		c.m.metrics.frameCache.WithLabelValues(labelFrameCacheHit).Inc()
+		return functionName
+	}
+	c.m.metrics.frameCache.WithLabelValues(labelFrameCacheMiss).Inc()
+
+	functionName, err := c.m.vdsoSymbolizer.Resolve(processMapping, addr)
+	if err != nil {
+		level.Debug(c.logger).Log("msg", "failed to symbolize VDSO address", "address", strconv.FormatUint(addr, 16), "err", err)
+		return "unknown"
+	}
+	c.frames.vdso[addr] = functionName
+	return functionName
+}
+
 func (c *Converter) addExecutableInfo(
 	processMapping *process.Mapping,
 	addr uint64,
@@ -397,15 +495,22 @@ func (c *Converter) addJITLocation(
 		return c.addAddrLocation(m, addr)
 	}
 
-	// We have an address that does not have a backing file, therefore we first
-	// try to symbolize using any of the mappings we've found to be jitdumps.
-	// Unfortunately this is unspecified and different JITs do different
-	// things. Eg. nodejs correctly annotates mappings with their backing
-	// jitdump file, but Julia does not.
+	f := c.jitFrame(addr, func() jitFrame {
+		return c.symbolizeJIT(mappings, addr)
+	})
+	return c.addJITFrameLocation(m, addr, f)
+}
+
+// symbolizeJIT symbolizes an address that does not have a backing file.
+func (c *Converter) symbolizeJIT(mappings process.Mappings, addr uint64) jitFrame {
+	// We first try to symbolize using any of the mappings we've found to be
+	// jitdumps. Unfortunately this is unspecified and different JITs do
+	// different things. Eg. nodejs correctly annotates mappings with their
+	// backing jitdump file, but Julia does not.
 	for i, mapping := range mappings {
 		if mapping.IsJITDump {
-			if l := c.getJITDumpLocation(c.result.Mapping[i], addr, mapping.Pathname); l != nil {
-				return l
+			if f := c.symbolizeJITDump(i, addr, mapping.Pathname); f.found {
+				return f
 			}
 		}
 	}
@@ -416,22 +521,79 @@ func (c *Converter) addJITLocation(
 	}
 
 	if perfMap == nil {
-		return c.addAddrLocation(m, addr)
+		return jitFrame{}
 	}
 
 	symbol, err := perfMap.Symbolize(addr)
 	if err != nil {
 		level.Debug(c.logger).Log("msg", "failed to lookup symbol for JITed address", "pid", c.pid, "address", strconv.FormatUint(addr, 16), "err", err)
+		return jitFrame{}
+	}
+
+	return jitFrame{symbol: symbol, mappingIndex: perfMapFrame, found: true}
+}
+
+// jitFrame returns what a JIT'd address resolved to in the previous rounds,
+// unless the JIT symbols changed since, or symbolizes it.
+func (c *Converter) jitFrame(addr uint64, symbolize func() jitFrame) jitFrame {
+	if c.jitGenerations == nil {
+		c.jitGenerations = c.jitSymbolGenerations()
+		c.frames.checkJITGenerations(c.jitGenerations)
+	}
+
+	if f, ok := c.frames.jit[addr]; ok {
+		c.m.metrics.frameCache.WithLabelValues(labelFrameCacheHit).Inc()
+		return f
+	}
+	c.m.metrics.frameCache.WithLabelValues(labelFrameCacheMiss).Inc()
+
+	f := symbolize()
+	c.frames.jit[addr] = f
+	return f
+}
+
+// jitSymbolGenerations returns the generations of the symbols of the jitdumps
+// and the perf map of the process, 0 for the ones that are unavailable.
+func (c *Converter) jitSymbolGenerations() []uint64 {
+	generations := []uint64{}
+	for _, mapping := range c.mappings {
+		if !mapping.IsJITDump {
+			continue
+		}
+		var generation uint64
+		if jitdump, err := c.jitdump(mapping.Pathname); jitdump != nil && err == nil {
+			generation = jitdump.Generation()
+		}
+		generations = append(generations, generation)
+	}
+
+	var generation uint64
+	if perfMap, err := c.perfMap(); perfMap != nil && err == nil {
+		generation = perfMap.Generation()
+	}
+	return append(generations, generation)
+}
+
+// addJITFrameLocation adds the location of a symbolized JIT'd address.
+func (c *Converter) addJITFrameLocation(m *pprofprofile.Mapping, addr uint64, f jitFrame) *pprofprofile.Location {
+	if !f.found {
 		return c.addAddrLocation(m, addr)
 	}
 
-	if l, ok := c.perfmapLocationIndex[symbol]; ok {
+	index := c.jitdumpLocationIndex
+	if f.mappingIndex == perfMapFrame {
+		index = c.perfmapLocationIndex
+	} else {
+		m = c.result.Mapping[f.mappingIndex]
+	}
+
+	if l, ok := index[f.symbol]; ok {
 		return l
 	}
 
-	l := c.locationFromSymbol(m, symbol)
+	l := c.locationFromSymbol(m, f.symbol)
 
-	c.perfmapLocationIndex[symbol] = l
+	index[f.symbol] = l
 	c.result.Location = append(c.result.Location, l)
 	return l
 }
@@ -461,7 +623,7 @@ func (c *Converter) locationFromSymbol(m *pprofprofile.Mapping, symbol string) *
 	}
 }
 
-func (c *Converter) perfMap() (*symtab.FileReader, error) {
+func (c *Converter) perfMap() (*perf.SymbolIndex, error) {
 	if c.cachedPerfMap != nil || c.cachedPerfMapErr != nil {
 		return c.cachedPerfMap, c.cachedPerfMapErr
 	}
@@ -471,6 +633,7 @@ func (c *Converter) perfMap() (*symtab.FileReader, error) {
 }
 
 func (c *Converter) addJITDumpLocation(
+	mappingIndex int,
 	m *pprofprofile.Mapping,
 	addr uint64,
 	path string,
@@ -479,44 +642,33 @@ func (c *Converter) addJITDumpLocation(
 		return c.addAddrLocation(m, addr)
 	}
 
-	if l := c.getJITDumpLocation(m, addr, path); l != nil {
-		return l
-	}
-
-	return c.addAddrLocation(m, addr)
+	f := c.jitFrame(addr, func() jitFrame {
+		return c.symbolizeJITDump(mappingIndex, addr, path)
+	})
+	return c.addJITFrameLocation(m, addr, f)
 }
 
-func (c *Converter) getJITDumpLocation(
-	m *pprofprofile.Mapping,
-	addr uint64,
-	path string,
-) *pprofprofile.Location {
+// symbolizeJITDump symbolizes an address with the jitdump of the mapping at
+// the given index.
+func (c *Converter) symbolizeJITDump(mappingIndex int, addr uint64, path string) jitFrame {
 	jitdump, err := c.jitdump(path)
 	if err != nil {
 		level.Debug(c.logger).Log("msg", "failed to fetch jitdump", "pid", c.pid, "path", path, "err", err)
 	}
 
 	if jitdump == nil {
-		return nil
+		return jitFrame{}
 	}
 
 	symbol, err := jitdump.Symbolize(addr)
 	if err != nil {
-		return nil
+		return jitFrame{}
 	}
 
-	if l, ok := c.jitdumpLocationIndex[symbol]; ok {
-		return l
-	}
-
-	l := c.locationFromSymbol(m, symbol)
-
-	c.jitdumpLocationIndex[symbol] = l
-	c.result.Location = append(c.result.Location, l)
-	return l
+	return jitFrame{symbol: symbol, mappingIndex: mappingIndex, found: true}
 }
 
-func (c *Converter) jitdump(path string) (*symtab.FileReader, error) {
+func (c *Converter) jitdump(path string) (*perf.SymbolIndex, error) {
 	if c.cachedJITDumpKey == path {
 		return c.cachedJITDump, c.cachedJITDumpErr
 	}
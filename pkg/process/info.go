@@ -130,6 +130,7 @@ type InfoManager struct {
 	procFS           procfs.FS
 	objFilePool      *objectfile.Pool
 	mapManager       *MapManager
+	interpreters     *interpreter.Fetcher
 	debuginfoManager DebuginfoManager
 	labelManager     LabelManager
 
@@ -144,6 +145,7 @@ func NewInfoManager(
 	proceFS procfs.FS,
 	objFilePool *objectfile.Pool,
 	mm *MapManager,
+	interpreters *interpreter.Fetcher,
 	dim DebuginfoManager,
 	lm LabelManager,
 	profilingDuration time.Duration,
@@ -175,6 +177,7 @@ func NewInfoManager(
 		procFS:           proceFS,
 		objFilePool:      objFilePool,
 		mapManager:       mm,
+		interpreters:     interpreters,
 		debuginfoManager: dim,
 		labelManager:     lm,
 
@@ -289,7 +292,7 @@ func (im *InfoManager) fetch(ctx context.Context, pid int, checkMappings bool) (
 	// Fetch interpreter information.
 	// At this point we cannot tell if a process is a Python or Ruby interpreter so,
 	// we will pay the cost for the excluded one if only one of them enabled.
-	interp, err := interpreter.Fetch(proc)
+	interp, err := im.interpreters.Fetch(proc)
 	if err != nil {
 		level.Debug(im.logger).Log("msg", "failed to fetch interpreter information", "err", err, "pid", pid)
 	}
@@ -241,9 +241,9 @@ func (mm *MapManager) NewUserMapping(pm *procfs.ProcMap, pid int) (*Mapping, err
 		return nil, fmt.Errorf("failed to open mapped object file: %w", err)
 	}
 
-	ef, err := obj.ELF()
+	analysis, err := m.mm.objFilePool.Analyze(m.AbsolutePath())
 	if err != nil {
-		return nil, fmt.Errorf("failed to get ELF file: %w", err)
+		return nil, fmt.Errorf("failed to analyze mapped object file: %w", err)
 	}
 
 	m.BuildID = obj.BuildID
@@ -253,7 +253,7 @@ func (mm *MapManager) NewUserMapping(pm *procfs.ProcMap, pid int) (*Mapping, err
 	// value until we have a sample address for this mapping, so that we can
 	// correctly identify the associated program segment that is needed to compute
 	// the base.
-	m.executableInfo = m.extractExecutableInfoWithoutAddress(ef)
+	m.executableInfo = m.extractExecutableInfoWithoutAddress(analysis)
 	return m, nil
 }
 
@@ -291,20 +291,15 @@ func (m *Mapping) AbsolutePath() string {
 // findProgramHeader returns the program segment that matches the current
 // mapping and the given address, or an error if it cannot find a unique program
 // header.
-func (m *Mapping) findProgramHeader(ef *elf.File, addr uint64) (*elf.ProgHeader, error) {
+func (m *Mapping) findProgramHeader(analysis *objectfile.Analysis, addr uint64) (*elf.ProgHeader, error) {
 	// For user space executables, we try to find the actual program segment that
 	// is associated with the given mapping. Skip this search if limit <= start.
 	if m.StartAddr >= m.EndAddr || uint64(m.EndAddr) >= (uint64(1)<<63) {
-		return elfreader.FindTextProgHeader(ef), nil
+		return analysis.TextSegment, nil
 	}
 
-	// Fetch all the loadable segments.
-	var phdrs []elf.ProgHeader
-	for i := range ef.Progs {
-		if ef.Progs[i].Type == elf.PT_LOAD {
-			phdrs = append(phdrs, ef.Progs[i].ProgHeader)
-		}
-	}
+	// All the loadable segments.
+	phdrs := analysis.LoadSegments
 	// Some ELF files don't contain any loadable program segments, e.g. .ko
 	// kernel modules. It's not an error to have no header in such cases.
 	if len(phdrs) == 0 {
@@ -324,7 +319,7 @@ func (m *Mapping) findProgramHeader(ef *elf.File, addr uint64) (*elf.ProgHeader,
 	return elfreader.HeaderForFileOffset(headers, addr-uint64(m.StartAddr)+uint64(m.Offset))
 }
 
-func (m *Mapping) extractExecutableInfo(ef *elf.File, addr uint64) (*profilestorepb.ExecutableInfo, error) {
+func (m *Mapping) extractExecutableInfo(analysis *objectfile.Analysis, addr uint64) (*profilestorepb.ExecutableInfo, error) {
 	if m == nil {
 		return nil, nil //nolint:nilnil
 	}
@@ -332,13 +327,13 @@ func (m *Mapping) extractExecutableInfo(ef *elf.File, addr uint64) (*profilestor
 		return nil, fmt.Errorf("specified address %x is outside the mapping range [%x, %x]", addr, m.StartAddr, m.EndAddr)
 	}
 
-	loadSegment, err := m.findProgramHeader(ef, addr)
+	loadSegment, err := m.findProgramHeader(analysis, addr)
 	if err != nil {
 		return nil, fmt.Errorf("failed to find program header for mapping %#v: %w", m, err)
 	}
 
 	res := &profilestorepb.ExecutableInfo{
-		ElfType: uint32(ef.FileHeader.Type),
+		ElfType: uint32(analysis.Type),
 	}
 
 	if loadSegment != nil {
@@ -366,11 +361,11 @@ func (m *Mapping) Normalize(addr uint64) (uint64, error) {
 	)
 }
 
-func (m *Mapping) extractExecutableInfoWithoutAddress(ef *elf.File) *profilestorepb.ExecutableInfo {
-	loadSegment := elfreader.FindTextProgHeader(ef)
+func (m *Mapping) extractExecutableInfoWithoutAddress(analysis *objectfile.Analysis) *profilestorepb.ExecutableInfo {
+	loadSegment := analysis.TextSegment
 
 	res := &profilestorepb.ExecutableInfo{
-		ElfType: uint32(ef.FileHeader.Type),
+		ElfType: uint32(analysis.Type),
 	}
 
 	if loadSegment != nil {
@@ -414,19 +409,13 @@ func (m *Mapping) ExecutableInfo(addr uint64) (*profilestorepb.ExecutableInfo, e
 				}
 			}
 
-			obj, err := m.mm.objFilePool.Open(path)
-			if err != nil {
-				m.executableInfoErr = fmt.Errorf("failed to open mapped object file: %w", err)
-				return
-			}
-
-			ef, err := obj.ELF()
+			analysis, err := m.mm.objFilePool.Analyze(path)
 			if err != nil {
-				m.executableInfoErr = fmt.Errorf("failed to get ELF file: %w", err)
+				m.executableInfoErr = fmt.Errorf("failed to analyze mapped object file: %w", err)
 				return
 			}
 
-			executableInfo, err := m.extractExecutableInfo(ef, addr)
+			executableInfo, err := m.extractExecutableInfo(analysis, addr)
 			if err != nil {
 				m.executableInfoErr = fmt.Errorf("failed to compute base: %w", err)
 				return
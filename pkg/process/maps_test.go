@@ -147,7 +147,12 @@ func TestComputeBase(t *testing.T) {
 				os.Remove(dummyFile.Name())
 			})
 
-			executableInfo, err := tc.mapping.extractExecutableInfo(tc.file, tc.addr)
+			var analysis *objectfile.Analysis
+			if tc.file != nil {
+				analysis, err = objectfile.AnalyzeELF(tc.file, "")
+				require.NoError(t, err)
+			}
+			executableInfo, err := tc.mapping.extractExecutableInfo(analysis, tc.addr)
 			if (err != nil) != tc.wantError {
 				t.Errorf("got error %v, want any error=%v", err, tc.wantError)
 			}
@@ -31,6 +31,9 @@ type RawSample struct {
 	// frame.
 	InterpreterStack []uint64
 	Value            uint64
+	// The user stack was walked with frame pointers, as the unwind
+	// information of the process wasn't available yet.
+	Degraded bool
 }
 
 type RawData []ProcessRawData
@@ -0,0 +1,359 @@
+// Copyright 2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package profiler
+
+import (
+	"context"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"io"
+	"os"
+	"path/filepath"
+	"sort"
+	"sync"
+	"time"
+
+	"github.com/apache/arrow/go/v14/arrow"
+	"github.com/apache/arrow/go/v14/arrow/array"
+	"github.com/apache/arrow/go/v14/arrow/ipc"
+	"github.com/apache/arrow/go/v14/arrow/memory"
+	"github.com/go-kit/log"
+	"github.com/go-kit/log/level"
+	pprofprofile "github.com/google/pprof/profile"
+	profilestorepb "github.com/parca-dev/parca/gen/proto/go/parca/profilestore/v1alpha1"
+	"github.com/parca-dev/parca/pkg/parcacol"
+	"github.com/prometheus/common/model"
+
+	"github.com/parca-dev/parca-agent/pkg/profile"
+)
+
+const (
+	columnLabelsPrefix = "labels."
+	columnStacktrace   = "stacktrace"
+	columnValuePrefix  = "value."
+	columnTimestamp    = "timestamp"
+	columnDuration     = "duration"
+	columnPeriod       = "period"
+)
+
+var errNotPprof = errors.New("columnar store only supports pprof profiles")
+
+// ColumnarStore is a profile store that accumulates the profiles of all the
+// processes into one Arrow record, with a row per sample, instead of a gzipped
+// pprof per profile. The locations of the stacks and the label values are
+// dictionary-encoded, so the ones shared by many processes, like the ones of
+// the C library or the node labels, are only encoded once per batch.
+//
+// Native addresses are normalized, so the locations of the same binary are
+// shared regardless of where it's mapped. There is a value column per sample
+// type, named after its type and unit.
+type ColumnarStore struct {
+	mem memory.Allocator
+
+	mtx      sync.Mutex
+	profiles []columnarProfile
+}
+
+type columnarProfile struct {
+	labels model.LabelSet
+	// The value column of each of the values of the samples.
+	valueNames []string
+	timestamp  int64
+	duration   int64
+	period     int64
+	samples    []columnarSample
+}
+
+type columnarSample struct {
+	// Encoded with appendLocation.
+	stack  []string
+	values []int64
+}
+
+// NewColumnarStore returns a new ColumnarStore allocating the records with the
+// given allocator.
+func NewColumnarStore(mem memory.Allocator) *ColumnarStore {
+	return &ColumnarStore{mem: mem}
+}
+
+// Store adds a profile to the batch.
+func (s *ColumnarStore) Store(_ context.Context, labels model.LabelSet, prof profile.Writer, ei []*profilestorepb.ExecutableInfo) error {
+	p, ok := prof.(*pprofprofile.Profile)
+	if !ok {
+		return errNotPprof
+	}
+
+	cp := columnarProfile{
+		labels:     labels,
+		valueNames: make([]string, 0, len(p.SampleType)),
+		timestamp:  p.TimeNanos,
+		duration:   p.DurationNanos,
+		period:     p.Period,
+		samples:    make([]columnarSample, 0, len(p.Sample)),
+	}
+	for _, st := range p.SampleType {
+		cp.valueNames = append(cp.valueNames, st.Type+"."+st.Unit)
+	}
+
+	var (
+		locations = make(map[uint64]string, len(p.Location))
+		buf       []byte
+	)
+	for _, sample := range p.Sample {
+		stack := make([]string, 0, len(sample.Location))
+		for _, l := range sample.Location {
+			key, ok := locations[l.ID]
+			if !ok {
+				buf = appendLocation(buf[:0], l, ei)
+				key = string(buf)
+				locations[l.ID] = key
+			}
+			stack = append(stack, key)
+		}
+
+		if len(sample.Value) != len(cp.valueNames) {
+			return fmt.Errorf("sample has %d values, the profile has %d sample types", len(sample.Value), len(cp.valueNames))
+		}
+		cp.samples = append(cp.samples, columnarSample{stack: stack, values: sample.Value})
+	}
+
+	s.mtx.Lock()
+	s.profiles = append(s.profiles, cp)
+	s.mtx.Unlock()
+	return nil
+}
+
+// Flush writes the batch as an Arrow IPC stream, compressed with zstd, and
+// starts a new one. Nothing is written if the batch is empty.
+func (s *ColumnarStore) Flush(w io.Writer) error {
+	s.mtx.Lock()
+	profiles := s.profiles
+	s.profiles = nil
+	s.mtx.Unlock()
+
+	if len(profiles) == 0 {
+		return nil
+	}
+
+	schema, labelNames, valueNames := columnarSchema(profiles)
+	rb := array.NewRecordBuilder(s.mem, schema)
+	defer rb.Release()
+
+	n, v := len(labelNames), len(valueNames)
+	var (
+		labels     = make([]*array.BinaryDictionaryBuilder, n)
+		stacktrace = rb.Field(n).(*array.ListBuilder)                           //nolint:forcetypeassert
+		locations  = stacktrace.ValueBuilder().(*array.BinaryDictionaryBuilder) //nolint:forcetypeassert
+		values     = make([]*array.Int64Builder, v)
+		timestamp  = rb.Field(n + v + 1).(*array.Int64Builder) //nolint:forcetypeassert
+		duration   = rb.Field(n + v + 2).(*array.Int64Builder) //nolint:forcetypeassert
+		period     = rb.Field(n + v + 3).(*array.Int64Builder) //nolint:forcetypeassert
+	)
+	for i := range labels {
+		labels[i] = rb.Field(i).(*array.BinaryDictionaryBuilder) //nolint:forcetypeassert
+	}
+	for i := range values {
+		values[i] = rb.Field(n + 1 + i).(*array.Int64Builder) //nolint:forcetypeassert
+	}
+
+	// The index of each value column in the values of the samples of a
+	// profile, or -1 if the profile doesn't have it.
+	valueIndex := make([]int, v)
+	for _, p := range profiles {
+		for i, name := range valueNames {
+			valueIndex[i] = -1
+			for j, pname := range p.valueNames {
+				if pname == name {
+					valueIndex[i] = j
+					break
+				}
+			}
+		}
+
+		for _, sample := range p.samples {
+			for i, b := range labels {
+				v, ok := p.labels[labelNames[i]]
+				if !ok {
+					b.AppendNull()
+					continue
+				}
+				if err := b.AppendString(string(v)); err != nil {
+					return err
+				}
+			}
+
+			stacktrace.Append(true)
+			for _, l := range sample.stack {
+				if err := locations.AppendString(l); err != nil {
+					return err
+				}
+			}
+
+			for i, b := range values {
+				if valueIndex[i] < 0 {
+					b.AppendNull()
+					continue
+				}
+				b.Append(sample.values[valueIndex[i]])
+			}
+			timestamp.Append(p.timestamp)
+			duration.Append(p.duration)
+			period.Append(p.period)
+		}
+	}
+
+	rec := rb.NewRecord()
+	defer rec.Release()
+
+	iw := ipc.NewWriter(w, ipc.WithSchema(schema), ipc.WithAllocator(s.mem), ipc.WithZstd())
+	if err := iw.Write(rec); err != nil {
+		iw.Close()
+		return err
+	}
+	return iw.Close()
+}
+
+// columnarSchema returns the schema of the record of the given profiles, with
+// a column per label name and per value name, and the label and value names,
+// sorted.
+func columnarSchema(profiles []columnarProfile) (*arrow.Schema, []model.LabelName, []string) {
+	names := map[model.LabelName]struct{}{}
+	values := map[string]struct{}{}
+	for _, p := range profiles {
+		for name := range p.labels {
+			names[name] = struct{}{}
+		}
+		for _, name := range p.valueNames {
+			values[name] = struct{}{}
+		}
+	}
+	sortedNames := make([]model.LabelName, 0, len(names))
+	for name := range names {
+		sortedNames = append(sortedNames, name)
+	}
+	sort.Slice(sortedNames, func(i, j int) bool {
+		return sortedNames[i] < sortedNames[j]
+	})
+	sortedValues := make([]string, 0, len(values))
+	for name := range values {
+		sortedValues = append(sortedValues, name)
+	}
+	sort.Strings(sortedValues)
+
+	dictionary := &arrow.DictionaryType{
+		IndexType: arrow.PrimitiveTypes.Uint32,
+		ValueType: arrow.BinaryTypes.Binary,
+	}
+	fields := make([]arrow.Field, 0, len(sortedNames)+len(sortedValues)+4)
+	for _, name := range sortedNames {
+		fields = append(fields, arrow.Field{Name: columnLabelsPrefix + string(name), Type: dictionary, Nullable: true})
+	}
+	fields = append(fields, arrow.Field{Name: columnStacktrace, Type: arrow.ListOf(dictionary)})
+	for _, name := range sortedValues {
+		fields = append(fields, arrow.Field{Name: columnValuePrefix + name, Type: arrow.PrimitiveTypes.Int64, Nullable: true})
+	}
+	fields = append(fields,
+		arrow.Field{Name: columnTimestamp, Type: arrow.PrimitiveTypes.Int64},
+		arrow.Field{Name: columnDuration, Type: arrow.PrimitiveTypes.Int64},
+		arrow.Field{Name: columnPeriod, Type: arrow.PrimitiveTypes.Int64},
+	)
+	return arrow.NewSchema(fields, nil), sortedNames, sortedValues
+}
+
+// Run flushes the batch to a new file in the given directory at the given
+// interval, and once more when the context is done.
+func (s *ColumnarStore) Run(ctx context.Context, logger log.Logger, dir string, interval time.Duration) error {
+	if err := os.MkdirAll(dir, 0o755); err != nil {
+		return fmt.Errorf("could not use local store dir, %s: %w", dir, err)
+	}
+
+	ticker := time.NewTicker(interval)
+	defer ticker.Stop()
+	for {
+		select {
+		case <-ctx.Done():
+			return s.flushToFile(dir)
+		case <-ticker.C:
+			if err := s.flushToFile(dir); err != nil {
+				level.Warn(logger).Log("msg", "failed to write profiles", "err", err)
+			}
+		}
+	}
+}
+
+// flushToFile flushes the batch to a new file in the given directory, unless
+// it's empty.
+func (s *ColumnarStore) flushToFile(dir string) error {
+	path := filepath.Join(dir, fmt.Sprintf("%d.arrow", time.Now().UnixNano()))
+	f, err := os.OpenFile(path, os.O_RDWR|os.O_CREATE|os.O_EXCL, 0o666)
+	if err != nil {
+		return err
+	}
+	if err := s.Flush(f); err != nil {
+		f.Close()
+		os.Remove(path)
+		return err
+	}
+	info, err := f.Stat()
+	if err != nil {
+		f.Close()
+		return err
+	}
+	if err := f.Close(); err != nil {
+		return err
+	}
+	if info.Size() == 0 {
+		return os.Remove(path)
+	}
+	return nil
+}
+
+// appendLocation appends the encoding of a location to the buffer: the build
+// ID and file of its mapping, its normalized address, and its lines, if it was
+// symbolized by the agent.
+func appendLocation(buf []byte, l *pprofprofile.Location, ei []*profilestorepb.ExecutableInfo) []byte {
+	addr := l.Address
+	if m := l.Mapping; m != nil {
+		buf = appendString(buf, m.BuildID)
+		buf = appendString(buf, m.File)
+		if i := int(m.ID) - 1; i >= 0 && i < len(ei) && ei[i] != nil && addr != 0 {
+			if normalized, err := parcacol.NormalizeAddress(addr, ei[i], m.Start, m.Limit, m.Offset); err == nil {
+				addr = normalized
+			}
+		}
+	} else {
+		buf = appendString(buf, "")
+		buf = appendString(buf, "")
+	}
+	buf = binary.AppendUvarint(buf, addr)
+
+	buf = binary.AppendUvarint(buf, uint64(len(l.Line)))
+	for _, line := range l.Line {
+		if line.Function != nil {
+			buf = appendString(buf, line.Function.Name)
+			buf = appendString(buf, line.Function.Filename)
+		} else {
+			buf = appendString(buf, "")
+			buf = appendString(buf, "")
+		}
+		buf = binary.AppendVarint(buf, line.Line)
+	}
+	return buf
+}
+
+func appendString(buf []byte, s string) []byte {
+	buf = binary.AppendUvarint(buf, uint64(len(s)))
+	return append(buf, s...)
+}
@@ -0,0 +1,285 @@
+// Copyright 2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package profiler
+
+import (
+	"bytes"
+	"context"
+	"debug/elf"
+	"math/rand"
+	"os"
+	"strconv"
+	"strings"
+	"testing"
+	"time"
+
+	"github.com/apache/arrow/go/v14/arrow/array"
+	"github.com/apache/arrow/go/v14/arrow/ipc"
+	"github.com/apache/arrow/go/v14/arrow/memory"
+	"github.com/go-kit/log"
+	pprofprofile "github.com/google/pprof/profile"
+	profilestorepb "github.com/parca-dev/parca/gen/proto/go/parca/profilestore/v1alpha1"
+	"github.com/prometheus/common/model"
+	"github.com/stretchr/testify/require"
+	"google.golang.org/grpc"
+)
+
+// testProfile returns the profile of a process running the same binaries as
+// the other ones, loaded at a different address, with 100 stacks of 20
+// frames.
+func testProfile(pid int) (*pprofprofile.Profile, []*profilestorepb.ExecutableInfo) {
+	libc := &pprofprofile.Mapping{
+		ID:      1,
+		Start:   0x7f0000000000 + uint64(pid)<<24,
+		Limit:   0x7f0000200000 + uint64(pid)<<24,
+		BuildID: "c0ffee",
+		File:    "/usr/lib/libc.so.6",
+	}
+	app := &pprofprofile.Mapping{
+		ID:      2,
+		Start:   0x400000,
+		Limit:   0x800000,
+		BuildID: "app-" + strconv.Itoa(pid%10),
+		File:    "/app",
+	}
+	kernel := &pprofprofile.Mapping{ID: 3, File: "[kernel.kallsyms]"}
+
+	p := &pprofprofile.Profile{
+		TimeNanos:     1e18,
+		DurationNanos: 10e9,
+		Period:        1e9 / 19,
+		SampleType:    []*pprofprofile.ValueType{{Type: "samples", Unit: "count"}},
+		PeriodType:    &pprofprofile.ValueType{Type: "cpu", Unit: "nanoseconds"},
+		Mapping:       []*pprofprofile.Mapping{libc, app, kernel},
+	}
+	for i := 0; i < 50; i++ {
+		f := &pprofprofile.Function{ID: uint64(i + 1), Name: "kernel_function_" + strconv.Itoa(i)}
+		p.Function = append(p.Function, f)
+		p.Location = append(p.Location, &pprofprofile.Location{
+			ID:      uint64(len(p.Location) + 1),
+			Mapping: kernel,
+			Line:    []pprofprofile.Line{{Function: f}},
+		})
+	}
+	for i := 0; i < 200; i++ {
+		p.Location = append(p.Location,
+			&pprofprofile.Location{ID: uint64(len(p.Location) + 1), Mapping: libc, Address: libc.Start + 0x1000 + uint64(i)*0x10},
+			&pprofprofile.Location{ID: uint64(len(p.Location) + 2), Mapping: app, Address: app.Start + 0x1000 + uint64(i)*0x10},
+		)
+	}
+
+	r := rand.New(rand.NewSource(int64(pid))) //nolint:gosec
+	for i := 0; i < 100; i++ {
+		s := &pprofprofile.Sample{Value: []int64{int64(r.Intn(10) + 1)}}
+		for j := 0; j < 20; j++ {
+			s.Location = append(s.Location, p.Location[r.Intn(len(p.Location))])
+		}
+		p.Sample = append(p.Sample, s)
+	}
+
+	ei := []*profilestorepb.ExecutableInfo{
+		{ElfType: uint32(elf.ET_DYN), LoadSegment: &profilestorepb.LoadSegment{}},
+		{ElfType: uint32(elf.ET_EXEC)},
+		nil,
+	}
+	return p, ei
+}
+
+func testLabels(pid int) model.LabelSet {
+	return model.LabelSet{
+		"node": "node-1",
+		"pid":  model.LabelValue(strconv.Itoa(pid)),
+	}
+}
+
+func TestColumnarStore(t *testing.T) {
+	mem := memory.NewCheckedAllocator(memory.NewGoAllocator())
+	defer mem.AssertSize(t, 0)
+
+	s := NewColumnarStore(mem)
+	for pid := 1; pid <= 2; pid++ {
+		p, ei := testProfile(pid)
+		require.NoError(t, s.Store(context.Background(), testLabels(pid), p, ei))
+	}
+
+	buf := bytes.NewBuffer(nil)
+	require.NoError(t, s.Flush(buf))
+
+	r, err := ipc.NewReader(buf, ipc.WithAllocator(mem))
+	require.NoError(t, err)
+	defer r.Release()
+
+	require.True(t, r.Next())
+	rec := r.Record()
+	require.Equal(t, int64(200), rec.NumRows())
+	require.Equal(t, []string{"labels.node", "labels.pid", "stacktrace", "value.samples.count", "timestamp", "duration", "period"}, func() []string {
+		var names []string
+		for _, f := range rec.Schema().Fields() {
+			names = append(names, f.Name)
+		}
+		return names
+	}())
+
+	// The node label is shared by the processes.
+	node := rec.Column(0).(*array.Dictionary) //nolint:forcetypeassert
+	require.Equal(t, 1, node.Dictionary().Len())
+	pid := rec.Column(1).(*array.Dictionary) //nolint:forcetypeassert
+	require.Equal(t, 2, pid.Dictionary().Len())
+
+	// The locations of libc and of the kernel are shared regardless of where
+	// libc is loaded, the ones of the different binaries are not.
+	stacktrace := rec.Column(2).(*array.List)                //nolint:forcetypeassert
+	locations := stacktrace.ListValues().(*array.Dictionary) //nolint:forcetypeassert
+	require.Equal(t, 4000, locations.Len())
+	require.LessOrEqual(t, locations.Dictionary().Len(), 50+200+2*200)
+	require.Greater(t, locations.Dictionary().Len(), 200)
+
+	require.False(t, r.Next())
+	require.NoError(t, r.Err())
+
+	// The batch was reset.
+	buf.Reset()
+	require.NoError(t, s.Flush(buf))
+	require.Equal(t, 0, buf.Len())
+}
+
+func TestColumnarStoreMultipleValues(t *testing.T) {
+	mem := memory.NewCheckedAllocator(memory.NewGoAllocator())
+	defer mem.AssertSize(t, 0)
+
+	s := NewColumnarStore(mem)
+
+	p, ei := testProfile(1)
+	require.NoError(t, s.Store(context.Background(), testLabels(1), p, ei))
+
+	// A profile with another sample type as well.
+	p, ei = testProfile(2)
+	p.SampleType = append(p.SampleType, &pprofprofile.ValueType{Type: "cpu", Unit: "nanoseconds"})
+	for _, sample := range p.Sample {
+		sample.Value = append(sample.Value, sample.Value[0]*int64(p.Period))
+	}
+	require.NoError(t, s.Store(context.Background(), testLabels(2), p, ei))
+
+	// Samples must have a value per sample type.
+	p.Sample[0].Value = p.Sample[0].Value[:1]
+	require.Error(t, s.Store(context.Background(), testLabels(3), p, ei))
+
+	buf := bytes.NewBuffer(nil)
+	require.NoError(t, s.Flush(buf))
+
+	r, err := ipc.NewReader(buf, ipc.WithAllocator(mem))
+	require.NoError(t, err)
+	defer r.Release()
+
+	require.True(t, r.Next())
+	rec := r.Record()
+	require.Equal(t, int64(200), rec.NumRows())
+	require.Equal(t, "value.cpu.nanoseconds", rec.Schema().Field(3).Name)
+	require.Equal(t, "value.samples.count", rec.Schema().Field(4).Name)
+
+	// The first profile has no CPU time values.
+	cpu := rec.Column(3).(*array.Int64) //nolint:forcetypeassert
+	require.Equal(t, 100, cpu.NullN())
+	require.True(t, cpu.IsNull(0))
+	require.False(t, cpu.IsNull(199))
+}
+
+func TestColumnarStoreRun(t *testing.T) {
+	dir := t.TempDir()
+	s := NewColumnarStore(memory.NewGoAllocator())
+
+	p, ei := testProfile(1)
+	require.NoError(t, s.Store(context.Background(), testLabels(1), p, ei))
+
+	// The batch is flushed when the context is done.
+	ctx, cancel := context.WithCancel(context.Background())
+	cancel()
+	require.NoError(t, s.Run(ctx, log.NewNopLogger(), dir, time.Hour))
+
+	// Nothing is written for empty batches.
+	require.NoError(t, s.Run(ctx, log.NewNopLogger(), dir, time.Hour))
+
+	files, err := os.ReadDir(dir)
+	require.NoError(t, err)
+	require.Len(t, files, 1)
+	require.True(t, strings.HasSuffix(files[0].Name(), ".arrow"))
+}
+
+// countingClient is a stand-in for the profile store, counting the bytes of
+// the profiles it receives.
+type countingClient struct {
+	profilestorepb.ProfileStoreServiceClient
+	bytes int
+}
+
+func (c *countingClient) WriteRaw(_ context.Context, r *profilestorepb.WriteRawRequest, _ ...grpc.CallOption) (*profilestorepb.WriteRawResponse, error) {
+	for _, series := range r.GetSeries() {
+		for _, sample := range series.GetSamples() {
+			c.bytes += len(sample.GetRawProfile())
+		}
+	}
+	return &profilestorepb.WriteRawResponse{}, nil
+}
+
+// BenchmarkProfileEncoding compares the CPU time and the bytes it takes to
+// encode the profiles of a round of 100 processes as a gzipped pprof each, and
+// as one columnar batch.
+func BenchmarkProfileEncoding(b *testing.B) {
+	const processes = 100
+
+	profiles := make([]*pprofprofile.Profile, processes)
+	executableInfos := make([][]*profilestorepb.ExecutableInfo, processes)
+	for pid := range profiles {
+		profiles[pid], executableInfos[pid] = testProfile(pid)
+	}
+	ctx := context.Background()
+
+	b.Run("pprof", func(b *testing.B) {
+		client := &countingClient{}
+		s := NewRemoteStore(log.NewNopLogger(), client)
+
+		b.ReportAllocs()
+		b.ResetTimer()
+		for i := 0; i < b.N; i++ {
+			for pid, p := range profiles {
+				if err := s.Store(ctx, testLabels(pid), p, executableInfos[pid]); err != nil {
+					b.Fatal(err)
+				}
+			}
+		}
+		b.ReportMetric(float64(client.bytes)/float64(b.N), "bytes/round")
+	})
+
+	b.Run("columnar", func(b *testing.B) {
+		s := NewColumnarStore(memory.NewGoAllocator())
+		buf := bytes.NewBuffer(nil)
+		var size int
+
+		b.ReportAllocs()
+		b.ResetTimer()
+		for i := 0; i < b.N; i++ {
+			for pid, p := range profiles {
+				if err := s.Store(ctx, testLabels(pid), p, executableInfos[pid]); err != nil {
+					b.Fatal(err)
+				}
+			}
+			buf.Reset()
+			if err := s.Flush(buf); err != nil {
+				b.Fatal(err)
+			}
+			size += buf.Len()
+		}
+		b.ReportMetric(float64(size)/float64(b.N), "bytes/round")
+	})
+}
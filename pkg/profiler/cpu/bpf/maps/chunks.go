@@ -0,0 +1,110 @@
+// Copyright 2022-2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+package bpfmaps
+
+import (
+	"encoding/binary"
+	"errors"
+	"math"
+)
+
+const (
+	// Always need to be in sync with MAX_UNWIND_TABLE_CHUNK_DIRECTORIES.
+	maxUnwindTableChunkDirectories = 1000
+	// Always need to be in sync with MAX_UNWIND_TABLE_CHUNK_DIRECTORY_DEPTH.
+	maxChunkDirectoryDepth = 2
+	// Always need to be in sync with CHUNK_DIRECTORY_MARKER.
+	chunkDirectoryMarker = math.MaxUint64
+	// Most chunks a single executable can have, 27k. As each chunk covers up
+	// to a whole shard, this is way more than would fit in memory, so in
+	// practice executables are only bounded by the unwind table shards and
+	// the space left in the chunk directories map.
+	maxChunksPerExecutable = maxUnwindTableChunks * maxUnwindTableChunks * maxUnwindTableChunks
+
+	chunkInfoSizeBytes = 8 * 5
+	/*
+		typedef struct {
+			u64 executable_id;
+			u64 index;
+		} chunk_directory_key_t;
+	*/
+	chunkDirectoryKeySizeBytes = 8 * 2
+)
+
+var errTooManyChunks = errors.New("executable has more unwind table chunks than the maximum")
+
+// chunkInfo mirrors `chunk_info_t`. It maps a range of PCs to a range of
+// rows in an unwind table shard.
+type chunkInfo struct {
+	lowPC      uint64
+	highPC     uint64
+	shardIndex uint64
+	lowIndex   uint64
+	highIndex  uint64
+}
+
+// chunkDirectory is the layout of the unwind info chunks of an executable.
+// Most executables fit in the top level. For very large ones, every top level
+// entry covers the PC range of a group of up to `maxUnwindTableChunks` entries,
+// stored in `directories` under the index found in the entry's `lowIndex`.
+// These entries can point to a group themselves, up to
+// `maxChunkDirectoryDepth` levels below the top one.
+type chunkDirectory struct {
+	top         []chunkInfo
+	directories [][]chunkInfo
+}
+
+// buildChunkDirectory lays out the chunks, sorted by PC, of an executable. The
+// directories are numbered from base.
+func buildChunkDirectory(chunks []chunkInfo, base uint64) (chunkDirectory, error) {
+	var dir chunkDirectory
+	level := chunks
+	for depth := 0; len(level) > maxUnwindTableChunks; depth++ {
+		if depth == maxChunkDirectoryDepth {
+			return chunkDirectory{}, errTooManyChunks
+		}
+
+		parents := make([]chunkInfo, 0, (len(level)+maxUnwindTableChunks-1)/maxUnwindTableChunks)
+		for low := 0; low < len(level); low += maxUnwindTableChunks {
+			group := level[low:min(low+maxUnwindTableChunks, len(level))]
+			parents = append(parents, chunkInfo{
+				lowPC:      group[0].lowPC,
+				highPC:     group[len(group)-1].highPC,
+				shardIndex: chunkDirectoryMarker,
+				lowIndex:   base + uint64(len(dir.directories)),
+			})
+			dir.directories = append(dir.directories, group)
+		}
+		level = parents
+	}
+	dir.top = level
+	return dir, nil
+}
+
+// encodeChunks writes the chunks as an `unwind_info_chunks_t`. Unused
+// entries are zeroed, which the BPF program uses to find the last chunk.
+func encodeChunks(buf []byte, byteOrder binary.ByteOrder, chunks []chunkInfo) []byte {
+	buf = buf[:unwindShardsSizeBytes]
+	clear(buf)
+	for i, c := range chunks {
+		entry := buf[i*chunkInfoSizeBytes:]
+		byteOrder.PutUint64(entry[0:], c.lowPC)
+		byteOrder.PutUint64(entry[8:], c.highPC)
+		byteOrder.PutUint64(entry[16:], c.shardIndex)
+		byteOrder.PutUint64(entry[24:], c.lowIndex)
+		byteOrder.PutUint64(entry[32:], c.highIndex)
+	}
+	return buf
+}
@@ -0,0 +1,136 @@
+// Copyright 2022-2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+package bpfmaps
+
+import (
+	"encoding/binary"
+	"testing"
+
+	"github.com/stretchr/testify/require"
+)
+
+func testChunks(n int) []chunkInfo {
+	chunks := make([]chunkInfo, 0, n)
+	for i := 0; i < n; i++ {
+		chunks = append(chunks, chunkInfo{
+			lowPC:      uint64(i*100 + 1),
+			highPC:     uint64(i*100 + 99),
+			shardIndex: uint64(i / 2),
+			lowIndex:   uint64(i * 10),
+			highIndex:  uint64(i*10 + 10),
+		})
+	}
+	return chunks
+}
+
+// findChunk mirrors the lookup done in the BPF program.
+func findChunk(dir chunkDirectory, base, pc uint64) (chunkInfo, bool) {
+	search := func(chunks []chunkInfo) (chunkInfo, bool) {
+		for _, c := range chunks {
+			if c.lowPC <= pc && pc <= c.highPC {
+				return c, true
+			}
+		}
+		return chunkInfo{}, false
+	}
+	c, ok := search(dir.top)
+	for depth := 0; ok && depth < maxChunkDirectoryDepth; depth++ {
+		if c.shardIndex != chunkDirectoryMarker {
+			break
+		}
+		c, ok = search(dir.directories[c.lowIndex-base])
+	}
+	if ok && c.shardIndex == chunkDirectoryMarker {
+		return chunkInfo{}, false
+	}
+	return c, ok
+}
+
+func requireAllChunksFound(t *testing.T, dir chunkDirectory, base uint64, chunks []chunkInfo) {
+	t.Helper()
+
+	for _, c := range chunks {
+		for _, pc := range []uint64{c.lowPC, c.highPC} {
+			found, ok := findChunk(dir, base, pc)
+			require.True(t, ok)
+			require.Equal(t, c, found)
+		}
+	}
+	_, ok := findChunk(dir, base, 100)
+	require.False(t, ok)
+}
+
+func TestBuildChunkDirectory(t *testing.T) {
+	// Normal executables only use the top level.
+	chunks := testChunks(maxUnwindTableChunks)
+	dir, err := buildChunkDirectory(chunks, 0)
+	require.NoError(t, err)
+	require.Equal(t, chunks, dir.top)
+	require.Empty(t, dir.directories)
+
+	// Very large ones are split in groups.
+	chunks = testChunks(maxUnwindTableChunks*4 + 7)
+	dir, err = buildChunkDirectory(chunks, 0)
+	require.NoError(t, err)
+	require.Len(t, dir.top, 5)
+	require.Len(t, dir.directories, 5)
+	require.Len(t, dir.directories[4], 7)
+	requireAllChunksFound(t, dir, 0, chunks)
+
+	// Directories are numbered after the ones of other executables.
+	dir, err = buildChunkDirectory(chunks, 42)
+	require.NoError(t, err)
+	require.Equal(t, uint64(42), dir.top[0].lowIndex)
+	requireAllChunksFound(t, dir, 42, chunks)
+}
+
+func TestBuildChunkDirectoryNested(t *testing.T) {
+	// Executables with more chunks than two levels can hold get more levels.
+	chunks := testChunks(maxUnwindTableChunks*maxUnwindTableChunks*3 + 5)
+	dir, err := buildChunkDirectory(chunks, 7)
+	require.NoError(t, err)
+	require.Len(t, dir.top, 4)
+	// 91 groups of chunks, and 4 groups pointing to them.
+	require.Len(t, dir.directories, 91+4)
+	for _, c := range dir.top {
+		require.Equal(t, uint64(chunkDirectoryMarker), c.shardIndex)
+	}
+	requireAllChunksFound(t, dir, 7, chunks)
+
+	// The largest executable that fits.
+	chunks = testChunks(maxChunksPerExecutable)
+	dir, err = buildChunkDirectory(chunks, 0)
+	require.NoError(t, err)
+	require.Len(t, dir.top, maxUnwindTableChunks)
+	requireAllChunksFound(t, dir, 0, chunks[:maxUnwindTableChunks*2])
+	requireAllChunksFound(t, dir, 0, chunks[len(chunks)-maxUnwindTableChunks*2:])
+
+	_, err = buildChunkDirectory(testChunks(maxChunksPerExecutable+1), 0)
+	require.ErrorIs(t, err, errTooManyChunks)
+}
+
+func TestEncodeChunks(t *testing.T) {
+	buf := make([]byte, unwindShardsSizeBytes)
+	for i := range buf {
+		buf[i] = 0xff
+	}
+
+	val := encodeChunks(buf, binary.LittleEndian, testChunks(2))
+	require.Len(t, val, unwindShardsSizeBytes)
+	require.Equal(t, uint64(101), binary.LittleEndian.Uint64(val[chunkInfoSizeBytes:]))
+	require.Equal(t, uint64(20), binary.LittleEndian.Uint64(val[2*chunkInfoSizeBytes-8:]))
+	// Unused entries are zeroed.
+	require.Equal(t, uint64(0), binary.LittleEndian.Uint64(val[2*chunkInfoSizeBytes:]))
+}
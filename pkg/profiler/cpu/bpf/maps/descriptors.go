@@ -0,0 +1,114 @@
+// Copyright 2022-2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+package bpfmaps
+
+import (
+	"bytes"
+	"encoding/binary"
+	"fmt"
+	"unsafe"
+
+	libbpf "github.com/aquasecurity/libbpfgo"
+
+	"github.com/parca-dev/parca-agent/pkg/profiler/pyperf"
+	"github.com/parca-dev/parca-agent/pkg/profiler/rbperf"
+)
+
+// FrameDescriptorsMapName is the map of every interpreter unwinder holding
+// the descriptors of the frames of each version, with the same keys as its
+// version specific offsets.
+const FrameDescriptorsMapName = "frame_descriptors"
+
+// Values of enum interpreter_frame_link.
+const (
+	frameLinkPointer uint32 = iota
+	frameLinkArray
+)
+
+// frameDescriptor mirrors interpreter_frame_descriptor_t in
+// bpf/unwinders/common.h, which drives the frame walker shared by the
+// interpreter unwinders.
+type frameDescriptor struct {
+	FrameLink           uint32
+	FrameSize           uint32
+	CallerOffset        int64
+	CodeOffset          int64
+	CodeBodyOffset      int64
+	StringDataOffset    int64
+	StringHeapPtrOffset int64
+	StringHeapFlag      uint64
+}
+
+// Layout of CRuby's control frames and strings, which haven't changed across
+// the supported versions, other than for embedded strings.
+const (
+	// offsetof(rb_control_frame_t, iseq).
+	rubyIseqOffset = 0x10
+	// offsetof(struct rb_iseq_struct, body).
+	rubyIseqBodyOffset = 0x10
+	// offsetof(struct RString, as).
+	rubyStringAsOffset = 0x10
+	// offsetof(struct RString, as.heap.ptr).
+	rubyStringHeapPtrOffset = rubyStringAsOffset + 0x8
+	// RSTRING_NOEMBED, set in the flags of strings allocated on the heap.
+	rubyStringNoEmbed = 1 << 13
+)
+
+// rubyFrameDescriptor returns the descriptor of the control frames of a Ruby
+// version. They are contiguous, on the VM stack.
+func rubyFrameDescriptor(offsets rbperf.RubyVersionOffsets) frameDescriptor {
+	stringData := int64(rubyStringAsOffset)
+	if offsets.MajorVersion > 3 || (offsets.MajorVersion == 3 && offsets.MinorVersion >= 2) {
+		// Variable Width Allocation moved the embedded characters after the
+		// length, see https://bugs.ruby-lang.org/issues/18239.
+		stringData += 8
+	}
+	return frameDescriptor{
+		FrameLink:           frameLinkArray,
+		FrameSize:           uint32(offsets.ControlFrameSizeof),
+		CodeOffset:          rubyIseqOffset,
+		CodeBodyOffset:      rubyIseqBodyOffset,
+		StringDataOffset:    stringData,
+		StringHeapPtrOffset: rubyStringHeapPtrOffset,
+		StringHeapFlag:      rubyStringNoEmbed,
+	}
+}
+
+// pythonFrameDescriptor returns the descriptor of the frames of a Python
+// version. Each frame points to its caller's, and strings are always
+// embedded.
+func pythonFrameDescriptor(offsets pyperf.PythonVersionOffsets) frameDescriptor {
+	return frameDescriptor{
+		FrameLink:        frameLinkPointer,
+		CallerOffset:     offsets.PyFrameObject.FBack,
+		CodeOffset:       offsets.PyFrameObject.FCode,
+		CodeBodyOffset:   -1,
+		StringDataOffset: offsets.PyString.Data,
+	}
+}
+
+// setFrameDescriptor stores the descriptor of a version in the given
+// frame_descriptors map.
+func setFrameDescriptor(descriptors *libbpf.BPFMap, key uint32, desc frameDescriptor) error {
+	buf := new(bytes.Buffer)
+	buf.Grow(int(unsafe.Sizeof(desc)))
+	if err := binary.Write(buf, binary.LittleEndian, &desc); err != nil {
+		return fmt.Errorf("write frame descriptor to buffer: %w", err)
+	}
+	if err := descriptors.Update(unsafe.Pointer(&key), unsafe.Pointer(&buf.Bytes()[0])); err != nil {
+		return fmt.Errorf("update map frame_descriptors: %w", err)
+	}
+	return nil
+}
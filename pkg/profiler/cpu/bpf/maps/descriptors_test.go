@@ -0,0 +1,58 @@
+// Copyright 2022-2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+package bpfmaps
+
+import (
+	"encoding/binary"
+	"path/filepath"
+	"testing"
+
+	"github.com/stretchr/testify/require"
+
+	"github.com/parca-dev/parca-agent/pkg/profiler/pyperf"
+	"github.com/parca-dev/parca-agent/pkg/profiler/rbperf"
+)
+
+func TestFrameDescriptorMatchesBPFDefinition(t *testing.T) {
+	header := filepath.Join("..", "..", "..", "..", "..", "bpf", "unwinders", "common.h")
+	require.Equal(t, cStructSize(t, header, "interpreter_frame_descriptor_t"), binary.Size(frameDescriptor{}))
+}
+
+func TestRubyFrameDescriptor(t *testing.T) {
+	desc := rubyFrameDescriptor(rbperf.RubyVersionOffsets{MajorVersion: 3, MinorVersion: 1, ControlFrameSizeof: 0x38})
+	require.Equal(t, frameLinkArray, desc.FrameLink)
+	require.Equal(t, uint32(0x38), desc.FrameSize)
+	require.Equal(t, int64(0x10), desc.StringDataOffset)
+	require.Equal(t, uint64(1<<13), desc.StringHeapFlag)
+
+	// Embedded strings moved in 3.2.
+	desc = rubyFrameDescriptor(rbperf.RubyVersionOffsets{MajorVersion: 3, MinorVersion: 2, ControlFrameSizeof: 0x40})
+	require.Equal(t, int64(0x18), desc.StringDataOffset)
+}
+
+func TestPythonFrameDescriptor(t *testing.T) {
+	var offsets pyperf.PythonVersionOffsets
+	offsets.PyFrameObject.FBack = 0x18
+	offsets.PyFrameObject.FCode = 0x20
+	offsets.PyString.Data = 0x30
+
+	desc := pythonFrameDescriptor(offsets)
+	require.Equal(t, frameLinkPointer, desc.FrameLink)
+	require.Equal(t, int64(0x18), desc.CallerOffset)
+	require.Equal(t, int64(0x20), desc.CodeOffset)
+	require.Equal(t, int64(-1), desc.CodeBodyOffset)
+	require.Equal(t, int64(0x30), desc.StringDataOffset)
+	require.Zero(t, desc.StringHeapFlag)
+}
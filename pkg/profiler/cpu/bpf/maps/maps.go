@@ -22,11 +22,11 @@ import (
 	"encoding/binary"
 	"errors"
 	"fmt"
-	"os"
 	"path"
 	"strconv"
 	"sync"
 	"syscall"
+	"time"
 	"unsafe"
 
 	"github.com/Masterminds/semver/v3"
@@ -35,14 +35,14 @@ import (
 	"github.com/go-kit/log/level"
 	"github.com/prometheus/client_golang/prometheus"
 	"github.com/prometheus/procfs"
+	"github.com/puzpuzpuz/xsync/v3"
 	"golang.org/x/exp/constraints"
 
 	"github.com/parca-dev/runtime-data/pkg/python"
 	"github.com/parca-dev/runtime-data/pkg/ruby"
 
-	"github.com/parca-dev/parca-agent/pkg/buildid"
 	"github.com/parca-dev/parca-agent/pkg/cache"
-	"github.com/parca-dev/parca-agent/pkg/elfreader"
+	"github.com/parca-dev/parca-agent/pkg/objectfile"
 	"github.com/parca-dev/parca-agent/pkg/profile"
 	"github.com/parca-dev/parca-agent/pkg/profiler"
 	"github.com/parca-dev/parca-agent/pkg/profiler/cpu/bpf"
@@ -62,6 +62,8 @@ const (
 	symbolIndexStorageMapName = "symbol_index_storage"
 	symbolTableMapName        = "symbol_table"
 	eventsMapName             = "events"
+	// Second level of the chunk directory for very large executables.
+	unwindInfoChunksDirectoryMapName = "unwind_info_chunks_directory"
 
 	// rbperf maps.
 	RubyPIDToRubyThreadMapName       = "pid_to_rb_thread"
@@ -168,6 +170,9 @@ type Maps struct {
 	nativeModule *libbpf.Module
 	rbperfModule *libbpf.Module
 	pyperfModule *libbpf.Module
+	// Interpreter unwinders loaded the first time a process they unwind is
+	// seen, instead of at startup.
+	interpreterUnwinders map[ProfilerModuleType]*interpreterUnwinder
 
 	debugPIDs *libbpf.BPFMap
 
@@ -187,14 +192,24 @@ type Maps struct {
 	// Keeps track of synced process info and interpreter info.
 	syncedInterpreters *cache.Cache[int, runtime.Interpreter]
 
-	unwindShards *libbpf.BPFMap
-	unwindTables *libbpf.BPFMap
-	programs     *libbpf.BPFMap
-	processInfo  *libbpf.BPFMap
+	unwindShards           *libbpf.BPFMap
+	unwindChunkDirectories *libbpf.BPFMap
+	unwindTables           *libbpf.BPFMap
+	programs               *libbpf.BPFMap
+	processInfo            *libbpf.BPFMap
 
 	// Unwind stuff 🔬
+	objFilePool       *objectfile.Pool
 	processCache      *ProcessCache
 	mappingInfoMemory profiler.EfficientBuffer
+	// PIDs written to the process info map since it was last cleaned.
+	processInfoPIDs map[int]struct{}
+	// Unwind tables generated ahead of time, keyed by build ID.
+	preparedUnwindTables *xsync.MapOf[string, preparedUnwindTable]
+
+	// Sizes the maps were created with and their observed usage.
+	sizes MapSizes
+	stats MapStats
 
 	buildIDMapping map[string]uint64
 
@@ -202,6 +217,7 @@ type Maps struct {
 	maxUnwindShards           uint64
 	shardIndex                uint64
 	executableID              uint64
+	chunkDirectories          uint64
 	compactUnwindRowSizeBytes int
 	unwindInfoMemory          profiler.EfficientBuffer
 	// Account where we are within a shard
@@ -251,9 +267,52 @@ const (
 	PyperfModule
 )
 
-type stackTraceWithLength struct {
-	Len   uint64
-	Addrs [bpfprograms.StackDepth]uint64
+// interpreterUnwinder is an interpreter unwinder that is loaded lazily.
+type interpreterUnwinder struct {
+	open func() (*libbpf.Module, error)
+
+	once sync.Once
+	err  error
+}
+
+// interpreterUnwinderPrograms are the programs of an interpreter unwinder and
+// where they go in the tail call maps.
+type interpreterUnwinderPrograms struct {
+	name           string
+	entrypoint     string
+	entrypointSlot uint64
+	walker         string
+	walkerSlot     uint64
+}
+
+var interpreterPrograms = map[ProfilerModuleType]interpreterUnwinderPrograms{
+	RbperfModule: {
+		name:           "rbperf",
+		entrypoint:     "unwind_ruby_stack",
+		entrypointSlot: bpfprograms.RubyEntrypointProgramFD,
+		walker:         "walk_ruby_stack",
+		walkerSlot:     bpfprograms.RubyUnwinderProgramFD,
+	},
+	PyperfModule: {
+		name:           "pyperf",
+		entrypoint:     "unwind_python_stack",
+		entrypointSlot: bpfprograms.PythonEntrypointProgramFD,
+		walker:         "walk_python_stack",
+		walkerSlot:     bpfprograms.PythonUnwinderProgramFD,
+	},
+}
+
+// CompactUnwindRowSizeBytes returns the size of an unwind table row for the
+// given architecture, or zero if the architecture is not supported.
+func CompactUnwindRowSizeBytes(arch elf.Machine) int {
+	switch arch {
+	case elf.EM_AARCH64:
+		return compactUnwindRowSizeBytesArm64
+	case elf.EM_X86_64:
+		return compactUnwindRowSizeBytesX86
+	default:
+		return 0
+	}
 }
 
 func New(
@@ -264,18 +323,14 @@ func New(
 	metrics *Metrics,
 	processCache *ProcessCache,
 	syncedInterpreters *cache.Cache[int, runtime.Interpreter],
+	objFilePool *objectfile.Pool,
 ) (*Maps, error) {
 	if modules[NativeModule] == nil {
 		return nil, fmt.Errorf("nil nativeModule")
 	}
 
-	var compactUnwindRowSizeBytes int
-	switch arch {
-	case elf.EM_AARCH64:
-		compactUnwindRowSizeBytes = compactUnwindRowSizeBytesArm64
-	case elf.EM_X86_64:
-		compactUnwindRowSizeBytes = compactUnwindRowSizeBytesX86
-	default:
+	compactUnwindRowSizeBytes := CompactUnwindRowSizeBytes(arch)
+	if compactUnwindRowSizeBytes == 0 {
 		level.Error(logger).Log("msg", "unknown architecture", "arch", arch)
 	}
 
@@ -294,10 +349,13 @@ func New(
 		compactUnwindRowSizeBytes:  compactUnwindRowSizeBytes,
 		unwindInfoMemory:           unwindInfoMemory,
 		buildIDMapping:             make(map[string]uint64),
+		processInfoPIDs:            make(map[int]struct{}),
+		preparedUnwindTables:       xsync.NewMapOf[string, preparedUnwindTable](),
 		mutex:                      sync.Mutex{},
 		pythonVersionToOffsetIndex: make(map[string]uint32),
 		rubyVersionToOffsetIndex:   make(map[string]uint32),
 		syncedInterpreters:         syncedInterpreters,
+		objFilePool:                objFilePool,
 	}
 
 	if err := maps.resetInFlightBuffer(); err != nil {
@@ -308,125 +366,121 @@ func New(
 }
 
 func (m *Maps) ReuseMaps() error {
-	if m.pyperfModule == nil && m.rbperfModule == nil {
-		return nil
-	}
-
-	// Fetch native maps.
-	heapNative, err := m.nativeModule.GetMap(heapMapName)
-	if err != nil {
-		return fmt.Errorf("get map (native) heap: %w", err)
-	}
-	stackTracesNative, err := m.nativeModule.GetMap(StackTracesMapName)
-	if err != nil {
-		return fmt.Errorf("get map (native) stack_traces: %w", err)
-	}
-	stackCountNative, err := m.nativeModule.GetMap(StackCountsMapName)
-	if err != nil {
-		return fmt.Errorf("get map (native) stack_counts: %w", err)
-	}
-	symbolIndexStorage, err := m.nativeModule.GetMap(symbolIndexStorageMapName)
-	if err != nil {
-		return fmt.Errorf("get map (native) symbol_index_storage map: %w", err)
-	}
-	symbolTableMap, err := m.nativeModule.GetMap(symbolTableMapName)
-	if err != nil {
-		return fmt.Errorf("get map (native) symbol_table map: %w", err)
-	}
-
 	if m.rbperfModule != nil {
-		// Fetch rbperf maps.
-		rubyHeap, err := m.rbperfModule.GetMap(heapMapName)
-		if err != nil {
-			return (fmt.Errorf("get map (rbperf) heap: %w", err))
-		}
-		rubystackCounts, err := m.rbperfModule.GetMap(StackCountsMapName)
-		if err != nil {
-			return fmt.Errorf("get map (rbperf) stack_counts: %w", err)
-		}
-		rubyStackTraces, err := m.rbperfModule.GetMap(StackTracesMapName)
-		if err != nil {
-			return fmt.Errorf("get map (rbperf) stack_traces: %w", err)
-		}
-		rubySymbolIndex, err := m.rbperfModule.GetMap(symbolIndexStorageMapName)
-		if err != nil {
-			return fmt.Errorf("get map (rbperf) symbol_index_storage: %w", err)
+		if err := m.reuseMaps(RbperfModule, m.rbperfModule); err != nil {
+			return err
 		}
-		rubySymbolTable, err := m.rbperfModule.GetMap(symbolTableMapName)
-		if err != nil {
-			return fmt.Errorf("get map (rbperf) symbol_table: %w", err)
+	}
+	if m.pyperfModule != nil {
+		if err := m.reuseMaps(PyperfModule, m.pyperfModule); err != nil {
+			return err
 		}
+	}
+	return nil
+}
 
-		// Reuse maps across programs.
-		err = rubyHeap.ReuseFD(heapNative.FileDescriptor())
-		if err != nil {
-			return fmt.Errorf("reuse map (rbperf) heap: %w", err)
-		}
-		err = rubystackCounts.ReuseFD(stackCountNative.FileDescriptor())
+// reuseMaps makes an interpreter unwinder share the maps it has in common
+// with the native unwinder.
+//
+// Note: It must be called after the native unwinder is loaded, and before the
+// interpreter unwinder is.
+func (m *Maps) reuseMaps(typ ProfilerModuleType, module *libbpf.Module) error {
+	name := interpreterPrograms[typ].name
+	for _, mapName := range []string{
+		heapMapName,
+		StackCountsMapName,
+		StackTracesMapName,
+		symbolIndexStorageMapName,
+		symbolTableMapName,
+	} {
+		nativeMap, err := m.nativeModule.GetMap(mapName)
 		if err != nil {
-			return fmt.Errorf("reuse map (rbperf) stack_counts: %w", err)
+			return fmt.Errorf("get map (native) %s: %w", mapName, err)
 		}
-		err = rubyStackTraces.ReuseFD(stackTracesNative.FileDescriptor())
+		bpfMap, err := module.GetMap(mapName)
 		if err != nil {
-			return fmt.Errorf("reuse map (rbperf) stack_traces: %w", err)
+			return fmt.Errorf("get map (%s) %s: %w", name, mapName, err)
 		}
-		err = rubySymbolIndex.ReuseFD(symbolIndexStorage.FileDescriptor())
-		if err != nil {
-			return fmt.Errorf("reuse map (rbperf) symbol_index_storage: %w", err)
-		}
-		err = rubySymbolTable.ReuseFD(symbolTableMap.FileDescriptor())
-		if err != nil {
-			return fmt.Errorf("reuse map (rbperf) symbol_table: %w", err)
+		if err := bpfMap.ReuseFD(nativeMap.FileDescriptor()); err != nil {
+			return fmt.Errorf("reuse map (%s) %s: %w", name, mapName, err)
 		}
 	}
+	return nil
+}
 
-	if m.pyperfModule != nil {
-		// Fetch pyperf maps.
-		pythonHeap, err := m.pyperfModule.GetMap(heapMapName)
-		if err != nil {
-			return fmt.Errorf("get map (pyperf) heap: %w", err)
-		}
-		pythonStackCounts, err := m.pyperfModule.GetMap(StackCountsMapName)
-		if err != nil {
-			return fmt.Errorf("get map (pyperf) stack_counts: %w", err)
-		}
-		pythonStackTraces, err := m.pyperfModule.GetMap(StackTracesMapName)
-		if err != nil {
-			return fmt.Errorf("get map (pyperf) stack_traces: %w", err)
-		}
-		pythonSymbolIndex, err := m.pyperfModule.GetMap(symbolIndexStorageMapName)
-		if err != nil {
-			return fmt.Errorf("get map (pyperf) symbol_index_storage: %w", err)
-		}
-		pythonSymbolTable, err := m.pyperfModule.GetMap(symbolTableMapName)
-		if err != nil {
-			return fmt.Errorf("get map (pyperf) symbol_table: %w", err)
-		}
+// RegisterInterpreterUnwinder registers an interpreter unwinder to be opened
+// with the given function, and loaded, the first time a process it unwinds is
+// added, so its programs aren't verified and its maps aren't created on
+// hosts that don't run the interpreter. The module returned by open must not
+// be loaded yet.
+//
+// Note: It must be called before `AdjustMapSizes()`.
+func (m *Maps) RegisterInterpreterUnwinder(typ ProfilerModuleType, open func() (*libbpf.Module, error)) {
+	if m.interpreterUnwinders == nil {
+		m.interpreterUnwinders = make(map[ProfilerModuleType]*interpreterUnwinder)
+	}
+	m.interpreterUnwinders[typ] = &interpreterUnwinder{open: open}
+}
 
-		// Reuse maps across programs.
-		err = pythonHeap.ReuseFD(heapNative.FileDescriptor())
-		if err != nil {
-			return fmt.Errorf("reuse map (pyperf) heap: %w", err)
-		}
-		err = pythonStackCounts.ReuseFD(stackCountNative.FileDescriptor())
-		if err != nil {
-			return fmt.Errorf("reuse map (pyperf) stack_counts: %w", err)
-		}
-		err = pythonStackTraces.ReuseFD(stackTracesNative.FileDescriptor())
-		if err != nil {
-			return fmt.Errorf("reuse map (pyperf) stack_traces: %w", err)
+// interpretersEnabled returns whether any interpreter unwinder is, or can
+// be, loaded.
+func (m *Maps) interpretersEnabled() bool {
+	return m.pyperfModule != nil || m.rbperfModule != nil || len(m.interpreterUnwinders) > 0
+}
+
+// loadInterpreterUnwinder loads the given interpreter unwinder, if it was
+// registered and isn't loaded yet, and splices it into the tail call maps.
+// The unwinders of different interpreters are loaded, and verified,
+// concurrently. A failed load isn't retried.
+func (m *Maps) loadInterpreterUnwinder(typ ProfilerModuleType) error {
+	u, ok := m.interpreterUnwinders[typ]
+	if !ok {
+		return nil
+	}
+	u.once.Do(func() {
+		u.err = m.doLoadInterpreterUnwinder(typ, u)
+		if u.err != nil {
+			level.Error(m.logger).Log("msg", "failed to load interpreter unwinder", "unwinder", interpreterPrograms[typ].name, "err", u.err)
 		}
-		err = pythonSymbolIndex.ReuseFD(symbolIndexStorage.FileDescriptor())
-		if err != nil {
-			return fmt.Errorf("reuse map (pyperf) symbol_index_storage: %w", err)
+	})
+	return u.err
+}
+
+func (m *Maps) doLoadInterpreterUnwinder(typ ProfilerModuleType, u *interpreterUnwinder) error {
+	name := interpreterPrograms[typ].name
+
+	module, err := u.open()
+	if err != nil {
+		return fmt.Errorf("open %s: %w", name, err)
+	}
+	if err := m.reuseMaps(typ, module); err != nil {
+		module.Close()
+		return err
+	}
+
+	start := time.Now()
+	if err := module.BPFLoadObject(); err != nil {
+		module.Close()
+		return fmt.Errorf("load %s: %w", name, err)
+	}
+	duration := time.Since(start)
+	m.metrics.ObserveProgramLoad(name, duration)
+	level.Info(m.logger).Log("msg", "loaded interpreter unwinder", "unwinder", name, "duration", duration)
+
+	switch typ {
+	case RbperfModule:
+		m.rbperfModule = module
+		if err := m.setRbperfData(); err != nil {
+			return err
 		}
-		err = pythonSymbolTable.ReuseFD(symbolTableMap.FileDescriptor())
-		if err != nil {
-			return fmt.Errorf("reuse map (pyperf) symbol_table: %w", err)
+	case PyperfModule:
+		m.pyperfModule = module
+		if err := m.setPyperfData(); err != nil {
+			return err
 		}
 	}
 
-	return nil
+	return m.updateTailCalls(typ, module)
 }
 
 // Interpreter Information.
@@ -466,6 +520,10 @@ func (m *Maps) setRbperfVersionOffsets(versionOffsets []ruby.VersionOffsets) err
 	if err != nil {
 		return fmt.Errorf("get map version_specific_offsets: %w", err)
 	}
+	descriptors, err := m.rbperfModule.GetMap(FrameDescriptorsMapName)
+	if err != nil {
+		return fmt.Errorf("get map frame_descriptors: %w", err)
+	}
 
 	if len(versionOffsets) == 0 {
 		return fmt.Errorf("no version offsets provided")
@@ -487,6 +545,14 @@ func (m *Maps) setRbperfVersionOffsets(versionOffsets []ruby.VersionOffsets) err
 			return fmt.Errorf("update map version_specific_offsets: %w", err)
 		}
 
+		var offsets rbperf.RubyVersionOffsets
+		if err := binary.Read(bytes.NewReader(buf.Bytes()), binary.LittleEndian, &offsets); err != nil {
+			return fmt.Errorf("read back versionOffsets: %w", err)
+		}
+		if err := setFrameDescriptor(descriptors, key, rubyFrameDescriptor(offsets)); err != nil {
+			return err
+		}
+
 		m.rubyVersionToOffsetIndex[fmt.Sprintf("%d.%d.%d", versionOffset.MajorVersion, versionOffset.MinorVersion, versionOffset.PatchVersion)] = i
 		i++
 		buf.Reset()
@@ -528,6 +594,10 @@ func (m *Maps) setPyperfVersionOffsets(versionOffsets []python.VersionOffsets) e
 	if err != nil {
 		return fmt.Errorf("get map version_specific_offsets: %w", err)
 	}
+	descriptors, err := m.pyperfModule.GetMap(FrameDescriptorsMapName)
+	if err != nil {
+		return fmt.Errorf("get map frame_descriptors: %w", err)
+	}
 
 	if len(versionOffsets) == 0 {
 		return fmt.Errorf("no version offsets provided")
@@ -536,27 +606,36 @@ func (m *Maps) setPyperfVersionOffsets(versionOffsets []python.VersionOffsets) e
 	buf := new(bytes.Buffer)
 	i := uint32(0)
 	for _, v := range versionOffsets {
+		buf.Reset()
 		buf.Grow(int(unsafe.Sizeof(v)))
 		err = binary.Write(buf, binary.LittleEndian, &v)
 		if err != nil {
 			level.Debug(m.logger).Log("msg", "write versionOffsets to buffer", "err", err)
 			continue
 		}
+		var offsets pyperf.PythonVersionOffsets
+		if err := binary.Read(bytes.NewReader(buf.Bytes()), binary.LittleEndian, &offsets); err != nil {
+			level.Debug(m.logger).Log("msg", "read back versionOffsets", "err", err)
+			continue
+		}
 		key := i
 		err = versions.Update(unsafe.Pointer(&key), unsafe.Pointer(&buf.Bytes()[0]))
 		if err != nil {
 			level.Debug(m.logger).Log("msg", "update map version_specific_offsets", "err", err)
 			continue
 		}
+		if err := setFrameDescriptor(descriptors, key, pythonFrameDescriptor(offsets)); err != nil {
+			level.Debug(m.logger).Log("msg", "update map frame_descriptors", "err", err)
+			continue
+		}
 		m.pythonVersionToOffsetIndex[fmt.Sprintf("%d.%d", v.MajorVersion, v.MinorVersion)] = i
 		i++
-		buf.Reset()
 	}
 	return nil
 }
 
 func (m *Maps) SetInterpreterData() error {
-	if m.pyperfModule == nil && m.rbperfModule == nil {
+	if !m.interpretersEnabled() {
 		return nil
 	}
 
@@ -573,96 +652,125 @@ func (m *Maps) SetInterpreterData() error {
 	}
 
 	if m.rbperfModule != nil {
-		versions, err := ruby.GetVersions()
-		if err != nil {
-			return fmt.Errorf("get ruby versions: %w", err)
-		}
-
-		err = m.setRbperfVersionOffsets(versions)
-		if err != nil {
-			return fmt.Errorf("set rbperf version offsets: %w", err)
+		if err := m.setRbperfData(); err != nil {
+			return err
 		}
 	}
 
 	if m.pyperfModule != nil {
-		versions, err := python.GetVersions()
-		if err != nil {
-			return fmt.Errorf("get python versions: %w", err)
-		}
-
-		err = m.setPyperfVersionOffsets(versions)
-		if err != nil {
-			return fmt.Errorf("set pyperf version offsets: %w", err)
+		if err := m.setPyperfData(); err != nil {
+			return err
 		}
 	}
 
 	return nil
 }
 
-func (m *Maps) UpdateTailCallsMap() error {
-	if m.pyperfModule == nil && m.rbperfModule == nil {
-		return nil
+// setRbperfData sets the maps of the Ruby unwinder up.
+func (m *Maps) setRbperfData() error {
+	versions, err := ruby.GetVersions()
+	if err != nil {
+		return fmt.Errorf("get ruby versions: %w", err)
 	}
 
-	entrypointPrograms, err := m.nativeModule.GetMap(ProgramsMapName)
+	err = m.setRbperfVersionOffsets(versions)
 	if err != nil {
-		return fmt.Errorf("get map (native) programs: %w", err)
+		return fmt.Errorf("set rbperf version offsets: %w", err)
 	}
 
-	if m.rbperfModule != nil {
-		// rbperf.
-		rubyEntrypointProg, err := m.rbperfModule.GetProgram("unwind_ruby_stack")
-		if err != nil {
-			return fmt.Errorf("get program unwind_ruby_stack: %w", err)
-		}
+	rubyPIDToRubyThread, err := m.rbperfModule.GetMap(RubyPIDToRubyThreadMapName)
+	if err != nil {
+		return fmt.Errorf("get pid to rb thread map: %w", err)
+	}
 
-		rubyEntrypointFd := rubyEntrypointProg.FileDescriptor()
-		if err = entrypointPrograms.Update(unsafe.Pointer(&bpfprograms.RubyEntrypointProgramFD), unsafe.Pointer(&rubyEntrypointFd)); err != nil {
-			return fmt.Errorf("update (native) programs: %w", err)
-		}
+	rubyVersionSpecificOffsets, err := m.rbperfModule.GetMap(RubyVersionSpecificOffsetMapName)
+	if err != nil {
+		return fmt.Errorf("get pid to rb thread map: %w", err)
+	}
 
-		rubyWalkerProg, err := m.rbperfModule.GetProgram("walk_ruby_stack")
-		if err != nil {
-			return fmt.Errorf("get program walk_ruby_stack: %w", err)
-		}
+	m.rubyPIDToThread = rubyPIDToRubyThread
+	m.rubyVersionSpecificOffsets = rubyVersionSpecificOffsets
+	return nil
+}
 
-		rubyPrograms, err := m.rbperfModule.GetMap(ProgramsMapName)
-		if err != nil {
-			return fmt.Errorf("get map (rbperf) programs: %w", err)
-		}
+// setPyperfData sets the maps of the Python unwinder up.
+func (m *Maps) setPyperfData() error {
+	versions, err := python.GetVersions()
+	if err != nil {
+		return fmt.Errorf("get python versions: %w", err)
+	}
 
-		rubyWalkerFd := rubyWalkerProg.FileDescriptor()
-		if err = rubyPrograms.Update(unsafe.Pointer(&bpfprograms.RubyUnwinderProgramFD), unsafe.Pointer(&rubyWalkerFd)); err != nil {
-			return fmt.Errorf("update (rbperf) programs: %w", err)
-		}
+	err = m.setPyperfVersionOffsets(versions)
+	if err != nil {
+		return fmt.Errorf("set pyperf version offsets: %w", err)
 	}
 
+	pythonPIDToProcessInfo, err := m.pyperfModule.GetMap(PythonPIDToInterpreterInfoMapName)
+	if err != nil {
+		return fmt.Errorf("get pid to process info map: %w", err)
+	}
+
+	pythonVersionSpecificOffsets, err := m.pyperfModule.GetMap(PythonVersionSpecificOffsetMapName)
+	if err != nil {
+		return fmt.Errorf("get pid to process info map: %w", err)
+	}
+
+	m.pythonPIDToProcessInfo = pythonPIDToProcessInfo
+	m.pythonVersionSpecificOffsets = pythonVersionSpecificOffsets
+	return nil
+}
+
+func (m *Maps) UpdateTailCallsMap() error {
+	if m.rbperfModule != nil {
+		if err := m.updateTailCalls(RbperfModule, m.rbperfModule); err != nil {
+			return err
+		}
+	}
 	if m.pyperfModule != nil {
-		// pyperf.
-		pythonEntrypointProg, err := m.pyperfModule.GetProgram("unwind_python_stack")
-		if err != nil {
-			return fmt.Errorf("get program unwind_python_stack: %w", err)
+		if err := m.updateTailCalls(PyperfModule, m.pyperfModule); err != nil {
+			return err
 		}
+	}
+	return nil
+}
 
-		pythonEntrypointFd := pythonEntrypointProg.FileDescriptor()
-		if err = entrypointPrograms.Update(unsafe.Pointer(&bpfprograms.PythonEntrypointProgramFD), unsafe.Pointer(&pythonEntrypointFd)); err != nil {
-			return fmt.Errorf("update (native) programs: %w", err)
-		}
+// updateTailCalls splices the programs of a loaded interpreter unwinder into
+// the tail call maps, so the native unwinder calls into it.
+func (m *Maps) updateTailCalls(typ ProfilerModuleType, module *libbpf.Module) error {
+	programs := interpreterPrograms[typ]
 
-		pythonWalkerProg, err := m.pyperfModule.GetProgram("walk_python_stack")
-		if err != nil {
-			return fmt.Errorf("get program walk_python_stack: %w", err)
-		}
+	entrypointPrograms, err := m.nativeModule.GetMap(ProgramsMapName)
+	if err != nil {
+		return fmt.Errorf("get map (native) programs: %w", err)
+	}
 
-		pythonPrograms, err := m.pyperfModule.GetMap(ProgramsMapName)
-		if err != nil {
-			return fmt.Errorf("get map (pyperf) programs: %w", err)
-		}
+	entrypointProg, err := module.GetProgram(programs.entrypoint)
+	if err != nil {
+		return fmt.Errorf("get program %s: %w", programs.entrypoint, err)
+	}
 
-		pythonWalkerFd := pythonWalkerProg.FileDescriptor()
-		if err = pythonPrograms.Update(unsafe.Pointer(&bpfprograms.PythonUnwinderProgramFD), unsafe.Pointer(&pythonWalkerFd)); err != nil {
-			return fmt.Errorf("update (pyperf) programs: %w", err)
-		}
+	walkerProg, err := module.GetProgram(programs.walker)
+	if err != nil {
+		return fmt.Errorf("get program %s: %w", programs.walker, err)
+	}
+
+	unwinderPrograms, err := module.GetMap(ProgramsMapName)
+	if err != nil {
+		return fmt.Errorf("get map (%s) programs: %w", programs.name, err)
+	}
+
+	// The walker goes first, the native unwinder calls into the unwinder as
+	// soon as its entrypoint is in place.
+	walkerSlot := programs.walkerSlot
+	walkerFd := walkerProg.FileDescriptor()
+	if err = unwinderPrograms.Update(unsafe.Pointer(&walkerSlot), unsafe.Pointer(&walkerFd)); err != nil {
+		return fmt.Errorf("update (%s) programs: %w", programs.name, err)
+	}
+
+	entrypointSlot := programs.entrypointSlot
+	entrypointFd := entrypointProg.FileDescriptor()
+	if err = entrypointPrograms.Update(unsafe.Pointer(&entrypointSlot), unsafe.Pointer(&entrypointFd)); err != nil {
+		return fmt.Errorf("update (native) programs: %w", err)
 	}
 
 	return nil
@@ -673,10 +781,11 @@ func (m *Maps) Close() error {
 	return m.processCache.Close()
 }
 
-// AdjustMapSizes updates the amount of unwind shards.
+// AdjustMapSizes updates the amount of unwind shards and the number of
+// entries of the rest of the resizable maps.
 //
 // Note: It must be called before `BPFLoadObject()`.
-func (m *Maps) AdjustMapSizes(debugEnabled bool, unwindTableShards, eventsBufferSize uint32) error {
+func (m *Maps) AdjustMapSizes(debugEnabled bool, sizes MapSizes, numPossibleCPUs uint32) error {
 	unwindTables, err := m.nativeModule.GetMap(UnwindTablesMapName)
 	if err != nil {
 		return fmt.Errorf("get unwind tables map: %w", err)
@@ -684,31 +793,48 @@ func (m *Maps) AdjustMapSizes(debugEnabled bool, unwindTableShards, eventsBuffer
 
 	// Adjust unwind_tables size.
 	sizeBefore := unwindTables.MaxEntries()
-	if err := unwindTables.SetMaxEntries(unwindTableShards); err != nil {
-		return fmt.Errorf("resize unwind tables map from %d to %d elements: %w", sizeBefore, unwindTableShards, err)
+	if err := unwindTables.SetMaxEntries(sizes.UnwindShards); err != nil {
+		return fmt.Errorf("resize unwind tables map from %d to %d elements: %w", sizeBefore, sizes.UnwindShards, err)
 	}
 
-	m.maxUnwindShards = uint64(unwindTableShards)
+	m.maxUnwindShards = uint64(sizes.UnwindShards)
 
-	if m.pyperfModule != nil || m.rbperfModule != nil {
+	for name, size := range map[string]uint32{
+		ProcessInfoMapName:      sizes.ProcessInfo,
+		UnwindInfoChunksMapName: sizes.UnwindInfoChunks,
+		StackCountsMapName:      sizes.StackCounts,
+		StackTracesMapName:      sizes.StackTraces,
+	} {
+		bpfMap, err := m.nativeModule.GetMap(name)
+		if err != nil {
+			return fmt.Errorf("get %s map: %w", name, err)
+		}
+		if err := bpfMap.SetMaxEntries(size); err != nil {
+			return fmt.Errorf("resize %s map from %d to %d elements: %w", name, bpfMap.MaxEntries(), size, err)
+		}
+	}
+
+	if m.interpretersEnabled() {
 		symbolTable, err := m.nativeModule.GetMap(symbolTableMapName)
 		if err != nil {
 			return fmt.Errorf("get symbol table map: %w", err)
 		}
 
 		// Adjust symbol_table size.
-		if err := symbolTable.SetMaxEntries(defaultSymbolTableSize); err != nil {
-			return fmt.Errorf("resize symbol table map from default to %d elements: %w", unwindTableShards, err)
+		if err := symbolTable.SetMaxEntries(sizes.SymbolTable); err != nil {
+			return fmt.Errorf("resize symbol table map from default to %d elements: %w", sizes.SymbolTable, err)
 		}
 	}
 
-	// Adjust events size.
-	eventCounts, err := m.nativeModule.GetMap(eventsMapName)
+	m.sizes = sizes
+
+	// Adjust events size. The perf event array has one entry per CPU.
+	events, err := m.nativeModule.GetMap(eventsMapName)
 	if err != nil {
 		return fmt.Errorf("get event map: %w", err)
 	}
-	if err := eventCounts.SetMaxEntries(eventsBufferSize); err != nil {
-		return fmt.Errorf("resize event map from default to %d elements: %w", maxProcesses, err)
+	if err := events.SetMaxEntries(numPossibleCPUs); err != nil {
+		return fmt.Errorf("resize event map from default to %d elements: %w", numPossibleCPUs, err)
 	}
 
 	// Adjust debug_threads_ids size.
@@ -724,6 +850,48 @@ func (m *Maps) AdjustMapSizes(debugEnabled bool, unwindTableShards, eventsBuffer
 	return nil
 }
 
+// Stats returns the highest usage observed for the maps that are sized
+// from the memory budget.
+func (m *Maps) Stats() MapStats {
+	m.mutex.Lock()
+	defer m.mutex.Unlock()
+
+	return m.stats
+}
+
+// SeedStats sets the statistics observed in previous runs, so the persisted
+// high watermarks are not lost after a restart.
+func (m *Maps) SeedStats(stats MapStats) {
+	m.mutex.Lock()
+	defer m.mutex.Unlock()
+
+	m.stats = stats
+}
+
+// ObserveStackCounts records the number of aggregated stacks read in a
+// profiling round.
+func (m *Maps) ObserveStackCounts(n int) {
+	m.mutex.Lock()
+	defer m.mutex.Unlock()
+
+	m.stats.Stacks = max(m.stats.Stacks, uint64(n))
+	m.metrics.observeMapUsage(StackCountsMapName, uint64(m.sizes.StackCounts), uint64(n))
+}
+
+// reportUsage updates the statistics and the usage metrics of the maps
+// whose usage is tracked in userspace.
+//
+// Note: the caller must hold the mutex.
+func (m *Maps) reportUsage() {
+	processes := uint64(len(m.processInfoPIDs))
+	m.stats.Processes = max(m.stats.Processes, processes)
+	m.stats.Executables = max(m.stats.Executables, m.executableID)
+
+	m.metrics.observeMapUsage(ProcessInfoMapName, uint64(m.sizes.ProcessInfo), processes)
+	m.metrics.observeMapUsage(UnwindInfoChunksMapName, uint64(m.sizes.UnwindInfoChunks), m.executableID)
+	m.metrics.observeMapUsage(UnwindTablesMapName, m.maxUnwindShards, min(m.shardIndex+1, m.maxUnwindShards))
+}
+
 func (m *Maps) Create() error {
 	debugPIDs, err := m.nativeModule.GetMap(debugThreadsIDsMapName)
 	if err != nil {
@@ -750,6 +918,11 @@ func (m *Maps) Create() error {
 		return fmt.Errorf("get unwind shards map: %w", err)
 	}
 
+	unwindChunkDirectories, err := m.nativeModule.GetMap(unwindInfoChunksDirectoryMapName)
+	if err != nil {
+		return fmt.Errorf("get unwind chunk directories map: %w", err)
+	}
+
 	unwindTables, err := m.nativeModule.GetMap(UnwindTablesMapName)
 	if err != nil {
 		return fmt.Errorf("get unwind tables map: %w", err)
@@ -765,10 +938,11 @@ func (m *Maps) Create() error {
 	m.stackTraces = stackTraces
 	m.eventsCount = eventsCount
 	m.unwindShards = unwindShards
+	m.unwindChunkDirectories = unwindChunkDirectories
 	m.unwindTables = unwindTables
 	m.processInfo = processInfo
 
-	if m.pyperfModule == nil && m.rbperfModule == nil {
+	if !m.interpretersEnabled() {
 		return nil
 	}
 
@@ -778,39 +952,6 @@ func (m *Maps) Create() error {
 	}
 	m.symbolTable = symbolTable
 
-	if m.rbperfModule != nil {
-		// rbperf maps.
-		rubyPIDToRubyThread, err := m.rbperfModule.GetMap(RubyPIDToRubyThreadMapName)
-		if err != nil {
-			return fmt.Errorf("get pid to rb thread map: %w", err)
-		}
-
-		rubyVersionSpecificOffsets, err := m.rbperfModule.GetMap(RubyVersionSpecificOffsetMapName)
-		if err != nil {
-			return fmt.Errorf("get pid to rb thread map: %w", err)
-		}
-
-		// rbperf maps.
-		m.rubyPIDToThread = rubyPIDToRubyThread
-		m.rubyVersionSpecificOffsets = rubyVersionSpecificOffsets
-	}
-
-	if m.pyperfModule != nil {
-		pythonPIDToProcessInfo, err := m.pyperfModule.GetMap(PythonPIDToInterpreterInfoMapName)
-		if err != nil {
-			return fmt.Errorf("get pid to process info map: %w", err)
-		}
-
-		pythonVersionSpecificOffsets, err := m.pyperfModule.GetMap(PythonVersionSpecificOffsetMapName)
-		if err != nil {
-			return fmt.Errorf("get pid to process info map: %w", err)
-		}
-
-		// pyperf maps.
-		m.pythonPIDToProcessInfo = pythonPIDToProcessInfo
-		m.pythonVersionSpecificOffsets = pythonVersionSpecificOffsets
-	}
-
 	return nil
 }
 
@@ -824,6 +965,17 @@ func (m *Maps) AddInterpreter(pid int, interpreter runtime.Interpreter) error {
 		return nil
 	}
 
+	switch interpreter.Type {
+	case runtime.InterpreterRuby:
+		if err := m.loadInterpreterUnwinder(RbperfModule); err != nil {
+			return fmt.Errorf("load interpreter unwinder: %w", err)
+		}
+	case runtime.InterpreterPython:
+		if err := m.loadInterpreterUnwinder(PyperfModule); err != nil {
+			return fmt.Errorf("load interpreter unwinder: %w", err)
+		}
+	}
+
 	i, err := m.indexForInterpreter(interpreter)
 	if err != nil {
 		return fmt.Errorf("index for interpreter version: %w", err)
@@ -845,6 +997,7 @@ func (m *Maps) AddInterpreter(pid int, interpreter runtime.Interpreter) error {
 	case runtime.InterpreterPython:
 		interpreterInfo := pyperf.InterpreterInfo{
 			ThreadStateAddr:      interpreter.MainThreadAddress,
+			InterpreterAddr:      interpreter.InterpreterAddress,
 			PyVersionOffsetIndex: i,
 		}
 		level.Debug(m.logger).Log("msg", "Python Version Offset", "pid", pid, "version_offset_index", i)
@@ -927,13 +1080,15 @@ func (m *Maps) ReadStack(stackID uint64, stack []uint64) error {
 		return fmt.Errorf("read user stack trace, %w: %w", err, ErrMissing)
 	}
 
-	var rawStackWithLenth stackTraceWithLength
-	if err := binary.Read(bytes.NewBuffer(stackBytes), m.byteOrder, &rawStackWithLenth); err != nil {
-		return fmt.Errorf("read user stack bytes, %w: %w", err, ErrUnrecoverable)
+	// The length of the stack, followed by as many addresses as the stack
+	// depth the BPF programs were built for.
+	if len(stackBytes) < 8 {
+		return fmt.Errorf("read user stack bytes, got %d bytes: %w", len(stackBytes), ErrUnrecoverable)
 	}
-
-	for i, addr := range rawStackWithLenth.Addrs {
-		if i >= bpfprograms.StackDepth || i >= int(rawStackWithLenth.Len) || addr == 0 {
+	n := min(m.byteOrder.Uint64(stackBytes), uint64(len(stackBytes)/8-1), uint64(len(stack)))
+	for i := 0; i < int(n); i++ {
+		addr := m.byteOrder.Uint64(stackBytes[8*(i+1):])
+		if addr == 0 {
 			break
 		}
 		stack[i] = addr
@@ -991,6 +1146,11 @@ func (m *Maps) InterpreterSymbolTable() (profile.InterpreterSymbolTable, error)
 		}
 	}
 
+	m.mutex.Lock()
+	m.stats.Symbols = max(m.stats.Symbols, uint64(len(interpreterFrames)))
+	m.metrics.observeMapUsage(symbolTableMapName, uint64(m.sizes.SymbolTable), uint64(len(interpreterFrames)))
+	m.mutex.Unlock()
+
 	return interpreterFrames, nil
 }
 
@@ -1017,6 +1177,10 @@ func (m *Maps) FinalizeProfileLoop() error {
 		result = errors.Join(result, err)
 	}
 
+	m.mutex.Lock()
+	m.reportUsage()
+	m.mutex.Unlock()
+
 	return result
 }
 
@@ -1074,6 +1238,7 @@ func (m *Maps) cleanEventsCount() error {
 }
 
 func (m *Maps) cleanProcessInfo() error {
+	m.processInfoPIDs = make(map[int]struct{})
 	if err := clearMap(m.processInfo); err != nil {
 		m.metrics.mapCleanErrors.WithLabelValues(m.processInfo.Name()).Inc()
 		return err
@@ -1087,6 +1252,11 @@ func (m *Maps) cleanShardInfo() error {
 		m.metrics.mapCleanErrors.WithLabelValues(m.unwindShards.Name()).Inc()
 		return err
 	}
+	m.chunkDirectories = 0
+	if err := clearMap(m.unwindChunkDirectories); err != nil {
+		m.metrics.mapCleanErrors.WithLabelValues(m.unwindChunkDirectories.Name()).Inc()
+		return err
+	}
 	return nil
 }
 
@@ -1243,6 +1413,7 @@ func (m *Maps) AddUnwindTableForProcess(pid int, executableMappings unwind.Execu
 		}
 		return fmt.Errorf("update processInfo: %w", err)
 	}
+	m.processInfoPIDs[pid] = struct{}{}
 
 	mapsHash, err := executableMappings.Hash()
 	if err != nil {
@@ -1424,6 +1595,42 @@ func (m *Maps) resetUnwindState() error {
 	return nil
 }
 
+// writeChunkDirectory stores where the unwind table chunks of the current
+// executable live. Executables with more chunks than fit in a single
+// `unwind_info_chunks` entry use the lower levels of the directory.
+func (m *Maps) writeChunkDirectory(executable string, chunks []chunkInfo) error {
+	dir, err := buildChunkDirectory(chunks, m.chunkDirectories)
+	if err == nil && m.chunkDirectories+uint64(len(dir.directories)) > maxUnwindTableChunkDirectories {
+		err = fmt.Errorf("no space left in the chunk directories map")
+	}
+	if err != nil {
+		// Only part of the executable will be covered.
+		level.Error(m.logger).Log("msg", "failed to add all unwind table chunks", "executable", executable, "chunks", len(chunks), "err", err)
+		dir = chunkDirectory{top: chunks[:min(len(chunks), maxUnwindTableChunks)]}
+	}
+
+	buf := make([]byte, unwindShardsSizeBytes)
+	keyBuf := make([]byte, chunkDirectoryKeySizeBytes)
+	executableID := m.executableID
+	for _, group := range dir.directories {
+		index := m.chunkDirectories
+		m.chunkDirectories++
+
+		m.byteOrder.PutUint64(keyBuf[0:], executableID)
+		m.byteOrder.PutUint64(keyBuf[8:], index)
+		val := encodeChunks(buf, m.byteOrder, group)
+		if err := m.unwindChunkDirectories.Update(unsafe.Pointer(&keyBuf[0]), unsafe.Pointer(&val[0])); err != nil {
+			return fmt.Errorf("failed to update unwind chunk directory: %w", err)
+		}
+	}
+
+	val := encodeChunks(buf, m.byteOrder, dir.top)
+	if err := m.unwindShards.Update(unsafe.Pointer(&executableID), unsafe.Pointer(&val[0])); err != nil {
+		return fmt.Errorf("failed to update unwind shard: %w", err)
+	}
+	return nil
+}
+
 // availableEntries returns how many entries we have left
 // in the in-flight shard.
 func (m *Maps) availableEntries() uint64 {
@@ -1469,6 +1676,64 @@ func (m *Maps) allocateNewShard() error {
 	return nil
 }
 
+// preparedUnwindTable is an unwind table generated outside of the maps' lock.
+type preparedUnwindTable struct {
+	table unwind.CompactUnwindTable
+	arch  elf.Machine
+}
+
+// PrepareUnwindTables generates the unwind tables for the executables mapped
+// by the given process that haven't been added yet. The next call to
+// `AddUnwindTableForProcess` for this process then only has to write them to
+// the BPF maps. Unlike the rest of the unwind table methods, this can be
+// called concurrently, as the expensive part doesn't hold the lock.
+func (m *Maps) PrepareUnwindTables(pid int) error {
+	proc, err := procfs.NewProc(pid)
+	if err != nil {
+		return err
+	}
+	mappings, err := proc.ProcMaps()
+	if err != nil {
+		return err
+	}
+
+	for _, mapping := range unwind.ListExecutableMappings(mappings) {
+		if mapping.IsNotFileBacked() || mapping.IsJITDump() {
+			continue
+		}
+
+		fullExecutablePath := path.Join("/proc/", strconv.Itoa(pid), "/root/", mapping.Executable)
+		analysis, err := m.objFilePool.Analyze(fullExecutablePath)
+		if err != nil || analysis.EhFrame == nil {
+			// It will be dealt with when adding the unwind table.
+			continue
+		}
+		buildID := analysis.BuildID
+
+		if _, ok := m.preparedUnwindTables.Load(buildID); ok {
+			continue
+		}
+		m.mutex.Lock()
+		_, seen := m.buildIDMapping[buildID]
+		m.mutex.Unlock()
+		if seen {
+			continue
+		}
+
+		ut, arch, err := unwind.GenerateCompactUnwindTable(fullExecutablePath)
+		if err != nil || len(ut) == 0 {
+			continue
+		}
+		m.preparedUnwindTables.Store(buildID, preparedUnwindTable{table: ut, arch: arch})
+	}
+	return nil
+}
+
+// DiscardPreparedUnwindTables frees the prepared unwind tables that weren't used.
+func (m *Maps) DiscardPreparedUnwindTables() {
+	m.preparedUnwindTables.Clear()
+}
+
 // setUnwindTableForMapping sets all the necessary metadata and unwind tables, if needed
 // to make DWARF unwinding work, such as:
 //
@@ -1505,30 +1770,19 @@ func (m *Maps) setUnwindTableForMapping(buf *profiler.EfficientBuffer, pid int,
 	// information.
 	fullExecutablePath := path.Join("/proc/", strconv.Itoa(pid), "/root/", mapping.Executable)
 
-	f, err := os.Open(fullExecutablePath)
-	if err != nil {
-		return err
-	}
-
-	ef, err := elf.NewFile(f)
+	analysis, err := m.objFilePool.Analyze(fullExecutablePath)
 	var elfErr *elf.FormatError
 	if err != nil {
-		if errors.Is(err, os.ErrNotExist) {
-			return nil
-		}
 		if errors.As(err, &elfErr) {
 			level.Debug(m.logger).Log("msg", "bad ELF file format", "err", err)
 			return nil
 		}
-		return fmt.Errorf("elf.Open failed: %w", err)
-	}
-	buildID, err := buildid.FromELF(ef)
-	if err != nil {
-		return fmt.Errorf("BuildID failed %s: %w", fullExecutablePath, err)
+		return fmt.Errorf("analyze %s: %w", fullExecutablePath, err)
 	}
+	buildID := analysis.BuildID
 
 	// Find the adjusted load address.
-	aslrElegible := elfreader.IsASLRElegibleElf(ef)
+	aslrElegible := analysis.ASLREligible
 
 	adjustedLoadAddress := uint64(0)
 	if mapping.IsMainObject() {
@@ -1550,13 +1804,22 @@ func (m *Maps) setUnwindTableForMapping(buf *profiler.EfficientBuffer, pid int,
 
 	// Generated and add the unwind table, if needed.
 	if !mappingAlreadySeen {
-		unwindShardsValBuf := new(bytes.Buffer)
-		unwindShardsValBuf.Grow(unwindShardsSizeBytes)
-
-		// Generate the unwind table.
+		// Generate the unwind table, unless it was prepared ahead of time.
 		// PERF(javierhonduco): Not reusing a buffer here yet, let's profile and decide whether this
 		// change would be worth it.
-		ut, arch, err := unwind.GenerateCompactUnwindTable(fullExecutablePath)
+		var (
+			ut   unwind.CompactUnwindTable
+			arch elf.Machine
+		)
+		switch prepared, ok := m.preparedUnwindTables.LoadAndDelete(buildID); {
+		case ok:
+			ut, arch = prepared.table, prepared.arch
+		case analysis.EhFrame == nil:
+			// No need to open the file again to find out.
+			err = unwind.ErrEhFrameSectionNotFound
+		default:
+			ut, arch, err = unwind.GenerateCompactUnwindTable(fullExecutablePath)
+		}
 		level.Debug(m.logger).Log("msg", "found unwind entries", "executable", mapping.Executable, "len", len(ut))
 
 		if err != nil {
@@ -1573,9 +1836,8 @@ func (m *Maps) setUnwindTableForMapping(buf *profiler.EfficientBuffer, pid int,
 			return nil
 		}
 
-		chunkIndex := 0
-
 		var (
+			chunks       []chunkInfo
 			currentChunk unwind.CompactUnwindTable
 			restChunks   unwind.CompactUnwindTable
 		)
@@ -1628,11 +1890,6 @@ func (m *Maps) setUnwindTableForMapping(buf *profiler.EfficientBuffer, pid int,
 
 			m.assertInvariants()
 
-			if chunkIndex >= maxUnwindTableChunks {
-				level.Error(m.logger).Log("msg", "have more chunks than the max", "chunks", chunkIndex, "maxChunks", maxUnwindTableChunks)
-				// TODO(javierhonduco): not returning an error right now, but let's handle this later on.
-			}
-
 			level.Debug(m.logger).Log("current chunk size", len(currentChunk))
 			level.Debug(m.logger).Log("rest of chunk size", len(restChunks))
 
@@ -1644,38 +1901,23 @@ func (m *Maps) setUnwindTableForMapping(buf *profiler.EfficientBuffer, pid int,
 
 			// Add shard information.
 
-			level.Debug(m.logger).Log("executableID", m.executableID, "executable", mapping.Executable, "current shard", chunkIndex)
+			level.Debug(m.logger).Log("executableID", m.executableID, "executable", mapping.Executable, "current shard", len(chunks))
 
 			// Dealing with the first chunk, we must add the lowest known PC.
 			minPc := currentChunk[0].Pc()
 			if minPc == 0 {
 				panic("maxPC can't be zero")
 			}
-			// .low_pc
-			if err := binary.Write(unwindShardsValBuf, m.byteOrder, minPc); err != nil {
-				return fmt.Errorf("write shards .low_pc bytes: %w", err)
-			}
-
 			// Dealing with the last chunk, we must add the highest known PC.
 			maxPc := currentChunk[len(currentChunk)-1].Pc()
-			// .high_pc
-			if err := binary.Write(unwindShardsValBuf, m.byteOrder, maxPc); err != nil {
-				return fmt.Errorf("write shards .high_pc bytes: %w", err)
-			}
 
-			// .shard_index
-			if err := binary.Write(unwindShardsValBuf, m.byteOrder, m.shardIndex); err != nil {
-				return fmt.Errorf("write shards .shard_index bytes: %w", err)
-			}
-
-			// .low_index
-			if err := binary.Write(unwindShardsValBuf, m.byteOrder, m.lowIndex); err != nil {
-				return fmt.Errorf("write shards .low_index bytes: %w", err)
-			}
-			// .high_index
-			if err := binary.Write(unwindShardsValBuf, m.byteOrder, m.highIndex); err != nil {
-				return fmt.Errorf("write shards .high_index bytes: %w", err)
-			}
+			chunks = append(chunks, chunkInfo{
+				lowPC:      minPc,
+				highPC:     maxPc,
+				shardIndex: m.shardIndex,
+				lowIndex:   m.lowIndex,
+				highIndex:  m.highIndex,
+			})
 
 			m.lowIndex = m.highIndex
 
@@ -1694,15 +1936,10 @@ func (m *Maps) setUnwindTableForMapping(buf *profiler.EfficientBuffer, pid int,
 					return err
 				}
 			}
-
-			chunkIndex++
 		}
 
-		executableID := m.executableID
-		if err := m.unwindShards.Update(
-			unsafe.Pointer(&executableID),
-			unsafe.Pointer(&unwindShardsValBuf.Bytes()[0])); err != nil {
-			return fmt.Errorf("failed to update unwind shard: %w", err)
+		if err := m.writeChunkDirectory(mapping.Executable, chunks); err != nil {
+			return err
 		}
 
 		m.executableID++
@@ -15,6 +15,8 @@
 package bpfmaps
 
 import (
+	"time"
+
 	"github.com/prometheus/client_golang/prometheus"
 	"github.com/prometheus/client_golang/prometheus/promauto"
 )
@@ -29,6 +31,14 @@ type Metrics struct {
 
 	// Map clean.
 	mapCleanErrors *prometheus.CounterVec
+
+	// Map usage.
+	mapCapacity *prometheus.GaugeVec
+	mapEntries  *prometheus.GaugeVec
+	mapHeadroom *prometheus.GaugeVec
+
+	// Program loading.
+	programLoadDuration *prometheus.HistogramVec
 }
 
 func NewMetrics(reg prometheus.Registerer) *Metrics {
@@ -43,6 +53,27 @@ func NewMetrics(reg prometheus.Registerer) *Metrics {
 			Help:        "Number of errors cleaning BPF maps",
 			ConstLabels: map[string]string{"type": "cpu"},
 		}, []string{"map"}),
+		mapCapacity: promauto.With(reg).NewGaugeVec(prometheus.GaugeOpts{
+			Name:        "parca_agent_profiler_bpf_maps_capacity",
+			Help:        "Maximum number of entries of BPF maps",
+			ConstLabels: map[string]string{"type": "cpu"},
+		}, []string{"map"}),
+		mapEntries: promauto.With(reg).NewGaugeVec(prometheus.GaugeOpts{
+			Name:        "parca_agent_profiler_bpf_maps_entries",
+			Help:        "Number of entries in use in BPF maps",
+			ConstLabels: map[string]string{"type": "cpu"},
+		}, []string{"map"}),
+		mapHeadroom: promauto.With(reg).NewGaugeVec(prometheus.GaugeOpts{
+			Name:        "parca_agent_profiler_bpf_maps_headroom_ratio",
+			Help:        "Ratio of the capacity of BPF maps that is still available",
+			ConstLabels: map[string]string{"type": "cpu"},
+		}, []string{"map"}),
+		programLoadDuration: promauto.With(reg).NewHistogramVec(prometheus.HistogramOpts{
+			Name:                        "parca_agent_profiler_bpf_program_load_duration_seconds",
+			Help:                        "Time spent loading and verifying BPF objects",
+			ConstLabels:                 map[string]string{"type": "cpu"},
+			NativeHistogramBucketFactor: 1.1,
+		}, []string{"program"}),
 	}
 
 	m.refreshProcessInfoErrors.WithLabelValues(labelHash)
@@ -54,3 +85,19 @@ func NewMetrics(reg prometheus.Registerer) *Metrics {
 	m.mapCleanErrors.WithLabelValues(UnwindInfoChunksMapName)
 	return m
 }
+
+// observeMapUsage records the capacity and the used entries of a BPF map.
+func (m *Metrics) observeMapUsage(name string, capacity, entries uint64) {
+	m.mapCapacity.WithLabelValues(name).Set(float64(capacity))
+	m.mapEntries.WithLabelValues(name).Set(float64(entries))
+	if capacity == 0 {
+		return
+	}
+	m.mapHeadroom.WithLabelValues(name).Set(1 - float64(min(entries, capacity))/float64(capacity))
+}
+
+// ObserveProgramLoad records the time it took to load, and verify, the BPF
+// object of the given unwinder.
+func (m *Metrics) ObserveProgramLoad(program string, d time.Duration) {
+	m.programLoadDuration.WithLabelValues(program).Observe(d.Seconds())
+}
@@ -0,0 +1,260 @@
+// Copyright 2022-2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+package bpfmaps
+
+import (
+	"encoding/json"
+	"errors"
+	"fmt"
+	"os"
+	"path/filepath"
+
+	"github.com/parca-dev/parca-agent/internal/fsutil"
+)
+
+const (
+	// Default sizes, used when no memory budget is given. They always need
+	// to be in sync with the `max_entries` of the maps in the BPF program.
+	defaultUnwindInfoChunks = 5 * 1000
+	defaultStackCounts      = 10240
+
+	// Lower bounds for the maps sized from the memory budget. Going below
+	// these would make the profiler drop data on even the smallest nodes.
+	minProcessInfo      = 256
+	minUnwindInfoChunks = 256
+	minStackCounts      = 1024
+	minSymbolTable      = 1024
+
+	// Stack aggregation entries we expect per CPU in a profiling round. It
+	// is picked so that 64 CPUs result in the previous default.
+	stackCountsPerCPU = defaultStackCounts / 64
+
+	// Bounds, in pages, of the per-CPU perf buffers used for events.
+	minEventsBufferPagesPerCPU = 8
+	maxEventsBufferPagesPerCPU = 64
+
+	/*
+		typedef struct {
+			int pid;
+			int tgid;
+			u64 user_stack_id;
+			u64 kernel_stack_id;
+			u64 interpreter_stack_id;
+			u64 flags;
+		} stack_count_key_t;
+	*/
+	stackCountKeySizeBytes = 4*2 + 8*4
+	/*
+		typedef struct {
+			char class_name[CLASS_NAME_MAXLEN];
+			char method_name[METHOD_MAXLEN];
+			char path[PATH_MAXLEN];
+		} symbol_t;
+	*/
+	symbolSizeBytes = 32 + 64 + 128
+
+	// Approximate memory used by each entry, key and value, of the maps.
+	processInfoEntryBytes      = 4 + mappingInfoSizeBytes
+	unwindInfoChunksEntryBytes = 8 + unwindShardsSizeBytes
+	stackCountsEntryBytes      = stackCountKeySizeBytes + 8
+	symbolTableEntryBytes      = symbolSizeBytes + 4
+
+	// The second level of the chunk directory can't be resized, but as it's
+	// preallocated it still takes its share of the budget.
+	unwindInfoChunksDirectoryBytes = maxUnwindTableChunkDirectories * (chunkDirectoryKeySizeBytes + unwindShardsSizeBytes)
+)
+
+// stackTracesEntryBytes returns the approximate memory used by each entry of
+// the stack traces map for the given stack depth.
+func stackTracesEntryBytes(stackDepth int) uint64 {
+	return uint64(8 + 8*(1+stackDepth))
+}
+
+var ErrMemoryBudgetTooSmall = errors.New("BPF memory budget too small")
+
+// MapSizes contains the number of entries for the BPF maps that can be
+// resized before loading the BPF program.
+type MapSizes struct {
+	UnwindShards     uint32
+	ProcessInfo      uint32
+	UnwindInfoChunks uint32
+	StackCounts      uint32
+	StackTraces      uint32
+	SymbolTable      uint32
+}
+
+// DefaultMapSizes returns the map sizes used when no memory budget is set.
+func DefaultMapSizes(unwindShards uint32) MapSizes {
+	return MapSizes{
+		UnwindShards:     unwindShards,
+		ProcessInfo:      maxProcesses,
+		UnwindInfoChunks: defaultUnwindInfoChunks,
+		StackCounts:      defaultStackCounts,
+		StackTraces:      defaultStackCounts,
+		SymbolTable:      defaultSymbolTableSize,
+	}
+}
+
+// MapStats are the high watermarks of the BPF maps' usage. They are
+// persisted so the maps can be sized accordingly after a restart.
+type MapStats struct {
+	// The CPUs the statistics were observed with, the stacks seen in a
+	// profiling round grow with them.
+	NumCPUs     int    `json:"num_cpus"`
+	Processes   uint64 `json:"processes"`
+	Executables uint64 `json:"executables"`
+	Stacks      uint64 `json:"stacks"`
+	Symbols     uint64 `json:"symbols"`
+}
+
+// LoadMapStats reads the previously persisted statistics. A missing file is
+// not an error, zero statistics are returned instead.
+func LoadMapStats(path string) (MapStats, error) {
+	var stats MapStats
+
+	b, err := os.ReadFile(path)
+	if err != nil {
+		if errors.Is(err, os.ErrNotExist) {
+			return stats, nil
+		}
+		return stats, fmt.Errorf("read map stats: %w", err)
+	}
+
+	if err := json.Unmarshal(b, &stats); err != nil {
+		return MapStats{}, fmt.Errorf("decode map stats: %w", err)
+	}
+	return stats, nil
+}
+
+// Save atomically writes the statistics to the given path.
+func (s MapStats) Save(path string) error {
+	b, err := json.Marshal(s)
+	if err != nil {
+		return fmt.Errorf("encode map stats: %w", err)
+	}
+
+	if err := os.MkdirAll(filepath.Dir(path), 0o755); err != nil {
+		return fmt.Errorf("create map stats directory: %w", err)
+	}
+
+	if err := fsutil.WriteFileAtomic(path, b, 0o644); err != nil {
+		return fmt.Errorf("write map stats: %w", err)
+	}
+	return nil
+}
+
+// withHeadroom adds 50% on top of an observed value, so we don't
+// immediately run out of space if the node is a bit busier than before.
+func withHeadroom(observed uint64) uint64 {
+	return observed + observed/2
+}
+
+func clampEntries(v, low, high uint64) uint32 {
+	return uint32(max(low, min(v, high)))
+}
+
+// MapSizesForBudget divides the given memory budget, in bytes, across the BPF
+// maps. The maps that track processes, executables, stacks and symbols are
+// sized from the previously observed statistics, or from the defaults and
+// the CPU count if none were observed, and the stack traces take more with
+// deeper stacks. The observed stacks are scaled to the current CPU count if
+// they were observed with a different one, e.g. after a node was resized. They can take up to half of the budget left after the maps
+// with a fixed size. The rest goes to the unwind table shards, which is where
+// most of the memory is used.
+func MapSizesForBudget(budget uint64, numCPUs int, stats MapStats, compactUnwindRowSizeBytes, stackDepth int, interpreters bool) (MapSizes, error) {
+	unwindShardBytes := uint64(8 + maxUnwindTableSize*compactUnwindRowSizeBytes)
+
+	processes := uint64(maxProcesses)
+	if stats.Processes != 0 {
+		processes = withHeadroom(stats.Processes)
+	}
+	executables := uint64(defaultUnwindInfoChunks)
+	if stats.Executables != 0 {
+		executables = withHeadroom(stats.Executables)
+	}
+	observedStacks := stats.Stacks
+	if stats.NumCPUs > 0 && numCPUs > 0 && stats.NumCPUs != numCPUs {
+		observedStacks = observedStacks * uint64(numCPUs) / uint64(stats.NumCPUs)
+	}
+	stacks := max(uint64(numCPUs)*stackCountsPerCPU, withHeadroom(observedStacks))
+	symbols := uint64(0)
+	if interpreters {
+		symbols = defaultSymbolTableSize
+		if stats.Symbols != 0 {
+			symbols = withHeadroom(stats.Symbols)
+		}
+	}
+
+	cost := func(processes, executables, stacks, symbols uint64) uint64 {
+		return processes*processInfoEntryBytes +
+			executables*unwindInfoChunksEntryBytes +
+			stacks*(stackCountsEntryBytes+stackTracesEntryBytes(stackDepth)) +
+			symbols*symbolTableEntryBytes
+	}
+
+	// Scale the auxiliary maps down proportionally if they would take more
+	// than half of what is available.
+	available := budget - min(budget, uint64(unwindInfoChunksDirectoryBytes))
+	if c := cost(processes, executables, stacks, symbols); c > available/2 {
+		scale := func(v uint64) uint64 { return v * (available / 2) / c }
+		processes = scale(processes)
+		executables = scale(executables)
+		stacks = scale(stacks)
+		symbols = scale(symbols)
+	}
+
+	const maxEntries = 1 << 24
+	sizes := MapSizes{
+		ProcessInfo:      clampEntries(processes, minProcessInfo, maxEntries),
+		UnwindInfoChunks: clampEntries(executables, minUnwindInfoChunks, maxEntries),
+		StackCounts:      clampEntries(stacks, minStackCounts, maxEntries),
+		StackTraces:      clampEntries(stacks, minStackCounts, maxEntries),
+		SymbolTable:      defaultSymbolTableSize,
+	}
+	if interpreters {
+		sizes.SymbolTable = clampEntries(symbols, minSymbolTable, maxEntries)
+	}
+
+	used := cost(uint64(sizes.ProcessInfo), uint64(sizes.UnwindInfoChunks), uint64(sizes.StackCounts), 0) + unwindInfoChunksDirectoryBytes
+	if interpreters {
+		used += uint64(sizes.SymbolTable) * symbolTableEntryBytes
+	}
+	if used+unwindShardBytes > budget {
+		return MapSizes{}, fmt.Errorf("%w: need at least %d bytes, got %d", ErrMemoryBudgetTooSmall, used+unwindShardBytes, budget)
+	}
+
+	sizes.UnwindShards = uint32(min((budget-used)/unwindShardBytes, MaxUnwindShards))
+	return sizes, nil
+}
+
+// EventsBufferPagesPerCPU splits the events buffer, given in pages, across
+// CPUs. Every CPU gets up to `maxEventsBufferPagesPerCPU` pages, so the total
+// stays under the configured size once there are enough CPUs, but never less
+// than `minEventsBufferPagesPerCPU`, as events would be lost otherwise. The
+// result is always a power of two, which the kernel requires.
+func EventsBufferPagesPerCPU(totalPages uint32, numCPUs int) int {
+	perCPU := uint32(maxEventsBufferPagesPerCPU)
+	if numCPUs > 0 {
+		perCPU = min(perCPU, totalPages/uint32(numCPUs))
+	}
+	perCPU = max(perCPU, minEventsBufferPagesPerCPU)
+
+	// Round down to a power of two.
+	pages := uint32(1)
+	for pages*2 <= perCPU {
+		pages *= 2
+	}
+	return int(pages)
+}
@@ -0,0 +1,156 @@
+// Copyright 2022-2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+package bpfmaps
+
+import (
+	"os"
+	"path/filepath"
+	"regexp"
+	"strings"
+	"testing"
+
+	"github.com/stretchr/testify/require"
+
+	bpfprograms "github.com/parca-dev/parca-agent/pkg/profiler/cpu/bpf/programs"
+)
+
+func TestMapSizesForBudget(t *testing.T) {
+	const mb = 1024 * 1024
+
+	// Without statistics we should get the defaults and as many shards as fit.
+	sizes, err := MapSizesForBudget(512*mb, 64, MapStats{}, compactUnwindRowSizeBytesX86, bpfprograms.DefaultStackDepth, true)
+	require.NoError(t, err)
+	require.Equal(t, uint32(maxProcesses), sizes.ProcessInfo)
+	require.Equal(t, uint32(defaultUnwindInfoChunks), sizes.UnwindInfoChunks)
+	require.Equal(t, uint32(defaultStackCounts), sizes.StackCounts)
+	require.Equal(t, uint32(defaultSymbolTableSize), sizes.SymbolTable)
+	require.Greater(t, sizes.UnwindShards, uint32(0))
+	require.LessOrEqual(t, sizes.UnwindShards, uint32(MaxUnwindShards))
+
+	// Observed statistics take precedence, with some headroom.
+	sizes, err = MapSizesForBudget(512*mb, 64, MapStats{Processes: 1000, Executables: 2000}, compactUnwindRowSizeBytesX86, bpfprograms.DefaultStackDepth, true)
+	require.NoError(t, err)
+	require.Equal(t, uint32(1500), sizes.ProcessInfo)
+	require.Equal(t, uint32(3000), sizes.UnwindInfoChunks)
+
+	// Stack maps grow with the number of CPUs.
+	sizes, err = MapSizesForBudget(512*mb, 384, MapStats{}, compactUnwindRowSizeBytesX86, bpfprograms.DefaultStackDepth, false)
+	require.NoError(t, err)
+	require.Equal(t, uint32(384*stackCountsPerCPU), sizes.StackCounts)
+	require.Equal(t, sizes.StackCounts, sizes.StackTraces)
+
+	// Stacks observed with fewer CPUs are scaled up to the current ones, and
+	// the other way around.
+	sizes, err = MapSizesForBudget(512*mb, 128, MapStats{NumCPUs: 64, Stacks: 20000}, compactUnwindRowSizeBytesX86, bpfprograms.DefaultStackDepth, false)
+	require.NoError(t, err)
+	require.Equal(t, uint32(60000), sizes.StackCounts)
+	sizes, err = MapSizesForBudget(512*mb, 64, MapStats{NumCPUs: 128, Stacks: 40000}, compactUnwindRowSizeBytesX86, bpfprograms.DefaultStackDepth, false)
+	require.NoError(t, err)
+	require.Equal(t, uint32(30000), sizes.StackCounts)
+	// Without the CPU count the observed stacks are used as they are.
+	sizes, err = MapSizesForBudget(512*mb, 128, MapStats{Stacks: 20000}, compactUnwindRowSizeBytesX86, bpfprograms.DefaultStackDepth, false)
+	require.NoError(t, err)
+	require.Equal(t, uint32(30000), sizes.StackCounts)
+
+	// Small budgets shrink the auxiliary maps so unwind tables still fit.
+	sizes, err = MapSizesForBudget(64*mb, 64, MapStats{}, compactUnwindRowSizeBytesX86, bpfprograms.DefaultStackDepth, true)
+	require.NoError(t, err)
+	require.Less(t, sizes.ProcessInfo, uint32(maxProcesses))
+	require.GreaterOrEqual(t, sizes.UnwindShards, uint32(1))
+
+	// Deeper stacks take more of the budget.
+	deeper, err := MapSizesForBudget(64*mb, 64, MapStats{}, compactUnwindRowSizeBytesX86, 160, true)
+	require.NoError(t, err)
+	require.Less(t, deeper.StackTraces, sizes.StackTraces)
+
+	// Every map, including the ones with a fixed size, fits in the budget.
+	for budget := uint64(8 * mb); budget <= 128*mb; budget += mb / 2 {
+		sizes, err := MapSizesForBudget(budget, 64, MapStats{}, compactUnwindRowSizeBytesX86, bpfprograms.DefaultStackDepth, true)
+		if err != nil {
+			require.ErrorIs(t, err, ErrMemoryBudgetTooSmall)
+			continue
+		}
+		total := uint64(sizes.ProcessInfo)*processInfoEntryBytes +
+			uint64(sizes.UnwindInfoChunks)*unwindInfoChunksEntryBytes +
+			uint64(sizes.StackCounts)*stackCountsEntryBytes +
+			uint64(sizes.StackTraces)*stackTracesEntryBytes(bpfprograms.DefaultStackDepth) +
+			uint64(sizes.SymbolTable)*symbolTableEntryBytes +
+			uint64(sizes.UnwindShards)*(8+maxUnwindTableSize*compactUnwindRowSizeBytesX86) +
+			unwindInfoChunksDirectoryBytes
+		require.LessOrEqual(t, total, budget, "budget %d", budget)
+	}
+
+	_, err = MapSizesForBudget(1*mb, 64, MapStats{}, compactUnwindRowSizeBytesX86, bpfprograms.DefaultStackDepth, true)
+	require.ErrorIs(t, err, ErrMemoryBudgetTooSmall)
+}
+
+// cStructSize returns the size of a C struct made of 32 and 64-bit integers, as
+// defined in the given header.
+func cStructSize(t *testing.T, header, name string) int {
+	t.Helper()
+
+	src, err := os.ReadFile(header)
+	require.NoError(t, err)
+
+	m := regexp.MustCompile(`(?s)typedef struct \{([^}]*)\} ` + name + `;`).FindSubmatch(src)
+	require.NotNil(t, m, "struct %s not found in %s", name, header)
+
+	size := 0
+	for _, line := range strings.Split(string(m[1]), "\n") {
+		line = strings.TrimSpace(line)
+		switch {
+		case line == "" || strings.HasPrefix(line, "//"):
+		case strings.HasPrefix(line, "int "), strings.HasPrefix(line, "u32 "):
+			size = (size+3)/4*4 + 4
+		case strings.HasPrefix(line, "u64 "), strings.HasPrefix(line, "s64 "):
+			// Aligned to 8 bytes.
+			size = (size+7)/8*8 + 8
+		default:
+			t.Fatalf("unexpected field in %s: %q", name, line)
+		}
+	}
+	return (size + 7) / 8 * 8
+}
+
+func TestEntrySizesMatchBPFDefinitions(t *testing.T) {
+	header := filepath.Join("..", "..", "..", "..", "..", "bpf", "unwinders", "shared.h")
+	require.Equal(t, cStructSize(t, header, "stack_count_key_t"), stackCountKeySizeBytes)
+}
+
+func TestEventsBufferPagesPerCPU(t *testing.T) {
+	// Up to 128 CPUs the default buffer size gives every CPU the maximum.
+	require.Equal(t, 64, EventsBufferPagesPerCPU(8192, 4))
+	require.Equal(t, 64, EventsBufferPagesPerCPU(8192, 128))
+	// Past that, the total stays bounded by the configured size.
+	require.Equal(t, 32, EventsBufferPagesPerCPU(8192, 256))
+	require.Equal(t, 16, EventsBufferPagesPerCPU(8192, 384))
+	// But each CPU always gets a minimum.
+	require.Equal(t, 8, EventsBufferPagesPerCPU(32, 384))
+}
+
+func TestMapStatsPersistence(t *testing.T) {
+	path := filepath.Join(t.TempDir(), "stats", "bpf_map_stats.json")
+
+	stats, err := LoadMapStats(path)
+	require.NoError(t, err)
+	require.Equal(t, MapStats{}, stats)
+
+	want := MapStats{NumCPUs: 8, Processes: 10, Executables: 20, Stacks: 30, Symbols: 40}
+	require.NoError(t, want.Save(path))
+
+	stats, err = LoadMapStats(path)
+	require.NoError(t, err)
+	require.Equal(t, want, stats)
+}
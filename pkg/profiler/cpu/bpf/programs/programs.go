@@ -20,10 +20,23 @@ import (
 	"runtime"
 )
 
-const (
-	StackDepth       = 127 // Always needs to be sync with MAX_STACK_DEPTH in BPF program.
-	tripleStackDepth = StackDepth * 3
-)
+// DefaultStackDepth is the maximum number of frames of the stacks walked by
+// the default build of the BPF programs. Always needs to be sync with
+// MAX_STACK_DEPTH in BPF program.
+const DefaultStackDepth = 127
+
+// StackDepths are the maximum numbers of frames the BPF programs are built
+// for. Always needs to be sync with STACK_DEPTH_VARIANTS in bpf/Makefile.
+var StackDepths = stackDepths(runtime.GOARCH)
+
+func stackDepths(arch string) []int {
+	if arch == "arm64" {
+		// Walking 160 native frames takes all the tail calls on arm64,
+		// leaving none to the interpreter unwinders.
+		return []int{64, DefaultStackDepth}
+	}
+	return []int{64, DefaultStackDepth, 160}
+}
 
 var (
 	//go:embed objects/*
@@ -42,18 +55,66 @@ var (
 	NativeUnwinderProgramName = "native_unwind"
 )
 
-type CombinedStack [tripleStackDepth]uint64
+// CombinedStack holds the user, kernel and interpreter stacks of a sample,
+// one after the other, each of them of the stack depth the BPF programs were
+// built for.
+type CombinedStack []uint64
+
+// NewCombinedStack returns a CombinedStack for the given stack depth.
+func NewCombinedStack(depth int) CombinedStack {
+	return make(CombinedStack, depth*3)
+}
+
+func (s CombinedStack) depth() int {
+	return len(s) / 3
+}
+
+// User returns the user stack.
+func (s CombinedStack) User() []uint64 {
+	return s[:s.depth()]
+}
 
-func OpenNative() ([]byte, error) {
-	return open(fmt.Sprintf("objects/%s/native.bpf.o", runtime.GOARCH))
+// Kernel returns the kernel stack.
+func (s CombinedStack) Kernel() []uint64 {
+	return s[s.depth() : s.depth()*2]
 }
 
-func OpenRuby() ([]byte, error) {
-	return open(fmt.Sprintf("objects/%s/rbperf.bpf.o", runtime.GOARCH))
+// Interpreter returns the interpreter stack.
+func (s CombinedStack) Interpreter() []uint64 {
+	return s[s.depth()*2:]
 }
 
-func OpenPython() ([]byte, error) {
-	return open(fmt.Sprintf("objects/%s/pyperf.bpf.o", runtime.GOARCH))
+// ValidateStackDepth returns an error if the BPF programs weren't built for
+// the given stack depth.
+func ValidateStackDepth(depth int) error {
+	for _, d := range StackDepths {
+		if d == depth {
+			return nil
+		}
+	}
+	return fmt.Errorf("unsupported stack depth %d, supported stack depths are %v", depth, StackDepths)
+}
+
+func OpenNative(depth int) ([]byte, error) {
+	return open(objectPath("native.bpf.o", depth))
+}
+
+func OpenRuby(depth int) ([]byte, error) {
+	return open(objectPath("rbperf.bpf.o", depth))
+}
+
+func OpenPython(depth int) ([]byte, error) {
+	return open(objectPath("pyperf.bpf.o", depth))
+}
+
+// objectPath returns the path of the given BPF object built for the given
+// stack depth. The variants built for other than the default depth live in
+// their own directory.
+func objectPath(name string, depth int) string {
+	if depth == DefaultStackDepth {
+		return fmt.Sprintf("objects/%s/%s", runtime.GOARCH, name)
+	}
+	return fmt.Sprintf("objects/%s/depth-%d/%s", runtime.GOARCH, depth, name)
 }
 
 func open(file string) ([]byte, error) {
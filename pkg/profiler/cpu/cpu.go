@@ -44,7 +44,7 @@ import (
 	"github.com/parca-dev/parca-agent/pkg/byteorder"
 	"github.com/parca-dev/parca-agent/pkg/cache"
 	"github.com/parca-dev/parca-agent/pkg/cpuinfo"
-	"github.com/parca-dev/parca-agent/pkg/metadata/labels"
+	"github.com/parca-dev/parca-agent/pkg/objectfile"
 	"github.com/parca-dev/parca-agent/pkg/pprof"
 	"github.com/parca-dev/parca-agent/pkg/profile"
 	"github.com/parca-dev/parca-agent/pkg/profiler"
@@ -67,7 +67,7 @@ type UnwinderConfig struct {
 	MixedStackWalking           bool
 	PythonEnable                bool
 	RubyEnabled                 bool
-	Padding1                    bool
+	DegradedUnwinding           bool
 	Padding2                    bool
 	Padding3                    bool
 	RateLimitUnwindInfo         uint32
@@ -83,14 +83,37 @@ type Config struct {
 	PerfEventBufferProcessingInterval time.Duration
 	PerfEventBufferWorkerCount        int
 
+	// The profiles of the processes are converted and stored by this many
+	// workers each, with up to ProfilePipelineQueueSize profiles waiting
+	// for each stage.
+	ProfilePipelineConvertWorkerCount int
+	ProfilePipelineStoreWorkerCount   int
+	ProfilePipelineQueueSize          int
+
 	MemlockRlimit uint64
 
 	DebugProcessNames []string
 
 	DWARFUnwindingDisabled         bool
 	DWARFUnwindingMixedModeEnabled bool
-	BPFVerboseLoggingEnabled       bool
-	BPFEventsBufferSize            uint32
+	// DWARFUnwindingDegradedModeEnabled records the stacks of the processes
+	// whose unwind tables aren't loaded yet, walked with frame pointers.
+	DWARFUnwindingDegradedModeEnabled bool
+	BPFVerboseLoggingEnabled          bool
+	BPFEventsBufferSize               uint32
+	// BPFMemoryBudget is the number of bytes to divide across the BPF maps.
+	// Zero means the default sizes are used.
+	BPFMemoryBudget uint64
+	// BPFMapStatsPath is where the maps' usage is persisted to size them on restarts.
+	BPFMapStatsPath string
+	// BPFStackDepth is the maximum number of frames of the walked stacks, the
+	// BPF programs built for it are loaded. Zero means the default depth.
+	BPFStackDepth int
+
+	// DWARFUnwindingPrewarmEnabled adds the unwind tables of the running
+	// processes on startup, using up to DWARFUnwindingPrewarmConcurrency workers.
+	DWARFUnwindingPrewarmEnabled     bool
+	DWARFUnwindingPrewarmConcurrency int
 
 	PythonUnwindingEnabled bool
 	RubyUnwindingEnabled   bool
@@ -104,6 +127,13 @@ func (c Config) DebugModeEnabled() bool {
 	return len(c.DebugProcessNames) > 0
 }
 
+func (c Config) stackDepth() int {
+	if c.BPFStackDepth == 0 {
+		return bpfprograms.DefaultStackDepth
+	}
+	return c.BPFStackDepth
+}
+
 type CPU struct {
 	config *Config
 
@@ -112,6 +142,7 @@ type CPU struct {
 	metrics *metrics
 
 	processInfoManager profiler.ProcessInfoManager
+	objFilePool        *objectfile.Pool
 	profileConverter   *pprof.Manager
 	profileStore       profiler.ProfileStore
 
@@ -137,6 +168,7 @@ func NewCPUProfiler(
 	reg prometheus.Registerer,
 	processInfoManager profiler.ProcessInfoManager,
 	compilerInfoManager *runtime.CompilerInfoManager,
+	objFilePool *objectfile.Pool,
 	profileConverter *pprof.Manager,
 	profileWriter profiler.ProfileStore,
 	config *Config,
@@ -150,11 +182,12 @@ func NewCPUProfiler(
 		metrics: newMetrics(reg),
 
 		processInfoManager: processInfoManager,
+		objFilePool:        objFilePool,
 		profileConverter:   profileConverter,
 		profileStore:       profileWriter,
 
 		// CPU profiler specific caches.
-		framePointerCache: unwind.NewHasFramePointersCache(logger, reg, compilerInfoManager),
+		framePointerCache: unwind.NewHasFramePointersCache(logger, reg, compilerInfoManager, objFilePool),
 
 		byteOrder: byteorder.GetHostByteOrder(),
 
@@ -191,53 +224,40 @@ func (p *CPU) ProcessLastErrors() map[int]error {
 // loadBPFModules loads the BPF programs and maps.
 // Also adjusts the unwind shards to the highest possible value.
 // And configures shared maps between BPF programs.
-func loadBPFModules(logger log.Logger, reg prometheus.Registerer, memlockRlimit uint64, config Config) (*libbpf.Module, *bpfmaps.Maps, error) {
+func loadBPFModules(logger log.Logger, reg prometheus.Registerer, memlockRlimit uint64, config Config, objFilePool *objectfile.Pool) (*libbpf.Module, *bpfmaps.Maps, error) {
 	var lerr error
 
 	maxLoadAttempts := 10
 	unwindShards := uint32(bpfmaps.MaxUnwindShards)
 
-	bpfObj, err := bpfprograms.OpenNative()
+	stackDepth := config.stackDepth()
+	bpfObj, err := bpfprograms.OpenNative(stackDepth)
 	if err != nil {
 		return nil, nil, err
 	}
 
 	var (
-		rbperf *libbpf.Module
-		pyperf *libbpf.Module
+		mapSizes = bpfmaps.DefaultMapSizes(unwindShards)
+		mapStats bpfmaps.MapStats
+		// Per-CPU maps and sharded IDs are sized from the possible CPUs, as
+		// CPUs that are offline now may come online later.
+		numCPUs = cpuinfo.NumPossibleCPU()
 	)
-	if config.RubyUnwindingEnabled {
-		// rbperf
-		rbperfBpfObj, err := bpfprograms.OpenRuby()
+	if config.BPFMemoryBudget != 0 {
+		stats, err := bpfmaps.LoadMapStats(config.BPFMapStatsPath)
 		if err != nil {
-			return nil, nil, err
+			level.Warn(logger).Log("msg", "failed to load BPF map stats, using defaults", "err", err)
 		}
+		mapStats = stats
 
-		rbperf, err = libbpf.NewModuleFromBufferArgs(libbpf.NewModuleArgs{
-			BPFObjBuff: rbperfBpfObj,
-			BPFObjName: "parca-rbperf",
-		})
-		if err != nil {
-			return nil, nil, fmt.Errorf("new bpf module: %w", err)
-		}
-		level.Info(logger).Log("msg", "loaded rbperf BPF module")
-	}
-
-	if config.PythonUnwindingEnabled {
-		// pyperf
-		pyperfBpfObj, err := bpfprograms.OpenPython()
+		rowSize := bpfmaps.CompactUnwindRowSizeBytes(getArch())
+		interpreters := config.RubyUnwindingEnabled || config.PythonUnwindingEnabled
+		mapSizes, err = bpfmaps.MapSizesForBudget(config.BPFMemoryBudget, numCPUs, stats, rowSize, stackDepth, interpreters)
 		if err != nil {
 			return nil, nil, err
 		}
-
-		pyperf, err = libbpf.NewModuleFromBufferArgs(libbpf.NewModuleArgs{
-			BPFObjBuff: pyperfBpfObj,
-			BPFObjName: "parca-pyperf",
-		})
-		if err != nil {
-			return nil, nil, fmt.Errorf("new bpf module: %w", err)
-		}
-		level.Info(logger).Log("msg", "loaded pyperf BPF module")
+		unwindShards = mapSizes.UnwindShards
+		level.Info(logger).Log("msg", "sized BPF maps from memory budget", "budget", rlimit.HumanizeRLimit(config.BPFMemoryBudget), "sizes", fmt.Sprintf("%+v", mapSizes))
 	}
 
 	bpfmapMetrics := bpfmaps.NewMetrics(reg)
@@ -266,8 +286,6 @@ func loadBPFModules(logger log.Logger, reg prometheus.Registerer, memlockRlimit
 
 		modules := map[bpfmaps.ProfilerModuleType]*libbpf.Module{
 			bpfmaps.NativeModule: native,
-			bpfmaps.RbperfModule: rbperf,
-			bpfmaps.PyperfModule: pyperf,
 		}
 
 		arch := getArch()
@@ -280,10 +298,29 @@ func loadBPFModules(logger log.Logger, reg prometheus.Registerer, memlockRlimit
 			bpfmapMetrics,
 			bpfmapsProcessCache,
 			syncedIntepreters,
+			objFilePool,
 		)
 		if err != nil {
 			return nil, nil, fmt.Errorf("failed to initialize eBPF maps: %w", err)
 		}
+		bpfMaps.SeedStats(mapStats)
+
+		// The interpreter unwinders are loaded the first time a process
+		// running the interpreter is seen.
+		if config.RubyUnwindingEnabled {
+			bpfMaps.RegisterInterpreterUnwinder(bpfmaps.RbperfModule, func() (*libbpf.Module, error) {
+				return openInterpreterUnwinder(logger, "rbperf", func() ([]byte, error) {
+					return bpfprograms.OpenRuby(stackDepth)
+				}, config.BPFVerboseLoggingEnabled, numCPUs)
+			})
+		}
+		if config.PythonUnwindingEnabled {
+			bpfMaps.RegisterInterpreterUnwinder(bpfmaps.PyperfModule, func() (*libbpf.Module, error) {
+				return openInterpreterUnwinder(logger, "pyperf", func() ([]byte, error) {
+					return bpfprograms.OpenPython(stackDepth)
+				}, config.BPFVerboseLoggingEnabled, numCPUs)
+			})
+		}
 
 		if config.DWARFUnwindingDisabled {
 			// Even if DWARF-based unwinding is disabled, either due to the user passing the flag to disable it or running on arm64, still
@@ -293,7 +330,8 @@ func loadBPFModules(logger log.Logger, reg prometheus.Registerer, memlockRlimit
 		}
 
 		level.Debug(logger).Log("msg", "attempting to create unwind shards", "count", unwindShards)
-		if err := bpfMaps.AdjustMapSizes(config.DebugModeEnabled(), unwindShards, config.BPFEventsBufferSize); err != nil {
+		mapSizes.UnwindShards = unwindShards
+		if err := bpfMaps.AdjustMapSizes(config.DebugModeEnabled(), mapSizes, uint32(numCPUs)); err != nil {
 			return nil, nil, fmt.Errorf("failed to adjust map sizes: %w", err)
 		}
 		level.Debug(logger).Log("msg", "created unwind shards", "count", unwindShards)
@@ -305,7 +343,7 @@ func loadBPFModules(logger log.Logger, reg prometheus.Registerer, memlockRlimit
 			MixedStackWalking:           config.DWARFUnwindingMixedModeEnabled,
 			PythonEnable:                config.PythonUnwindingEnabled,
 			RubyEnabled:                 config.RubyUnwindingEnabled,
-			Padding1:                    false,
+			DegradedUnwinding:           config.DWARFUnwindingDegradedModeEnabled,
 			Padding2:                    false,
 			Padding3:                    false,
 			RateLimitUnwindInfo:         config.RateLimitUnwindInfo,
@@ -315,43 +353,18 @@ func loadBPFModules(logger log.Logger, reg prometheus.Registerer, memlockRlimit
 			return nil, nil, fmt.Errorf("init global variable: %w", err)
 		}
 
-		if config.RubyUnwindingEnabled {
-			if err := rbperf.InitGlobalVariable("verbose", config.BPFVerboseLoggingEnabled); err != nil {
-				return nil, nil, fmt.Errorf("rbperf: init global variable: %w", err)
-			}
-		}
-
-		if config.PythonUnwindingEnabled {
-			if err := pyperf.InitGlobalVariable("verbose", config.BPFVerboseLoggingEnabled); err != nil {
-				return nil, nil, fmt.Errorf("pyperf: init global variable: %w", err)
-			}
-		}
-
 		level.Debug(logger).Log("msg", "loading BPF object for native unwinder")
+		start := time.Now()
 		lerr = native.BPFLoadObject()
 		if lerr == nil {
+			bpfmapMetrics.ObserveProgramLoad("native", time.Since(start))
+
 			// Must be called before loading the interpreter stack walkers.
 			err := bpfMaps.ReuseMaps()
 			if err != nil {
 				return nil, nil, fmt.Errorf("failed to reuse maps: %w", err)
 			}
 
-			if config.RubyUnwindingEnabled {
-				level.Debug(logger).Log("msg", "loading BPF object for ruby unwinder")
-				err = rbperf.BPFLoadObject()
-				if err != nil {
-					return nil, nil, fmt.Errorf("failed to load rbperf: %w", err)
-				}
-			}
-
-			if config.PythonUnwindingEnabled {
-				level.Debug(logger).Log("msg", "loading BPF object for python unwinder")
-				err = pyperf.BPFLoadObject()
-				if err != nil {
-					return nil, nil, fmt.Errorf("failed to load pyperf: %w", err)
-				}
-			}
-
 			level.Debug(logger).Log("msg", "updating programs map")
 			err = bpfMaps.UpdateTailCallsMap()
 			if err != nil {
@@ -383,6 +396,34 @@ func loadBPFModules(logger log.Logger, reg prometheus.Registerer, memlockRlimit
 	return nil, nil, lerr
 }
 
+// openInterpreterUnwinder opens the BPF module of an interpreter unwinder and
+// initializes its global variables. It's loaded by the caller.
+func openInterpreterUnwinder(logger log.Logger, name string, open func() ([]byte, error), verbose bool, numCPUs int) (*libbpf.Module, error) {
+	bpfObj, err := open()
+	if err != nil {
+		return nil, err
+	}
+
+	module, err := libbpf.NewModuleFromBufferArgs(libbpf.NewModuleArgs{
+		BPFObjBuff: bpfObj,
+		BPFObjName: "parca-" + name,
+	})
+	if err != nil {
+		return nil, fmt.Errorf("new bpf module: %w", err)
+	}
+
+	if err := module.InitGlobalVariable("verbose", verbose); err != nil {
+		module.Close()
+		return nil, fmt.Errorf("%s: init global variable: %w", name, err)
+	}
+	if err := module.InitGlobalVariable("num_cpus", int32(numCPUs)); err != nil {
+		module.Close()
+		return nil, fmt.Errorf("%s: init global variable: %w", name, err)
+	}
+	level.Info(logger).Log("msg", "opened BPF module", "module", name)
+	return module, nil
+}
+
 // listenEvents listens for events from the BPF program and handles them.
 // It also listens for lost events and logs them.
 func (p *CPU) listenEvents(ctx context.Context, eventsChan <-chan []byte, lostChan <-chan uint64, requestUnwindInfoChan chan<- int) {
@@ -533,7 +574,7 @@ func (p *CPU) fetchProcessInfoWithFreshMappings(ctx context.Context, pid int) er
 func (p *CPU) onDemandUnwindInfoBatcher(ctx context.Context, requestUnwindInfoChannel <-chan int) {
 	processEventBatcher(ctx, requestUnwindInfoChannel, 150*time.Millisecond, func(pids []int) {
 		for _, pid := range pids {
-			p.addUnwindTableForProcess(ctx, pid)
+			p.addUnwindTableForProcess(ctx, pid, false)
 		}
 
 		// Must be called after all the calls to `addUnwindTableForProcess`, as it's possible
@@ -551,7 +592,10 @@ func (p *CPU) onDemandUnwindInfoBatcher(ctx context.Context, requestUnwindInfoCh
 	})
 }
 
-func (p *CPU) addUnwindTableForProcess(ctx context.Context, pid int) {
+// addUnwindTableForProcess adds the unwind tables of the process and reports
+// whether it succeeded. If prepare is set, the unwind tables are generated
+// before taking the BPF maps' lock, so it can be called concurrently.
+func (p *CPU) addUnwindTableForProcess(ctx context.Context, pid int, prepare bool) bool {
 	executable := fmt.Sprintf("/proc/%d/exe", pid)
 	shouldUseFPByDefault, err := p.framePointerCache.HasFramePointers(executable) // nolint:contextcheck
 	if err != nil {
@@ -560,19 +604,26 @@ func (p *CPU) addUnwindTableForProcess(ctx context.Context, pid int) {
 		// we assume it does not and that we should generate the unwind information.
 		level.Debug(p.logger).Log("msg", "frame pointer detection failed", "executable", executable, "err", err)
 		if !errors.Is(err, os.ErrNotExist) && !errors.Is(err, elf.ErrNoSymbols) {
-			return
+			return false
 		}
 	}
 
 	level.Debug(p.logger).Log("msg", "prefetching process info", "pid", pid)
 	if err := p.prefetchProcessInfo(ctx, pid); err != nil {
-		return
+		return false
+	}
+
+	if prepare {
+		level.Debug(p.logger).Log("msg", "preparing unwind tables", "pid", pid)
+		if err := p.bpfMaps.PrepareUnwindTables(pid); err != nil {
+			level.Debug(p.logger).Log("msg", "failed to prepare unwind tables", "pid", pid, "err", err)
+		}
 	}
 
 	level.Debug(p.logger).Log("msg", "adding unwind tables", "pid", pid)
 	if err = p.bpfMaps.AddUnwindTableForProcess(pid, nil, true, shouldUseFPByDefault); err == nil {
 		// Happy path.
-		return
+		return true
 	}
 
 	// Error handling,
@@ -592,6 +643,7 @@ func (p *CPU) addUnwindTableForProcess(ctx context.Context, pid int) {
 		p.metrics.unwindTableAddErrors.WithLabelValues(labelOther).Inc()
 		level.Error(p.logger).Log("msg", "failed to add unwind table", "pid", pid, "err", err)
 	}
+	return false
 }
 
 // processEventBatcher batches PIDs sent from the BPF program.
@@ -742,7 +794,7 @@ func (p *CPU) Run(ctx context.Context) error {
 	}
 
 	level.Debug(p.logger).Log("msg", "loading BPF modules")
-	native, bpfMaps, err := loadBPFModules(p.logger, p.reg, p.config.MemlockRlimit, *p.config)
+	native, bpfMaps, err := loadBPFModules(p.logger, p.reg, p.config.MemlockRlimit, *p.config, p.objFilePool)
 	if err != nil {
 		return fmt.Errorf("load bpf program: %w", err)
 	}
@@ -845,7 +897,8 @@ func (p *CPU) Run(ctx context.Context) error {
 		eventsChan  = make(chan []byte, 30)
 		lostChannel = make(chan uint64, 10)
 	)
-	perfBuf, err := native.InitPerfBuf("events", eventsChan, lostChannel, 64)
+	pageCount := bpfmaps.EventsBufferPagesPerCPU(p.config.BPFEventsBufferSize, cpuinfo.NumPossibleCPU())
+	perfBuf, err := native.InitPerfBuf("events", eventsChan, lostChannel, pageCount)
 	if err != nil {
 		return fmt.Errorf("failed to init perf buffer: %w", err)
 	}
@@ -854,6 +907,12 @@ func (p *CPU) Run(ctx context.Context) error {
 	requestUnwindInfoChannel := make(chan int, 30)
 	go p.listenEvents(ctx, eventsChan, lostChannel, requestUnwindInfoChannel)
 	go p.onDemandUnwindInfoBatcher(ctx, requestUnwindInfoChannel)
+	if p.config.DWARFUnwindingPrewarmEnabled && !p.config.DWARFUnwindingDisabled {
+		go p.prewarmUnwindTables(ctx, pfs)
+	}
+
+	pipeline := newProfilePipeline(p, pfs, samplingPeriod)
+	pipeline.start(ctx)
 
 	ticker := time.NewTicker(p.config.ProfilingDuration)
 	defer ticker.Stop()
@@ -876,80 +935,29 @@ func (p *CPU) Run(ctx context.Context) error {
 		p.metrics.obtainAttempts.WithLabelValues(labelSuccess).Inc()
 		p.metrics.obtainDuration.Observe(time.Since(obtainStart).Seconds())
 
-		groupedRawData := make(map[int]profile.ProcessRawData)
-		for _, perThreadRawData := range rawData {
-			pid := int(perThreadRawData.PID)
-			data, ok := groupedRawData[pid]
-			if !ok {
-				groupedRawData[pid] = profile.ProcessRawData{
-					PID:        perThreadRawData.PID,
-					RawSamples: perThreadRawData.RawSamples,
-				}
-				continue
-			}
+		// The next profiling window starts now, regardless of how long it
+		// takes to process the profiles of this one.
+		startedAt, endedAt := p.LastProfileStartedAt(), time.Now()
+		p.report(nil)
 
-			groupedRawData[pid] = profile.ProcessRawData{
-				PID:        perThreadRawData.PID,
-				RawSamples: append(data.RawSamples, perThreadRawData.RawSamples...),
-			}
+		kernelSymbols := p.profileConverter.ResolveKernelSymbols(rawData)
+		interpreterSymbolTable, err := p.interpreterSymbolTable(rawData)
+		if err != nil {
+			level.Debug(p.logger).Log("msg", "failed to get interpreter symbol table", "err", err)
 		}
+		pipeline.submit(startedAt, endedAt.Sub(startedAt), rawData, kernelSymbols, interpreterSymbolTable)
 
-		processLastErrors := map[int]error{}
-		for pid, perProcessRawData := range groupedRawData {
-			processLastErrors[pid] = nil
-
-			pi, err := p.processInfoManager.Info(ctx, pid)
-			if err != nil {
-				p.metrics.profileDrop.WithLabelValues(labelProfileDropReasonProcessInfo).Inc()
-				level.Debug(p.logger).Log("msg", "failed to get process info", "pid", pid, "err", err)
-				processLastErrors[pid] = err
-				continue
-			}
-
-			interpreterSymbolTable, err := p.interpreterSymbolTable(perProcessRawData.RawSamples)
-			if err != nil {
-				level.Debug(p.logger).Log("msg", "failed to get interpreter symbol table", "pid", pid, "err", err)
-			}
-			pprof, executableInfos, err := p.profileConverter.NewConverter(
-				pfs,
-				pid,
-				pi.Mappings.Executables(),
-				p.LastProfileStartedAt(),
-				samplingPeriod,
-				interpreterSymbolTable,
-			).Convert(ctx, perProcessRawData.RawSamples)
-			if err != nil {
-				level.Warn(p.logger).Log("msg", "failed to convert profile to pprof", "pid", pid, "err", err)
-				processLastErrors[pid] = err
-				continue
-			}
-
-			labelSet, err := pi.Labels(ctx)
-			if err != nil {
-				level.Warn(p.logger).Log("msg", "failed to get process labels", "pid", pid, "err", err)
-				processLastErrors[pid] = err
-				continue
-			}
-			if len(labelSet) == 0 {
-				level.Debug(p.logger).Log("msg", "profile dropped", "pid", pid)
-				continue
-			}
-			// Add the profiler name as a label.
-			// Uses labels.Merge under the hood, so it re-allocates the label set.
-			// If we want to drop/disable a profiler, we should do it with another mechanism besides relabelling.
-			labelSet = labels.WithProfilerName(labelSet, p.Name())
-
-			if err := p.profileStore.Store(ctx, labelSet, pprof, executableInfos); err != nil {
-				level.Warn(p.logger).Log("msg", "failed to write profile", "pid", pid, "err", err)
-				processLastErrors[pid] = err
-				continue
+		if p.config.BPFMemoryBudget != 0 && p.config.BPFMapStatsPath != "" {
+			stats := p.bpfMaps.Stats()
+			stats.NumCPUs = cpuinfo.NumPossibleCPU()
+			if err := stats.Save(p.config.BPFMapStatsPath); err != nil {
+				level.Debug(p.logger).Log("msg", "failed to persist BPF map stats", "err", err)
 			}
 		}
-		p.report(err, processLastErrors)
 	}
 }
 
-func (p *CPU) report(lastError error, processLastErrors map[int]error) {
+func (p *CPU) report(lastError error) {
 	p.mtx.Lock()
 	defer p.mtx.Unlock()
 
@@ -958,6 +966,14 @@ func (p *CPU) report(lastError error, processLastErrors map[int]error) {
 		p.lastProfileStartedAt = time.Now()
 	}
 	p.lastError = lastError
+}
+
+// reportProcessErrors reports the errors of the processes of a round, once
+// their profiles went through the pipeline.
+func (p *CPU) reportProcessErrors(processLastErrors map[int]error) {
+	p.mtx.Lock()
+	defer p.mtx.Unlock()
+
 	p.processLastErrors = processLastErrors
 }
 
@@ -974,16 +990,23 @@ type (
 		UserStackID        uint64
 		KernelStackID      uint64
 		InterpreterStackID uint64
+		Flags              uint64
 	}
 )
 
+// stackFlagDegraded mirrors STACK_FLAG_DEGRADED in BPF program.
+const stackFlagDegraded = 1 << 0
+
 type profileKey struct {
 	pid int32
 	tid int32
+	// The user stacks were walked with frame pointers, as the unwind
+	// information of the process wasn't loaded yet.
+	degraded bool
 }
 
 // interpreterSymbolTable returns an up-to-date symbol table for the interpreter.
-func (p *CPU) interpreterSymbolTable(samples []profile.RawSample) (profile.InterpreterSymbolTable, error) {
+func (p *CPU) interpreterSymbolTable(rawData profile.RawData) (profile.InterpreterSymbolTable, error) {
 	if !p.config.RubyUnwindingEnabled && !p.config.PythonUnwindingEnabled {
 		return nil, nil
 	}
@@ -996,19 +1019,21 @@ func (p *CPU) interpreterSymbolTable(samples []profile.RawSample) (profile.Inter
 		return p.interpSymTab, nil
 	}
 
-	for _, sample := range samples {
-		if sample.InterpreterStack == nil {
-			continue
-		}
+	for _, perThreadRawData := range rawData {
+		for _, sample := range perThreadRawData.RawSamples {
+			if sample.InterpreterStack == nil {
+				continue
+			}
 
-		for _, id := range sample.InterpreterStack {
-			if _, ok := p.interpSymTab[uint32(id)]; !ok {
-				if err := p.updateInterpreterSymbolTable(); err != nil {
-					// Return the old version of the symbol table if we failed to update it.
-					return p.interpSymTab, err
+			for _, id := range sample.InterpreterStack {
+				if _, ok := p.interpSymTab[uint32(id)]; !ok {
+					if err := p.updateInterpreterSymbolTable(); err != nil {
+						// Return the old version of the symbol table if we failed to update it.
+						return p.interpSymTab, err
+					}
+					// We only need to update the symbol table once.
+					return p.interpSymTab, nil
 				}
-				// We only need to update the symbol table once.
-				return p.interpSymTab, nil
 			}
 		}
 	}
@@ -1027,10 +1052,13 @@ func (p *CPU) updateInterpreterSymbolTable() error {
 
 // obtainProfiles collects profiles from the BPF maps.
 func (p *CPU) obtainRawData(ctx context.Context) (profile.RawData, error) {
-	rawData := map[profileKey]map[bpfprograms.CombinedStack]uint64{}
+	rawData := map[profileKey]map[combinedStackKey]*combinedStackCount{}
+	stackDepth := p.config.stackDepth()
 
+	stackCounts := 0
 	it := p.bpfMaps.StackCounts.Iterator()
 	for it.Next() {
+		stackCounts++
 		if ctx.Err() != nil {
 			return nil, ctx.Err()
 		}
@@ -1048,36 +1076,46 @@ func (p *CPU) obtainRawData(ctx context.Context) (profile.RawData, error) {
 		}
 
 		// Profile aggregation key.
-		pKey := profileKey{pid: key.PID, tid: key.TID}
+		pKey := profileKey{pid: key.PID, tid: key.TID, degraded: key.Flags&stackFlagDegraded != 0}
+		userUnwind := labelNativeUnwind
+		if pKey.degraded {
+			userUnwind = labelKernelUnwind
+		}
 
-		// Twice the stack depth because we have a user and a potential Kernel stack.
+		// Three times the stack depth because we have a user, a potential
+		// Kernel and a potential interpreter stack.
 		// Read order matters, since we read from the key buffer.
-		stack := bpfprograms.CombinedStack{}
-		interpreterStack := stack[bpfprograms.StackDepth*2:]
+		stack := bpfprograms.NewCombinedStack(stackDepth)
+		interpreterStack := stack.Interpreter()
+		// Stacks are aggregated by their IDs, which are hashes of their
+		// addresses, the ones that couldn't be read are left empty.
+		stackKey := combinedStackKey{user: key.UserStackID, kernel: key.KernelStackID, interpreter: key.InterpreterStackID}
 
 		var userErr error
 
 		// User stacks which could have been unwound with the frame pointer or CFI unwinders.
-		userStack := stack[:bpfprograms.StackDepth]
+		userStack := stack.User()
 		userErr = p.bpfMaps.ReadStack(key.UserStackID, userStack)
 		if userErr != nil {
+			stackKey.user = 0
 			p.metrics.stackDrop.WithLabelValues(labelStackDropReasonUser).Inc()
 			if errors.Is(userErr, bpfmaps.ErrUnrecoverable) {
-				p.metrics.readMapAttempts.WithLabelValues(labelUser, labelNativeUnwind, labelError).Inc()
+				p.metrics.readMapAttempts.WithLabelValues(labelUser, userUnwind, labelError).Inc()
 				return nil, userErr
 			}
 			if errors.Is(userErr, bpfmaps.ErrUnwindFailed) {
-				p.metrics.readMapAttempts.WithLabelValues(labelUser, labelNativeUnwind, labelFailed).Inc()
+				p.metrics.readMapAttempts.WithLabelValues(labelUser, userUnwind, labelFailed).Inc()
 			}
 			if errors.Is(userErr, bpfmaps.ErrMissing) {
-				p.metrics.readMapAttempts.WithLabelValues(labelUser, labelNativeUnwind, labelMissing).Inc()
+				p.metrics.readMapAttempts.WithLabelValues(labelUser, userUnwind, labelMissing).Inc()
 			}
 		} else {
-			p.metrics.readMapAttempts.WithLabelValues(labelUser, labelNativeUnwind, labelSuccess).Inc()
+			p.metrics.readMapAttempts.WithLabelValues(labelUser, userUnwind, labelSuccess).Inc()
 		}
 
 		if key.InterpreterStackID != 0 {
 			if interpErr := p.bpfMaps.ReadStack(key.InterpreterStackID, interpreterStack); interpErr != nil {
+				stackKey.interpreter = 0
 				p.metrics.readMapAttempts.WithLabelValues(labelInterpreter, labelInterpreterUnwind, labelError).Inc()
 				level.Debug(p.logger).Log("msg", "failed to read interpreter stacks", "err", interpErr)
 			} else {
@@ -1085,9 +1123,10 @@ func (p *CPU) obtainRawData(ctx context.Context) (profile.RawData, error) {
 			}
 		}
 
-		kStack := stack[bpfprograms.StackDepth : bpfprograms.StackDepth*2]
+		kStack := stack.Kernel()
 		kernelErr := p.bpfMaps.ReadStack(key.KernelStackID, kStack)
 		if kernelErr != nil {
+			stackKey.kernel = 0
 			p.metrics.stackDrop.WithLabelValues(labelStackDropReasonKernel).Inc()
 			if errors.Is(kernelErr, bpfmaps.ErrUnrecoverable) {
 				p.metrics.readMapAttempts.WithLabelValues(labelKernel, labelKernelUnwind, labelError).Inc()
@@ -1124,17 +1163,23 @@ func (p *CPU) obtainRawData(ctx context.Context) (profile.RawData, error) {
 		perThreadData, ok := rawData[pKey]
 		if !ok {
 			// We haven't seen this id yet.
-			perThreadData = map[bpfprograms.CombinedStack]uint64{}
+			perThreadData = map[combinedStackKey]*combinedStackCount{}
 			rawData[pKey] = perThreadData
 		}
 
-		perThreadData[stack] += value
+		if c, ok := perThreadData[stackKey]; ok {
+			c.count += value
+		} else {
+			perThreadData[stackKey] = &combinedStackCount{stack: stack, count: value}
+		}
 	}
 	if it.Err() != nil {
 		p.metrics.stackDrop.WithLabelValues(labelStackDropReasonIterator).Inc()
 		return nil, fmt.Errorf("failed iterator: %w", it.Err())
 	}
 
+	p.bpfMaps.ObserveStackCounts(stackCounts)
+
 	if err := p.bpfMaps.FinalizeProfileLoop(); err != nil {
 		level.Warn(p.logger).Log("msg", "failed to clean BPF maps that store stacktraces", "err", err)
 	}
@@ -1142,12 +1187,24 @@ func (p *CPU) obtainRawData(ctx context.Context) (profile.RawData, error) {
 	return preprocessRawData(rawData), nil
 }
 
+// combinedStackKey identifies the stacks of a sample by their IDs.
+type combinedStackKey struct {
+	user        uint64
+	kernel      uint64
+	interpreter uint64
+}
+
+type combinedStackCount struct {
+	stack bpfprograms.CombinedStack
+	count uint64
+}
+
 // preprocessRawData takes the raw data from the BPF maps and converts it into
 // a profile.RawData, which already splits the stacks into user, kernel and interpreter
 // stacks. Since the input data is a map of maps, we can assume that they're
 // already unique and there are no duplicates, which is why at this point we
 // can just transform them into plain slices and structs.
-func preprocessRawData(rawData map[profileKey]map[bpfprograms.CombinedStack]uint64) profile.RawData {
+func preprocessRawData(rawData map[profileKey]map[combinedStackKey]*combinedStackCount) profile.RawData {
 	res := make(profile.RawData, 0, len(rawData))
 	for pKey, perThreadRawData := range rawData {
 		p := profile.ProcessRawData{
@@ -1155,47 +1212,18 @@ func preprocessRawData(rawData map[profileKey]map[bpfprograms.CombinedStack]uint
 			RawSamples: make([]profile.RawSample, 0, len(perThreadRawData)),
 		}
 
-		for stack, count := range perThreadRawData {
-			kernelStackDepth := 0
-			userStackDepth := 0
-			interpreterStackDepth := 0
-
-			// We count the number of frames in the stack to be able to preallocate.
-			// If an address in the stack is 0 then the stack ended.
-			for _, addr := range stack[:bpfprograms.StackDepth] {
-				if addr == 0 {
-					break
-				}
-				userStackDepth++
-			}
-			for _, addr := range stack[bpfprograms.StackDepth : bpfprograms.StackDepth*2] {
-				if addr == 0 {
-					break
-				}
-				kernelStackDepth++
-			}
-
-			for _, addr := range stack[bpfprograms.StackDepth*2:] {
-				if addr == 0 {
-					break
-				}
-				interpreterStackDepth++
-			}
-
-			userStack := make([]uint64, userStackDepth)
-			kernelStack := make([]uint64, kernelStackDepth)
-			interpreterStack := make([]uint64, interpreterStackDepth)
-
-			copy(userStack, stack[:userStackDepth])
-			copy(kernelStack, stack[bpfprograms.StackDepth:bpfprograms.StackDepth+kernelStackDepth])
-			copy(interpreterStack, stack[bpfprograms.StackDepth*2:bpfprograms.StackDepth*2+interpreterStackDepth])
+		for _, c := range perThreadRawData {
+			userStack := copyStack(c.stack.User())
+			kernelStack := copyStack(c.stack.Kernel())
+			interpreterStack := copyStack(c.stack.Interpreter())
 
 			p.RawSamples = append(p.RawSamples, profile.RawSample{
 				TID:              profile.PID(pKey.tid),
 				UserStack:        userStack,
 				KernelStack:      kernelStack,
 				InterpreterStack: interpreterStack,
-				Value:            count,
+				Value:            c.count,
+				Degraded:         pKey.degraded,
 			})
 		}
 
@@ -1205,6 +1233,22 @@ func preprocessRawData(rawData map[profileKey]map[bpfprograms.CombinedStack]uint
 	return res
 }
 
+// copyStack copies the addresses of a stack up to the first zero one, which is
+// where the stack ended.
+func copyStack(stack []uint64) []uint64 {
+	depth := 0
+	// We count the number of frames in the stack to be able to preallocate.
+	for _, addr := range stack {
+		if addr == 0 {
+			break
+		}
+		depth++
+	}
+	res := make([]uint64, depth)
+	copy(res, stack[:depth])
+	return res
+}
+
 func getArch() elf.Machine {
 	switch goruntime.GOARCH {
 	case "arm64":
@@ -32,6 +32,7 @@ const (
 	labelMissing = "missing"
 	labelFailed  = "failed"
 	labelSuccess = "success"
+	labelSkipped = "skipped"
 
 	labelStackDropReasonKey       = "read_stack_key"
 	labelStackDropReasonUser      = "read_user_stack"
@@ -45,7 +46,8 @@ const (
 	labelEventProcessMappings = "process_mappings"
 	labelEventRefreshProcInfo = "refresh_proc_info"
 
-	labelProfileDropReasonProcessInfo = "process_info"
+	labelProfileDropReasonProcessInfo    = "process_info"
+	labelProfileDropReasonPipelineBehind = "pipeline_behind"
 
 	labelNeedMoreProfilingRounds = "need_more_rounds"
 	labelProcfsRace              = "procfs_race"
@@ -59,6 +61,10 @@ type metrics struct {
 	obtainDuration prometheus.Histogram
 	profileDrop    *prometheus.CounterVec
 
+	// profile pipeline.
+	pipelineQueueDuration *prometheus.HistogramVec
+	pipelineStageDuration *prometheus.HistogramVec
+
 	// stack level.
 	stackDrop       *prometheus.CounterVec
 	readMapAttempts *prometheus.CounterVec
@@ -69,6 +75,10 @@ type metrics struct {
 
 	unwindTableAddErrors     *prometheus.CounterVec
 	unwindTablePersistErrors *prometheus.CounterVec
+
+	// unwind table prewarm.
+	prewarmProcesses        *prometheus.CounterVec
+	prewarmCoverageDuration *prometheus.GaugeVec
 }
 
 func newMetrics(reg prometheus.Registerer) *metrics {
@@ -89,6 +99,24 @@ func newMetrics(reg prometheus.Registerer) *metrics {
 				NativeHistogramBucketFactor: 1.1,
 			},
 		),
+		pipelineQueueDuration: promauto.With(reg).NewHistogramVec(
+			prometheus.HistogramOpts{
+				Name:                        "parca_agent_profiler_pipeline_queue_duration_seconds",
+				Help:                        "The duration the profile of a process waits for a stage of the profile pipeline.",
+				ConstLabels:                 map[string]string{"type": "cpu"},
+				NativeHistogramBucketFactor: 1.1,
+			},
+			[]string{"stage"},
+		),
+		pipelineStageDuration: promauto.With(reg).NewHistogramVec(
+			prometheus.HistogramOpts{
+				Name:                        "parca_agent_profiler_pipeline_stage_duration_seconds",
+				Help:                        "The duration it takes a stage of the profile pipeline to process the profile of a process.",
+				ConstLabels:                 map[string]string{"type": "cpu"},
+				NativeHistogramBucketFactor: 1.1,
+			},
+			[]string{"stage"},
+		),
 		stackDrop: promauto.With(reg).NewCounterVec(
 			prometheus.CounterOpts{
 				Name:        "parca_agent_profiler_stack_drop_total",
@@ -141,6 +169,20 @@ func newMetrics(reg prometheus.Registerer) *metrics {
 				ConstLabels: map[string]string{"type": "cpu"},
 			},
 			[]string{"error"}),
+		prewarmProcesses: promauto.With(reg).NewCounterVec(
+			prometheus.CounterOpts{
+				Name:        "parca_agent_profiler_unwind_table_prewarm_processes_total",
+				Help:        "Total number of processes whose unwind tables were added on startup, by whether it succeeded or they were skipped.",
+				ConstLabels: map[string]string{"type": "cpu"},
+			},
+			[]string{"status"}),
+		prewarmCoverageDuration: promauto.With(reg).NewGaugeVec(
+			prometheus.GaugeOpts{
+				Name:        "parca_agent_profiler_unwind_table_prewarm_coverage_seconds",
+				Help:        "Time it took on startup to add the unwind tables of the processes accounting for the given ratio of CPU usage.",
+				ConstLabels: map[string]string{"type": "cpu"},
+			},
+			[]string{"coverage"}),
 	}
 	m.obtainAttempts.WithLabelValues(labelSuccess)
 	m.obtainAttempts.WithLabelValues(labelError)
@@ -168,6 +210,7 @@ func newMetrics(reg prometheus.Registerer) *metrics {
 	m.readMapAttempts.WithLabelValues(labelKernel, labelKernelUnwind, labelFailed)
 
 	m.profileDrop.WithLabelValues(labelProfileDropReasonProcessInfo)
+	m.profileDrop.WithLabelValues(labelProfileDropReasonPipelineBehind)
 
 	m.eventsReceived.WithLabelValues(labelEventEmpty)
 	m.eventsReceived.WithLabelValues(labelEventUnwindInfo)
@@ -182,5 +225,9 @@ func newMetrics(reg prometheus.Registerer) *metrics {
 	m.unwindTablePersistErrors.WithLabelValues(labelNeedMoreProfilingRounds)
 	m.unwindTablePersistErrors.WithLabelValues(labelOther)
 
+	m.prewarmProcesses.WithLabelValues(labelSuccess)
+	m.prewarmProcesses.WithLabelValues(labelError)
+	m.prewarmProcesses.WithLabelValues(labelSkipped)
+
 	return m
 }
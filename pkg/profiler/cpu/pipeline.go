@@ -0,0 +1,314 @@
+// Copyright 2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package cpu
+
+import (
+	"context"
+	"errors"
+	"sync"
+	"time"
+
+	"github.com/go-kit/log/level"
+	pprofprofile "github.com/google/pprof/profile"
+	profilestorepb "github.com/parca-dev/parca/gen/proto/go/parca/profilestore/v1alpha1"
+	"github.com/prometheus/common/model"
+	"github.com/prometheus/procfs"
+
+	"github.com/parca-dev/parca-agent/pkg/metadata/labels"
+	"github.com/parca-dev/parca-agent/pkg/pprof"
+	"github.com/parca-dev/parca-agent/pkg/profile"
+)
+
+const (
+	stageConvert = "convert"
+	stageStore   = "store"
+)
+
+var errPipelineBehind = errors.New("profile dropped, the pipeline is a round behind")
+
+// profilePipeline converts and stores the profiles of the processes collected
+// by the profiling loop, so the loop only has to collect them and the
+// profiling windows don't depend on how long it takes to process them.
+//
+// Each stage has its own workers, and is fed by a bounded queue. The store
+// stage pushes back on the conversion when it falls behind, which pushes back
+// on the dispatch of the profiles of a round. The profiles of a round that
+// weren't dispatched by the time the next round is collected are dropped,
+// rather than holding up the collection.
+type profilePipeline struct {
+	p              *CPU
+	pfs            procfs.FS
+	samplingPeriod int64
+
+	// Holds the next round to dispatch, if any.
+	rounds       chan *profilingRound
+	convertQueue chan *processProfile
+	storeQueue   chan *processProfile
+
+	reportMtx sync.Mutex
+	// The last round whose errors were reported, rounds can complete out
+	// of order.
+	lastReportedRound uint64
+	nextRound         uint64
+}
+
+// profilingRound is what the profiles of the processes collected at once
+// share.
+type profilingRound struct {
+	id        uint64
+	startedAt time.Time
+	duration  time.Duration
+
+	kernelSymbols          pprof.KernelSymbols
+	interpreterSymbolTable profile.InterpreterSymbolTable
+
+	profiles []*processProfile
+
+	pending           sync.WaitGroup
+	mtx               sync.Mutex
+	processLastErrors map[int]error
+}
+
+// processProfile is the profile of a process going through the pipeline.
+type processProfile struct {
+	round      *profilingRound
+	pid        int
+	rawSamples []profile.RawSample
+	// When the profile was added to the queue of its current stage.
+	queuedAt time.Time
+
+	// Set by the convert stage.
+	pprof           *pprofprofile.Profile
+	executableInfos []*profilestorepb.ExecutableInfo
+	labelSet        model.LabelSet
+}
+
+func newProfilePipeline(p *CPU, pfs procfs.FS, samplingPeriod int64) *profilePipeline {
+	return &profilePipeline{
+		p:              p,
+		pfs:            pfs,
+		samplingPeriod: samplingPeriod,
+		rounds:         make(chan *profilingRound, 1),
+		convertQueue:   make(chan *processProfile, max(p.config.ProfilePipelineQueueSize, 1)),
+		storeQueue:     make(chan *processProfile, max(p.config.ProfilePipelineQueueSize, 1)),
+	}
+}
+
+// start starts the workers of the stages, which stop when the context is
+// done.
+func (pp *profilePipeline) start(ctx context.Context) {
+	go pp.runDispatcher(ctx)
+	for i := 0; i < max(pp.p.config.ProfilePipelineConvertWorkerCount, 1); i++ {
+		go pp.runConvertWorker(ctx)
+	}
+	for i := 0; i < max(pp.p.config.ProfilePipelineStoreWorkerCount, 1); i++ {
+		go pp.runStoreWorker(ctx)
+	}
+}
+
+// submit queues the profiles of a round for conversion. It never blocks, the
+// round is dropped if the previous one is still waiting to be dispatched.
+func (pp *profilePipeline) submit(startedAt time.Time, duration time.Duration, rawData profile.RawData, kernelSymbols pprof.KernelSymbols, interpreterSymbolTable profile.InterpreterSymbolTable) {
+	pp.reportMtx.Lock()
+	pp.nextRound++
+	id := pp.nextRound
+	pp.reportMtx.Unlock()
+
+	round := &profilingRound{
+		id:                     id,
+		startedAt:              startedAt,
+		duration:               duration,
+		kernelSymbols:          kernelSymbols,
+		interpreterSymbolTable: interpreterSymbolTable,
+		processLastErrors:      map[int]error{},
+	}
+
+	groupedRawData := make(map[int][]profile.RawSample)
+	for _, perThreadRawData := range rawData {
+		pid := int(perThreadRawData.PID)
+		groupedRawData[pid] = append(groupedRawData[pid], perThreadRawData.RawSamples...)
+	}
+	for pid, rawSamples := range groupedRawData {
+		round.profiles = append(round.profiles, &processProfile{round: round, pid: pid, rawSamples: rawSamples})
+	}
+
+	round.pending.Add(len(round.profiles))
+	go func() {
+		round.pending.Wait()
+		pp.report(round)
+	}()
+
+	select {
+	case pp.rounds <- round:
+	default:
+		pp.drop(round.profiles, errPipelineBehind)
+	}
+}
+
+// runDispatcher queues the profiles of the rounds for conversion, as fast as
+// they are converted.
+func (pp *profilePipeline) runDispatcher(ctx context.Context) {
+	for {
+		var round *profilingRound
+		select {
+		case <-ctx.Done():
+			return
+		case round = <-pp.rounds:
+		}
+
+		for i, pr := range round.profiles {
+			if len(pp.rounds) > 0 {
+				// The next round was collected already.
+				pp.drop(round.profiles[i:], errPipelineBehind)
+				break
+			}
+
+			pr.queuedAt = time.Now()
+			select {
+			case <-ctx.Done():
+				pp.drop(round.profiles[i:], ctx.Err())
+				return
+			case pp.convertQueue <- pr:
+			}
+		}
+		// The round is referenced until all of its profiles are stored, which
+		// shouldn't keep the raw data of the stored ones alive.
+		round.profiles = nil
+	}
+}
+
+// drop records the given profiles as dropped.
+func (pp *profilePipeline) drop(profiles []*processProfile, err error) {
+	for _, pr := range profiles {
+		if errors.Is(err, errPipelineBehind) {
+			pp.p.metrics.profileDrop.WithLabelValues(labelProfileDropReasonPipelineBehind).Inc()
+		}
+		pr.round.done(pr.pid, err)
+	}
+}
+
+// report reports the errors of the processes of a round, unless the ones of a
+// later round were already reported.
+func (pp *profilePipeline) report(round *profilingRound) {
+	pp.reportMtx.Lock()
+	defer pp.reportMtx.Unlock()
+
+	if round.id < pp.lastReportedRound {
+		return
+	}
+	pp.lastReportedRound = round.id
+	pp.p.reportProcessErrors(round.processLastErrors)
+}
+
+func (pp *profilePipeline) runConvertWorker(ctx context.Context) {
+	for {
+		var pr *processProfile
+		select {
+		case <-ctx.Done():
+			return
+		case pr = <-pp.convertQueue:
+		}
+		pp.p.metrics.pipelineQueueDuration.WithLabelValues(stageConvert).Observe(time.Since(pr.queuedAt).Seconds())
+
+		start := time.Now()
+		err := pp.convert(ctx, pr)
+		pp.p.metrics.pipelineStageDuration.WithLabelValues(stageConvert).Observe(time.Since(start).Seconds())
+		if err != nil || pr.pprof == nil {
+			pr.round.done(pr.pid, err)
+			continue
+		}
+
+		pr.rawSamples = nil
+		pr.queuedAt = time.Now()
+		select {
+		case <-ctx.Done():
+			pr.round.done(pr.pid, ctx.Err())
+			return
+		case pp.storeQueue <- pr:
+		}
+	}
+}
+
+func (pp *profilePipeline) runStoreWorker(ctx context.Context) {
+	for {
+		var pr *processProfile
+		select {
+		case <-ctx.Done():
+			return
+		case pr = <-pp.storeQueue:
+		}
+		pp.p.metrics.pipelineQueueDuration.WithLabelValues(stageStore).Observe(time.Since(pr.queuedAt).Seconds())
+
+		start := time.Now()
+		err := pp.p.profileStore.Store(ctx, pr.labelSet, pr.pprof, pr.executableInfos)
+		pp.p.metrics.pipelineStageDuration.WithLabelValues(stageStore).Observe(time.Since(start).Seconds())
+		if err != nil {
+			level.Warn(pp.p.logger).Log("msg", "failed to write profile", "pid", pr.pid, "err", err)
+		}
+		pr.round.done(pr.pid, err)
+	}
+}
+
+// convert converts the profile of a process to pprof and fetches its labels.
+// The profile is left nil if it should be dropped.
+func (pp *profilePipeline) convert(ctx context.Context, pr *processProfile) error {
+	pi, err := pp.p.processInfoManager.Info(ctx, pr.pid)
+	if err != nil {
+		pp.p.metrics.profileDrop.WithLabelValues(labelProfileDropReasonProcessInfo).Inc()
+		level.Debug(pp.p.logger).Log("msg", "failed to get process info", "pid", pr.pid, "err", err)
+		return err
+	}
+
+	pprof, executableInfos, err := pp.p.profileConverter.NewConverter(
+		pp.pfs,
+		pr.pid,
+		pi.Mappings.Executables(),
+		pr.round.startedAt,
+		pp.samplingPeriod,
+		pr.round.interpreterSymbolTable,
+		pr.round.kernelSymbols,
+	).Convert(ctx, pr.rawSamples)
+	if err != nil {
+		level.Warn(pp.p.logger).Log("msg", "failed to convert profile to pprof", "pid", pr.pid, "err", err)
+		return err
+	}
+	// The profile covers the round, not the time it waited to be converted.
+	pprof.DurationNanos = pr.round.duration.Nanoseconds()
+
+	labelSet, err := pi.Labels(ctx)
+	if err != nil {
+		level.Warn(pp.p.logger).Log("msg", "failed to get process labels", "pid", pr.pid, "err", err)
+		return err
+	}
+	if len(labelSet) == 0 {
+		level.Debug(pp.p.logger).Log("msg", "profile dropped", "pid", pr.pid)
+		return nil
+	}
+	// Add the profiler name as a label.
+	// Uses labels.Merge under the hood, so it re-allocates the label set.
+	// If we want to drop/disable a profiler, we should do it with another mechanism besides relabelling.
+	pr.labelSet = labels.WithProfilerName(labelSet, pp.p.Name())
+	pr.pprof = pprof
+	pr.executableInfos = executableInfos
+	return nil
+}
+
+// done records the outcome of the profile of a process.
+func (r *profilingRound) done(pid int, err error) {
+	r.mtx.Lock()
+	r.processLastErrors[pid] = err
+	r.mtx.Unlock()
+
+	r.pending.Done()
+}
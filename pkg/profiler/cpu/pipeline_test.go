@@ -0,0 +1,65 @@
+// Copyright 2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package cpu
+
+import (
+	"context"
+	"sync"
+	"testing"
+	"time"
+
+	"github.com/prometheus/client_golang/prometheus"
+	"github.com/prometheus/client_golang/prometheus/testutil"
+	"github.com/prometheus/procfs"
+	"github.com/stretchr/testify/require"
+
+	"github.com/parca-dev/parca-agent/pkg/profile"
+)
+
+func TestProfilePipelineBehind(t *testing.T) {
+	p := &CPU{
+		config:  &Config{ProfilePipelineQueueSize: 1},
+		metrics: newMetrics(prometheus.NewRegistry()),
+		mtx:     &sync.RWMutex{},
+	}
+	pp := newProfilePipeline(p, procfs.FS{}, 1)
+
+	pp.submit(time.Now(), time.Second, profile.RawData{{PID: 1}, {PID: 2}, {PID: 3}}, nil, nil)
+
+	// The first round is waiting to be dispatched, so the next one is dropped
+	// as a whole.
+	pp.submit(time.Now(), time.Second, profile.RawData{{PID: 1}, {PID: 2}}, nil, nil)
+	require.Eventually(t, func() bool {
+		errs := p.ProcessLastErrors()
+		return len(errs) == 2 && errs[1] == errPipelineBehind && errs[2] == errPipelineBehind
+	}, time.Second, 10*time.Millisecond)
+
+	// Nothing converts the profiles, so only the first ones of the first round
+	// are queued by the time the next round is submitted, and the rest are
+	// dropped.
+	ctx, cancel := context.WithCancel(context.Background())
+	defer cancel()
+	go pp.runDispatcher(ctx)
+	require.Eventually(t, func() bool {
+		return len(pp.convertQueue) == 1
+	}, time.Second, 10*time.Millisecond)
+
+	pp.submit(time.Now(), time.Second, profile.RawData{{PID: 4}}, nil, nil)
+	var queued int
+	for (<-pp.convertQueue).pid != 4 {
+		queued++
+	}
+	require.LessOrEqual(t, queued, 2)
+	require.Equal(t, float64(2+3-queued), testutil.ToFloat64(p.metrics.profileDrop.WithLabelValues(labelProfileDropReasonPipelineBehind)))
+}
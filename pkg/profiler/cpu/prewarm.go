@@ -0,0 +1,232 @@
+// Copyright 2022-2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+package cpu
+
+import (
+	"context"
+	"errors"
+	"fmt"
+	"os"
+	"sort"
+	"sync"
+	"time"
+
+	"github.com/go-kit/log/level"
+	"github.com/prometheus/procfs"
+	"golang.org/x/sync/errgroup"
+
+	bpfmaps "github.com/parca-dev/parca-agent/pkg/profiler/cpu/bpf/maps"
+)
+
+const (
+	// How long to measure the CPU usage of processes for to rank them.
+	prewarmSampleInterval = time.Second
+	// How many processes to add before writing the in-flight shard.
+	prewarmPersistEvery = 16
+)
+
+// Ratios of the CPU usage whose time to coverage is reported.
+var prewarmCoverageRatios = []float64{0.5, 0.9, 0.99}
+
+// pfKthread is the flag set in /proc/<pid>/stat for kernel threads, see
+// PF_KTHREAD in include/linux/sched.h.
+const pfKthread = 0x00200000
+
+// processCPUUsage is the CPU time a process used while being sampled.
+type processCPUUsage struct {
+	pid   int
+	usage float64
+}
+
+// rankProcessesByCPUUsage returns the processes that used CPU time during the
+// given interval, sorted by how much, along with the number of processes
+// skipped. Kernel threads, which have no user space unwind tables, and idle
+// processes, which would take their tables' space without being sampled, are
+// skipped.
+func rankProcessesByCPUUsage(ctx context.Context, pfs procfs.FS, interval time.Duration) ([]processCPUUsage, int, error) {
+	before, _, err := processCPUTimes(pfs)
+	if err != nil {
+		return nil, 0, err
+	}
+
+	select {
+	case <-ctx.Done():
+		return nil, 0, ctx.Err()
+	case <-time.After(interval):
+	}
+
+	after, kernelThreads, err := processCPUTimes(pfs)
+	if err != nil {
+		return nil, 0, err
+	}
+
+	ranked, idle := rankByCPUUsage(before, after)
+	return ranked, kernelThreads + idle, nil
+}
+
+// rankByCPUUsage returns the processes whose CPU time grew between the two
+// measurements, sorted by how much, and the number of those whose didn't.
+// Processes that used the same amount are sorted by the CPU time they used
+// since they started.
+func rankByCPUUsage(before, after map[int]float64) ([]processCPUUsage, int) {
+	var idle int
+	ranked := make([]processCPUUsage, 0, len(after))
+	for pid, total := range after {
+		// New processes used all of their CPU time during the interval.
+		usage := total - before[pid]
+		if usage <= 0 {
+			idle++
+			continue
+		}
+		ranked = append(ranked, processCPUUsage{pid: pid, usage: usage})
+	}
+	sort.SliceStable(ranked, func(i, j int) bool {
+		if ranked[i].usage != ranked[j].usage {
+			return ranked[i].usage > ranked[j].usage
+		}
+		return after[ranked[i].pid] > after[ranked[j].pid]
+	})
+	return ranked, idle
+}
+
+// processCPUTimes returns the CPU time used by every user space process, and
+// the number of kernel threads left out.
+func processCPUTimes(pfs procfs.FS) (map[int]float64, int, error) {
+	procs, err := pfs.AllProcs()
+	if err != nil {
+		return nil, 0, fmt.Errorf("failed to list processes: %w", err)
+	}
+
+	self := os.Getpid()
+	times := make(map[int]float64, len(procs))
+	var kernelThreads int
+	for _, proc := range procs {
+		if proc.PID == self {
+			continue
+		}
+		stat, err := proc.Stat()
+		if err != nil {
+			// The process might have exited.
+			continue
+		}
+		if stat.Flags&pfKthread != 0 {
+			kernelThreads++
+			continue
+		}
+		times[proc.PID] = stat.CPUTime()
+	}
+	return times, kernelThreads, nil
+}
+
+// coverageTracker reports how long it took to add the unwind tables of the
+// processes accounting for a ratio of the CPU usage.
+type coverageTracker struct {
+	start   time.Time
+	total   float64
+	covered float64
+	// Index of the next ratio in prewarmCoverageRatios to report.
+	next int
+}
+
+func newCoverageTracker(start time.Time, ranked []processCPUUsage) *coverageTracker {
+	t := &coverageTracker{start: start}
+	for _, p := range ranked {
+		t.total += p.usage
+	}
+	return t
+}
+
+// add records a process whose unwind tables were added, and returns the
+// ratios reached with it along with the elapsed time.
+func (t *coverageTracker) add(usage float64, now time.Time) ([]float64, time.Duration) {
+	t.covered += usage
+
+	var reached []float64
+	for t.next < len(prewarmCoverageRatios) && t.total > 0 && t.covered/t.total >= prewarmCoverageRatios[t.next] {
+		reached = append(reached, prewarmCoverageRatios[t.next])
+		t.next++
+	}
+	return reached, now.Sub(t.start)
+}
+
+// prewarmUnwindTables adds the unwind tables of the running processes on
+// startup, from the most to the least CPU intensive ones, instead of waiting
+// for the BPF program to request them, which is rate limited.
+func (p *CPU) prewarmUnwindTables(ctx context.Context, pfs procfs.FS) {
+	defer p.bpfMaps.DiscardPreparedUnwindTables()
+
+	start := time.Now()
+	ranked, skipped, err := rankProcessesByCPUUsage(ctx, pfs, prewarmSampleInterval)
+	if err != nil {
+		level.Warn(p.logger).Log("msg", "failed to rank processes for the unwind table prewarm", "err", err)
+		return
+	}
+	p.metrics.prewarmProcesses.WithLabelValues(labelSkipped).Add(float64(skipped))
+	level.Info(p.logger).Log("msg", "prewarming unwind tables", "processes", len(ranked), "skipped", skipped, "concurrency", p.config.DWARFUnwindingPrewarmConcurrency)
+
+	var (
+		mtx       sync.Mutex
+		tracker   = newCoverageTracker(start, ranked)
+		added     int
+		persisted bool
+	)
+	persist := func() {
+		err := p.bpfMaps.PersistUnwindTable()
+		if err != nil && !errors.Is(err, bpfmaps.ErrNeedMoreProfilingRounds) {
+			p.metrics.unwindTablePersistErrors.WithLabelValues(labelOther).Inc()
+			level.Error(p.logger).Log("msg", "PersistUnwindTable failed", "err", err)
+		}
+	}
+
+	g, ctx := errgroup.WithContext(ctx)
+	g.SetLimit(p.config.DWARFUnwindingPrewarmConcurrency)
+	for _, proc := range ranked {
+		proc := proc
+		if ctx.Err() != nil {
+			break
+		}
+		g.Go(func() error {
+			if !p.addUnwindTableForProcess(ctx, proc.pid, true) {
+				p.metrics.prewarmProcesses.WithLabelValues(labelError).Inc()
+				return nil
+			}
+			p.metrics.prewarmProcesses.WithLabelValues(labelSuccess).Inc()
+
+			mtx.Lock()
+			defer mtx.Unlock()
+
+			added++
+			persisted = false
+			// Only processes whose unwind tables made it to the BPF maps count
+			// towards the coverage.
+			reached, elapsed := tracker.add(proc.usage, time.Now())
+			if len(reached) > 0 || added%prewarmPersistEvery == 0 {
+				persist()
+				persisted = true
+			}
+			for _, ratio := range reached {
+				p.metrics.prewarmCoverageDuration.WithLabelValues(fmt.Sprintf("%g", ratio)).Set(elapsed.Seconds())
+				level.Info(p.logger).Log("msg", "unwind table prewarm coverage reached", "coverage", ratio, "elapsed", elapsed)
+			}
+			return nil
+		})
+	}
+	_ = g.Wait()
+
+	if !persisted {
+		persist()
+	}
+	level.Info(p.logger).Log("msg", "unwind table prewarm finished", "added", added, "processes", len(ranked), "elapsed", time.Since(start))
+}
@@ -0,0 +1,52 @@
+// Copyright 2022-2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+package cpu
+
+import (
+	"testing"
+	"time"
+
+	"github.com/stretchr/testify/require"
+)
+
+func TestCoverageTracker(t *testing.T) {
+	start := time.Now()
+	ranked := []processCPUUsage{{pid: 1, usage: 6}, {pid: 2, usage: 3}, {pid: 3, usage: 0.9}, {pid: 4, usage: 0.1}}
+	tracker := newCoverageTracker(start, ranked)
+
+	reached, elapsed := tracker.add(ranked[0].usage, start.Add(time.Second))
+	require.Equal(t, []float64{0.5}, reached)
+	require.Equal(t, time.Second, elapsed)
+
+	reached, _ = tracker.add(ranked[1].usage, start)
+	require.Equal(t, []float64{0.9}, reached)
+
+	reached, _ = tracker.add(ranked[2].usage, start)
+	require.Equal(t, []float64{0.99}, reached)
+
+	reached, _ = tracker.add(ranked[3].usage, start)
+	require.Empty(t, reached)
+}
+
+func TestRankByCPUUsage(t *testing.T) {
+	before := map[int]float64{1: 10, 2: 5, 3: 7, 4: 2}
+	// 5 started during the interval and 4 exited.
+	after := map[int]float64{1: 11, 2: 8, 3: 7, 5: 1}
+
+	ranked, idle := rankByCPUUsage(before, after)
+	// 1 and 5 used the same amount, 1 used more since it started.
+	require.Equal(t, []processCPUUsage{{pid: 2, usage: 3}, {pid: 1, usage: 1}, {pid: 5, usage: 1}}, ranked)
+	require.Equal(t, 1, idle)
+}
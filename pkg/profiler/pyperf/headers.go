@@ -16,7 +16,79 @@ package pyperf
 
 type InterpreterInfo struct {
 	// u64 start_time;
-	// InterpreterAddr uint64
 	ThreadStateAddr      uint64
+	InterpreterAddr      uint64
 	PyVersionOffsetIndex uint32
 }
+
+// PythonVersionOffsets mirrors the layout of PythonVersionOffsets in
+// bpf/unwinders/pyperf.h.
+type PythonVersionOffsets struct {
+	MajorVersion uint32
+	MinorVersion uint32
+	PatchVersion uint32
+	Padding_     [4]byte
+
+	PyCFrame           PyCFrame
+	PyCodeObject       PyCodeObject
+	PyFrameObject      PyFrameObject
+	PyInterpreterState PyInterpreterState
+	PyObject           PyObject
+	PyRuntimeState     PyRuntimeState
+	PyString           PyString
+	PyThreadState      PyThreadState
+	PyTupleObject      PyTupleObject
+	PyTypeObject       PyTypeObject
+}
+
+type PyCFrame struct {
+	CurrentFrame int64
+}
+
+type PyCodeObject struct {
+	CoFilename    int64
+	CoName        int64
+	CoVarnames    int64
+	CoFirstlineno int64
+}
+
+type PyFrameObject struct {
+	FBack       int64
+	FCode       int64
+	FLineno     int64
+	FLocalsplus int64
+}
+
+type PyInterpreterState struct {
+	TstateHead int64
+}
+
+type PyObject struct {
+	ObType int64
+}
+
+type PyRuntimeState struct {
+	InterpMain int64
+}
+
+type PyString struct {
+	Data int64
+	Size int64
+}
+
+type PyThreadState struct {
+	Next           int64
+	Interp         int64
+	Frame          int64
+	ThreadID       int64
+	NativeThreadID int64
+	Cframe         int64
+}
+
+type PyTupleObject struct {
+	ObItem int64
+}
+
+type PyTypeObject struct {
+	TpName int64
+}
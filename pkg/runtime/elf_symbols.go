@@ -23,26 +23,9 @@ import (
 	"io"
 
 	"github.com/xyproto/ainur"
-)
-
-func HasSymbols(ef *elf.File, matches [][]byte) (bool, error) {
-	var (
-		hasSymbols bool
-		err        error
-	)
 
-	if hasSymbols, err = IsSymbolNameInSymbols(ef, matches); err != nil && !errors.Is(err, elf.ErrNoSymbols) {
-		return hasSymbols, fmt.Errorf("search symbols: %w", err)
-	}
-
-	if !hasSymbols {
-		if hasSymbols, err = IsSymbolNameInDynamicSymbols(ef, matches); err != nil && !errors.Is(err, elf.ErrNoSymbols) {
-			return hasSymbols, fmt.Errorf("search dynamic symbols: %w", err)
-		}
-	}
-
-	return hasSymbols, nil
-}
+	"github.com/parca-dev/parca-agent/pkg/elfreader"
+)
 
 // ForEachElfSymbolNameInSymbols iterates over the symbols in the symbol table
 // of the given elf file. It calls the given function for each symbol name. The
@@ -95,28 +78,9 @@ func isSymbolNameInSection(ef *elf.File, t elf.SectionType, matches [][]byte) (b
 	return false, nil
 }
 
-func scanNullTerminated(data []byte, atEOF bool) (int, []byte, error) {
-	if atEOF && len(data) == 0 {
-		return 0, nil, nil // io.EOF
-	}
-
-	if i := bytes.IndexByte(data, 0); i >= 0 {
-		// We have a full null-terminated line.
-		return i + 1, data[0:i], nil
-	}
-
-	// If we're at EOF, we have a final, non-terminated line. Return it.
-	if atEOF {
-		return len(data), data, nil
-	}
-
-	// Request more data.
-	return 0, nil, nil
-}
-
 func firstIndexOfMatchingSymbol(r io.Reader, matches [][]byte) (int, error) {
 	scanner := bufio.NewScanner(r)
-	scanner.Split(scanNullTerminated)
+	scanner.Split(elfreader.ScanNullTerminated)
 
 	bytesRead := 0
 	for scanner.Scan() {
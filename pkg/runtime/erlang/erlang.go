@@ -27,31 +27,35 @@ import (
 	"github.com/prometheus/procfs"
 	"github.com/xyproto/ainur"
 
+	"github.com/parca-dev/parca-agent/pkg/objectfile"
 	"github.com/parca-dev/parca-agent/pkg/runtime"
 )
 
-var beamIdentifyingSymbols = [][]byte{
-	[]byte("erts_schedule"),
+var beamIdentifyingSymbols = []string{
+	"erts_schedule",
 }
 
-func IsBEAM(path string) (bool, error) {
-	ef, err := elf.Open(path)
+func init() {
+	objectfile.RegisterIdentifyingSymbols(beamIdentifyingSymbols...)
+}
+
+func IsBEAM(objFilePool *objectfile.Pool, path string) (bool, error) {
+	analysis, err := objFilePool.Analyze(path)
 	if err != nil {
-		return false, fmt.Errorf("open elf file: %w", err)
+		return false, fmt.Errorf("analyze elf file: %w", err)
 	}
-	defer ef.Close()
 
-	return runtime.HasSymbols(ef, beamIdentifyingSymbols)
+	return analysis.HasIdentifyingSymbol(beamIdentifyingSymbols...), nil
 }
 
-func IsRuntime(proc procfs.Proc) (bool, error) {
+func IsRuntime(objFilePool *objectfile.Pool, proc procfs.Proc) (bool, error) {
 	exe, err := proc.Executable()
 	if err != nil {
 		return false, err
 	}
 
 	if isBeamBin(exe) {
-		isBeam, err := IsBEAM(absolutePath(proc, exe))
+		isBeam, err := IsBEAM(objFilePool, absolutePath(proc, exe))
 		if err != nil {
 			return false, fmt.Errorf("is beam: %w", err)
 		}
@@ -62,8 +66,8 @@ func IsRuntime(proc procfs.Proc) (bool, error) {
 	return false, nil
 }
 
-func RuntimeInfo(proc procfs.Proc) (*runtime.Runtime, error) {
-	isBeam, err := IsRuntime(proc)
+func RuntimeInfo(objFilePool *objectfile.Pool, proc procfs.Proc) (*runtime.Runtime, error) {
+	isBeam, err := IsRuntime(objFilePool, proc)
 	if err != nil {
 		return nil, fmt.Errorf("is runtime: %w", err)
 	}
@@ -19,7 +19,11 @@ import (
 	"runtime"
 	"testing"
 
+	"github.com/go-kit/log"
+	"github.com/prometheus/client_golang/prometheus"
 	"github.com/stretchr/testify/require"
+
+	"github.com/parca-dev/parca-agent/pkg/objectfile"
 )
 
 const testdata = "../../../testdata"
@@ -42,7 +46,12 @@ func testBinaryPath(p string) string {
 func TestAll(t *testing.T) {
 	file := testBinaryPath("beam.smp")
 
-	isBeam, err := IsBEAM(file)
+	objFilePool := objectfile.NewPool(log.NewNopLogger(), prometheus.NewRegistry(), "", 10, 0)
+	t.Cleanup(func() {
+		objFilePool.Close()
+	})
+
+	isBeam, err := IsBEAM(objFilePool, file)
 	require.NoError(t, err)
 	require.True(t, isBeam)
 
@@ -0,0 +1,223 @@
+// Copyright 2022-2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+package interpreter
+
+import (
+	"fmt"
+	"path"
+	"strconv"
+	"time"
+
+	"github.com/go-kit/log"
+	"github.com/go-kit/log/level"
+	"github.com/prometheus/client_golang/prometheus"
+	"github.com/prometheus/client_golang/prometheus/promauto"
+	"github.com/prometheus/procfs"
+
+	"github.com/parca-dev/parca-agent/pkg/cache"
+	"github.com/parca-dev/parca-agent/pkg/objectfile"
+	"github.com/parca-dev/parca-agent/pkg/runtime"
+	"github.com/parca-dev/parca-agent/pkg/runtime/python"
+	"github.com/parca-dev/parca-agent/pkg/runtime/ruby"
+)
+
+const (
+	// There are very few distinct interpreter binaries on a node.
+	maxBinaries = 1024
+	// How often, at most, newly analyzed binaries are written to disk.
+	cacheSaveInterval = time.Minute
+
+	lvHit  = "hit"
+	lvMiss = "miss"
+)
+
+// binary is what is known about the interpreter binaries run by a process.
+type binary struct {
+	Type   runtime.InterpreterType `json:"type"`
+	Python *python.Binary          `json:"python,omitempty"`
+	Ruby   *ruby.Binary            `json:"ruby,omitempty"`
+}
+
+// Fetcher fetches interpreter information like Fetch, but only analyzes each
+// distinct set of interpreter binaries once, which involves scanning their
+// symbols and reading the version from the memory of the process. Processes
+// forked from or running the same binaries, like the workers of a pre-forking
+// web server, only pay for finding where the binaries are loaded.
+type Fetcher struct {
+	logger      log.Logger
+	objFilePool *objectfile.Pool
+
+	// Keyed by the build IDs of the interpreter binaries.
+	binaries *cache.Persistent[string, binary]
+	requests *prometheus.CounterVec
+}
+
+// NewFetcher returns a new Fetcher. The analyzed binaries are persisted to
+// the given path, if not empty, so they are known after a restart.
+func NewFetcher(logger log.Logger, reg prometheus.Registerer, objFilePool *objectfile.Pool, cachePath string) *Fetcher {
+	f := &Fetcher{
+		logger:      logger,
+		objFilePool: objFilePool,
+		binaries:    cache.NewPersistentCache[string, binary](cachePath, maxBinaries, cacheSaveInterval),
+		requests: promauto.With(reg).NewCounterVec(prometheus.CounterOpts{
+			Name: "parca_agent_interpreter_binary_cache_requests_total",
+			Help: "Total number of interpreter information fetches, by whether the interpreter binaries were already analyzed.",
+		}, []string{"result"}),
+	}
+	f.requests.WithLabelValues(lvHit)
+	f.requests.WithLabelValues(lvMiss)
+
+	if err := f.binaries.Load(); err != nil {
+		level.Warn(logger).Log("msg", "failed to load the interpreter binary cache", "err", err)
+	}
+	return f
+}
+
+// Fetch attempts to fetch interpreter information for each supported
+// interpreter.
+func (f *Fetcher) Fetch(p procfs.Proc) (*runtime.Interpreter, error) {
+	key, ok := f.binaryKey(p)
+	if !ok {
+		return Fetch(f.objFilePool, p)
+	}
+
+	if b, ok := f.binaries.Get(key); ok {
+		f.requests.WithLabelValues(lvHit).Inc()
+		return fromBinary(p, b)
+	}
+	f.requests.WithLabelValues(lvMiss).Inc()
+
+	b, err := analyze(f.objFilePool, p)
+	if err != nil {
+		return nil, err
+	}
+	if b.Type == runtime.InterpreterNone {
+		// Not worth caching, we didn't pay for the analysis.
+		return nil, nil //nolint: nilnil
+	}
+	if f.binaries.Add(key, b) {
+		if err := f.binaries.Save(); err != nil {
+			level.Warn(f.logger).Log("msg", "failed to save the interpreter binary cache", "err", err)
+		}
+	}
+	return fromBinary(p, b)
+}
+
+// Close persists the analyzed binaries.
+func (f *Fetcher) Close() error {
+	return f.binaries.Save()
+}
+
+// binaryKey returns a key identifying the binaries that might be an
+// interpreter in a process. It returns false if none look like one, which is
+// cheap to figure out without the cache.
+func (f *Fetcher) binaryKey(p procfs.Proc) (string, bool) {
+	exe, err := p.Executable()
+	if err != nil {
+		return "", false
+	}
+	maps, err := p.ProcMaps()
+	if err != nil {
+		return "", false
+	}
+
+	var lib string
+	for _, m := range maps {
+		if m.Pathname != "" && (python.IsLibrary(m.Pathname) || ruby.IsLibrary(m.Pathname)) {
+			lib = m.Pathname
+			break
+		}
+	}
+	if lib == "" && !python.IsBinary(exe) && !ruby.IsBinary(exe) {
+		return "", false
+	}
+
+	root := path.Join("/proc", strconv.Itoa(p.PID), "root")
+	exeAnalysis, err := f.objFilePool.Analyze(path.Join(root, exe))
+	if err != nil {
+		return "", false
+	}
+	key := exeAnalysis.BuildID
+	if lib != "" {
+		libAnalysis, err := f.objFilePool.Analyze(path.Join(root, lib))
+		if err != nil {
+			return "", false
+		}
+		key += "/" + libAnalysis.BuildID
+	}
+	return key, true
+}
+
+func analyze(objFilePool *objectfile.Pool, p procfs.Proc) (binary, error) {
+	interpreterType, err := determineInterpreterType(objFilePool, p)
+	if err != nil {
+		return binary{}, err
+	}
+
+	b := binary{Type: interpreterType}
+	switch interpreterType {
+	case runtime.InterpreterRuby:
+		m, err := ruby.FindMappings(p)
+		if err != nil {
+			return binary{}, fmt.Errorf("failed to fetch ruby interpreter info: %w", err)
+		}
+		b.Ruby, err = ruby.AnalyzeBinary(p, m)
+		if err != nil {
+			return binary{}, fmt.Errorf("failed to fetch ruby interpreter info: %w", err)
+		}
+	case runtime.InterpreterPython:
+		m, err := python.FindMappings(p)
+		if err != nil {
+			return binary{}, fmt.Errorf("failed to fetch python interpreter info: %w", err)
+		}
+		b.Python, err = python.AnalyzeBinary(p, m)
+		if err != nil {
+			return binary{}, fmt.Errorf("failed to fetch python interpreter info: %w", err)
+		}
+	case runtime.InterpreterNone:
+	default:
+		return binary{}, fmt.Errorf("unknown interpreter type: %v", interpreterType)
+	}
+	return b, nil
+}
+
+// fromBinary returns the interpreter information of a process running the
+// given, already analyzed, binaries.
+func fromBinary(p procfs.Proc, b binary) (*runtime.Interpreter, error) {
+	switch {
+	case b.Type == runtime.InterpreterRuby && b.Ruby != nil:
+		m, err := ruby.FindMappings(p)
+		if err != nil {
+			return nil, fmt.Errorf("failed to fetch ruby interpreter info: %w", err)
+		}
+		info, err := ruby.InterpreterInfoFromBinary(b.Ruby, m)
+		if err != nil {
+			return nil, fmt.Errorf("failed to fetch ruby interpreter info: %w", err)
+		}
+		return info, nil
+	case b.Type == runtime.InterpreterPython && b.Python != nil:
+		m, err := python.FindMappings(p)
+		if err != nil {
+			return nil, fmt.Errorf("failed to fetch python interpreter info: %w", err)
+		}
+		info, err := python.InterpreterInfoFromBinary(b.Python, m)
+		if err != nil {
+			return nil, fmt.Errorf("failed to fetch python interpreter info: %w", err)
+		}
+		return info, nil
+	default:
+		return nil, fmt.Errorf("unknown interpreter type: %v", b.Type)
+	}
+}
@@ -19,6 +19,7 @@ import (
 
 	"github.com/prometheus/procfs"
 
+	"github.com/parca-dev/parca-agent/pkg/objectfile"
 	"github.com/parca-dev/parca-agent/pkg/runtime"
 	"github.com/parca-dev/parca-agent/pkg/runtime/python"
 	"github.com/parca-dev/parca-agent/pkg/runtime/ruby"
@@ -27,8 +28,8 @@ import (
 // Fetch attempts to fetch interpreter information
 // for each supported interpreter. Once one is found, it will be
 // returned.
-func Fetch(p procfs.Proc) (*runtime.Interpreter, error) {
-	interpreterType, err := determineInterpreterType(p)
+func Fetch(objFilePool *objectfile.Pool, p procfs.Proc) (*runtime.Interpreter, error) {
+	interpreterType, err := determineInterpreterType(objFilePool, p)
 	if err != nil {
 		return nil, err
 	}
@@ -54,9 +55,9 @@ func Fetch(p procfs.Proc) (*runtime.Interpreter, error) {
 	}
 }
 
-func determineInterpreterType(proc procfs.Proc) (runtime.InterpreterType, error) {
+func determineInterpreterType(objFilePool *objectfile.Pool, proc procfs.Proc) (runtime.InterpreterType, error) {
 	errs := errors.New("failed to determine intepreter")
-	ok, err := ruby.IsRuntime(proc)
+	ok, err := ruby.IsRuntime(objFilePool, proc)
 	if ok {
 		return runtime.InterpreterRuby, nil
 	}
@@ -64,7 +65,7 @@ func determineInterpreterType(proc procfs.Proc) (runtime.InterpreterType, error)
 		errs = errors.Join(errs, err)
 	}
 
-	ok, err = python.IsRuntime(proc)
+	ok, err = python.IsRuntime(objFilePool, proc)
 	if ok {
 		return runtime.InterpreterPython, nil
 	}
@@ -27,24 +27,28 @@ import (
 	"github.com/prometheus/procfs"
 	"github.com/xyproto/ainur"
 
+	"github.com/parca-dev/parca-agent/pkg/objectfile"
 	"github.com/parca-dev/parca-agent/pkg/runtime"
 )
 
-var nodejsIdentifyingSymbols = [][]byte{
-	[]byte("InterpreterEntryTrampoline"),
+var nodejsIdentifyingSymbols = []string{
+	"InterpreterEntryTrampoline",
 }
 
-func IsV8(path string) (bool, error) {
-	ef, err := elf.Open(path)
+func init() {
+	objectfile.RegisterIdentifyingSymbols(nodejsIdentifyingSymbols...)
+}
+
+func IsV8(objFilePool *objectfile.Pool, path string) (bool, error) {
+	analysis, err := objFilePool.Analyze(path)
 	if err != nil {
-		return false, fmt.Errorf("open elf file: %w", err)
+		return false, fmt.Errorf("analyze elf file: %w", err)
 	}
-	defer ef.Close()
 
-	return runtime.HasSymbols(ef, nodejsIdentifyingSymbols)
+	return analysis.HasIdentifyingSymbol(nodejsIdentifyingSymbols...), nil
 }
 
-func IsRuntime(proc procfs.Proc) (bool, error) {
+func IsRuntime(objFilePool *objectfile.Pool, proc procfs.Proc) (bool, error) {
 	exe, err := proc.Executable()
 	if err != nil {
 		return false, err
@@ -52,13 +56,7 @@ func IsRuntime(proc procfs.Proc) (bool, error) {
 
 	var isNodeJS bool
 	if isNodeJSBin(exe) {
-		var err error
-		ef, err := elf.Open(absolutePath(proc, exe))
-		if err != nil {
-			return false, fmt.Errorf("open elf file: %w", err)
-		}
-
-		isNodeJS, err = runtime.HasSymbols(ef, nodejsIdentifyingSymbols)
+		isNodeJS, err = IsV8(objFilePool, absolutePath(proc, exe))
 		if err != nil {
 			return false, fmt.Errorf("failed to check for symbols: %w", err)
 		}
@@ -93,12 +91,7 @@ func IsRuntime(proc procfs.Proc) (bool, error) {
 		return false, nil
 	}
 
-	ef, err := elf.Open(absolutePath(proc, lib))
-	if err != nil {
-		return false, fmt.Errorf("open elf file: %w", err)
-	}
-
-	isNodeJS, err = runtime.HasSymbols(ef, nodejsIdentifyingSymbols)
+	isNodeJS, err = IsV8(objFilePool, absolutePath(proc, lib))
 	if err != nil {
 		return false, fmt.Errorf("failed to check for symbols: %w", err)
 	}
@@ -106,8 +99,8 @@ func IsRuntime(proc procfs.Proc) (bool, error) {
 	return isNodeJS, nil
 }
 
-func RuntimeInfo(proc procfs.Proc) (*runtime.Runtime, error) {
-	isNodeJS, err := IsRuntime(proc)
+func RuntimeInfo(objFilePool *objectfile.Pool, proc procfs.Proc) (*runtime.Runtime, error) {
+	isNodeJS, err := IsRuntime(objFilePool, proc)
 	if err != nil {
 		return nil, fmt.Errorf("is runtime: %w", err)
 	}
@@ -33,6 +33,7 @@ import (
 	"github.com/prometheus/procfs"
 
 	"github.com/parca-dev/parca-agent/pkg/elfreader"
+	"github.com/parca-dev/parca-agent/pkg/objectfile"
 	"github.com/parca-dev/parca-agent/pkg/runtime"
 )
 
@@ -49,10 +50,10 @@ import (
 //	3.9:`Py_BytesMain`
 //	3.10:`Py_BytesMain`
 //	3.11:`Py_BytesMain`
-var pythonExecutableIdentifyingSymbols = [][]byte{
-	[]byte("Py_Main"),
-	[]byte("_Py_UnixMain"),
-	[]byte("Py_BytesMain"),
+var pythonExecutableIdentifyingSymbols = []string{
+	"Py_Main",
+	"_Py_UnixMain",
+	"Py_BytesMain",
 }
 
 const (
@@ -61,16 +62,21 @@ const (
 	pythonInterpreterSymbol = "interp_head"
 )
 
-var pythonLibraryIdentifyingSymbols = [][]byte{
-	[]byte(pythonRuntimeSymbol),
-	[]byte(pythonThreadStateSymbol),
+var pythonLibraryIdentifyingSymbols = []string{
+	pythonRuntimeSymbol,
+	pythonThreadStateSymbol,
+}
+
+func init() {
+	objectfile.RegisterIdentifyingSymbols(pythonExecutableIdentifyingSymbols...)
+	objectfile.RegisterIdentifyingSymbols(pythonLibraryIdentifyingSymbols...)
 }
 
 func absolutePath(proc procfs.Proc, p string) string {
 	return path.Join("/proc/", strconv.Itoa(proc.PID), "/root/", p)
 }
 
-func IsRuntime(proc procfs.Proc) (bool, error) {
+func IsRuntime(objFilePool *objectfile.Pool, proc procfs.Proc) (bool, error) {
 	// First, let's check the executable's pathname since it's the cheapest and fastest.
 	exe, err := proc.Executable()
 	if err != nil {
@@ -79,12 +85,12 @@ func IsRuntime(proc procfs.Proc) (bool, error) {
 
 	if isPythonBin(exe) {
 		// Let's make sure it's a python process by checking the ELF file.
-		ef, err := elf.Open(absolutePath(proc, exe))
+		analysis, err := objFilePool.Analyze(absolutePath(proc, exe))
 		if err != nil {
-			return false, fmt.Errorf("open elf file: %w", err)
+			return false, fmt.Errorf("analyze elf file: %w", err)
 		}
 
-		return runtime.HasSymbols(ef, pythonExecutableIdentifyingSymbols)
+		return analysis.HasIdentifyingSymbol(pythonExecutableIdentifyingSymbols...), nil
 	}
 
 	// If the executable is not a Python interpreter, let's check the memory mappings.
@@ -95,12 +101,12 @@ func IsRuntime(proc procfs.Proc) (bool, error) {
 	for _, mapping := range maps {
 		if isPythonLib(mapping.Pathname) {
 			// Let's make sure it's a Python process by checking the ELF file.
-			ef, err := elf.Open(absolutePath(proc, mapping.Pathname))
+			analysis, err := objFilePool.Analyze(absolutePath(proc, mapping.Pathname))
 			if err != nil {
-				return false, fmt.Errorf("open elf file: %w", err)
+				return false, fmt.Errorf("analyze elf file: %w", err)
 			}
 
-			return runtime.HasSymbols(ef, pythonLibraryIdentifyingSymbols)
+			return analysis.HasIdentifyingSymbol(pythonLibraryIdentifyingSymbols...), nil
 		}
 	}
 
@@ -190,39 +196,66 @@ func scanVersionPath(data []byte) (string, error) {
 	return fmt.Sprintf("%d.%d.0", major, minor), nil
 }
 
+// Symbol is the address of a symbol relative to where the binary defining it
+// is loaded.
+type Symbol struct {
+	// Whether the symbol is defined in libpython rather than the executable.
+	InLibrary bool   `json:"in_library"`
+	Value     uint64 `json:"value"`
+	// Virtual address of the segment containing the .text section.
+	TextVaddr uint64 `json:"text_vaddr"`
+}
+
+// address returns the address of the symbol in the process with the given
+// mappings.
+func (s Symbol) address(m Mappings) uint64 {
+	start := m.ExeStart
+	if s.InLibrary {
+		start = m.LibStart
+	}
+	return s.Value + loadOffset(start, s.TextVaddr)
+}
+
+func loadOffset(start, textVaddr uint64) uint64 {
+	// p_vaddr may be larger than the map address in case when the header has an offset and
+	// the map address is relatively small. In this case we can default to 0.
+	return saturatingSub(start, textVaddr)
+}
+
 type interpreterExecutableFile struct {
 	*os.File
 	elfFile *elf.File
 
-	pid   int
-	start uint64
+	pid       int
+	start     uint64
+	textVaddr uint64
+	inLibrary bool
 
-	cache map[string]uint64
+	cache map[string]Symbol
 }
 
-func newInterpreterExecutableFile(pid int, f *os.File, start uint64) (*interpreterExecutableFile, error) {
+func newInterpreterExecutableFile(pid int, f *os.File, start uint64, inLibrary bool) (*interpreterExecutableFile, error) {
 	ef, err := elf.NewFile(f)
 	if err != nil {
 		return nil, fmt.Errorf("new file: %w", err)
 	}
+	var textVaddr uint64
+	if header := elfreader.FindTextProgHeader(ef); header != nil {
+		textVaddr = header.Vaddr
+	}
 	return &interpreterExecutableFile{
-		pid:     pid,
-		File:    f,
-		elfFile: ef,
-		start:   start,
-		cache:   make(map[string]uint64),
+		pid:       pid,
+		File:      f,
+		elfFile:   ef,
+		start:     start,
+		textVaddr: textVaddr,
+		inLibrary: inLibrary,
+		cache:     make(map[string]Symbol),
 	}, nil
 }
 
 func (ef interpreterExecutableFile) offset() uint64 {
-	// p_vaddr may be larger than the map address in case when the header has an offset and
-	// the map address is relatively small. In this case we can default to 0.
-	header := elfreader.FindTextProgHeader(ef.elfFile)
-	if header == nil {
-		return ef.start
-	}
-	// return ef.start - header.Vaddr
-	return saturatingSub(ef.start, header.Vaddr)
+	return loadOffset(ef.start, ef.textVaddr)
 }
 
 func saturatingSub(a, b uint64) uint64 {
@@ -277,20 +310,24 @@ func (ef interpreterExecutableFile) copyMemory(addr uintptr, buf []byte) error {
 	return nil
 }
 
-func (ef interpreterExecutableFile) findAddressOf(s string) (uint64, error) {
-	addr, ok := ef.cache[s]
+func (ef interpreterExecutableFile) findSymbol(s string) (Symbol, error) {
+	sym, ok := ef.cache[s]
 	if ok {
-		return addr, nil
+		return sym, nil
 	}
 	// Search in both symbol and dynamic symbol tables.
 	symbol, err := runtime.FindSymbol(ef.elfFile, s)
 	if err != nil {
-		return 0, fmt.Errorf("FindSymbol: %w", err)
+		return Symbol{}, fmt.Errorf("FindSymbol: %w", err)
 	}
 	// Memoize the result.
-	addr = symbol.Value + ef.offset()
-	ef.cache[s] = addr
-	return addr, nil
+	sym = Symbol{
+		InLibrary: ef.inLibrary,
+		Value:     symbol.Value,
+		TextVaddr: ef.textVaddr,
+	}
+	ef.cache[s] = sym
+	return sym, nil
 }
 
 type interpreter struct {
@@ -301,46 +338,49 @@ type interpreter struct {
 	version *semver.Version
 }
 
-func (i interpreter) findAddressOf(s string) (uint64, error) {
-	addr, err := i.exe.findAddressOf(s)
-	if addr != 0 && err == nil {
-		return addr, nil
+func (i interpreter) findSymbol(s string) (Symbol, error) {
+	if i.exe != nil {
+		sym, err := i.exe.findSymbol(s)
+		if sym.Value != 0 && err == nil {
+			return sym, nil
+		}
 	}
 
 	if i.lib != nil {
-		addr, err = i.lib.findAddressOf(s)
-		if addr != 0 && err == nil {
-			return addr, nil
+		sym, err := i.lib.findSymbol(s)
+		if sym.Value != 0 && err == nil {
+			return sym, nil
 		}
 	}
 
-	return 0, fmt.Errorf("symbol %q not found", s)
+	return Symbol{}, fmt.Errorf("symbol %q not found", s)
 }
 
-func (i interpreter) threadStateAddress() (uint64, error) {
+func (i interpreter) threadStateSymbol() (Symbol, error) {
 	const37_11, err := semver.NewConstraint(">=3.7.x <=3.11.x")
 	if err != nil {
-		return 0, fmt.Errorf("new constraint: %w", err)
+		return Symbol{}, fmt.Errorf("new constraint: %w", err)
 	}
 
 	switch {
 	case const37_11.Check(i.version):
-		addr, err := i.findAddressOf(pythonRuntimeSymbol) // _PyRuntime
+		sym, err := i.findSymbol(pythonRuntimeSymbol) // _PyRuntime
 		if err != nil {
-			return 0, fmt.Errorf("findAddressOf: %w", err)
+			return Symbol{}, fmt.Errorf("findSymbol: %w", err)
 		}
 		offset, err := i.tstateCurrentOffset()
 		if err != nil {
-			return 0, fmt.Errorf("tstate current offset: %w", err)
+			return Symbol{}, fmt.Errorf("tstate current offset: %w", err)
 		}
-		return addr + offset, nil
+		sym.Value += offset
+		return sym, nil
 	// Older versions (<3.7.0) of Python do not have the _PyRuntime struct.
 	default:
-		addr, err := i.findAddressOf(pythonThreadStateSymbol) // _PyThreadState_Current
+		sym, err := i.findSymbol(pythonThreadStateSymbol) // _PyThreadState_Current
 		if err != nil {
-			return 0, fmt.Errorf("findAddressOf: %w", err)
+			return Symbol{}, fmt.Errorf("findSymbol: %w", err)
 		}
-		return addr, nil
+		return sym, nil
 	}
 }
 
@@ -448,30 +488,31 @@ func (i interpreter) tstateCurrentOffsetAmd64() (uint64, error) {
 	}
 }
 
-func (i interpreter) interpreterAddress() (uint64, error) {
+func (i interpreter) interpreterSymbol() (Symbol, error) {
 	const37_11, err := semver.NewConstraint(">=3.7.x <=3.11.x")
 	if err != nil {
-		return 0, fmt.Errorf("new constraint: %w", err)
+		return Symbol{}, fmt.Errorf("new constraint: %w", err)
 	}
 
 	switch {
 	case const37_11.Check(i.version):
-		addr, err := i.findAddressOf(pythonRuntimeSymbol) // _PyRuntime
+		sym, err := i.findSymbol(pythonRuntimeSymbol) // _PyRuntime
 		if err != nil {
-			return 0, fmt.Errorf("findAddressOf: %w", err)
+			return Symbol{}, fmt.Errorf("findSymbol: %w", err)
 		}
 		offset, err := i.interpHeadOffset()
 		if err != nil {
-			return 0, fmt.Errorf("tstate current offset: %w", err)
+			return Symbol{}, fmt.Errorf("tstate current offset: %w", err)
 		}
-		return addr + offset, nil
+		sym.Value += offset
+		return sym, nil
 	// Older versions (<3.7.0) of Python do not have the _PyRuntime struct.
 	default:
-		addr, err := i.findAddressOf(pythonInterpreterSymbol) // interp_head
+		sym, err := i.findSymbol(pythonInterpreterSymbol) // interp_head
 		if err != nil {
-			return 0, fmt.Errorf("findAddressOf: %w", err)
+			return Symbol{}, fmt.Errorf("findSymbol: %w", err)
 		}
-		return addr, nil
+		return sym, nil
 	}
 }
 
@@ -516,8 +557,8 @@ func (i interpreter) Close() error {
 	return nil
 }
 
-func RuntimeInfo(proc procfs.Proc) (*runtime.Runtime, error) {
-	isPython, err := IsRuntime(proc)
+func RuntimeInfo(objFilePool *objectfile.Pool, proc procfs.Proc) (*runtime.Runtime, error) {
+	isPython, err := IsRuntime(objFilePool, proc)
 	if err != nil {
 		return nil, fmt.Errorf("is runtime: %w", err)
 	}
@@ -529,23 +570,40 @@ func RuntimeInfo(proc procfs.Proc) (*runtime.Runtime, error) {
 		Name: "python",
 	}
 
-	interpreter, err := newInterpreter(proc)
+	m, err := FindMappings(proc)
+	if err != nil {
+		return nil, err
+	}
+	interpreter, err := newInterpreter(proc, m)
 	if err != nil {
 		return nil, fmt.Errorf("new interpreter: %w", err)
 	}
+	defer interpreter.Close()
+
 	rt.Version = interpreter.version.String()
 	return rt, nil
 }
 
-func newInterpreter(proc procfs.Proc) (*interpreter, error) {
+// Mappings are the paths, relative to the root of the process, and the load
+// addresses of the Python interpreter binaries of a process.
+type Mappings struct {
+	ExePath  string
+	ExeStart uint64
+	LibPath  string
+	LibStart uint64
+}
+
+// FindMappings finds where the Python interpreter binaries are loaded in the
+// address space of a process.
+func FindMappings(proc procfs.Proc) (Mappings, error) {
 	maps, err := proc.ProcMaps()
 	if err != nil {
-		return nil, fmt.Errorf("error reading process maps: %w", err)
+		return Mappings{}, fmt.Errorf("error reading process maps: %w", err)
 	}
 
 	exePath, err := proc.Executable()
 	if err != nil {
-		return nil, fmt.Errorf("get executable: %w", err)
+		return Mappings{}, fmt.Errorf("get executable: %w", err)
 	}
 
 	isPythonBin := func(pathname string) bool {
@@ -554,24 +612,21 @@ func newInterpreter(proc procfs.Proc) (*interpreter, error) {
 	}
 
 	var (
-		pythonExecutablePath         string
-		pythonExecutableStartAddress uint64
-		libpythonPath                string
-		libpythonStartAddress        uint64
-		found                        bool
+		m     Mappings
+		found bool
 	)
-	for _, m := range maps {
-		if pathname := m.Pathname; pathname != "" {
-			if m.Perms.Execute {
+	for _, mapping := range maps {
+		if pathname := mapping.Pathname; pathname != "" {
+			if mapping.Perms.Execute {
 				if isPythonBin(pathname) {
-					pythonExecutablePath = pathname
-					pythonExecutableStartAddress = uint64(m.StartAddr)
+					m.ExePath = pathname
+					m.ExeStart = uint64(mapping.StartAddr)
 					found = true
 					continue
 				}
 				if isPythonLib(pathname) {
-					libpythonPath = pathname
-					libpythonStartAddress = uint64(m.StartAddr)
+					m.LibPath = pathname
+					m.LibStart = uint64(mapping.StartAddr)
 					found = true
 					continue
 				}
@@ -579,31 +634,35 @@ func newInterpreter(proc procfs.Proc) (*interpreter, error) {
 		}
 	}
 	if !found {
-		return nil, errors.New("not a python process")
+		return Mappings{}, errors.New("not a python process")
 	}
+	return m, nil
+}
 
+func newInterpreter(proc procfs.Proc, m Mappings) (*interpreter, error) {
 	var (
 		exe *interpreterExecutableFile
 		lib *interpreterExecutableFile
+		err error
 	)
-	if pythonExecutablePath != "" {
-		f, err := os.Open(absolutePath(proc, pythonExecutablePath))
+	if m.ExePath != "" {
+		f, err := os.Open(absolutePath(proc, m.ExePath))
 		if err != nil {
 			return nil, fmt.Errorf("open executable: %w", err)
 		}
 
-		exe, err = newInterpreterExecutableFile(proc.PID, f, pythonExecutableStartAddress)
+		exe, err = newInterpreterExecutableFile(proc.PID, f, m.ExeStart, false)
 		if err != nil {
 			return nil, fmt.Errorf("new elf file: %w", err)
 		}
 	}
-	if libpythonPath != "" {
-		f, err := os.Open(absolutePath(proc, libpythonPath))
+	if m.LibPath != "" {
+		f, err := os.Open(absolutePath(proc, m.LibPath))
 		if err != nil {
 			return nil, fmt.Errorf("open library: %w", err)
 		}
 
-		lib, err = newInterpreterExecutableFile(proc.PID, f, libpythonStartAddress)
+		lib, err = newInterpreterExecutableFile(proc.PID, f, m.LibStart, true)
 		if err != nil {
 			return nil, fmt.Errorf("new elf file: %w", err)
 		}
@@ -623,6 +682,9 @@ func newInterpreter(proc procfs.Proc) (*interpreter, error) {
 	}
 	if versionString == "" {
 		for _, source := range versionSources {
+			if source == nil {
+				continue
+			}
 			// As a last resort, try to parse the version from the path.
 			versionString, err = versionFromPath(source.File)
 			if versionString != "" && err == nil {
@@ -644,33 +706,57 @@ func newInterpreter(proc procfs.Proc) (*interpreter, error) {
 	}, nil
 }
 
-func InterpreterInfo(proc procfs.Proc) (*runtime.Interpreter, error) {
-	interpreter, err := newInterpreter(proc)
+// Binary is the information about a Python interpreter that only depends on
+// its binaries, so it is the same for all the processes running them.
+type Binary struct {
+	Version     string `json:"version"`
+	ThreadState Symbol `json:"thread_state"`
+	Interpreter Symbol `json:"interpreter"`
+}
+
+// AnalyzeBinary finds the version of the Python interpreter loaded in the
+// process with the given mappings, and the symbols needed to walk its stacks.
+func AnalyzeBinary(proc procfs.Proc, m Mappings) (*Binary, error) {
+	interpreter, err := newInterpreter(proc, m)
 	if err != nil {
 		return nil, fmt.Errorf("new interpreter: %w", err)
 	}
 	defer interpreter.Close()
 
-	threadStateAddress, err := interpreter.threadStateAddress()
+	threadState, err := interpreter.threadStateSymbol()
 	if err != nil {
 		return nil, fmt.Errorf("python version: %s, thread state address: %w", interpreter.version.String(), err)
 	}
-	if threadStateAddress == 0 {
-		return nil, fmt.Errorf("invalid address, python version: %s, thread state address: 0x%016x", interpreter.version.String(), threadStateAddress)
-	}
 
-	interpreterAddress, err := interpreter.interpreterAddress()
+	interp, err := interpreter.interpreterSymbol()
 	if err != nil {
 		return nil, fmt.Errorf("python version: %s, interpreter address: %w", interpreter.version.String(), err)
 	}
+
+	return &Binary{
+		Version:     interpreter.version.String(),
+		ThreadState: threadState,
+		Interpreter: interp,
+	}, nil
+}
+
+// InterpreterInfoFromBinary returns the information needed to walk the stacks
+// of a process running the given interpreter binaries.
+func InterpreterInfoFromBinary(b *Binary, m Mappings) (*runtime.Interpreter, error) {
+	threadStateAddress := b.ThreadState.address(m)
+	if threadStateAddress == 0 {
+		return nil, fmt.Errorf("invalid address, python version: %s, thread state address: 0x%016x", b.Version, threadStateAddress)
+	}
+
+	interpreterAddress := b.Interpreter.address(m)
 	if interpreterAddress == 0 {
-		return nil, fmt.Errorf("invalid address, python version: %s, interpreter address: 0x%016x", interpreter.version.String(), interpreterAddress)
+		return nil, fmt.Errorf("invalid address, python version: %s, interpreter address: 0x%016x", b.Version, interpreterAddress)
 	}
 
 	return &runtime.Interpreter{
 		Runtime: runtime.Runtime{
 			Name:    "Python",
-			Version: interpreter.version.String(),
+			Version: b.Version,
 		},
 		Type:               runtime.InterpreterPython,
 		MainThreadAddress:  threadStateAddress,
@@ -678,13 +764,35 @@ func InterpreterInfo(proc procfs.Proc) (*runtime.Interpreter, error) {
 	}, nil
 }
 
+func InterpreterInfo(proc procfs.Proc) (*runtime.Interpreter, error) {
+	m, err := FindMappings(proc)
+	if err != nil {
+		return nil, fmt.Errorf("new interpreter: %w", err)
+	}
+	b, err := AnalyzeBinary(proc, m)
+	if err != nil {
+		return nil, err
+	}
+	return InterpreterInfoFromBinary(b, m)
+}
+
 var libRegex = regexp.MustCompile(`/libpython\d.\d\d?(m|d|u)?.so`)
 
+// IsLibrary returns true if the given path looks like libpython.
+func IsLibrary(pathname string) bool {
+	return isPythonLib(pathname)
+}
+
 func isPythonLib(pathname string) bool {
 	// Alternatively, we could check the ELF file for the interpreter symbol.
 	return libRegex.MatchString(pathname)
 }
 
+// IsBinary returns true if the given path looks like a Python executable.
+func IsBinary(pathname string) bool {
+	return isPythonBin(pathname)
+}
+
 func isPythonBin(pathname string) bool {
 	return strings.Contains(path.Base(pathname), "python")
 }
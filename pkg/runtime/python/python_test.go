@@ -242,3 +242,31 @@ func Test_scanVersionPath(t *testing.T) {
 		}
 	}
 }
+
+func TestInterpreterInfoFromBinary(t *testing.T) {
+	b := &Binary{
+		Version:     "3.11.0",
+		ThreadState: Symbol{Value: 0x5000 + 576, TextVaddr: 0x1000},
+		Interpreter: Symbol{InLibrary: true, Value: 0x3000 + 40},
+	}
+
+	// The same binaries loaded at different addresses in two processes.
+	for _, m := range []Mappings{
+		{ExeStart: 0x401000, LibStart: 0x7f0000000000},
+		{ExeStart: 0x801000, LibStart: 0x7f1000000000},
+	} {
+		info, err := InterpreterInfoFromBinary(b, m)
+		if err != nil {
+			t.Fatalf("Unexpected error: %v", err)
+		}
+		if want := m.ExeStart - 0x1000 + 0x5000 + 576; info.MainThreadAddress != want {
+			t.Errorf("Expected main thread address 0x%x, got 0x%x", want, info.MainThreadAddress)
+		}
+		if want := m.LibStart + 0x3000 + 40; info.InterpreterAddress != want {
+			t.Errorf("Expected interpreter address 0x%x, got 0x%x", want, info.InterpreterAddress)
+		}
+		if info.Version != "3.11.0" {
+			t.Errorf("Expected version 3.11.0, got %s", info.Version)
+		}
+	}
+}
@@ -27,6 +27,7 @@ import (
 	"github.com/Masterminds/semver/v3"
 	"github.com/prometheus/procfs"
 
+	"github.com/parca-dev/parca-agent/pkg/objectfile"
 	"github.com/parca-dev/parca-agent/pkg/runtime"
 )
 
@@ -45,8 +46,8 @@ import (
 //	3.1:`ruby_init`
 //	3.2:`ruby_init`
 //	3.3-preview1:`ruby_init`
-var rubyExecutableIdentifyingSymbols = [][]byte{
-	[]byte("ruby_init"),
+var rubyExecutableIdentifyingSymbols = []string{
+	"ruby_init",
 }
 
 const (
@@ -55,16 +56,21 @@ const (
 	rubyCurrentVMSymbol    = "ruby_current_vm"
 )
 
-var rubyLibraryIdentifyingSymbols = [][]byte{
-	[]byte(rubyCurrentVMPtrSymbol),
-	[]byte(rubyCurrentVMSymbol),
+var rubyLibraryIdentifyingSymbols = []string{
+	rubyCurrentVMPtrSymbol,
+	rubyCurrentVMSymbol,
+}
+
+func init() {
+	objectfile.RegisterIdentifyingSymbols(rubyExecutableIdentifyingSymbols...)
+	objectfile.RegisterIdentifyingSymbols(rubyLibraryIdentifyingSymbols...)
 }
 
 func absolutePath(proc procfs.Proc, p string) string {
 	return path.Join("/proc/", strconv.Itoa(proc.PID), "/root/", p)
 }
 
-func IsRuntime(proc procfs.Proc) (bool, error) {
+func IsRuntime(objFilePool *objectfile.Pool, proc procfs.Proc) (bool, error) {
 	// First, let's check the executable`pathname since it's the cheapest and fastest.
 	exe, err := proc.Executable()
 	if err != nil {
@@ -73,12 +79,12 @@ func IsRuntime(proc procfs.Proc) (bool, error) {
 
 	if isRubyBin(exe) {
 		// Let's make sure it's a Ruby process by checking the ELF file.
-		ef, err := elf.Open(absolutePath(proc, exe))
+		analysis, err := objFilePool.Analyze(absolutePath(proc, exe))
 		if err != nil {
-			return false, fmt.Errorf("open elf file: %w", err)
+			return false, fmt.Errorf("analyze elf file: %w", err)
 		}
 
-		return runtime.HasSymbols(ef, rubyExecutableIdentifyingSymbols)
+		return analysis.HasIdentifyingSymbol(rubyExecutableIdentifyingSymbols...), nil
 	}
 
 	// If the executable is not a Ruby interpreter, let's check the memory mappings.
@@ -90,12 +96,12 @@ func IsRuntime(proc procfs.Proc) (bool, error) {
 	for _, mapping := range maps {
 		if isRubyLib(mapping.Pathname) {
 			// Let's make sure it's a Ruby process by checking the ELF file.
-			ef, err := elf.Open(absolutePath(proc, mapping.Pathname))
+			analysis, err := objFilePool.Analyze(absolutePath(proc, mapping.Pathname))
 			if err != nil {
-				return false, fmt.Errorf("open elf file: %w", err)
+				return false, fmt.Errorf("analyze elf file: %w", err)
 			}
 
-			return runtime.HasSymbols(ef, rubyLibraryIdentifyingSymbols)
+			return analysis.HasIdentifyingSymbol(rubyLibraryIdentifyingSymbols...), nil
 		}
 	}
 
@@ -135,8 +141,8 @@ func versionFromSymbol(f *os.File) (string, error) {
 	return string(rubyVersionBuf), nil
 }
 
-func RuntimeInfo(proc procfs.Proc) (*runtime.Runtime, error) {
-	isRuby, err := IsRuntime(proc)
+func RuntimeInfo(objFilePool *objectfile.Pool, proc procfs.Proc) (*runtime.Runtime, error) {
+	isRuby, err := IsRuntime(objFilePool, proc)
 	if err != nil {
 		return nil, fmt.Errorf("is runtime: %w", err)
 	}
@@ -215,29 +221,30 @@ func RuntimeInfo(proc procfs.Proc) (*runtime.Runtime, error) {
 	return rt, nil
 }
 
-// InterpreterInfo receives a process pid and memory mappings and
-// figures out whether it might be a Ruby interpreter. In that case, it
-// returns an `Interpreter` structure with the data that is needed by rbperf
-// (https://github.com/javierhonduco/rbperf) to walk Ruby stacks.
-func InterpreterInfo(proc procfs.Proc) (*runtime.Interpreter, error) {
-	var (
-		pid = proc.PID
+// Mappings are where the Ruby interpreter binaries are loaded in the address
+// space of a process.
+type Mappings struct {
+	ExeStart *uint64
+	// Path of libruby relative to the root of the process, if it is loaded.
+	LibPath  string
+	LibStart *uint64
+}
 
-		rubyBaseAddress    *uint64
-		librubyBaseAddress *uint64
-		librubyPath        string
-	)
+// FindMappings finds where the Ruby interpreter binaries are loaded in the
+// address space of a process.
+func FindMappings(proc procfs.Proc) (Mappings, error) {
+	var m Mappings
 
 	maps, err := proc.ProcMaps()
 	if err != nil {
-		return nil, fmt.Errorf("error reading process maps: %w", err)
+		return m, fmt.Errorf("error reading process maps: %w", err)
 	}
 
 	// Find the load address for the interpreter.
 	for _, mapping := range maps {
 		if isRubyBin(mapping.Pathname) {
 			startAddr := uint64(mapping.StartAddr)
-			rubyBaseAddress = &startAddr
+			m.ExeStart = &startAddr
 			break
 		}
 	}
@@ -246,23 +253,39 @@ func InterpreterInfo(proc procfs.Proc) (*runtime.Interpreter, error) {
 	for _, mapping := range maps {
 		if isRubyLib(mapping.Pathname) {
 			startAddr := uint64(mapping.StartAddr)
-			librubyPath = mapping.Pathname
-			librubyBaseAddress = &startAddr
+			m.LibPath = mapping.Pathname
+			m.LibStart = &startAddr
 			break
 		}
 	}
 
 	// If we can't find either, this is most likely not a Ruby
 	// process.
-	if rubyBaseAddress == nil && librubyBaseAddress == nil {
-		return nil, errors.New("does not look like a Ruby Process")
+	if m.ExeStart == nil && m.LibStart == nil {
+		return m, errors.New("does not look like a Ruby Process")
 	}
+	return m, nil
+}
+
+// Binary is the information about a Ruby interpreter that only depends on its
+// binaries, so it is the same for all the processes running them.
+type Binary struct {
+	Version string `json:"version"`
+	// Value of the VM pointer symbol, relative to where the binary defining
+	// it is loaded.
+	VMPointer uint64 `json:"vm_pointer"`
+	// Whether the symbol is defined in libruby rather than the executable.
+	InLibrary bool `json:"in_library"`
+}
 
+// AnalyzeBinary finds the version of the Ruby interpreter loaded in the
+// process with the given mappings, and the symbols needed to walk its stacks.
+func AnalyzeBinary(proc procfs.Proc, m Mappings) (*Binary, error) {
 	var rubyExecutable string
-	if librubyBaseAddress == nil {
-		rubyExecutable = path.Join("/proc/", strconv.Itoa(pid), "/exe")
+	if m.LibStart == nil {
+		rubyExecutable = path.Join("/proc/", strconv.Itoa(proc.PID), "/exe")
 	} else {
-		rubyExecutable = path.Join("/proc/", strconv.Itoa(pid), "/root/", librubyPath)
+		rubyExecutable = path.Join("/proc/", strconv.Itoa(proc.PID), "/root/", m.LibPath)
 	}
 
 	f, err := os.Open(rubyExecutable)
@@ -278,6 +301,10 @@ func InterpreterInfo(proc procfs.Proc) (*runtime.Interpreter, error) {
 	if rubyVersion == "" {
 		return nil, errors.New("could not find Ruby version")
 	}
+	version, err := semver.NewVersion(rubyVersion)
+	if err != nil {
+		return nil, fmt.Errorf("new version: %q: %w", rubyVersion, err)
+	}
 
 	var vmPointerSymbolName string
 
@@ -286,7 +313,7 @@ func InterpreterInfo(proc procfs.Proc) (*runtime.Interpreter, error) {
 		return nil, fmt.Errorf("could not parse version constraint: %w", err)
 	}
 
-	if constr.Check(semver.MustParse(rubyVersion)) {
+	if constr.Check(version) {
 		vmPointerSymbolName = rubyCurrentVMPtrSymbol
 	} else {
 		vmPointerSymbolName = rubyCurrentVMSymbol
@@ -307,27 +334,66 @@ func InterpreterInfo(proc procfs.Proc) (*runtime.Interpreter, error) {
 		return nil, fmt.Errorf("symbol %q not found", vmPointerSymbolName)
 	}
 
-	mainThreadAddress := vmPointerSymbol.Value
-	if mainThreadAddress == 0 {
+	if vmPointerSymbol.Value == 0 {
 		return nil, errors.New("mainThreadAddress should never be zero")
 	}
 
-	if librubyBaseAddress == nil {
-		mainThreadAddress += *rubyBaseAddress
-	} else {
-		mainThreadAddress += *librubyBaseAddress
+	return &Binary{
+		Version:   version.String(),
+		VMPointer: vmPointerSymbol.Value,
+		InLibrary: m.LibStart != nil,
+	}, nil
+}
+
+// InterpreterInfoFromBinary returns the information needed to walk the stacks
+// of a process running the given interpreter binaries.
+func InterpreterInfoFromBinary(b *Binary, m Mappings) (*runtime.Interpreter, error) {
+	mainThreadAddress := b.VMPointer
+	switch {
+	case b.InLibrary && m.LibStart != nil:
+		mainThreadAddress += *m.LibStart
+	case !b.InLibrary && m.ExeStart != nil:
+		mainThreadAddress += *m.ExeStart
+	default:
+		return nil, errors.New("interpreter binary is not loaded")
 	}
 
 	return &runtime.Interpreter{
 		Runtime: runtime.Runtime{
 			Name:    "Ruby",
-			Version: semver.MustParse(rubyVersion).String(),
+			Version: b.Version,
 		},
 		Type:              runtime.InterpreterRuby,
 		MainThreadAddress: mainThreadAddress,
 	}, nil
 }
 
+// InterpreterInfo receives a process pid and memory mappings and
+// figures out whether it might be a Ruby interpreter. In that case, it
+// returns an `Interpreter` structure with the data that is needed by rbperf
+// (https://github.com/javierhonduco/rbperf) to walk Ruby stacks.
+func InterpreterInfo(proc procfs.Proc) (*runtime.Interpreter, error) {
+	m, err := FindMappings(proc)
+	if err != nil {
+		return nil, err
+	}
+	b, err := AnalyzeBinary(proc, m)
+	if err != nil {
+		return nil, err
+	}
+	return InterpreterInfoFromBinary(b, m)
+}
+
+// IsBinary returns true if the given path looks like a Ruby executable.
+func IsBinary(pathname string) bool {
+	return isRubyBin(pathname)
+}
+
+// IsLibrary returns true if the given path looks like libruby.
+func IsLibrary(pathname string) bool {
+	return isRubyLib(pathname)
+}
+
 func isRubyBin(pathname string) bool {
 	return strings.Contains(path.Base(pathname), "ruby") || strings.Contains(path.Base(pathname), "irb")
 }
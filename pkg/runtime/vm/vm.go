@@ -19,12 +19,13 @@ import (
 
 	"github.com/prometheus/procfs"
 
+	"github.com/parca-dev/parca-agent/pkg/objectfile"
 	"github.com/parca-dev/parca-agent/pkg/runtime"
 	"github.com/parca-dev/parca-agent/pkg/runtime/nodejs"
 )
 
-func Fetch(p procfs.Proc) (*runtime.Runtime, error) {
-	rt, err := nodejs.RuntimeInfo(p)
+func Fetch(objFilePool *objectfile.Pool, p procfs.Proc) (*runtime.Runtime, error) {
+	rt, err := nodejs.RuntimeInfo(objFilePool, p)
 	if rt == nil {
 		if err != nil {
 			return nil, fmt.Errorf("failed to fetch nodejs runtime info: %w", err)
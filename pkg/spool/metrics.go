@@ -0,0 +1,68 @@
+// Copyright 2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package spool
+
+import (
+	"github.com/prometheus/client_golang/prometheus"
+	"github.com/prometheus/client_golang/prometheus/promauto"
+)
+
+const (
+	dropReasonSize    = "size"
+	dropReasonAge     = "age"
+	dropReasonCorrupt = "corrupt"
+)
+
+type metrics struct {
+	size           prometheus.Gauge
+	appended       prometheus.Counter
+	drained        prometheus.Counter
+	dropped        *prometheus.CounterVec
+	drainErrors    prometheus.Counter
+	drainBatchSize prometheus.Histogram
+}
+
+func newMetrics(reg prometheus.Registerer) *metrics {
+	m := &metrics{
+		size: promauto.With(reg).NewGauge(prometheus.GaugeOpts{
+			Name: "parca_agent_spool_size_bytes",
+			Help: "The size of the segments of the profile spool.",
+		}),
+		appended: promauto.With(reg).NewCounter(prometheus.CounterOpts{
+			Name: "parca_agent_spool_records_appended_total",
+			Help: "Total number of requests appended to the profile spool.",
+		}),
+		drained: promauto.With(reg).NewCounter(prometheus.CounterOpts{
+			Name: "parca_agent_spool_records_drained_total",
+			Help: "Total number of requests of the profile spool sent to the remote store.",
+		}),
+		dropped: promauto.With(reg).NewCounterVec(prometheus.CounterOpts{
+			Name: "parca_agent_spool_records_dropped_total",
+			Help: "Total number of requests of the profile spool dropped before they were sent to the remote store.",
+		}, []string{"reason"}),
+		drainErrors: promauto.With(reg).NewCounter(prometheus.CounterOpts{
+			Name: "parca_agent_spool_drain_errors_total",
+			Help: "Total number of failures to send requests of the profile spool to the remote store.",
+		}),
+		drainBatchSize: promauto.With(reg).NewHistogram(prometheus.HistogramOpts{
+			Name:                        "parca_agent_spool_drain_batch_records",
+			Help:                        "The number of requests of the profile spool sent at once to the remote store.",
+			NativeHistogramBucketFactor: 1.1,
+		}),
+	}
+	m.dropped.WithLabelValues(dropReasonSize)
+	m.dropped.WithLabelValues(dropReasonAge)
+	m.dropped.WithLabelValues(dropReasonCorrupt)
+	return m
+}
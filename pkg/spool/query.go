@@ -0,0 +1,112 @@
+// Copyright 2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package spool
+
+import (
+	"errors"
+	"fmt"
+	"io/fs"
+	"os"
+	"time"
+
+	profilestorepb "github.com/parca-dev/parca/gen/proto/go/parca/profilestore/v1alpha1"
+)
+
+// Record is a request read back from a spool.
+type Record struct {
+	Time    time.Time
+	Request *profilestorepb.WriteRawRequest
+}
+
+// Query calls fn with the requests of the spool in the given directory that
+// were appended between from and to, oldest first. A zero from or to is
+// unbounded. If labels are given, only the series with all of them are kept,
+// and the requests without any are skipped.
+//
+// The sealed segments are looked up by their index, and only the records that
+// match are read. Query only reads the spool, so it can run while the agent
+// writes to it.
+func Query(dir string, from, to time.Time, labels map[string]string, fn func(Record) error) error {
+	ids, err := segmentIDs(dir)
+	if err != nil {
+		return fmt.Errorf("list spool segments: %w", err)
+	}
+
+	var minTime, maxTime int64 = 0, 1<<63 - 1
+	if !from.IsZero() {
+		minTime = from.UnixNano()
+	}
+	if !to.IsZero() {
+		maxTime = to.UnixNano()
+	}
+
+	for _, id := range ids {
+		idx, err := readIndex(dir, id)
+		if errors.Is(err, fs.ErrNotExist) {
+			// The head segment, or one the agent didn't get to seal.
+			idx, _, err = scanSegment(segmentPath(dir, id))
+		}
+		if err != nil {
+			if errors.Is(err, fs.ErrNotExist) {
+				// Removed since it was listed.
+				continue
+			}
+			return err
+		}
+		if len(idx.Records) == 0 || idx.MaxTime < minTime || idx.MinTime > maxTime {
+			continue
+		}
+
+		if err := querySegment(dir, id, idx, minTime, maxTime, labels, fn); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+func querySegment(dir string, id uint64, idx *segmentIndex, minTime, maxTime int64, labels map[string]string, fn func(Record) error) error {
+	f, err := os.Open(segmentPath(dir, id))
+	if err != nil {
+		if errors.Is(err, fs.ErrNotExist) {
+			return nil
+		}
+		return err
+	}
+	defer f.Close()
+
+	for _, r := range idx.Records {
+		if r.Time < minTime || r.Time > maxTime || !r.matches(labels) {
+			continue
+		}
+		req, err := readRecord(f, r)
+		if err != nil {
+			return fmt.Errorf("read record at %d of segment %016x: %w", r.Offset, id, err)
+		}
+
+		if len(labels) > 0 {
+			series := req.Series[:0]
+			for _, s := range req.GetSeries() {
+				if seriesMatches(seriesLabels(s), labels) {
+					series = append(series, s)
+				}
+			}
+			req.Series = series
+		}
+
+		if err := fn(Record{Time: time.Unix(0, r.Time), Request: req}); err != nil {
+			return err
+		}
+	}
+	return nil
+}
@@ -0,0 +1,266 @@
+// Copyright 2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package spool
+
+import (
+	"bufio"
+	"encoding/binary"
+	"encoding/json"
+	"errors"
+	"fmt"
+	"hash/crc32"
+	"io"
+	"os"
+	"path/filepath"
+	"sort"
+	"strconv"
+	"strings"
+
+	profilestorepb "github.com/parca-dev/parca/gen/proto/go/parca/profilestore/v1alpha1"
+	"google.golang.org/protobuf/proto"
+
+	"github.com/parca-dev/parca-agent/internal/fsutil"
+)
+
+// A segment is a file of records, each a WriteRawRequest framed by a header:
+//
+//	length  uint32, of the request
+//	crc     uint32, Castagnoli checksum of the request
+//	time    int64, Unix nanoseconds the request was appended at
+//	request [length]byte, marshaled
+//
+// Segments are append-only. Once a segment is full it's sealed, and an index
+// of its records, by time and labels, is written next to it so they can be
+// looked up without reading the segment.
+const (
+	headerSize = 16
+
+	segmentExtension = ".segment"
+	indexExtension   = ".index"
+)
+
+var (
+	castagnoli = crc32.MakeTable(crc32.Castagnoli)
+
+	errCorruptRecord = errors.New("corrupt record")
+)
+
+type header struct {
+	length uint32
+	crc    uint32
+	time   int64
+}
+
+func (h header) append(buf []byte) []byte {
+	buf = binary.LittleEndian.AppendUint32(buf, h.length)
+	buf = binary.LittleEndian.AppendUint32(buf, h.crc)
+	return binary.LittleEndian.AppendUint64(buf, uint64(h.time))
+}
+
+func parseHeader(buf []byte) header {
+	return header{
+		length: binary.LittleEndian.Uint32(buf[0:4]),
+		crc:    binary.LittleEndian.Uint32(buf[4:8]),
+		time:   int64(binary.LittleEndian.Uint64(buf[8:16])),
+	}
+}
+
+// record is the entry of a record in the index of its segment.
+type record struct {
+	Offset int64  `json:"offset"`
+	Length uint32 `json:"length"`
+	Time   int64  `json:"time"`
+	// The label sets of the series of the request.
+	Labels []map[string]string `json:"labels,omitempty"`
+}
+
+func (r record) end() int64 {
+	return r.Offset + headerSize + int64(r.Length)
+}
+
+// matches returns whether any of the series of the record has all the given
+// labels.
+func (r record) matches(labels map[string]string) bool {
+	if len(labels) == 0 {
+		return true
+	}
+	for _, ls := range r.Labels {
+		if seriesMatches(ls, labels) {
+			return true
+		}
+	}
+	return false
+}
+
+func seriesMatches(ls, labels map[string]string) bool {
+	for name, value := range labels {
+		if ls[name] != value {
+			return false
+		}
+	}
+	return true
+}
+
+type segmentIndex struct {
+	MinTime int64    `json:"min_time"`
+	MaxTime int64    `json:"max_time"`
+	Records []record `json:"records"`
+}
+
+func labelSets(r *profilestorepb.WriteRawRequest) []map[string]string {
+	sets := make([]map[string]string, 0, len(r.GetSeries()))
+	for _, series := range r.GetSeries() {
+		sets = append(sets, seriesLabels(series))
+	}
+	return sets
+}
+
+func seriesLabels(series *profilestorepb.RawProfileSeries) map[string]string {
+	ls := make(map[string]string, len(series.GetLabels().GetLabels()))
+	for _, l := range series.GetLabels().GetLabels() {
+		ls[l.GetName()] = l.GetValue()
+	}
+	return ls
+}
+
+func segmentPath(dir string, id uint64) string {
+	return filepath.Join(dir, fmt.Sprintf("%016x%s", id, segmentExtension))
+}
+
+func indexPath(dir string, id uint64) string {
+	return filepath.Join(dir, fmt.Sprintf("%016x%s", id, indexExtension))
+}
+
+// segmentIDs returns the IDs of the segments in the directory, in order.
+func segmentIDs(dir string) ([]uint64, error) {
+	entries, err := os.ReadDir(dir)
+	if err != nil {
+		return nil, err
+	}
+	var ids []uint64
+	for _, e := range entries {
+		name, ok := strings.CutSuffix(e.Name(), segmentExtension)
+		if !ok {
+			continue
+		}
+		id, err := strconv.ParseUint(name, 16, 64)
+		if err != nil {
+			continue
+		}
+		ids = append(ids, id)
+	}
+	sort.Slice(ids, func(i, j int) bool { return ids[i] < ids[j] })
+	return ids, nil
+}
+
+// readIndex reads the index of a sealed segment.
+func readIndex(dir string, id uint64) (*segmentIndex, error) {
+	b, err := os.ReadFile(indexPath(dir, id))
+	if err != nil {
+		return nil, err
+	}
+	var idx segmentIndex
+	if err := json.Unmarshal(b, &idx); err != nil {
+		return nil, fmt.Errorf("parse index of segment %016x: %w", id, err)
+	}
+	return &idx, nil
+}
+
+// writeIndex writes the index of a sealed segment.
+func writeIndex(dir string, id uint64, idx *segmentIndex) error {
+	b, err := json.Marshal(idx)
+	if err != nil {
+		return err
+	}
+	return fsutil.WriteFileAtomic(indexPath(dir, id), b, 0o644)
+}
+
+// scanSegment reads the records of a segment, up to the first one that isn't
+// complete or doesn't match its checksum, which is where the writes were cut
+// short. It returns the index of the valid records, and their size.
+func scanSegment(path string) (*segmentIndex, int64, error) {
+	f, err := os.Open(path)
+	if err != nil {
+		return nil, 0, err
+	}
+	defer f.Close()
+
+	fi, err := f.Stat()
+	if err != nil {
+		return nil, 0, err
+	}
+
+	var (
+		r      = bufio.NewReader(f)
+		idx    = &segmentIndex{}
+		offset int64
+		buf    = make([]byte, headerSize)
+	)
+	for {
+		if _, err := io.ReadFull(r, buf[:headerSize]); err != nil {
+			break
+		}
+		h := parseHeader(buf)
+		if offset+headerSize+int64(h.length) > fi.Size() {
+			break
+		}
+		if cap(buf) < int(h.length) {
+			buf = make([]byte, h.length)
+		}
+		payload := buf[:h.length]
+		if _, err := io.ReadFull(r, payload); err != nil {
+			break
+		}
+		if crc32.Checksum(payload, castagnoli) != h.crc {
+			break
+		}
+		req := &profilestorepb.WriteRawRequest{}
+		if err := proto.Unmarshal(payload, req); err != nil {
+			break
+		}
+
+		idx.add(record{Offset: offset, Length: h.length, Time: h.time, Labels: labelSets(req)})
+		offset += headerSize + int64(h.length)
+		buf = buf[:headerSize]
+	}
+	return idx, offset, nil
+}
+
+func (idx *segmentIndex) add(r record) {
+	if len(idx.Records) == 0 || r.Time < idx.MinTime {
+		idx.MinTime = r.Time
+	}
+	if r.Time > idx.MaxTime {
+		idx.MaxTime = r.Time
+	}
+	idx.Records = append(idx.Records, r)
+}
+
+// readRecord reads the request of a record.
+func readRecord(f io.ReaderAt, r record) (*profilestorepb.WriteRawRequest, error) {
+	buf := make([]byte, headerSize+int(r.Length))
+	if _, err := f.ReadAt(buf, r.Offset); err != nil {
+		return nil, err
+	}
+	h := parseHeader(buf)
+	payload := buf[headerSize:]
+	if h.length != r.Length || crc32.Checksum(payload, castagnoli) != h.crc {
+		return nil, errCorruptRecord
+	}
+	req := &profilestorepb.WriteRawRequest{}
+	if err := proto.Unmarshal(payload, req); err != nil {
+		return nil, errors.Join(errCorruptRecord, err)
+	}
+	return req, nil
+}
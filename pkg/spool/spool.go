@@ -0,0 +1,489 @@
+// Copyright 2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Package spool implements an on-disk spool of the profiles to send to the
+// remote store, so they aren't lost while it's slow or unreachable.
+package spool
+
+import (
+	"context"
+	"encoding/json"
+	"errors"
+	"fmt"
+	"hash/crc32"
+	"io/fs"
+	"os"
+	"path/filepath"
+	"sync"
+	"time"
+
+	"github.com/go-kit/log"
+	"github.com/go-kit/log/level"
+	profilestorepb "github.com/parca-dev/parca/gen/proto/go/parca/profilestore/v1alpha1"
+	"github.com/prometheus/client_golang/prometheus"
+	"google.golang.org/grpc"
+	"google.golang.org/protobuf/proto"
+
+	"github.com/parca-dev/parca-agent/internal/fsutil"
+)
+
+const (
+	defaultSegmentSize = 16 << 20
+	// maxDrainBatchSize is the maximum size of the records sent at once to
+	// the remote store.
+	maxDrainBatchSize = 16 << 20
+
+	cursorFileName = "cursor"
+)
+
+// Options configures a Spool.
+type Options struct {
+	// MaxSize is the size the segments are kept under, by removing the
+	// oldest ones. Zero means no limit.
+	MaxSize int64
+	// MaxAge is how long the records are kept. Zero means no limit.
+	MaxAge time.Duration
+	// SegmentSize is the size the segments are sealed at.
+	SegmentSize int64
+}
+
+// Spool is an append-only log of WriteRawRequests on disk, split into
+// segments. It's a profile store client, so the profiles are written to it
+// instead of the remote store, and Run sends them to the remote store in the
+// background. The requests that can't be sent are kept, until the spool is
+// over its size or age limits.
+//
+// The requests already sent are kept within the same limits, so they can be
+// read back with Query.
+type Spool struct {
+	logger  log.Logger
+	metrics *metrics
+	dir     string
+	opts    Options
+
+	mtx sync.Mutex
+	// Ordered by ID, the last one is the head, the one being written to.
+	segments []*segment
+	head     *os.File
+	size     int64
+	// The position of the first record not sent to the remote store yet.
+	cursor position
+}
+
+type segment struct {
+	id   uint64
+	size int64
+	// The labels of the records are only kept until the segment is sealed,
+	// and its index written.
+	index segmentIndex
+}
+
+type position struct {
+	Segment uint64 `json:"segment"`
+	Offset  int64  `json:"offset"`
+}
+
+func (p position) before(o position) bool {
+	return p.Segment < o.Segment || (p.Segment == o.Segment && p.Offset < o.Offset)
+}
+
+// Open opens the spool in the given directory, creating it if needed. The
+// head segment left by a previous run is sealed, up to its last complete
+// record.
+func Open(logger log.Logger, reg prometheus.Registerer, dir string, opts Options) (*Spool, error) {
+	if opts.SegmentSize <= 0 {
+		opts.SegmentSize = defaultSegmentSize
+	}
+	if opts.MaxSize > 0 {
+		// Keep at least two segments, so the head isn't removed as soon as
+		// it's sealed.
+		opts.SegmentSize = min(opts.SegmentSize, max(opts.MaxSize/2, 1))
+	}
+	if err := os.MkdirAll(dir, 0o755); err != nil {
+		return nil, fmt.Errorf("create spool directory: %w", err)
+	}
+
+	s := &Spool{
+		logger:  logger,
+		metrics: newMetrics(reg),
+		dir:     dir,
+		opts:    opts,
+	}
+
+	ids, err := segmentIDs(dir)
+	if err != nil {
+		return nil, fmt.Errorf("list spool segments: %w", err)
+	}
+	for _, id := range ids {
+		seg, err := s.loadSegment(id)
+		if err != nil {
+			return nil, err
+		}
+		if seg == nil {
+			continue
+		}
+		s.segments = append(s.segments, seg)
+		s.size += seg.size
+	}
+
+	if b, err := os.ReadFile(s.cursorPath()); err == nil {
+		if err := json.Unmarshal(b, &s.cursor); err != nil {
+			level.Warn(logger).Log("msg", "failed to parse spool cursor, resending the spool", "err", err)
+		}
+	} else if !errors.Is(err, fs.ErrNotExist) {
+		return nil, fmt.Errorf("read spool cursor: %w", err)
+	}
+
+	next := uint64(1)
+	if len(s.segments) > 0 {
+		next = s.segments[len(s.segments)-1].id + 1
+	}
+	if err := s.newHead(next); err != nil {
+		return nil, err
+	}
+
+	s.mtx.Lock()
+	s.enforceRetention(time.Now())
+	s.mtx.Unlock()
+	return s, nil
+}
+
+// loadSegment loads the index of a segment, or builds it if the segment
+// wasn't sealed. It returns nil if the segment is empty.
+func (s *Spool) loadSegment(id uint64) (*segment, error) {
+	path := segmentPath(s.dir, id)
+	idx, err := readIndex(s.dir, id)
+	switch {
+	case err == nil:
+	case errors.Is(err, fs.ErrNotExist):
+		var size int64
+		idx, size, err = scanSegment(path)
+		if err != nil {
+			return nil, fmt.Errorf("read spool segment: %w", err)
+		}
+		if size == 0 {
+			return nil, os.Remove(path)
+		}
+		// Drop what's left of a record cut short.
+		if err := os.Truncate(path, size); err != nil {
+			return nil, fmt.Errorf("truncate spool segment: %w", err)
+		}
+		if err := writeIndex(s.dir, id, idx); err != nil {
+			return nil, fmt.Errorf("write spool segment index: %w", err)
+		}
+	default:
+		return nil, err
+	}
+	if len(idx.Records) == 0 {
+		return nil, nil //nolint:nilnil
+	}
+
+	seg := &segment{id: id, index: *idx}
+	seg.dropLabels()
+	seg.size = idx.Records[len(idx.Records)-1].end()
+	return seg, nil
+}
+
+func (seg *segment) dropLabels() {
+	for i := range seg.index.Records {
+		seg.index.Records[i].Labels = nil
+	}
+}
+
+func (s *Spool) newHead(id uint64) error {
+	f, err := os.OpenFile(segmentPath(s.dir, id), os.O_CREATE|os.O_EXCL|os.O_WRONLY|os.O_APPEND, 0o644) //nolint:gosec
+	if err != nil {
+		return fmt.Errorf("create spool segment: %w", err)
+	}
+	s.head = f
+	s.segments = append(s.segments, &segment{id: id})
+	return nil
+}
+
+// seal writes the index of the head segment and starts a new one. It must be
+// called with the lock held.
+func (s *Spool) seal() error {
+	head := s.segments[len(s.segments)-1]
+	if err := s.head.Sync(); err != nil {
+		return fmt.Errorf("sync spool segment: %w", err)
+	}
+	if err := s.head.Close(); err != nil {
+		return fmt.Errorf("close spool segment: %w", err)
+	}
+	if err := writeIndex(s.dir, head.id, &head.index); err != nil {
+		return fmt.Errorf("write spool segment index: %w", err)
+	}
+	head.dropLabels()
+	return s.newHead(head.id + 1)
+}
+
+// WriteRaw appends the request to the spool.
+func (s *Spool) WriteRaw(_ context.Context, r *profilestorepb.WriteRawRequest, _ ...grpc.CallOption) (*profilestorepb.WriteRawResponse, error) {
+	if err := s.Append(time.Now(), r); err != nil {
+		return nil, err
+	}
+	return &profilestorepb.WriteRawResponse{}, nil
+}
+
+// Append appends the request to the spool, as written at the given time.
+func (s *Spool) Append(t time.Time, r *profilestorepb.WriteRawRequest) error {
+	payload, err := proto.Marshal(r)
+	if err != nil {
+		return fmt.Errorf("marshal request: %w", err)
+	}
+	h := header{
+		length: uint32(len(payload)),
+		crc:    crc32.Checksum(payload, castagnoli),
+		time:   t.UnixNano(),
+	}
+	buf := h.append(make([]byte, 0, headerSize+len(payload)))
+	buf = append(buf, payload...)
+	rec := record{Length: h.length, Time: h.time, Labels: labelSets(r)}
+
+	s.mtx.Lock()
+	defer s.mtx.Unlock()
+
+	head := s.segments[len(s.segments)-1]
+	if head.size > 0 && head.size+int64(len(buf)) > s.opts.SegmentSize {
+		if err := s.seal(); err != nil {
+			return err
+		}
+		head = s.segments[len(s.segments)-1]
+	}
+
+	if _, err := s.head.Write(buf); err != nil {
+		// Don't leave a partial record behind, the ones after it wouldn't
+		// be found when the segment is scanned.
+		if terr := s.head.Truncate(head.size); terr != nil {
+			err = errors.Join(err, terr)
+		}
+		return fmt.Errorf("append to spool: %w", err)
+	}
+	rec.Offset = head.size
+	head.index.add(rec)
+	head.size += int64(len(buf))
+	s.size += int64(len(buf))
+	s.metrics.appended.Inc()
+
+	s.enforceRetention(t)
+	return nil
+}
+
+// enforceRetention removes the oldest segments while the spool is over its
+// size or age limits. The head is never removed. It must be called with the
+// lock held.
+func (s *Spool) enforceRetention(now time.Time) {
+	defer func() {
+		s.metrics.size.Set(float64(s.size))
+	}()
+
+	for len(s.segments) > 1 {
+		oldest := s.segments[0]
+		var reason string
+		switch {
+		case s.opts.MaxSize > 0 && s.size > s.opts.MaxSize:
+			reason = dropReasonSize
+		case s.opts.MaxAge > 0 && oldest.index.MaxTime < now.Add(-s.opts.MaxAge).UnixNano():
+			reason = dropReasonAge
+		default:
+			return
+		}
+
+		if s.cursor.before(position{Segment: oldest.id + 1}) {
+			// Not sent entirely.
+			var dropped int
+			for _, r := range oldest.index.Records {
+				if !(position{Segment: oldest.id, Offset: r.Offset}).before(s.cursor) {
+					dropped++
+				}
+			}
+			if dropped > 0 {
+				s.metrics.dropped.WithLabelValues(reason).Add(float64(dropped))
+				level.Warn(s.logger).Log("msg", "dropped requests from the spool before sending them", "count", dropped, "reason", reason)
+			}
+			s.cursor = position{Segment: s.segments[1].id}
+		}
+
+		for _, path := range []string{indexPath(s.dir, oldest.id), segmentPath(s.dir, oldest.id)} {
+			if err := os.Remove(path); err != nil && !errors.Is(err, fs.ErrNotExist) {
+				level.Warn(s.logger).Log("msg", "failed to remove spool segment", "path", path, "err", err)
+			}
+		}
+		s.size -= oldest.size
+		s.segments = s.segments[1:]
+	}
+}
+
+// Run sends the requests of the spool to the remote store at every interval,
+// until the context is done. The requests that fail to be sent are retried
+// at the next interval.
+func (s *Spool) Run(ctx context.Context, client profilestorepb.ProfileStoreServiceClient, interval time.Duration) error {
+	ticker := time.NewTicker(interval)
+	defer ticker.Stop()
+
+	for {
+		select {
+		case <-ctx.Done():
+			return ctx.Err()
+		case <-ticker.C:
+		}
+
+		s.mtx.Lock()
+		s.enforceRetention(time.Now())
+		s.mtx.Unlock()
+
+		for {
+			n, err := s.drain(ctx, client)
+			if err != nil {
+				s.metrics.drainErrors.Inc()
+				level.Warn(s.logger).Log("msg", "failed to send spooled profiles", "err", err)
+				break
+			}
+			if n == 0 {
+				break
+			}
+		}
+	}
+}
+
+// pendingRecords are the records of a segment to send.
+type pendingRecords struct {
+	segment uint64
+	records []record
+}
+
+// pending returns the records after the cursor, up to the given size, and the
+// position after them. It must be called with the lock held.
+func (s *Spool) pending(maxSize int64) ([]pendingRecords, position) {
+	var (
+		pending []pendingRecords
+		end     = s.cursor
+		size    int64
+	)
+	for _, seg := range s.segments {
+		if seg.id < s.cursor.Segment {
+			continue
+		}
+		p := pendingRecords{segment: seg.id}
+		for _, r := range seg.index.Records {
+			if (position{Segment: seg.id, Offset: r.Offset}).before(s.cursor) {
+				continue
+			}
+			if size > 0 && size+int64(r.Length) > maxSize {
+				break
+			}
+			p.records = append(p.records, r)
+			size += int64(r.Length)
+			end = position{Segment: seg.id, Offset: r.end()}
+		}
+		if len(p.records) > 0 {
+			pending = append(pending, p)
+		}
+		if size >= maxSize {
+			break
+		}
+	}
+	return pending, end
+}
+
+// drain sends the records after the cursor, in one request, and moves the
+// cursor after them. It returns the number of records it went through.
+func (s *Spool) drain(ctx context.Context, client profilestorepb.ProfileStoreServiceClient) (int, error) {
+	s.mtx.Lock()
+	pending, end := s.pending(maxDrainBatchSize)
+	s.mtx.Unlock()
+	if len(pending) == 0 {
+		return 0, nil
+	}
+
+	var (
+		req              = &profilestorepb.WriteRawRequest{}
+		records, corrupt int
+	)
+	for _, p := range pending {
+		err := func() error {
+			f, err := os.Open(segmentPath(s.dir, p.segment))
+			if err != nil {
+				if errors.Is(err, fs.ErrNotExist) {
+					// Removed since, the records were accounted as dropped.
+					return nil
+				}
+				return err
+			}
+			defer f.Close()
+
+			for _, r := range p.records {
+				rr, err := readRecord(f, r)
+				if err != nil {
+					level.Debug(s.logger).Log("msg", "failed to read spooled request", "segment", p.segment, "offset", r.Offset, "err", err)
+					corrupt++
+					continue
+				}
+				req.Series = append(req.Series, rr.GetSeries()...)
+				records++
+			}
+			return nil
+		}()
+		if err != nil {
+			return 0, err
+		}
+	}
+
+	if len(req.GetSeries()) > 0 {
+		if _, err := client.WriteRaw(ctx, req); err != nil {
+			return 0, err
+		}
+	}
+	s.metrics.drained.Add(float64(records))
+	s.metrics.dropped.WithLabelValues(dropReasonCorrupt).Add(float64(corrupt))
+	s.metrics.drainBatchSize.Observe(float64(records))
+
+	s.mtx.Lock()
+	defer s.mtx.Unlock()
+	if s.cursor.before(end) {
+		s.cursor = end
+	}
+	return records + corrupt, s.writeCursor()
+}
+
+func (s *Spool) cursorPath() string {
+	return filepath.Join(s.dir, cursorFileName)
+}
+
+// writeCursor persists the cursor, so the requests sent aren't sent again
+// after a restart. It must be called with the lock held.
+func (s *Spool) writeCursor() error {
+	b, err := json.Marshal(s.cursor)
+	if err != nil {
+		return err
+	}
+	if err := fsutil.WriteFileAtomic(s.cursorPath(), b, 0o644); err != nil {
+		return fmt.Errorf("write spool cursor: %w", err)
+	}
+	return nil
+}
+
+// Close seals the head segment.
+func (s *Spool) Close() error {
+	s.mtx.Lock()
+	defer s.mtx.Unlock()
+
+	head := s.segments[len(s.segments)-1]
+	if err := s.head.Close(); err != nil {
+		return err
+	}
+	if head.size == 0 {
+		return os.Remove(segmentPath(s.dir, head.id))
+	}
+	return writeIndex(s.dir, head.id, &head.index)
+}
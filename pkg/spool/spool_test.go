@@ -0,0 +1,196 @@
+// Copyright 2024 The Parca Authors
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package spool
+
+import (
+	"context"
+	"errors"
+	"os"
+	"strconv"
+	"strings"
+	"testing"
+	"time"
+
+	"github.com/go-kit/log"
+	profilestorepb "github.com/parca-dev/parca/gen/proto/go/parca/profilestore/v1alpha1"
+	"github.com/prometheus/client_golang/prometheus"
+	"github.com/prometheus/client_golang/prometheus/testutil"
+	"github.com/stretchr/testify/require"
+	"google.golang.org/grpc"
+)
+
+func testRequest(pid int) *profilestorepb.WriteRawRequest {
+	return &profilestorepb.WriteRawRequest{
+		Series: []*profilestorepb.RawProfileSeries{{
+			Labels: &profilestorepb.LabelSet{Labels: []*profilestorepb.Label{
+				{Name: "node", Value: "node-1"},
+				{Name: "pid", Value: strconv.Itoa(pid)},
+			}},
+			Samples: []*profilestorepb.RawSample{{RawProfile: make([]byte, 100)}},
+		}},
+	}
+}
+
+type testClient struct {
+	err  error
+	pids []string
+}
+
+func (c *testClient) WriteRaw(_ context.Context, r *profilestorepb.WriteRawRequest, _ ...grpc.CallOption) (*profilestorepb.WriteRawResponse, error) {
+	if c.err != nil {
+		return nil, c.err
+	}
+	for _, s := range r.GetSeries() {
+		c.pids = append(c.pids, seriesLabels(s)["pid"])
+	}
+	return &profilestorepb.WriteRawResponse{}, nil
+}
+
+func drainAll(t *testing.T, s *Spool, c *testClient) {
+	t.Helper()
+	for {
+		n, err := s.drain(context.Background(), c)
+		require.NoError(t, err)
+		if n == 0 {
+			return
+		}
+	}
+}
+
+func TestSpoolDrain(t *testing.T) {
+	dir := t.TempDir()
+	s, err := Open(log.NewNopLogger(), prometheus.NewRegistry(), dir, Options{SegmentSize: 1000})
+	require.NoError(t, err)
+
+	for pid := 1; pid <= 20; pid++ {
+		_, err := s.WriteRaw(context.Background(), testRequest(pid))
+		require.NoError(t, err)
+	}
+	require.Greater(t, len(s.segments), 1)
+
+	// Nothing is lost while the remote store is unreachable.
+	c := &testClient{err: errors.New("unavailable")}
+	_, err = s.drain(context.Background(), c)
+	require.Error(t, err)
+
+	c.err = nil
+	drainAll(t, s, c)
+	require.Len(t, c.pids, 20)
+	require.Equal(t, "1", c.pids[0])
+	require.Equal(t, "20", c.pids[19])
+
+	_, err = s.WriteRaw(context.Background(), testRequest(21))
+	require.NoError(t, err)
+	require.NoError(t, s.Close())
+
+	// Only what wasn't sent is sent after a restart.
+	s, err = Open(log.NewNopLogger(), prometheus.NewRegistry(), dir, Options{SegmentSize: 1000})
+	require.NoError(t, err)
+	c = &testClient{}
+	drainAll(t, s, c)
+	require.Equal(t, []string{"21"}, c.pids)
+	require.NoError(t, s.Close())
+}
+
+func TestSpoolRecover(t *testing.T) {
+	dir := t.TempDir()
+	s, err := Open(log.NewNopLogger(), prometheus.NewRegistry(), dir, Options{})
+	require.NoError(t, err)
+	for pid := 1; pid <= 3; pid++ {
+		require.NoError(t, s.Append(time.Now(), testRequest(pid)))
+	}
+	// A write cut short, and the agent stopped without sealing the head.
+	_, err = s.head.Write([]byte{42, 0, 0, 0, 1, 2})
+	require.NoError(t, err)
+	require.NoError(t, s.head.Close())
+
+	s, err = Open(log.NewNopLogger(), prometheus.NewRegistry(), dir, Options{})
+	require.NoError(t, err)
+	require.NoError(t, s.Append(time.Now(), testRequest(4)))
+
+	c := &testClient{}
+	drainAll(t, s, c)
+	require.Equal(t, []string{"1", "2", "3", "4"}, c.pids)
+	require.NoError(t, s.Close())
+}
+
+func TestSpoolRetention(t *testing.T) {
+	dir := t.TempDir()
+	s, err := Open(log.NewNopLogger(), prometheus.NewRegistry(), dir, Options{MaxSize: 2000, MaxAge: time.Hour, SegmentSize: 500})
+	require.NoError(t, err)
+
+	start := time.Now()
+	for pid := 1; pid <= 20; pid++ {
+		require.NoError(t, s.Append(start, testRequest(pid)))
+	}
+	require.LessOrEqual(t, s.size, int64(2000))
+	dropped := testutil.ToFloat64(s.metrics.dropped.WithLabelValues(dropReasonSize))
+	require.Greater(t, dropped, 0.0)
+
+	c := &testClient{}
+	drainAll(t, s, c)
+	require.Len(t, c.pids, 20-int(dropped))
+	require.Equal(t, "20", c.pids[len(c.pids)-1])
+
+	// Records sent are kept until they're too old.
+	require.NoError(t, s.Append(start.Add(2*time.Hour), testRequest(21)))
+	for _, seg := range s.segments[:len(s.segments)-1] {
+		require.Greater(t, seg.index.MaxTime, start.UnixNano())
+	}
+	require.Zero(t, testutil.ToFloat64(s.metrics.dropped.WithLabelValues(dropReasonAge)))
+	require.NoError(t, s.Close())
+}
+
+func TestQuery(t *testing.T) {
+	dir := t.TempDir()
+	s, err := Open(log.NewNopLogger(), prometheus.NewRegistry(), dir, Options{SegmentSize: 1000})
+	require.NoError(t, err)
+
+	start := time.Unix(1000, 0)
+	for pid := 1; pid <= 20; pid++ {
+		require.NoError(t, s.Append(start.Add(time.Duration(pid)*time.Second), testRequest(pid%2)))
+	}
+
+	query := func(from, to time.Time, labels map[string]string) int {
+		t.Helper()
+		var n int
+		require.NoError(t, Query(dir, from, to, labels, func(r Record) error {
+			require.False(t, r.Time.Before(from))
+			for _, s := range r.Request.GetSeries() {
+				require.True(t, seriesMatches(seriesLabels(s), labels))
+			}
+			n++
+			return nil
+		}))
+		return n
+	}
+
+	// The head segment isn't indexed yet.
+	require.Equal(t, 20, query(time.Time{}, time.Time{}, nil))
+	require.Equal(t, 10, query(time.Time{}, time.Time{}, map[string]string{"pid": "1"}))
+	require.Equal(t, 5, query(start.Add(11*time.Second), start.Add(20*time.Second), map[string]string{"pid": "0"}))
+	require.Zero(t, query(time.Time{}, time.Time{}, map[string]string{"pid": "2"}))
+
+	require.NoError(t, s.Close())
+	entries, err := os.ReadDir(dir)
+	require.NoError(t, err)
+	var indexes int
+	for _, e := range entries {
+		if strings.HasSuffix(e.Name(), indexExtension) {
+			indexes++
+		}
+	}
+	require.Greater(t, indexes, 1)
+	require.Equal(t, 10, query(time.Time{}, time.Time{}, map[string]string{"pid": "1"}))
+}
@@ -15,72 +15,46 @@
 package unwind
 
 import (
-	"errors"
 	"fmt"
-	"os"
 	"strings"
-	"syscall"
 
 	"github.com/Masterminds/semver/v3"
 	"github.com/go-kit/log"
 	"github.com/prometheus/client_golang/prometheus"
 
 	"github.com/parca-dev/parca-agent/pkg/cache"
+	"github.com/parca-dev/parca-agent/pkg/objectfile"
 	"github.com/parca-dev/parca-agent/pkg/runtime"
 	"github.com/parca-dev/parca-agent/pkg/runtime/erlang"
 	"github.com/parca-dev/parca-agent/pkg/runtime/nodejs"
 )
 
 type FramePointerCache struct {
-	cache        *cache.Cache[framePointerCacheKey, bool]
+	cache        *cache.Cache[objectfile.FileID, bool]
 	compilerInfo *runtime.CompilerInfoManager
+	objFilePool  *objectfile.Pool
 }
 
-func NewHasFramePointersCache(logger log.Logger, reg prometheus.Registerer, cim *runtime.CompilerInfoManager) FramePointerCache {
+func NewHasFramePointersCache(logger log.Logger, reg prometheus.Registerer, cim *runtime.CompilerInfoManager, objFilePool *objectfile.Pool) FramePointerCache {
 	return FramePointerCache{
-		// 8 bytes for the hash + 3 * 8 bytes for the actual key (inode: uint64
-		// syscall.Timespec: 2x int64) + size of value (bool: 1x byte)
-		// => 33 bytes
-		// => 33 bytes * 10_000 entries = 0.330 KB (excluding metadata from the map).
-		cache: cache.NewLRUCache[framePointerCacheKey, bool](
+		// 8 bytes for the hash + 4 * 8 bytes for the actual key (device, inode,
+		// modification time and size) + size of value (bool: 1x byte)
+		// => 41 bytes
+		// => 41 bytes * 10_000 entries = 0.410 KB (excluding metadata from the map).
+		cache: cache.NewLRUCache[objectfile.FileID, bool](
 			prometheus.WrapRegistererWith(prometheus.Labels{"cache": "frame_pointer"}, reg),
 			10_000,
 		),
 		compilerInfo: cim,
+		objFilePool:  objFilePool,
 	}
 }
 
-// The inode value can be recycled (this behavior is filesystem specific)
-// and it's only guaranteed to be unique within each filesystem. By adding
-// the change time, which gets updated every time the file or its medatadata
-// are modified + the inode we significantly reduce the chances of collisions.
-//
-// Replacing the file in-place might result in the same inode being used, but
-// the change time will most likely be different.
-type framePointerCacheKey struct {
-	inode        uint64
-	creationTime syscall.Timespec
-}
-
-func (fpc *FramePointerCache) cacheKey(executable string) (framePointerCacheKey, error) {
-	fileinfo, err := os.Stat(executable)
-	if err != nil {
-		return framePointerCacheKey{}, err
-	}
-
-	stat, ok := fileinfo.Sys().(*syscall.Stat_t)
-	if !ok {
-		return framePointerCacheKey{}, errors.New("fileinfo didn't have stat_t")
-	}
-
-	return framePointerCacheKey{
-		inode:        stat.Ino,
-		creationTime: stat.Ctim,
-	}, nil
-}
-
+// HasFramePointers returns whether the executable is compiled with frame
+// pointers. It is cached by the file's ID, so it's only computed once for
+// every executable, regardless of how many processes run it.
 func (fpc *FramePointerCache) HasFramePointers(executable string) (bool, error) {
-	cacheKey, err := fpc.cacheKey(executable)
+	cacheKey, err := objectfile.FileIDFromPath(executable)
 	if err != nil {
 		return false, err
 	}
@@ -129,7 +103,7 @@ func (fpc *FramePointerCache) hasFramePointers(executable string) (bool, error)
 	// v8 uses a custom code generator for some of it's ahead-of-time functions. They do contain
 	// frame pointers, but no DWARF unwind information, so we force frame pointer unwinding as
 	// mixed mode unwinding (fp -> DWARF) won't work here.
-	isV8, err := nodejs.IsV8(executable)
+	isV8, err := nodejs.IsV8(fpc.objFilePool, executable)
 	if err != nil {
 		return false, fmt.Errorf("check if executable is v8: %w", err)
 	}
@@ -137,9 +111,9 @@ func (fpc *FramePointerCache) hasFramePointers(executable string) (bool, error)
 		return true, nil
 	}
 
-	isBEAM, err := erlang.IsBEAM(executable)
+	isBEAM, err := erlang.IsBEAM(fpc.objFilePool, executable)
 	if err != nil {
-		return false, fmt.Errorf("check if executable is v8: %w", err)
+		return false, fmt.Errorf("check if executable is beam: %w", err)
 	}
 	if isBEAM {
 		return true, nil
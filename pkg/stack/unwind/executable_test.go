@@ -34,7 +34,7 @@ func TestHasFramePointersInModernGolang(t *testing.T) {
 	})
 	fpCache := NewHasFramePointersCache(
 		logger,
-		reg, runtime.NewCompilerInfoManager(reg, objFilePool),
+		reg, runtime.NewCompilerInfoManager(reg, objFilePool), objFilePool,
 	)
 
 	// This test works because we require Go > 1.18,
@@ -53,7 +53,7 @@ func TestHasFramePointersInCApplication(t *testing.T) {
 	})
 	fpCache := NewHasFramePointersCache(
 		logger,
-		reg, runtime.NewCompilerInfoManager(reg, objFilePool),
+		reg, runtime.NewCompilerInfoManager(reg, objFilePool), objFilePool,
 	)
 
 	hasFp, err := fpCache.hasFramePointers("../../../testdata/out/x86/basic-cpp")
@@ -70,7 +70,7 @@ func TestHasFramePointersCache(t *testing.T) {
 	})
 	fpCache := NewHasFramePointersCache(
 		logger,
-		reg, runtime.NewCompilerInfoManager(reg, objFilePool),
+		reg, runtime.NewCompilerInfoManager(reg, objFilePool), objFilePool,
 	)
 
 	// Ensure that the cached results are correct.
@@ -19,11 +19,12 @@ import (
 	"errors"
 	"fmt"
 	"io"
+	"math/bits"
 	"os"
 	"sort"
 	"unsafe"
 
-	"golang.org/x/exp/mmap"
+	"golang.org/x/sys/unix"
 )
 
 // There are several use-cases, such as symbolization, that conceptually boil
@@ -43,25 +44,41 @@ import (
 // This implementation produces a simple binary format that's easy to write
 // and read, but most importantly, it should be efficient to query.
 //
-// ┌─────────┬────────────────────────────┬────────────────────────────────────────────┐
-// │         │                            │                                            │
-// │ Header  │  Strings with nul endings  │  Sorted ids + meta information on strings  │
-// │         │                            │                                            │
-// └─────────┴────────────────────────────┴────────────────────────────────────────────┘
+// ┌─────────┬────────────────────────────┬────────────────────────────────────────────┬───────────────┐
+// │         │                            │                                            │               │
+// │ Header  │  Strings with nul endings  │  Sorted ids + meta information on strings  │  Block index  │
+// │         │                            │                                            │               │
+// └─────────┴────────────────────────────┴────────────────────────────────────────────┴───────────────┘
 //
 // The strings aren't deduplicated or optimized in any way, to reduce the memory
 // usage during the write phase.
 //
+// Entries without a string mark the end of the previous symbol, so addresses
+// from there up to the next entry aren't symbolized to it.
+//
+// A binary search over the sorted ids touches a different page or cache line
+// on every probe. Instead, the ids are split in blocks of a few cache lines,
+// and the first id of each block is stored in the block index, in Eytzinger
+// (breadth-first) order. The top levels of that tree are shared by all
+// lookups and stay in cache, and each level of the search reads the next
+// cache line, which the CPU can predict. Only the block found that way is
+// then searched.
+//
 // The file is read with `mmap(2)`, to avoid performing any read system calls
-// while binary searching over the identifiers, and leveraging the caching layer
-// of the filesystem. As we now have a backing file, rather than being anonymous
-// memory, the OS can remove cached pages if there's need for more memory.
+// or copies while searching over the identifiers, and leveraging the caching
+// layer of the filesystem. As we now have a backing file, rather than being
+// anonymous memory, the OS can remove cached pages if there's need for more
+// memory.
 
 const (
 	MAGIC      = uint32(0x8A4CA)
-	VERSION    = uint32(1)
+	VERSION    = uint32(2)
 	headerSize = uint32(unsafe.Sizeof(FileHeader{}))
 	entrySize  = uint32(8 + 4 + 2) // uint64, uint32, uint16
+	// Number of entries per block, 224 bytes.
+	blockEntries = uint32(16)
+	// Size of a block index node, the first id of a block and the block number.
+	indexNodeSize = uint32(8 + 4) // uint64, uint32
 )
 
 var (
@@ -70,6 +87,8 @@ var (
 	ErrBadMagic         = errors.New("bad magic identifier")
 	ErrBadVersion       = errors.New("bad version")
 	ErrReadZeroBytes    = errors.New("read zero bytes")
+	ErrTruncated        = errors.New("truncated file")
+	ErrNotSorted        = errors.New("addresses are not sorted")
 )
 
 type FileHeader struct {
@@ -77,6 +96,7 @@ type FileHeader struct {
 	Version         uint32
 	AddressesOffset uint32
 	AddressesCount  uint32
+	BlocksCount     uint32
 }
 
 type Entry struct {
@@ -93,6 +113,8 @@ type FileWriter struct {
 	finalized    bool
 	entryBuf     []byte
 	entryCount   uint32
+	// First address of each block of entries.
+	blockAddresses []uint64
 }
 
 func NewWriter(path string, preallocate int) (*FileWriter, error) {
@@ -153,6 +175,9 @@ func (fw *FileWriter) AddString(name string) (uint32, error) {
 }
 
 func (fw *FileWriter) WriteHeader() error {
+	if err := fw.writeIndex(); err != nil {
+		return fmt.Errorf("writeIndex: %w", err)
+	}
 	if err := fw.w.Flush(); err != nil {
 		return fmt.Errorf("flush: %w", err)
 	}
@@ -165,6 +190,7 @@ func (fw *FileWriter) WriteHeader() error {
 		Version:         VERSION,
 		AddressesOffset: fw.stringOffset,
 		AddressesCount:  fw.entryCount,
+		BlocksCount:     uint32(len(fw.blockAddresses)),
 	}); err != nil {
 		return fmt.Errorf("binary.Write: %w", err)
 	}
@@ -204,7 +230,39 @@ func (fw *FileWriter) Close() error {
 	return fw.file.Close()
 }
 
+// writeIndex writes the block index, which is the complete binary search tree
+// of the first address of the blocks, in breadth-first order.
+func (fw *FileWriter) writeIndex() error {
+	n := uint32(len(fw.blockAddresses))
+	nodes := make([]byte, indexNodeSize*n)
+
+	// An in-order traversal of the tree visits the blocks in order.
+	block := uint32(0)
+	var fill func(k uint32)
+	fill = func(k uint32) {
+		if k > n {
+			return
+		}
+		fill(2 * k)
+		node := nodes[indexNodeSize*(k-1):]
+		binary.LittleEndian.PutUint64(node[:8], fw.blockAddresses[block])
+		binary.LittleEndian.PutUint32(node[8:12], block)
+		block++
+		fill(2*k + 1)
+	}
+	fill(1)
+
+	if _, err := fw.w.Write(nodes); err != nil {
+		return fmt.Errorf("write: %w", err)
+	}
+	return nil
+}
+
 func (fw *FileWriter) WriteEntry(e Entry) error {
+	if fw.entryCount%blockEntries == 0 {
+		fw.blockAddresses = append(fw.blockAddresses, e.Address)
+	}
+
 	binary.LittleEndian.PutUint64(fw.entryBuf[:8], e.Address)
 	binary.LittleEndian.PutUint32(fw.entryBuf[8:12], e.Offset)
 	binary.LittleEndian.PutUint16(fw.entryBuf[12:14], e.Len)
@@ -217,6 +275,11 @@ func (fw *FileWriter) WriteEntry(e Entry) error {
 	return nil
 }
 
+// WriteEnd writes an entry marking the end of the previous symbol.
+func (fw *FileWriter) WriteEnd(address uint64) error {
+	return fw.WriteEntry(Entry{Address: address})
+}
+
 func readEntry(buf []byte) Entry {
 	return Entry{
 		Address: binary.LittleEndian.Uint64(buf[:8]),
@@ -225,22 +288,25 @@ func readEntry(buf []byte) Entry {
 	}
 }
 
+// FileReader is a concurrency-safe reader of a symtab file.
 type FileReader struct {
-	reader      *mmap.ReaderAt
-	header      *FileHeader
-	entryBuffer []byte
+	data   []byte
+	header *FileHeader
+
+	entriesStart uint32
+	indexStart   uint32
 }
 
-func validateHeader(path string) (*FileHeader, error) {
-	f, err := os.Open(path)
-	if err != nil {
-		return nil, fmt.Errorf("os.Open: %w", err)
+func readHeader(data []byte) (*FileHeader, error) {
+	if len(data) < int(headerSize) {
+		return nil, ErrTruncated
 	}
-	defer f.Close()
-	header := FileHeader{}
-	err = binary.Read(f, binary.LittleEndian, &header)
-	if err != nil {
-		return nil, fmt.Errorf("binary.Read: %w", err)
+	header := &FileHeader{
+		Magic:           binary.LittleEndian.Uint32(data[0:4]),
+		Version:         binary.LittleEndian.Uint32(data[4:8]),
+		AddressesOffset: binary.LittleEndian.Uint32(data[8:12]),
+		AddressesCount:  binary.LittleEndian.Uint32(data[12:16]),
+		BlocksCount:     binary.LittleEndian.Uint32(data[16:20]),
 	}
 
 	if header.Magic != MAGIC {
@@ -249,24 +315,50 @@ func validateHeader(path string) (*FileHeader, error) {
 	if header.Version != VERSION {
 		return nil, ErrBadVersion
 	}
+	if header.BlocksCount != (header.AddressesCount+blockEntries-1)/blockEntries {
+		return nil, fmt.Errorf("%w: %d blocks for %d entries", ErrTruncated, header.BlocksCount, header.AddressesCount)
+	}
+	size := uint64(headerSize) + uint64(header.AddressesOffset) +
+		uint64(entrySize)*uint64(header.AddressesCount) +
+		uint64(indexNodeSize)*uint64(header.BlocksCount)
+	if uint64(len(data)) < size {
+		return nil, ErrTruncated
+	}
 
-	return &header, nil
+	return header, nil
 }
 
 func NewReader(path string) (*FileReader, error) {
-	reader, err := mmap.Open(path)
+	f, err := os.Open(path)
 	if err != nil {
-		return nil, fmt.Errorf("mmap.Open: %w", err)
+		return nil, fmt.Errorf("os.Open: %w", err)
 	}
-	header, err := validateHeader(path)
+	defer f.Close()
+
+	stat, err := f.Stat()
+	if err != nil {
+		return nil, fmt.Errorf("stat: %w", err)
+	}
+	if stat.Size() < int64(headerSize) {
+		return nil, fmt.Errorf("validateHeader: %w", ErrTruncated)
+	}
+
+	data, err := unix.Mmap(int(f.Fd()), 0, int(stat.Size()), unix.PROT_READ, unix.MAP_SHARED)
+	if err != nil {
+		return nil, fmt.Errorf("mmap: %w", err)
+	}
+	header, err := readHeader(data)
 	if err != nil {
+		unix.Munmap(data)
 		return nil, fmt.Errorf("validateHeader: %w", err)
 	}
 
+	entriesStart := headerSize + header.AddressesOffset
 	return &FileReader{
-		reader:      reader,
-		header:      header,
-		entryBuffer: make([]byte, entrySize),
+		data:         data,
+		header:       header,
+		entriesStart: entriesStart,
+		indexStart:   entriesStart + entrySize*header.AddressesCount,
 	}, nil
 }
 
@@ -275,76 +367,137 @@ func (fr *FileReader) Header() FileHeader {
 }
 
 func (fr *FileReader) Close() error {
-	return fr.reader.Close()
+	if fr.data == nil {
+		return nil
+	}
+	err := unix.Munmap(fr.data)
+	fr.data = nil
+	return err
 }
 
-func (fr *FileReader) readEntry(at uint32) (*Entry, error) {
-	read, err := fr.reader.ReadAt(fr.entryBuffer, int64(at))
-	if err != nil {
-		return nil, fmt.Errorf("mmap ReadAt: %w", err)
+func (fr *FileReader) entryAt(i uint32) Entry {
+	return readEntry(fr.data[fr.entriesStart+entrySize*i:])
+}
+
+func (fr *FileReader) address(i uint32) uint64 {
+	return binary.LittleEndian.Uint64(fr.data[fr.entriesStart+entrySize*i:])
+}
+
+// block returns the last block starting at or before the given address.
+func (fr *FileReader) block(address uint64) (uint32, bool) {
+	n := uint64(fr.header.BlocksCount)
+	k := uint64(1)
+	for k <= n {
+		node := fr.data[uint64(fr.indexStart)+uint64(indexNodeSize)*(k-1):]
+		if binary.LittleEndian.Uint64(node[:8]) <= address {
+			k = 2*k + 1
+		} else {
+			k = 2 * k
+		}
 	}
-	if read == 0 {
-		return nil, ErrReadZeroBytes
+	// Go back to the last node where the search went right, which is the
+	// greatest address that's not after the one searched for.
+	k >>= bits.TrailingZeros64(k) + 1
+	if k == 0 {
+		return 0, false
 	}
-
-	entry := readEntry(fr.entryBuffer)
-	return &entry, nil
+	node := fr.data[uint64(fr.indexStart)+uint64(indexNodeSize)*(k-1):]
+	return binary.LittleEndian.Uint32(node[8:12]), true
 }
 
-func (fr *FileReader) entry(address uint64) (*Entry, error) {
-	left := uint32(0)
-	right := fr.header.AddressesCount
-	var found *Entry
+// entry returns the index of the last entry at or before the given address.
+func (fr *FileReader) entry(address uint64) (uint32, bool) {
+	block, ok := fr.block(address)
+	if !ok {
+		return 0, false
+	}
 
-	for {
+	// The first entry of the block is at or before the address.
+	left := block*blockEntries + 1
+	right := min(left-1+blockEntries, fr.header.AddressesCount)
+	for left < right {
 		mid := (left + right) / 2
-		absoluteMid := headerSize + fr.header.AddressesOffset + entrySize*mid
-
-		if left >= right {
-			break
-		}
-
-		entry, err := fr.readEntry(absoluteMid)
-		if err != nil {
-			return nil, fmt.Errorf("readEntry: %w", err)
-		}
-		if entry.Address <= address {
-			found = entry
+		if fr.address(mid) <= address {
 			left = mid + 1
 		} else {
 			right = mid
 		}
 	}
-
-	return found, nil
+	return left - 1, true
 }
 
 func (fr *FileReader) Symbolize(address uint64) (string, error) {
-	entry, err := fr.entry(address)
-	if err != nil {
-		return "", fmt.Errorf("entry: %w", err)
-	}
-	if entry == nil {
+	i, ok := fr.entry(address)
+	if !ok {
 		return "", ErrSymbolNotFound
 	}
 
-	offset := uint32(unsafe.Sizeof(FileHeader{})) + entry.Offset
-	buffer := make([]byte, entry.Len)
+	return fr.Name(fr.entryAt(i))
+}
 
-	read, err := fr.reader.ReadAt(buffer, int64(offset))
-	if err != nil {
-		return "", fmt.Errorf("mmap.ReadAt: %w", err)
+// SymbolizeSorted finds the entries of the given addresses, which must be
+// sorted, in a single pass over the table. The entries of addresses without a
+// symbol have a zero Len. It doesn't allocate, the names can be read with
+// Name, once per distinct entry.
+func (fr *FileReader) SymbolizeSorted(addresses []uint64, entries []Entry) error {
+	if len(entries) < len(addresses) {
+		return fmt.Errorf("%d entries for %d addresses", len(entries), len(addresses))
 	}
-	if read == 0 {
-		return "", ErrReadZeroBytes
+
+	var (
+		// The entry of the previous address, if found.
+		i     uint32
+		found bool
+		count = fr.header.AddressesCount
+	)
+	for j, address := range addresses {
+		if j > 0 && address < addresses[j-1] {
+			return ErrNotSorted
+		}
+
+		// Only search the index when the address is past the current block.
+		next := (i/blockEntries + 1) * blockEntries
+		if !found || (next < count && fr.address(next) <= address) {
+			i, found = fr.entry(address)
+			if !found {
+				entries[j] = Entry{}
+				continue
+			}
+		}
+		for i+1 < count && fr.address(i+1) <= address {
+			i++
+		}
+		entries[j] = fr.entryAt(i)
 	}
+	return nil
+}
 
-	return unsafeString(buffer), nil
+// Len returns the number of entries, including the ones marking the end of
+// symbols.
+func (fr *FileReader) Len() uint32 {
+	return fr.header.AddressesCount
 }
 
-// unsafeString avoids memory allocations by directly casting
-// the memory area that we know contains a valid string to a
-// string pointer.
-func unsafeString(b []byte) string {
-	return *((*string)(unsafe.Pointer(&b)))
+// EntryAt returns the i-th entry, in address order.
+func (fr *FileReader) EntryAt(i uint32) (Entry, error) {
+	if i >= fr.header.AddressesCount {
+		return Entry{}, fmt.Errorf("entry %d out of range", i)
+	}
+	return fr.entryAt(i), nil
+}
+
+// Name returns the symbol name of an entry.
+func (fr *FileReader) Name(entry Entry) (string, error) {
+	if entry.Len == 0 {
+		return "", ErrSymbolNotFound
+	}
+
+	start := uint64(headerSize) + uint64(entry.Offset)
+	end := start + uint64(entry.Len)
+	if end > uint64(fr.entriesStart) {
+		return "", fmt.Errorf("%w: string out of range", ErrTruncated)
+	}
+
+	// Copied, the mapping might be gone by the time the string is used.
+	return string(fr.data[start:end]), nil
 }
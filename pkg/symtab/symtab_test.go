@@ -14,7 +14,10 @@
 package symtab
 
 import (
+	"fmt"
+	"math/rand"
 	"path"
+	"sort"
 	"strings"
 	"testing"
 
@@ -62,6 +65,121 @@ func TestOptimizedSymbolizerWorks(t *testing.T) {
 	require.Equal(t, "last", symbol)
 }
 
+func TestOptimizedSymbolizerEnd(t *testing.T) {
+	file := path.Join(t.TempDir(), "parca-agent-kernel-symbols-tests")
+
+	writer, err := NewWriter(file, 0)
+	require.NoError(t, err)
+
+	symbols := []struct {
+		name       string
+		start, end uint64
+		offset     uint32
+	}{
+		{name: "first", start: 0x10, end: 0x20},
+		{name: "second", start: 0x20, end: 0x30},
+		{name: "third", start: 0x50, end: 0x60},
+	}
+	// All the strings need to be written before the entries.
+	for i := range symbols {
+		symbols[i].offset, err = writer.AddString(symbols[i].name)
+		require.NoError(t, err)
+	}
+	for i, s := range symbols {
+		require.NoError(t, writer.WriteEntry(Entry{Address: s.start, Offset: s.offset, Len: uint16(len(s.name))}))
+		if i == len(symbols)-1 || symbols[i+1].start > s.end {
+			require.NoError(t, writer.WriteEnd(s.end))
+		}
+	}
+	require.NoError(t, writer.WriteHeader())
+	require.NoError(t, writer.Close())
+
+	reader, err := NewReader(file)
+	require.NoError(t, err)
+	require.Equal(t, uint32(5), reader.Len())
+
+	symbol, err := reader.Symbolize(0x2f)
+	require.NoError(t, err)
+	require.Equal(t, "second", symbol)
+
+	// Between the end of second and the start of third.
+	_, err = reader.Symbolize(0x30)
+	require.ErrorIs(t, err, ErrSymbolNotFound)
+	_, err = reader.Symbolize(0x4f)
+	require.ErrorIs(t, err, ErrSymbolNotFound)
+
+	symbol, err = reader.Symbolize(0x50)
+	require.NoError(t, err)
+	require.Equal(t, "third", symbol)
+
+	_, err = reader.Symbolize(0x60)
+	require.ErrorIs(t, err, ErrSymbolNotFound)
+
+	entry, err := reader.EntryAt(3)
+	require.NoError(t, err)
+	require.Equal(t, uint64(0x50), entry.Address)
+	name, err := reader.Name(entry)
+	require.NoError(t, err)
+	require.Equal(t, "third", name)
+
+	_, err = reader.EntryAt(5)
+	require.Error(t, err)
+}
+
+func writeManySymbols(tb testing.TB, file string, n int) {
+	tb.Helper()
+
+	writer, err := NewWriter(file, n)
+	require.NoError(tb, err)
+	for i := 0; i < n; i++ {
+		// Duplicated addresses, possibly across blocks, resolve to the last one.
+		require.NoError(tb, writer.AddSymbol(fmt.Sprintf("sym%d", i), uint64(0x100+0x10*(i-i%3))))
+	}
+	require.NoError(tb, writer.Write())
+}
+
+func TestOptimizedSymbolizerBlocks(t *testing.T) {
+	file := path.Join(t.TempDir(), "parca-agent-kernel-symbols-tests")
+	const n = 1000
+	writeManySymbols(t, file, n)
+
+	reader, err := NewReader(file)
+	require.NoError(t, err)
+	defer reader.Close()
+	require.Equal(t, uint32((n+15)/16), reader.Header().BlocksCount)
+
+	addresses := []uint64{0, 0xff}
+	for i := 0; i < n; i++ {
+		addresses = append(addresses, uint64(0x100+0x10*i), uint64(0x100+0x10*i+0xf))
+	}
+	entries := make([]Entry, len(addresses))
+	require.NoError(t, reader.SymbolizeSorted(addresses, entries))
+
+	for i, addr := range addresses {
+		var expected string
+		if addr >= 0x100 {
+			j := int(addr-0x100) / 0x10
+			j = min(j-j%3+2, n-1)
+			expected = fmt.Sprintf("sym%d", j)
+		}
+
+		symbol, err := reader.Symbolize(addr)
+		if expected == "" {
+			require.ErrorIs(t, err, ErrSymbolNotFound)
+			require.Equal(t, uint16(0), entries[i].Len)
+			continue
+		}
+		require.NoError(t, err)
+		require.Equal(t, expected, symbol, "address %x", addr)
+
+		name, err := reader.Name(entries[i])
+		require.NoError(t, err)
+		require.Equal(t, expected, name, "address %x", addr)
+	}
+
+	require.ErrorIs(t, reader.SymbolizeSorted([]uint64{0x200, 0x100}, entries), ErrNotSorted)
+}
+
 func TestOptimizedSymbolizerWithNoSymbolsWorks(t *testing.T) {
 	file := path.Join(t.TempDir(), "parca-agent-kernel-symbols-tests")
 
@@ -150,3 +268,49 @@ func BenchmarkOptimizedSymbolizerRead(t *testing.B) {
 		require.Equal(t, "mid", symbol)
 	}
 }
+
+func BenchmarkOptimizedSymbolizerReadMany(b *testing.B) {
+	file := path.Join(b.TempDir(), "parca-agent-kernel-symbols-tests")
+	writeManySymbols(b, file, 100_000)
+	reader, err := NewReader(file)
+	require.NoError(b, err)
+	defer reader.Close()
+
+	addresses := make([]uint64, 1000)
+	for i := range addresses {
+		addresses[i] = uint64(0x100 + rand.Intn(0x10*100_000))
+	}
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for n := 0; n < b.N; n++ {
+		for _, addr := range addresses {
+			if _, err := reader.Symbolize(addr); err != nil {
+				b.Fatal(err)
+			}
+		}
+	}
+}
+
+func BenchmarkOptimizedSymbolizerSymbolizeSorted(b *testing.B) {
+	file := path.Join(b.TempDir(), "parca-agent-kernel-symbols-tests")
+	writeManySymbols(b, file, 100_000)
+	reader, err := NewReader(file)
+	require.NoError(b, err)
+	defer reader.Close()
+
+	addresses := make([]uint64, 1000)
+	for i := range addresses {
+		addresses[i] = uint64(0x100 + rand.Intn(0x10*100_000))
+	}
+	sort.Slice(addresses, func(i, j int) bool { return addresses[i] < addresses[j] })
+	entries := make([]Entry, len(addresses))
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for n := 0; n < b.N; n++ {
+		if err := reader.SymbolizeSorted(addresses, entries); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
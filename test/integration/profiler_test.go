@@ -56,6 +56,7 @@ import (
 	"github.com/parca-dev/parca-agent/pkg/profiler"
 	"github.com/parca-dev/parca-agent/pkg/profiler/cpu"
 	"github.com/parca-dev/parca-agent/pkg/runtime"
+	"github.com/parca-dev/parca-agent/pkg/runtime/interpreter"
 	"github.com/parca-dev/parca-agent/pkg/vdso"
 )
 
@@ -308,12 +309,14 @@ func prepareProfiler(t *testing.T, profileStore profiler.ProfileStore, logger lo
 			pfs,
 			ofp,
 			process.NewMapManager(reg, pfs, ofp),
+			interpreter.NewFetcher(logger, reg, ofp, ""),
 			dbginfo,
 			labelsManager,
 			loopDuration,
 			loopDuration,
 		),
 		cim,
+		ofp,
 		parcapprof.NewManager(
 			logger,
 			reg,
@@ -322,6 +325,7 @@ func prepareProfiler(t *testing.T, profileStore profiler.ProfileStore, logger lo
 			perf.NewJITDumpCache(logger, reg, optimizedSymtabs, loopDuration),
 			vdsoCache,
 			disableJIT,
+			loopDuration,
 		),
 		profileStore,
 		&cpu.Config{
@@ -330,6 +334,9 @@ func prepareProfiler(t *testing.T, profileStore profiler.ProfileStore, logger lo
 			PerfEventBufferPollInterval:       250,
 			PerfEventBufferProcessingInterval: 100,
 			PerfEventBufferWorkerCount:        8,
+			ProfilePipelineConvertWorkerCount: 4,
+			ProfilePipelineStoreWorkerCount:   2,
+			ProfilePipelineQueueSize:          256,
 			MemlockRlimit:                     memlockRlimit,
 			DebugProcessNames:                 []string{},
 			DWARFUnwindingDisabled:            false,